@@ -0,0 +1,576 @@
+#!/usr/bin/env python2
+"""
+    This software is part of lazycast, a simple wireless display receiver for Raspberry Pi
+    Copyright (C) 2020 Hsun-Wei Cho
+    Using any part of the code in commercial products is prohibited.
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+"""
+# How many sessions one machine receives: K fake sources on 127.0.0.1 to
+# 127.0.0.K negotiate with one h264.bin and stream to it over loopback, for
+# growing K. Per step it prints the packet or frame drop rate, the end-to-end
+# latency percentiles and the CPU time per session, read from the reports of
+# h264.bin and from its threads in /proc, which it is run with
+# STATS_INTERVAL=1 in the environment for:
+#   (cd h264 && make OMX=0 AVCODEC=0)
+#   ./bench.py --format 1080p30 --sessions 1,2,4,8,16 --csv curve.csv
+# With --fec L,D the sources also send SMPTE 2022-1 row and column FEC over
+# blocks of L by D packets, and --drop N leaves out every Nth media packet
+# (still covered by the FEC) for h264.bin to rebuild:
+#   ./bench.py --sessions 1,4 --fec 10,5 --drop 37
+# --srtp KEY protects the stream with AES_CM_128_HMAC_SHA1_80 under that
+# master key and salt (60 hex digits, the AES from OpenSSL's libcrypto), and
+# h264.bin is given the key. The sequence numbers wrap early on, so that the
+# rollover counter is needed, and every 100th packet goes out twice for its
+# replay check:
+#   ./bench.py --sessions 1,4 --srtp E1F97A0D3E018BE0D64FA32C06DE41390EC675AD498AFEEBB6960B3AABE6
+from __future__ import print_function, division
+import argparse
+import binascii
+import ctypes
+import ctypes.util
+import hashlib
+import hmac
+import multiprocessing
+import os
+import re
+import select
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+# frames per second and Mbps of the synthetic streams
+FORMATS = {'1080p30': (30, 20.0), '720p60': (60, 15.0)}
+TS_SIZE = 188
+TS_PER_RTP = 7
+# as in h264.c, where extract_pid reads them byte-swapped
+VIDEO_PID = 0x1011
+RTSP_PORT = 7236
+NTP_OFFSET = 2208988800
+# a packet this late counts against the source, the result is doubtful then
+LATE_S = 0.005
+# as in fec.h, relative to the RTP port of the session
+FEC_COLUMN_STEP = 2
+FEC_ROW_STEP = 4
+# with SRTP, packets before the sequence number wraps and between replays
+SRTP_WRAP = 1024
+SRTP_REPLAY = 100
+
+class Stream:
+    # One loop of RTP payloads with their send times, and where in them the
+    # continuity counters and PCRs are that change from loop to loop
+    def __init__(self):
+        self.chunks = []
+        self.times = []
+        self.duration = 0.0
+        self.ccs = []          # per chunk: (offset, pid) of TS with payload
+        self.pcrs = []         # per chunk: (offset, pcr in 27 MHz)
+        self.cccount = {}      # TS with payload per pid and loop
+
+    def add_ts(self, ts, when):
+        if len(self.chunks) == 0 or len(self.chunks[-1]) >= TS_SIZE * TS_PER_RTP or self.times[-1] != when:
+            self.chunks.append(bytearray())
+            self.times.append(when)
+            self.ccs.append([])
+            self.pcrs.append([])
+        off = len(self.chunks[-1])
+        self.chunks[-1] += ts
+        pid = ((ts[1] & 0x1F) << 8) | ts[2]
+        if ts[3] & 0x10:
+            self.ccs[-1].append((off, pid))
+            self.cccount[pid] = self.cccount.get(pid, 0) + 1
+        pcr = read_pcr(ts)
+        if pcr is not None:
+            self.pcrs[-1].append((off, pcr))
+
+    def payload(self, i, loop):
+        # the chunk i as sent in the given loop
+        data = bytearray(self.chunks[i])
+        for off, pid in self.ccs[i]:
+            data[off + 3] = (data[off + 3] & 0xF0) | ((data[off + 3] + loop * self.cccount[pid]) & 0x0F)
+        for off, pcr in self.pcrs[i]:
+            write_pcr(data, off, pcr + int(loop * self.duration * 27000000))
+        return data
+
+def read_pcr(ts):
+    if (ts[3] & 0x20) and ts[4] >= 7 and (ts[5] & 0x10):
+        base = (ts[6] << 25) | (ts[7] << 17) | (ts[8] << 9) | (ts[9] << 1) | (ts[10] >> 7)
+        return base * 300 + (((ts[10] & 1) << 8) | ts[11])
+    return None
+
+def write_pcr(data, off, pcr):
+    base = (pcr // 300) & 0x1FFFFFFFF
+    ext = pcr % 300
+    data[off + 6:off + 12] = struct.pack('!IH', base >> 1, ((base & 1) << 15) | 0x7E00 | ext)
+
+def ts_packet(pid, cc, start, payload, pcr=None):
+    # one TS packet with as much of payload as fits, and the rest of payload
+    header = bytearray([0x47, (0x40 if start else 0) | (pid >> 8), pid & 0xFF, 0x10 | (cc & 0x0F)])
+    adaptation = None
+    if pcr is not None:
+        adaptation = bytearray(struct.pack('!BB', 7, 0x10)) + bytearray(6)
+        write_pcr(adaptation, -4, pcr)
+    elif len(payload) < TS_SIZE - 4:
+        adaptation = bytearray([0]) if len(payload) == TS_SIZE - 5 else bytearray([0, 0])
+    if adaptation is not None:
+        # stuffing the last packet of the PES
+        stuffing = max(0, TS_SIZE - 4 - len(adaptation) - len(payload))
+        adaptation[0] += stuffing
+        adaptation += bytearray([0xFF]) * stuffing
+        header[3] |= 0x20
+        header += adaptation
+    used = TS_SIZE - len(header)
+    return header + bytearray(payload[:used]), payload[used:]
+
+def synthetic(fps, mbps):
+    # a second of H.264-like access units, an IDR twice the size of the
+    # others first; the demux and the null and stub decoders look at no more
+    # than the NAL unit types
+    s = Stream()
+    s.duration = 1.0
+    size = int(mbps * 1e6 / 8 / fps)
+    fill = bytearray((i * 151 + 7) % 255 + 1 for i in range(4 * size))
+    cc = 0
+    for f in range(fps):
+        when = f / fps
+        nalsize = 2 * size if f == 0 else (size * (fps - 2)) // (fps - 1)
+        au = bytearray([0, 0, 0, 1, 0x09, 0xF0, 0, 0, 0, 1, 0x65 if f == 0 else 0x41]) + fill[:nalsize]
+        pes = bytearray([0, 0, 1, 0xE0, 0, 0, 0x80, 0x80, 0x05]) + bytearray(5) + au
+        packets = []
+        while pes:
+            ts, pes = ts_packet(VIDEO_PID, cc, not packets, pes, None if packets else int(when * 27000000))
+            packets.append(ts)
+            cc += 1
+        # spread over the frame as an encoder at a constant rate sends it, a
+        # burst of the IDR would overflow the socket buffer on its own
+        for i, ts in enumerate(packets):
+            s.add_ts(ts, when + (i - i % TS_PER_RTP) / len(packets) / fps)
+    return s
+
+def replayed(path):
+    # a recording, sent as fast as its PCRs say
+    data = bytearray(open(path, 'rb').read())
+    packets = [data[i:i + TS_SIZE] for i in range(0, len(data) - TS_SIZE + 1, TS_SIZE) if data[i] == 0x47]
+    marks = [(i, read_pcr(ts)) for i, ts in enumerate(packets) if read_pcr(ts) is not None]
+    if len(marks) < 2:
+        sys.exit('{0}: no PCRs to pace it by'.format(path))
+    s = Stream()
+    first = marks[0][1]
+    m = 0
+    for i, ts in enumerate(packets):
+        while m < len(marks) - 2 and marks[m + 1][0] <= i:
+            m += 1
+        (i0, p0), (i1, p1) = marks[m], marks[m + 1]
+        pcr = p0 + (p1 - p0) * (i - i0) / (i1 - i0)
+        # seven TS to a packet as a source sends them, at the time of the first
+        if i % TS_PER_RTP == 0:
+            when = max(0.0, (pcr - first) / 27e6)
+        s.add_ts(ts, when)
+    s.duration = s.times[-1] + (s.times[-1] - s.times[0]) / len(s.times)
+    return s
+
+class Rtsp:
+    # The source side of the M1 to M7 exchange with h264.bin
+    def __init__(self, conn):
+        self.conn = conn
+        self.buf = b''
+        self.cseq = 1
+
+    def message(self, wait=True):
+        while True:
+            end = self.buf.find(b'\r\n\r\n')
+            if end >= 0:
+                head = self.buf[:end].decode()
+                length = 0
+                for line in head.split('\r\n'):
+                    if line.lower().startswith('content-length:'):
+                        length = int(line.split(':')[1])
+                if len(self.buf) >= end + 4 + length:
+                    msg = self.buf[:end + 4 + length].decode()
+                    self.buf = self.buf[end + 4 + length:]
+                    return msg
+            if not wait and not select.select([self.conn], [], [], 0)[0]:
+                return None
+            data = self.conn.recv(4096)
+            if not data:
+                raise EOFError('sink closed the connection')
+            self.buf += data
+
+    def request(self, method, body=None):
+        msg = '{0} rtsp://localhost/wfd1.0 RTSP/1.0\r\nCSeq: {1}\r\n'.format(method, self.cseq)
+        if body:
+            msg += 'Content-Type: text/parameters\r\nContent-Length: {0}\r\n\r\n{1}'.format(len(body), body)
+        else:
+            msg += '\r\n'
+        self.cseq += 1
+        self.conn.sendall(msg.encode())
+
+    def answer(self, msg, headers=''):
+        cseq = re.search(r'CSeq: *(\d+)', msg).group(1)
+        self.conn.sendall('RTSP/1.0 200 OK\r\nCSeq: {0}\r\n{1}\r\n'.format(cseq, headers).encode())
+
+    def negotiate(self, ip):
+        # returns the RTP port the sink wants the stream on
+        self.request('OPTIONS')
+        self.message()
+        self.answer(self.message())
+        self.request('GET_PARAMETER', 'wfd_client_rtp_ports\r\nwfd_video_formats\r\n')
+        self.message()
+        self.request('SET_PARAMETER', 'wfd_presentation_URL: rtsp://{0}/wfd1.0/streamid=0 none\r\n'.format(ip))
+        self.message()
+        self.request('SET_PARAMETER', 'wfd_trigger_method: SETUP\r\n')
+        self.message()
+        setup = self.message()
+        self.answer(setup, 'Session: 1234;timeout=60\r\n')
+        self.answer(self.message())
+        return int(re.search(r'client_port=(\d+)', setup).group(1))
+
+    def serve(self):
+        # answers IDR requests and whatever else comes in while streaming
+        msg = self.message(False)
+        while msg is not None:
+            if not msg.startswith('RTSP/1.0'):
+                self.answer(msg)
+            msg = self.message(False)
+
+class Srtp:
+    # AES_CM_128_HMAC_SHA1_80 of RFC 3711 with a key derivation rate of 0,
+    # as srtp.c checks it
+    def __init__(self, hexkey):
+        path = ctypes.util.find_library('crypto')
+        if not path:
+            raise OSError('--srtp needs libcrypto of OpenSSL')
+        self.lib = ctypes.CDLL(path)
+        self.lib.EVP_CIPHER_CTX_new.restype = ctypes.c_void_p
+        self.lib.EVP_aes_128_ctr.restype = ctypes.c_void_p
+        self.lib.EVP_EncryptInit_ex.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p]
+        self.lib.EVP_EncryptUpdate.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.POINTER(ctypes.c_int), ctypes.c_char_p, ctypes.c_int]
+        self.ctx = self.lib.EVP_CIPHER_CTX_new()
+        self.out = ctypes.create_string_buffer(TS_SIZE * TS_PER_RTP + 16)
+        master = binascii.unhexlify(hexkey)
+        self.key = master[:16]
+        salt = master[16:]
+        self.key, auth, salt = [self.derive(salt, label, n) for label, n in ((0, 16), (1, 20), (2, 14))]
+        self.mac = hmac.new(auth, digestmod=hashlib.sha1)
+        self.salt = int(binascii.hexlify(salt), 16) << 16
+
+    def ctr(self, key, iv, data):
+        out = self.out if len(data) + 16 <= len(self.out) else ctypes.create_string_buffer(len(data) + 16)
+        n = ctypes.c_int()
+        self.lib.EVP_EncryptInit_ex(self.ctx, self.lib.EVP_aes_128_ctr(), None, key, iv)
+        self.lib.EVP_EncryptUpdate(self.ctx, out, ctypes.byref(n), data, len(data))
+        return out.raw[:len(data)]
+
+    def derive(self, salt, label, n):
+        iv = bytearray(salt + b'\0\0')
+        iv[7] ^= label
+        return self.ctr(self.key, bytes(iv), b'\0' * n)
+
+    def protect(self, packet, index):
+        # the 12 byte header stays as it is, index is the ROC and sequence number
+        ssrc = struct.unpack('!I', packet[8:12])[0]
+        iv = binascii.unhexlify('{0:032x}'.format(self.salt ^ (ssrc << 64) ^ (index << 16)))
+        data = packet[:12] + self.ctr(self.key, iv, packet[12:])
+        mac = self.mac.copy()
+        mac.update(data + struct.pack('!I', (index >> 16) & 0xFFFFFFFF))
+        return data + mac.digest()[:10]
+
+def fec_packet(group, offset):
+    # SMPTE 2022-1 FEC over the (seq, pt, ts, payload) of a row (offset 1) or
+    # a column (offset L), the D bit set for a row
+    plen = max(len(g[3]) for g in group)
+    lr = 0
+    ptr = 0
+    tsr = 0
+    pay = 0
+    for _, pt, ts, p in group:
+        lr ^= len(p)
+        ptr ^= pt
+        tsr ^= ts
+        # as one big number, byte by byte is too slow to keep up
+        pay ^= int(binascii.hexlify(p.ljust(plen, b'\0')), 16)
+    return struct.pack('!HHBBHIBBBB', group[0][0] & 0xFFFF, lr, 0x80 | ptr, 0, 0, tsr,
+                       0x40 if offset == 1 else 0, offset, len(group), 0) + binascii.unhexlify('{0:0{1}x}'.format(pay, plen * 2))
+
+def source(ip, stream, seconds, ready, results, fec=None, drop=0, srtpkey=None):
+    # one source, in a process of its own so that the sources do not share
+    # one interpreter. fec is (L, D) or None, drop leaves out every drop-th
+    # media packet, srtpkey protects them
+    listen = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listen.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    listen.bind((ip, RTSP_PORT))
+    listen.listen(1)
+    ready.set()
+    sent = 0
+    late = 0
+    dropped = []
+    replayed = []
+    try:
+        srtp = Srtp(srtpkey) if srtpkey else None
+        conn, _ = listen.accept()
+        rtsp = Rtsp(conn)
+        port = rtsp.negotiate(ip)
+        rtp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        rtp.setsockopt(socket.SOL_SOCKET, socket.SO_SNDBUF, 1 << 20)
+        rtcp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        ssrc = 0x4C415A59
+        start = time.time()
+        nextsr = start
+        nextalive = start + 20
+        seq = 0x10000 - SRTP_WRAP if srtp else 0
+        loop = 0
+        fecseq = 0
+        matrix = []
+        while time.time() < start + seconds:
+            for i in range(len(stream.chunks)):
+                when = start + loop * stream.duration + stream.times[i]
+                now = time.time()
+                if when > now:
+                    time.sleep(when - now)
+                elif now - when > LATE_S:
+                    late += 1
+                rtpts = int((when - start) * 90000) & 0xFFFFFFFF
+                payload = bytes(stream.payload(i, loop))
+                if drop > 0 and seq % drop == drop - 1:
+                    dropped.append(now)
+                else:
+                    packet = struct.pack('!BBHII', 0x80, 33, seq & 0xFFFF, rtpts, ssrc) + payload
+                    if srtp:
+                        packet = srtp.protect(packet, seq)
+                    rtp.sendto(packet, ('127.0.0.1', port))
+                    if srtp and seq % SRTP_REPLAY == 0:
+                        rtp.sendto(packet, ('127.0.0.1', port))
+                        replayed.append(now)
+                if fec:
+                    # a row right after its last packet, the columns after the block
+                    columns, rows = fec
+                    matrix.append((seq, 33, rtpts, payload))
+                    sends = []
+                    if len(matrix) % columns == 0:
+                        sends.append((FEC_ROW_STEP, fec_packet(matrix[-columns:], 1)))
+                    if len(matrix) == columns * rows:
+                        sends += [(FEC_COLUMN_STEP, fec_packet(matrix[c::columns], columns)) for c in range(columns)]
+                        matrix = []
+                    for step, data in sends:
+                        rtp.sendto(struct.pack('!BBHII', 0x80, 96, fecseq & 0xFFFF, 0, 0) + data, ('127.0.0.1', port + step))
+                        fecseq += 1
+                seq += 1
+                sent += 1
+                if now >= nextsr:
+                    # sender report, h264.bin takes the network delay from it
+                    ntp = now + NTP_OFFSET
+                    sr = struct.pack('!BBHIIIIII', 0x80, 200, 6, ssrc, int(ntp), int((ntp % 1) * 4294967296) & 0xFFFFFFFF,
+                                     int((now - start) * 90000) & 0xFFFFFFFF, sent, sent * (12 + TS_SIZE * TS_PER_RTP))
+                    rtcp.sendto(sr, ('127.0.0.1', port + 1))
+                    nextsr = now + 1
+                if now >= nextalive:
+                    rtsp.request('GET_PARAMETER')
+                    nextalive = now + 20
+                if seq % 64 == 0:
+                    rtsp.serve()
+            loop += 1
+    except (socket.error, EOFError, AttributeError, OSError) as e:
+        results.put((ip, sent, late, str(e), time.time(), dropped, replayed))
+        return
+    results.put((ip, sent, late, None, time.time(), dropped, replayed))
+
+def find_program(name):
+    return any(os.access(os.path.join(d, name), os.X_OK) for d in os.environ.get('PATH', '').split(os.pathsep))
+
+def session_of(line):
+    # the session a report line is about and the line without the tag
+    m = re.match(r'\[(\d+)\] (.*)', line)
+    return (int(m.group(1)), m.group(2)) if m else (0, line)
+
+def thread_cpu(pid):
+    # CPU seconds per session of the threads h264.bin named after them, and
+    # of the whole process
+    tick = os.sysconf('SC_CLK_TCK')
+    sessions = {}
+    for tid in os.listdir('/proc/{0}/task'.format(pid)):
+        try:
+            stat = open('/proc/{0}/task/{1}/stat'.format(pid, tid)).read()
+        except IOError:
+            continue
+        name = stat[stat.index('(') + 1:stat.rindex(')')]
+        fields = stat[stat.rindex(')') + 2:].split()
+        m = re.match(r'(recv|decode|rtsp) (\d+)$', name)
+        if m:
+            n = int(m.group(2))
+            sessions[n] = sessions.get(n, 0.0) + (int(fields[11]) + int(fields[12])) / tick
+    fields = open('/proc/{0}/stat'.format(pid)).read().rsplit(')', 1)[1].split()
+    return sessions, (int(fields[11]) + int(fields[12])) / tick
+
+def reader(pipe, lines):
+    for line in iter(pipe.readline, ''):
+        lines.append((time.time(), line.rstrip()))
+
+def percentiles(line):
+    m = re.search(r'p50 (\d+) p95 (\d+) p99 (\d+) ms', line)
+    return tuple(int(x) for x in m.groups()) if m else None
+
+def measure(args, stream, k):
+    ips = ['127.0.0.{0}'.format(i + 1) for i in range(k)]
+    results = multiprocessing.Queue()
+    sources = []
+    for ip in ips:
+        ready = multiprocessing.Event()
+        p = multiprocessing.Process(target=source, args=(ip, stream, args.warmup + args.seconds + 2, ready, results, args.fec, args.drop, args.srtp))
+        p.daemon = True
+        p.start()
+        ready.wait(5)
+        sources.append(p)
+    # the reports as they come rather than when the pipe buffer is full
+    command = [args.binary, '0', '0', '0.0.0.0', args.decoder, ','.join(ips)]
+    if args.srtp:
+        command.append('srtp=' + args.srtp)
+    if find_program('stdbuf'):
+        command = ['stdbuf', '-oL'] + command
+    # a report a second from any build
+    env = dict(os.environ, STATS_INTERVAL='1')
+    sink = subprocess.Popen(command, stdout=subprocess.PIPE, universal_newlines=True, env=env)
+    lines = []
+    t = threading.Thread(target=reader, args=(sink.stdout, lines))
+    t.daemon = True
+    t.start()
+    time.sleep(args.warmup)
+    begin = time.time()
+    cpu0, total0 = thread_cpu(sink.pid)
+    time.sleep(args.seconds)
+    cpu1, total1 = thread_cpu(sink.pid)
+    end = time.time()
+    sink.kill()
+    sink.wait()
+    done = [results.get(timeout=10) for _ in sources]
+    for p in sources:
+        p.join(5)
+
+    packets = dict((n, [0, 0]) for n in range(k))
+    frames = {}
+    latency = {}
+    recovered = {}
+    rejected = 0
+    srtpns = []
+    for when, line in lines:
+        n, text = session_of(line)
+        if n >= k:
+            continue
+        if text.startswith('null ') and begin <= when <= end:
+            m = re.match(r'null (\d+) pkts/s .* lost (\d+)', text)
+            packets[n][0] += int(m.group(1))
+            packets[n][1] += int(m.group(2))
+        elif text.startswith('frames ') and when <= end:
+            # counted since the session started, the last before and in the window
+            counts = [int(x) for x in re.findall(r'(\d+)', text.split(',')[0])]
+            frames.setdefault(n, [None, None])[0 if when < begin else 1] = counts
+        elif text.startswith('latency ') and when <= end:
+            latency[n] = percentiles(text)
+        elif text.startswith('fec ') and when <= end:
+            # counted since the session started as well
+            m = re.match(r'fec packets \d+, recovered (\d+)', text)
+            if m:
+                recovered.setdefault(n, [0, 0])[0 if when < begin else 1] = int(m.group(1))
+        elif text.startswith('srtp ') and begin <= when <= end:
+            # counted since the last report
+            m = re.search(r'(\d+) rejected, (\d+) ns/packet', text)
+            if m:
+                rejected += int(m.group(1))
+                srtpns.append(int(m.group(2)))
+    drops = []
+    for n in range(k):
+        got, lost = packets[n]
+        if got + lost > 0:
+            drops.append(100.0 * lost / (got + lost))
+        elif n in frames and frames[n][0] and frames[n][1]:
+            # no null decoder, what is left is the frames that never made it
+            delta = [b - a for a, b in zip(frames[n][0], frames[n][1])]
+            drops.append(100.0 * delta[-1] / max(1, sum(delta)))
+        else:
+            drops.append(100.0)
+    lat = [latency.get(n) or (0, 0, 0) for n in range(k)]
+    seconds = end - begin
+    cpu = [100.0 * (cpu1.get(n, 0.0) - cpu0.get(n, 0.0)) / seconds for n in range(k)]
+    sent = sum(r[1] for r in done)
+    late = 100.0 * sum(r[2] for r in done) / max(1, sent)
+    # the sources lose the sink when it is stopped after the window
+    errors = [r for r in done if r[3] and r[4] < end]
+    for ip, _, _, error, _, _, _ in errors:
+        print('  source {0}: {1}'.format(ip, error))
+    return {'sessions': k, 'drop_mean': sum(drops) / k, 'drop_max': max(drops),
+            'p50': max(x[0] for x in lat), 'p95': max(x[1] for x in lat), 'p99': max(x[2] for x in lat),
+            'cpu_session': sum(cpu) / k, 'cpu_max': max(cpu), 'cpu_total': 100.0 * (total1 - total0) / seconds,
+            'source_late': late, 'latency_known': len(latency) == k and all(latency.values()), 'errors': len(errors),
+            'dropped': sum(len([t for t in r[5] if begin <= t <= end]) for r in done), 'recovered': sum(b - a for a, b in recovered.values()),
+            'replayed': sum(len([t for t in r[6] if begin <= t <= end]) for r in done), 'rejected': rejected,
+            'srtp_ns': sum(srtpns) // max(1, len(srtpns))}
+
+def main():
+    parser = argparse.ArgumentParser(description='Receive capacity of h264.bin for growing numbers of sessions on loopback')
+    parser.add_argument('--sessions', default='1,2,4,8,16', help='steps of the curve, up to 16 sessions')
+    parser.add_argument('--format', default='1080p30', choices=sorted(FORMATS), help='synthetic stream')
+    parser.add_argument('--mbps', type=float, help='bit rate of the synthetic stream instead of that of the format')
+    parser.add_argument('--ts', help='replay this MPEG-TS recording instead, paced by its PCRs and looped')
+    parser.add_argument('--decoder', default='null', help='null, stub or avcodec (which needs --ts)')
+    parser.add_argument('--seconds', type=float, default=10, help='measured per step')
+    parser.add_argument('--warmup', type=float, default=3, help='before measuring, for the sessions to start')
+    parser.add_argument('--max-drop', type=float, default=0.1, help='percent of packets a session may lose')
+    parser.add_argument('--max-p99', type=int, default=100, help='ms of end-to-end latency a session may reach')
+    parser.add_argument('--binary', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'h264', 'h264.bin'))
+    parser.add_argument('--fec', help='L,D: send 2022-1 FEC over blocks of L columns by D rows')
+    parser.add_argument('--drop', type=int, default=0, help='leave out every Nth media packet, for the FEC to rebuild')
+    parser.add_argument('--srtp', help='60 hex digits of SRTP master key and salt to protect the stream with')
+    parser.add_argument('--csv', help='write the curve to this file')
+    args = parser.parse_args()
+    if args.srtp and not re.match(r'[0-9A-Fa-f]{60}$', args.srtp):
+        parser.error('--srtp takes 60 hex digits')
+    if args.fec:
+        args.fec = tuple(int(x) for x in args.fec.split(','))
+        if len(args.fec) != 2 or not 1 <= args.fec[0] <= 20 or not 1 <= args.fec[1] <= 20 or args.fec[0] * args.fec[1] > 100:
+            parser.error('--fec takes L,D of 1 to 20 each and at most 100 packets')
+
+    fps, mbps = FORMATS[args.format]
+    stream = replayed(args.ts) if args.ts else synthetic(fps, args.mbps or mbps)
+    rate = sum(len(c) + 12 for c in stream.chunks) * 8 / stream.duration / 1e6
+    print('{0}, {1:.1f} Mbps per session, decoder {2}, {3:.0f} s per step'.format(args.ts or args.format, rate, args.decoder, args.seconds))
+    print('sessions  drop% mean   max  p50 ms   p95   p99  cpu% session   max  total  late%')
+    rows = []
+    capacity = 0
+    for k in [int(x) for x in args.sessions.split(',')]:
+        r = measure(args, stream, k)
+        rows.append(r)
+        print('{sessions:8d}  {drop_mean:10.3f} {drop_max:5.3f} {p50:7d} {p95:5d} {p99:5d}  {cpu_session:12.1f} {cpu_max:5.1f} {cpu_total:6.1f} {source_late:6.1f}'.format(**r))
+        sys.stdout.flush()
+        if not r['latency_known']:
+            print('  no latency reports, h264.bin does not read STATS_INTERVAL from the environment')
+        if args.drop > 0:
+            print('  {dropped} packets left out by the sources, {recovered} rebuilt from FEC in the window'.format(**r))
+        if args.srtp:
+            print('  {replayed} packets replayed by the sources, {rejected} rejected by h264.bin, {srtp_ns} ns/packet to check and decrypt'.format(**r))
+        if r['source_late'] > 1.0:
+            print('  the sources fell behind, the machine is busy sending as well')
+        if r['drop_max'] > args.max_drop or r['p99'] > args.max_p99 or r['errors'] > 0:
+            break
+        capacity = k
+        # the listening ports of the last step
+        time.sleep(1)
+    print('capacity: {0} sessions with at most {1} % drops and p99 {2} ms'.format(capacity, args.max_drop, args.max_p99))
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            keys = ['sessions', 'drop_mean', 'drop_max', 'p50', 'p95', 'p99', 'cpu_session', 'cpu_max', 'cpu_total', 'source_late']
+            f.write(','.join(keys) + '\n')
+            for r in rows:
+                f.write(','.join(str(round(r[key], 3)) for key in keys) + '\n')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,94 @@
+/* ALSA output of the Miracast LPCM audio */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <alsa/asoundlib.h>
+
+#include "alsa.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+struct salsaout {
+    snd_pcm_t* pcm;
+};
+
+alsaout* alsa_open (void)
+{
+    alsaout* out = NULL;
+    snd_pcm_t* pcm = NULL;
+    int err = 1;
+    unsigned int rate = 48000;
+    snd_pcm_uframes_t buffer_size = rate / 5u;
+    snd_pcm_uframes_t period_size = buffer_size / 4u;
+    snd_pcm_hw_params_t* hwp;
+
+    for (int32_t retry = 0; (retry < 3) && (err != 0); retry++) {
+        err = snd_pcm_open (&pcm, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK);
+        if (err != 0) {
+            usleep (300);
+        }
+    }
+    if (err == 0) {
+        snd_pcm_hw_params_alloca (&hwp);
+        snd_pcm_hw_params_any (pcm, hwp);
+        err = snd_pcm_hw_params_set_channels (pcm, hwp, 2);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params_set_access (pcm, hwp, SND_PCM_ACCESS_RW_INTERLEAVED);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params_set_rate_near (pcm, hwp, &rate, 0);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params_set_format (pcm, hwp, SND_PCM_FORMAT_S16_BE);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params_set_buffer_size_near (pcm, hwp, &buffer_size);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params_set_period_size_near (pcm, hwp, &period_size, 0);
+    }
+    if (err == 0) {
+        err = snd_pcm_hw_params (pcm, hwp);
+    }
+    if (err == 0) {
+        out = (alsaout*)malloc (sizeof (alsaout));
+    }
+    if (out != NULL) {
+        out->pcm = pcm;
+        DBG_PRINTF_DEBUG ("alsa rate %u buffer %lu frames\n", rate, (unsigned long)buffer_size);
+    } else {
+        if (pcm != NULL) {
+            (void)snd_pcm_close (pcm);
+        }
+        DBG_PRINTF_ERROR ("alsa init failed\n");
+    }
+    return out;
+}
+
+int32_t alsa_play (alsaout* out, const uint8_t* data, int32_t len)
+{
+    int32_t ret = 0;
+    /* 4 bytes per stereo frame */
+    snd_pcm_sframes_t written = snd_pcm_writei (out->pcm, data, (snd_pcm_uframes_t)len >> 2);
+    if (written == -EPIPE) {
+        /* underrun, start over with this packet */
+        (void)snd_pcm_prepare (out->pcm);
+        written = snd_pcm_writei (out->pcm, data, (snd_pcm_uframes_t)len >> 2);
+    }
+    if ((written < 0) && (written != -EAGAIN)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+void alsa_close (alsaout* out)
+{
+    if (out != NULL) {
+        (void)snd_pcm_drop (out->pcm);
+        (void)snd_pcm_close (out->pcm);
+        free (out);
+    }
+}
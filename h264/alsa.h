@@ -0,0 +1,18 @@
+/* ALSA output of the Miracast LPCM audio */
+
+#ifndef ALSA_H
+#define ALSA_H
+
+#include <stdint.h>
+
+typedef struct salsaout alsaout;
+
+/* Opens the default device for 48 kHz 16 bit big-endian stereo. Returns NULL
+ * if there is no usable device. */
+alsaout* alsa_open (void);
+/* Queues len bytes of interleaved samples. Samples the device has no room
+ * for are dropped rather than blocking the caller. Returns 0 on success. */
+int32_t alsa_play (alsaout* out, const uint8_t* data, int32_t len);
+void alsa_close (alsaout* out);
+
+#endif /* ALSA_H */
@@ -0,0 +1,365 @@
+/* Bitstream level concealment of lost slices */
+
+#include <string.h>
+
+#include "conceal.h"
+#include "sps.h"
+
+typedef struct snalspan {
+    int32_t start;       /* offset of the start code */
+    int32_t end;         /* offset of the next start code */
+    int32_t type;
+    int32_t first_mb;    /* -1 if not a slice or unknown */
+    bool damaged;
+} nalspan;
+
+typedef struct scabacenc {
+    bitwriter* bw;
+    uint32_t low;
+    uint32_t range;
+    int32_t outstanding;
+    bool firstbit;
+    int32_t state;
+    int32_t mps;
+} cabacenc;
+
+static const uint8_t range_lps[64][4] = {
+    {128, 176, 208, 240}, {128, 167, 197, 227}, {128, 158, 187, 216}, {123, 150, 178, 205},
+    {116, 142, 169, 195}, {111, 135, 160, 185}, {105, 128, 152, 175}, {100, 122, 144, 166},
+    {95, 116, 137, 158}, {90, 110, 130, 150}, {85, 104, 123, 142}, {81, 99, 117, 135},
+    {77, 94, 111, 128}, {73, 89, 105, 122}, {69, 85, 100, 116}, {66, 80, 95, 110},
+    {62, 76, 90, 104}, {59, 72, 86, 99}, {56, 69, 81, 94}, {53, 65, 77, 89},
+    {51, 62, 73, 85}, {48, 59, 69, 80}, {46, 56, 66, 76}, {43, 53, 63, 72},
+    {41, 50, 59, 69}, {39, 48, 56, 65}, {37, 45, 54, 62}, {35, 43, 51, 59},
+    {33, 41, 48, 56}, {32, 39, 46, 53}, {30, 37, 43, 50}, {29, 35, 41, 48},
+    {27, 33, 39, 45}, {26, 31, 37, 43}, {24, 30, 35, 41}, {23, 28, 33, 39},
+    {22, 27, 32, 37}, {21, 26, 30, 35}, {20, 24, 29, 33}, {19, 23, 27, 31},
+    {18, 22, 26, 30}, {17, 21, 25, 28}, {16, 20, 23, 27}, {15, 19, 22, 25},
+    {14, 18, 21, 24}, {14, 17, 20, 23}, {13, 16, 19, 22}, {12, 15, 18, 21},
+    {12, 14, 17, 20}, {11, 14, 16, 19}, {11, 13, 15, 18}, {10, 12, 15, 17},
+    {10, 12, 14, 16}, {9, 11, 13, 15}, {9, 11, 12, 14}, {8, 10, 12, 14},
+    {8, 9, 11, 13}, {7, 9, 11, 12}, {7, 9, 10, 12}, {7, 8, 10, 11},
+    {6, 8, 9, 11}, {6, 7, 9, 10}, {6, 7, 8, 9}, {2, 2, 2, 2}
+};
+
+static const uint8_t trans_lps[64] = {
+    0, 0, 1, 2, 2, 4, 4, 5, 6, 7, 8, 9, 9, 11, 11, 12,
+    13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+    24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+    33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63
+};
+
+static void cabac_putbit (cabacenc* ce, uint32_t bit);
+static void cabac_putbit (cabacenc* ce, uint32_t bit)
+{
+    if (ce->firstbit) {
+        ce->firstbit = false;
+    } else {
+        bw_write (ce->bw, bit, 1);
+    }
+    while (ce->outstanding > 0) {
+        bw_write (ce->bw, 1u - bit, 1);
+        ce->outstanding--;
+    }
+}
+
+static void cabac_renorm (cabacenc* ce);
+static void cabac_renorm (cabacenc* ce)
+{
+    while (ce->range < 256u) {
+        if (ce->low < 256u) {
+            cabac_putbit (ce, 0);
+        } else if (ce->low >= 512u) {
+            ce->low -= 512u;
+            cabac_putbit (ce, 1);
+        } else {
+            ce->low -= 256u;
+            ce->outstanding++;
+        }
+        ce->range <<= 1;
+        ce->low <<= 1;
+    }
+}
+
+/* Sets up the encoder with the context of mb_skip_flag (ctxIdx 11,
+ * cabac_init_idc 0). Neighbours of a skip run are skipped or in another
+ * slice, so ctxIdxInc stays 0 throughout. */
+static void cabac_init (cabacenc* ce, bitwriter* bw, int32_t qp);
+static void cabac_init (cabacenc* ce, bitwriter* bw, int32_t qp)
+{
+    const int32_t m = 23;
+    const int32_t n = 33;
+    int32_t clipqp = (qp < 0) ? 0 : ((qp > 51) ? 51 : qp);
+    int32_t pre = ((m * clipqp) >> 4) + n;
+    pre = (pre < 1) ? 1 : ((pre > 126) ? 126 : pre);
+    if (pre <= 63) {
+        ce->state = 63 - pre;
+        ce->mps = 0;
+    } else {
+        ce->state = pre - 64;
+        ce->mps = 1;
+    }
+    ce->bw = bw;
+    ce->low = 0;
+    ce->range = 510;
+    ce->outstanding = 0;
+    ce->firstbit = true;
+}
+
+static void cabac_decision (cabacenc* ce, int32_t bin);
+static void cabac_decision (cabacenc* ce, int32_t bin)
+{
+    uint32_t lps = range_lps[ce->state][(ce->range >> 6) & 3u];
+    ce->range -= lps;
+    if (bin != ce->mps) {
+        ce->low += ce->range;
+        ce->range = lps;
+        if (ce->state == 0) {
+            ce->mps = 1 - ce->mps;
+        }
+        ce->state = trans_lps[ce->state];
+    } else if (ce->state < 62) {
+        ce->state++;
+    } else {
+        /* empty */
+    }
+    cabac_renorm (ce);
+}
+
+static void cabac_terminate (cabacenc* ce, bool last);
+static void cabac_terminate (cabacenc* ce, bool last)
+{
+    ce->range -= 2u;
+    if (last) {
+        ce->low += ce->range;
+        /* flush, the final bit written doubles as rbsp_stop_one_bit */
+        ce->range = 2;
+        cabac_renorm (ce);
+        cabac_putbit (ce, (ce->low >> 9) & 1u);
+        bw_write (ce->bw, ((ce->low >> 7) & 3u) | 1u, 2);
+    } else {
+        cabac_renorm (ce);
+    }
+}
+
+static int32_t write_skip_slice (const slicehdr* tpl, const bitreader* tplbr, const spsinfo* sps, const ppsinfo* pps,
+                                 int32_t first_mb, int32_t count, uint8_t* out, int32_t maxout);
+static int32_t write_skip_slice (const slicehdr* tpl, const bitreader* tplbr, const spsinfo* sps, const ppsinfo* pps,
+                                 int32_t first_mb, int32_t count, uint8_t* out, int32_t maxout)
+{
+    uint8_t rbsp[512];
+    bitwriter bw;
+    bw_init (&bw, rbsp, (int32_t)sizeof (rbsp));
+
+    bw_write_ue (&bw, (uint32_t)first_mb);
+    bw_write_ue (&bw, 0);
+    bw_write_ue (&bw, (uint32_t)pps->pps_id);
+    bw_write (&bw, (uint32_t)tpl->frame_num, sps->log2_max_frame_num);
+    if (sps->poc_type == 0) {
+        bw_write (&bw, (uint32_t)tpl->poc_lsb, sps->log2_max_poc_lsb);
+        if (pps->bottom_field_pic_order) {
+            bw_write_se (&bw, tpl->delta_poc_bottom);
+        }
+    }
+    if ((sps->poc_type == 1) && (!sps->delta_pic_order_always_zero)) {
+        bw_write_se (&bw, tpl->delta_poc[0]);
+        if (pps->bottom_field_pic_order) {
+            bw_write_se (&bw, tpl->delta_poc[1]);
+        }
+    }
+    if (pps->redundant_pic_cnt_present) {
+        bw_write_ue (&bw, 0);
+    }
+    /* num_ref_idx_active_override_flag, ref_pic_list_modification_flag_l0 */
+    bw_write (&bw, 0, 2);
+    if (pps->weighted_pred) {
+        bool chroma = (sps->chroma_format_idc != 0);
+        bw_write_ue (&bw, 0);
+        if (chroma) {
+            bw_write_ue (&bw, 0);
+        }
+        for (int32_t i = 0; i < pps->num_ref_idx_l0; i++) {
+            bw_write (&bw, 0, chroma ? 2 : 1);
+        }
+    }
+    if (tpl->nal_ref_idc != 0) {
+        /* dec_ref_pic_marking() has to match the other slices of the picture */
+        bw_copy (&bw, tplbr, tpl->markingpos, tpl->markingend);
+    }
+    if (pps->cabac) {
+        bw_write_ue (&bw, 0);
+    }
+    /* slice_qp_delta */
+    bw_write_se (&bw, 0);
+    if (pps->deblocking_filter_control) {
+        bw_write_ue (&bw, 1);
+    }
+
+    if (pps->cabac) {
+        cabacenc ce;
+        while ((bw.bitpos & 7) != 0) {
+            bw_write (&bw, 1, 1);
+        }
+        cabac_init (&ce, &bw, pps->pic_init_qp);
+        for (int32_t i = 0; i < count; i++) {
+            cabac_decision (&ce, 1);
+            cabac_terminate (&ce, i == (count - 1));
+        }
+        while ((bw.bitpos & 7) != 0) {
+            bw_write (&bw, 0, 1);
+        }
+    } else {
+        bw_write_ue (&bw, (uint32_t)count);
+        (void)bw_finish (&bw);
+    }
+
+    int32_t ret = -1;
+    if ((!bw.overrun) && (maxout > 5)) {
+        out[0] = 0;
+        out[1] = 0;
+        out[2] = 0;
+        out[3] = 1;
+        out[4] = (uint8_t)((tpl->nal_ref_idc << 5) | NAL_TYPE_SLICE);
+        int32_t len = nal_escape (rbsp, bw.bitpos >> 3, out + 5, maxout - 5);
+        ret = (len < 0) ? -1 : (len + 5);
+    }
+    return ret;
+}
+
+static int32_t find_nals (const uint8_t* au, int32_t len, const int32_t* gaps, int32_t numgaps, nalspan* nals);
+static int32_t find_nals (const uint8_t* au, int32_t len, const int32_t* gaps, int32_t numgaps, nalspan* nals)
+{
+    int32_t count = 0;
+    nalunit nal;
+    int32_t pos = 0;
+    while ((count < CONCEAL_MAX_NALS) && ((pos = nal_next (au, len, pos, &nal)) >= 0)) {
+        nalspan* span = &nals[count];
+        span->start = (int32_t)(nal.data - au) - 3;
+        span->end = pos;
+        span->type = nal.type;
+        span->damaged = false;
+        span->first_mb = -1;
+        int32_t headerlost = len;
+        for (int32_t i = 0; i < numgaps; i++) {
+            /* a gap also spoils the unit it splices into the next start code */
+            if ((span->start <= (gaps[i] + 4)) && (span->end >= gaps[i])) {
+                span->damaged = true;
+                headerlost = (gaps[i] < headerlost) ? gaps[i] : headerlost;
+            }
+        }
+        if (((nal.type == NAL_TYPE_SLICE) || (nal.type == NAL_TYPE_IDR)) && ((headerlost - span->start) > 12)) {
+            span->first_mb = slice_first_mb (nal.data, nal.len);
+        }
+        count++;
+    }
+    return (pos >= 0) ? -1 : count;
+}
+
+int32_t conceal_au (const paramsets* ps, const uint8_t* au, int32_t len, const int32_t* gaps, int32_t numgaps, uint8_t* out, int32_t maxout)
+{
+    spsinfo sps;
+    ppsinfo pps;
+    nalspan nals[CONCEAL_MAX_NALS];
+    int32_t numnals = -1;
+    if (paramsets_valid (ps) && sps_parse (ps->sps, ps->spslen, &sps) && pps_parse (ps->pps, ps->ppslen, &pps) &&
+            (sps.frame_mbs_only) && (!sps.separate_colour_plane)) {
+        numnals = find_nals (au, len, gaps, numgaps, nals);
+    }
+
+    /* the header of the first intact slice is the template for the others */
+    int32_t tplnal = -1;
+    bool ok = (numnals > 0);
+    for (int32_t i = 0; (ok) && (i < numnals); i++) {
+        if (nals[i].type == NAL_TYPE_IDR) {
+            /* IDR pictures cannot contain P slices */
+            ok = false;
+        } else if ((nals[i].type == NAL_TYPE_SLICE) && (!nals[i].damaged) && (tplnal < 0)) {
+            tplnal = i;
+        } else {
+            /* empty */
+        }
+    }
+    ok = (ok) && (tplnal >= 0);
+
+    uint8_t tplrbsp[512];
+    bitreader tplbr;
+    slicehdr tpl;
+    if (ok) {
+        const uint8_t* data = au + nals[tplnal].start + 3;
+        int32_t rbsplen = nal_unescape (data + 1, nals[tplnal].end - nals[tplnal].start - 4, tplrbsp, (int32_t)sizeof (tplrbsp));
+        br_init (&tplbr, tplrbsp, rbsplen);
+        ok = slice_parse (&tplbr, (data[0] >> 5) & 3, false, &sps, &pps, &tpl) && (tpl.pps_id == pps.pps_id);
+    }
+
+    /* macroblocks covered by intact slices, in decoding order */
+    int32_t picsize = sps.width_mbs * sps.height_mbs;
+    int32_t loststart[CONCEAL_MAX_NALS];
+    int32_t lostend[CONCEAL_MAX_NALS];
+    int32_t numlost = 0;
+    int32_t cursor = 0;
+    int32_t lastfirst = -1;
+    for (int32_t i = 0; (ok) && (i < numnals); i++) {
+        if (nals[i].type == NAL_TYPE_SLICE) {
+            if ((nals[i].first_mb >= 0) && (nals[i].first_mb <= lastfirst)) {
+                /* arbitrary slice order */
+                ok = false;
+            }
+            lastfirst = (nals[i].first_mb >= 0) ? nals[i].first_mb : lastfirst;
+        }
+        if ((ok) && (nals[i].type == NAL_TYPE_SLICE) && (!nals[i].damaged)) {
+            int32_t end = picsize;
+            for (int32_t j = i + 1; j < numnals; j++) {
+                if (nals[j].type == NAL_TYPE_SLICE) {
+                    end = nals[j].first_mb;
+                    break;
+                }
+            }
+            if ((end < 0) || (nals[i].first_mb < cursor) || (end > picsize)) {
+                ok = false;
+            } else if (nals[i].first_mb > cursor) {
+                loststart[numlost] = cursor;
+                lostend[numlost] = nals[i].first_mb;
+                numlost++;
+            } else {
+                /* empty */
+            }
+            cursor = end;
+        }
+    }
+    if ((ok) && (cursor < picsize)) {
+        loststart[numlost] = cursor;
+        lostend[numlost] = picsize;
+        numlost++;
+    }
+
+    /* copy what survived and put skip slices where the lost ones were */
+    int32_t outlen = -1;
+    if (ok) {
+        int32_t lost = 0;
+        outlen = (nals[0].start <= maxout) ? nals[0].start : -1;
+        if (outlen >= 0) {
+            (void)memcpy (out, au, outlen);
+        }
+        for (int32_t i = 0; (outlen >= 0) && (i <= numnals); i++) {
+            bool vcl = (i < numnals) && (nals[i].type == NAL_TYPE_SLICE);
+            if ((i == numnals) || ((vcl) && (!nals[i].damaged))) {
+                int32_t before = (i == numnals) ? picsize : nals[i].first_mb;
+                while ((outlen >= 0) && (lost < numlost) && (loststart[lost] < before)) {
+                    int32_t n = write_skip_slice (&tpl, &tplbr, &sps, &pps, loststart[lost], lostend[lost] - loststart[lost], out + outlen, maxout - outlen);
+                    outlen = (n < 0) ? -1 : (outlen + n);
+                    lost++;
+                }
+            }
+            if ((outlen >= 0) && (i < numnals) && (!nals[i].damaged)) {
+                int32_t n = nals[i].end - nals[i].start;
+                if ((outlen + n) <= maxout) {
+                    (void)memcpy (out + outlen, au + nals[i].start, n);
+                    outlen += n;
+                } else {
+                    outlen = -1;
+                }
+            }
+        }
+    }
+    return outlen;
+}
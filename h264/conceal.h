@@ -0,0 +1,21 @@
+/* Bitstream level concealment of lost slices */
+
+#ifndef CONCEAL_H
+#define CONCEAL_H
+
+#include <stdint.h>
+
+#include "nal.h"
+
+/* Most NAL units of one access unit the concealment looks at */
+#define CONCEAL_MAX_NALS 256
+
+/* Rebuilds a damaged access unit into out. gaps holds the offsets in au at
+ * which data went missing. Slices overlapping a gap are dropped and the
+ * macroblocks no intact slice covers are filled with P_Skip slices, which
+ * repeat the previous picture there. Returns the new length, or -1 if the
+ * access unit cannot be concealed (IDR, unknown parameter sets, interlaced
+ * or FMO streams, no intact slice to take the header from). */
+int32_t conceal_au (const paramsets* ps, const uint8_t* au, int32_t len, const int32_t* gaps, int32_t numgaps, uint8_t* out, int32_t maxout);
+
+#endif /* CONCEAL_H */
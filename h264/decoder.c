@@ -0,0 +1,34 @@
+/* Decoder backends behind the TS demux of h264.bin */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "decoder.h"
+
+/* The first one is the default */
+static const decoderops* const backends[] = {
+#if DECODER_OMX != 0
+    &omx_decoder,
+#endif /* DECODER_OMX */
+#if DECODER_AVCODEC != 0
+    &avcodec_decoder,
+#endif /* DECODER_AVCODEC */
+    &stub_decoder,
+    &null_decoder,
+};
+
+const decoderops* decoder_find (const char* name)
+{
+    const decoderops* ret = NULL;
+    if (name == NULL) {
+        ret = backends[0];
+    } else {
+        for (size_t i = 0; i < (sizeof (backends) / sizeof (backends[0])); i++) {
+            if (strcmp (backends[i]->name, name) == 0) {
+                ret = backends[i];
+                break;
+            }
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,81 @@
+/* Decoder backends behind the TS demux of h264.bin */
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef DECODER_OMX
+/**
+ * Build the OpenMAX IL backend, needs the VideoCore libraries in /opt/vc
+ */
+#define DECODER_OMX (1)
+#endif /* DECODER_OMX */
+
+#ifndef DECODER_AVCODEC
+/**
+ * Build the libavcodec backend, needs the FFmpeg and ALSA development files
+ */
+#define DECODER_AVCODEC (1)
+#endif /* DECODER_AVCODEC */
+
+#ifndef DECODER_STALL_MS
+/**
+ * A decoder that takes no input for this long is taken as hung
+ */
+#define DECODER_STALL_MS (500)
+#endif /* DECODER_STALL_MS */
+
+#define DECODER_FLAG_ENDOFFRAME 0x01u  /* last buffer of an access unit */
+#define DECODER_FLAG_CODECCONFIG 0x02u /* SPS/PPS only */
+#define DECODER_FLAG_DECODEONLY 0x04u  /* decode as reference but do not show */
+#define DECODER_FLAG_CORRUPT 0x08u     /* data is missing */
+#define DECODER_FLAG_STARTTIME 0x10u   /* first buffer after (re)start */
+
+typedef struct sdecoderbuf {
+    uint8_t* data;
+    int32_t maxlen;      /* room in data */
+    int32_t len;
+    uint32_t flags;      /* DECODER_FLAG_ values */
+    void* priv;          /* the backend's own buffer */
+} decoderbuf;
+
+/* One input buffer is handed out at a time: get_buffer, fill it, submit. */
+typedef struct sdecoderops {
+    const char* name;
+    /* Sets up the decoder and the audio output, returns 0 on success. */
+    int32_t (*open) (void** ctx);
+    /* Blocks until an input buffer is free, returns NULL on failure or after
+     * DECODER_STALL_MS without one. */
+    decoderbuf* (*get_buffer) (void* ctx);
+    /* Queues the buffer for decoding, returns 0 on success. */
+    int32_t (*submit) (void* ctx, decoderbuf* buf);
+    /* Plays the payload of one TS packet of 48 kHz 16 bit big-endian stereo LPCM. */
+    int32_t (*play_audio) (void* ctx, const uint8_t* data, int32_t len);
+    void (*close) (void* ctx);
+    /* Optional, sees each RTP packet as the demux takes it from the reorder list. */
+    void (*received) (void* ctx, const uint8_t* packet, int32_t len);
+    /* Optional, true after a decoder error or a stall, until recover. */
+    bool (*failed) (void* ctx);
+    /* Optional, resets the video decoder only. The next input has to start
+     * with the parameter sets and an IDR. Returns 0 on success. */
+    int32_t (*recover) (void* ctx);
+} decoderops;
+
+#if DECODER_OMX != 0
+extern const decoderops omx_decoder;
+#endif /* DECODER_OMX */
+#if DECODER_AVCODEC != 0
+extern const decoderops avcodec_decoder;
+#endif /* DECODER_AVCODEC */
+/* Models the timing of video_decode without decoding anything */
+extern const decoderops stub_decoder;
+/* Checksums and counts what would be decoded, to benchmark the receive side */
+extern const decoderops null_decoder;
+
+/* Returns the backend called name, or the default one if name is NULL.
+ * Returns NULL if no such backend was built. */
+const decoderops* decoder_find (const char* name);
+
+#endif /* DECODER_H */
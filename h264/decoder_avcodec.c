@@ -0,0 +1,309 @@
+/* libavcodec software decoder backend, audio goes out through ALSA */
+
+#include <stdlib.h>
+#include <string.h>
+#include <libavcodec/avcodec.h>
+
+#ifndef AVCODEC_DRM
+/**
+ * Show the pictures on a DRM/KMS display, needs libdrm and libswscale
+ */
+#define AVCODEC_DRM (1)
+#endif /* AVCODEC_DRM */
+
+#include "alsa.h"
+#include "decoder.h"
+#if AVCODEC_DRM != 0
+#include "drm.h"
+#endif /* AVCODEC_DRM */
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#ifndef AVCODEC_THREADS
+/**
+ * Decoder threads, 0 lets libavcodec start one per core
+ */
+#define AVCODEC_THREADS (0)
+#endif /* AVCODEC_THREADS */
+
+#ifndef AVCODEC_FRAME_THREADS
+/**
+ * Decode several frames in parallel instead of the slices of one frame.
+ * Scales better with single slice streams but adds a frame of delay per thread.
+ */
+#define AVCODEC_FRAME_THREADS (0)
+#endif /* AVCODEC_FRAME_THREADS */
+
+#ifndef AVCODEC_FAILED_AUS
+/**
+ * Access units in a row that fail to decode without a picture coming out
+ * before the decoder is taken as failed
+ */
+#define AVCODEC_FAILED_AUS (30)
+#endif /* AVCODEC_FAILED_AUS */
+
+/* Room handed out per buffer, an access unit grows by this much at a time */
+#define AVCODEC_CHUNK (64 * 1024)
+/* Larger access units are dropped */
+#define AVCODEC_MAX_AU (8 * 1024 * 1024)
+/* Frames the decoder may still hold back, to look up DECODEONLY by pts */
+#define AVCODEC_PTS_RING 32
+
+typedef struct savdecoder {
+    AVCodecContext* codec;
+    AVPacket* pkt;
+    AVFrame* frame;
+    uint8_t* au;         /* access unit being collected */
+    int32_t aulen;
+    int32_t ausize;
+    uint32_t auflags;    /* DECODER_FLAG_ values seen in this access unit */
+    int64_t seq;         /* pts of the next access unit */
+    bool hidden[AVCODEC_PTS_RING];
+    int64_t frames;
+    int32_t errors;      /* access units in a row that failed to decode */
+    bool failed;
+    int32_t width;       /* of the last picture */
+    int32_t height;
+    decoderbuf buf;
+    alsaout* audio;
+#if AVCODEC_DRM != 0
+    drmout* display;
+#endif /* AVCODEC_DRM */
+} avdecoder;
+
+#define INLINE static inline
+
+/* Hands a decoded picture to the display, if there is one. */
+INLINE void present (avdecoder* av, const AVFrame* frame);
+INLINE void present (avdecoder* av, const AVFrame* frame)
+{
+    if ((frame->width != av->width) || (frame->height != av->height)) {
+        av->width = frame->width;
+        av->height = frame->height;
+        DBG_PRINTF_DEBUG ("picture size %dx%d\n", av->width, av->height);
+    }
+#if AVCODEC_DRM != 0
+    if ((av->display != NULL) && (drm_show (av->display, frame) != 0)) {
+        DBG_PRINTF_WARNING ("cannot show picture\n");
+    }
+#endif /* AVCODEC_DRM */
+    av->frames++;
+}
+
+static int32_t receive_frames (avdecoder* av);
+static int32_t receive_frames (avdecoder* av)
+{
+    int32_t ret = 0;
+    int err = 0;
+    while (err >= 0) {
+        err = avcodec_receive_frame (av->codec, av->frame);
+        if (err >= 0) {
+            if ((av->frame->pts < 0) || (!av->hidden[av->frame->pts % AVCODEC_PTS_RING])) {
+                present (av, av->frame);
+            }
+            av_frame_unref (av->frame);
+        } else if ((err != AVERROR (EAGAIN)) && (err != AVERROR_EOF)) {
+            ret = -1;
+        } else {
+            /* empty */
+        }
+    }
+    return ret;
+}
+
+static int32_t decode_au (avdecoder* av);
+static int32_t decode_au (avdecoder* av)
+{
+    int32_t ret = 0;
+    (void)memset (av->au + av->aulen, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    av->pkt->data = av->au;
+    av->pkt->size = av->aulen;
+    av->pkt->pts = av->seq;
+    av->pkt->dts = av->seq;
+    av->pkt->flags = ((av->auflags & DECODER_FLAG_CORRUPT) != 0u) ? AV_PKT_FLAG_CORRUPT : 0;
+    av->hidden[av->seq % AVCODEC_PTS_RING] = (av->auflags & DECODER_FLAG_DECODEONLY) != 0u;
+    av->seq++;
+    /* the packet is not reference counted, libavcodec copies it */
+    int err = avcodec_send_packet (av->codec, av->pkt);
+    if (err == AVERROR (EAGAIN)) {
+        /* output first, then the packet fits */
+        ret = receive_frames (av);
+        err = avcodec_send_packet (av->codec, av->pkt);
+    }
+    if (err < 0) {
+        /* a broken access unit is not fatal, the next one may decode */
+        DBG_PRINTF_WARNING ("decode error %d\n", err);
+    }
+    int64_t frames = av->frames;
+    if (ret == 0) {
+        ret = receive_frames (av);
+    }
+    if (ret != 0) {
+        av->failed = true;
+    } else if ((err < 0) && (av->frames == frames)) {
+        av->errors++;
+        av->failed = av->errors >= AVCODEC_FAILED_AUS;
+    } else {
+        av->errors = 0;
+    }
+    return ret;
+}
+
+static void av_close (void* ctx);
+static void av_close (void* ctx)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    if (av != NULL) {
+        if ((av->codec != NULL) && (avcodec_is_open (av->codec) != 0)) {
+            /* drain what the threads still hold */
+            if (avcodec_send_packet (av->codec, NULL) == 0) {
+                (void)receive_frames (av);
+            }
+        }
+        avcodec_free_context (&av->codec);
+        av_packet_free (&av->pkt);
+        av_frame_free (&av->frame);
+        alsa_close (av->audio);
+#if AVCODEC_DRM != 0
+        drm_close (av->display);
+#endif /* AVCODEC_DRM */
+        free (av->au);
+        free (av);
+    }
+}
+
+static int32_t av_open (void** ctx);
+static int32_t av_open (void** ctx)
+{
+    int32_t status = 0;
+    avdecoder* av = (avdecoder*)calloc (1, sizeof (avdecoder));
+    const AVCodec* h264 = avcodec_find_decoder (AV_CODEC_ID_H264);
+    if ((av == NULL) || (h264 == NULL)) {
+        status = -1;
+    } else {
+        av->codec = avcodec_alloc_context3 (h264);
+        av->pkt = av_packet_alloc();
+        av->frame = av_frame_alloc();
+        av->ausize = AVCODEC_CHUNK + AV_INPUT_BUFFER_PADDING_SIZE;
+        av->au = (uint8_t*)malloc (av->ausize);
+        if ((av->codec == NULL) || (av->pkt == NULL) || (av->frame == NULL) || (av->au == NULL)) {
+            status = -2;
+        }
+    }
+    if (status == 0) {
+        av->codec->thread_count = AVCODEC_THREADS;
+        av->codec->thread_type = (AVCODEC_FRAME_THREADS != 0) ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+        /* show each picture as soon as it is decoded, the SPS says there is no reordering */
+        av->codec->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        av->codec->flags2 |= AV_CODEC_FLAG2_FAST;
+        if (avcodec_open2 (av->codec, h264, NULL) < 0) {
+            status = -3;
+        }
+    }
+    if (status == 0) {
+        av->audio = alsa_open();
+        if (av->audio == NULL) {
+            DBG_PRINTF_WARNING ("no audio output\n");
+        }
+#if AVCODEC_DRM != 0
+        av->display = drm_open();
+        if (av->display == NULL) {
+            DBG_PRINTF_WARNING ("no display\n");
+        }
+#endif /* AVCODEC_DRM */
+    }
+    *ctx = av;
+    return status;
+}
+
+static decoderbuf* av_get_buffer (void* ctx);
+static decoderbuf* av_get_buffer (void* ctx)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    decoderbuf* ret = NULL;
+    int32_t need = av->aulen + AVCODEC_CHUNK + AV_INPUT_BUFFER_PADDING_SIZE;
+    if (need > (AVCODEC_MAX_AU + AV_INPUT_BUFFER_PADDING_SIZE)) {
+        DBG_PRINTF_WARNING ("access unit too large, dropped\n");
+        av->aulen = 0;
+        av->auflags = 0;
+        need = AVCODEC_CHUNK + AV_INPUT_BUFFER_PADDING_SIZE;
+    }
+    if (need > av->ausize) {
+        uint8_t* au = (uint8_t*)realloc (av->au, need);
+        if (au != NULL) {
+            av->au = au;
+            av->ausize = need;
+        }
+    }
+    if (need <= av->ausize) {
+        av->buf.data = av->au + av->aulen;
+        av->buf.maxlen = av->ausize - av->aulen - AV_INPUT_BUFFER_PADDING_SIZE;
+        av->buf.len = 0;
+        av->buf.flags = 0;
+        av->buf.priv = NULL;
+        ret = &av->buf;
+    }
+    return ret;
+}
+
+static int32_t av_submit (void* ctx, decoderbuf* buf);
+static int32_t av_submit (void* ctx, decoderbuf* buf)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    int32_t ret = 0;
+    av->aulen += buf->len;
+    av->auflags |= buf->flags;
+    /* parameter sets go out together with the access unit that follows them,
+     * STARTTIME needs nothing as pictures are shown as soon as they are decoded */
+    if (((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u) && ((buf->flags & DECODER_FLAG_CODECCONFIG) == 0u)) {
+        if (av->aulen > 0) {
+            ret = decode_au (av);
+        }
+        av->aulen = 0;
+        av->auflags = 0;
+    }
+    return ret;
+}
+
+static int32_t av_play_audio (void* ctx, const uint8_t* data, int32_t len);
+static int32_t av_play_audio (void* ctx, const uint8_t* data, int32_t len)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    int32_t ret = 0;
+    if (av->audio != NULL) {
+        ret = alsa_play (av->audio, data, len);
+    }
+    return ret;
+}
+
+static bool av_failed (void* ctx);
+static bool av_failed (void* ctx)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    return av->failed;
+}
+
+static int32_t av_recover (void* ctx);
+static int32_t av_recover (void* ctx)
+{
+    avdecoder* av = (avdecoder*)ctx;
+    /* drops the references and the frames in the threads, the display keeps the last picture */
+    avcodec_flush_buffers (av->codec);
+    av->aulen = 0;
+    av->auflags = 0;
+    av->errors = 0;
+    av->failed = false;
+    return 0;
+}
+
+const decoderops avcodec_decoder = {
+    .name = "avcodec",
+    .open = av_open,
+    .get_buffer = av_get_buffer,
+    .submit = av_submit,
+    .play_audio = av_play_audio,
+    .close = av_close,
+    .failed = av_failed,
+    .recover = av_recover,
+};
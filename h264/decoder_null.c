@@ -0,0 +1,236 @@
+/* Null sink for benchmarking the receive side of h264.bin. Access units and
+ * PCM are only checksummed and timestamped, so the report shows how many
+ * packets the receive, reorder and demux threads sustain on this machine and
+ * what each of them costs. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "decoder.h"
+#include "stats.h"
+
+#ifndef NULL_REPORT_INTERVAL
+/**
+ * Seconds between two reports on stdout
+ */
+#define NULL_REPORT_INTERVAL (1)
+#endif /* NULL_REPORT_INTERVAL */
+
+/* Large enough for any access unit, so the feed never splits one */
+#define NULL_BUFFER_SIZE (4 * 1024 * 1024)
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+typedef struct snullcounters {
+    int64_t packets;
+    int64_t bytes;       /* RTP packets including headers */
+    int64_t lost;        /* sequence numbers the demux never saw */
+    int64_t frames;
+    int64_t videobytes;
+    int64_t audiobytes;
+    int64_t sinkus;      /* CPU time spent in the sink itself */
+} nullcounters;
+
+typedef struct snulldecoder {
+    uint8_t* mem;
+    decoderbuf buf;
+    int32_t aulen;
+    uint32_t videosum;   /* FNV-1a over all video, to compare runs */
+    uint32_t audiosum;
+    int32_t nextseq;
+    int64_t austart;     /* when the first buffer of the current access unit came */
+    int64_t lastau;
+    int64_t maxgapus;    /* longest time between two access units */
+    int64_t maxauus;     /* longest time to collect one access unit */
+    nullcounters total;
+    nullcounters last;
+    int64_t lastreport;
+    int64_t lastproccpu;
+    int64_t lastthreadcpu;
+} nulldecoder;
+
+#define INLINE static inline
+
+INLINE int64_t cpu_us (clockid_t clock);
+INLINE int64_t cpu_us (clockid_t clock)
+{
+    struct timespec ts;
+    (void)clock_gettime (clock, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+INLINE uint32_t fnv1a (uint32_t sum, const uint8_t* data, int32_t len);
+INLINE uint32_t fnv1a (uint32_t sum, const uint8_t* data, int32_t len)
+{
+    for (int32_t i = 0; i < len; i++) {
+        sum = (sum ^ data[i]) * FNV_PRIME;
+    }
+    return sum;
+}
+
+/* The receive side as far as it is known: the receive and reorder thread
+ * of the session if stats has its clock, else the whole process */
+INLINE int64_t receive_cpu_us (void);
+INLINE int64_t receive_cpu_us (void)
+{
+    int64_t us = stats_receiver_cpu_us();
+    return (us >= 0) ? us : cpu_us (CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/* Called on the demux thread, whose CPU time is split into demux and sink.
+ * The rest of the process is the receive and reorder thread; with several
+ * sessions, that of this session is counted alone. */
+INLINE void report (nulldecoder* nd, int64_t now);
+INLINE void report (nulldecoder* nd, int64_t now)
+{
+    const nullcounters* t = &nd->total;
+    const nullcounters* l = &nd->last;
+    int64_t proccpu = receive_cpu_us();
+    int64_t threadcpu = cpu_us (CLOCK_THREAD_CPUTIME_ID);
+    int64_t us = now - nd->lastreport;
+    int64_t sinkus = t->sinkus - l->sinkus;
+    int64_t demuxus = (threadcpu - nd->lastthreadcpu) - sinkus;
+    int64_t recvus = proccpu - nd->lastproccpu;
+    if (stats_receiver_cpu_us() < 0) {
+        recvus -= threadcpu - nd->lastthreadcpu;
+    }
+    if (us > 0) {
+        (void)printf ("%snull %.0f pkts/s %.2f Mbps lost %lld, %.1f fps video %.2f Mbps audio %.0f kbps, max gap %lld ms collect %lld ms, "
+                      "cpu receive %.1f%% demux %.1f%% sink %.1f%%, sum %08x %08x\n",
+                      stats_tag(), (double)(t->packets - l->packets) * 1e6 / (double)us, (double)(t->bytes - l->bytes) * 8.0 / (double)us,
+                      (long long)(t->lost - l->lost), (double)(t->frames - l->frames) * 1e6 / (double)us,
+                      (double)(t->videobytes - l->videobytes) * 8.0 / (double)us, (double)(t->audiobytes - l->audiobytes) * 8e3 / (double)us,
+                      (long long)(nd->maxgapus / 1000), (long long)(nd->maxauus / 1000),
+                      (double)recvus * 100.0 / (double)us, (double)demuxus * 100.0 / (double)us, (double)sinkus * 100.0 / (double)us,
+                      (unsigned int)nd->videosum, (unsigned int)nd->audiosum);
+        (void)fflush (stdout);
+    }
+    nd->last = nd->total;
+    nd->maxgapus = 0;
+    nd->maxauus = 0;
+    nd->lastreport = now;
+    nd->lastproccpu = proccpu;
+    nd->lastthreadcpu = threadcpu;
+}
+
+static void null_close (void* ctx);
+static void null_close (void* ctx)
+{
+    nulldecoder* nd = (nulldecoder*)ctx;
+    if (nd != NULL) {
+        free (nd->mem);
+        free (nd);
+    }
+}
+
+static int32_t null_open (void** ctx);
+static int32_t null_open (void** ctx)
+{
+    int32_t status = 0;
+    nulldecoder* nd = (nulldecoder*)calloc (1, sizeof (nulldecoder));
+    if (nd == NULL) {
+        status = -1;
+    } else {
+        nd->mem = (uint8_t*)malloc (NULL_BUFFER_SIZE);
+        if (nd->mem == NULL) {
+            status = -2;
+        }
+        nd->videosum = FNV_OFFSET;
+        nd->audiosum = FNV_OFFSET;
+        nd->nextseq = -1;
+        nd->austart = -1;
+        nd->lastau = -1;
+        nd->lastthreadcpu = -1;
+    }
+    *ctx = nd;
+    return status;
+}
+
+static decoderbuf* null_get_buffer (void* ctx);
+static decoderbuf* null_get_buffer (void* ctx)
+{
+    nulldecoder* nd = (nulldecoder*)ctx;
+    nd->buf.data = nd->mem;
+    nd->buf.maxlen = NULL_BUFFER_SIZE;
+    nd->buf.len = 0;
+    nd->buf.flags = 0;
+    nd->buf.priv = NULL;
+    return &nd->buf;
+}
+
+static int32_t null_submit (void* ctx, decoderbuf* buf);
+static int32_t null_submit (void* ctx, decoderbuf* buf)
+{
+    nulldecoder* nd = (nulldecoder*)ctx;
+    int64_t start = cpu_us (CLOCK_THREAD_CPUTIME_ID);
+    int64_t now = stats_now_us();
+    if (nd->austart < 0) {
+        nd->austart = now;
+    }
+    nd->videosum = fnv1a (nd->videosum, buf->data, buf->len);
+    nd->aulen += buf->len;
+    nd->total.videobytes += buf->len;
+    if (((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u) && ((buf->flags & DECODER_FLAG_CODECCONFIG) == 0u)) {
+        if (nd->aulen > 0) {
+            nd->total.frames++;
+            if ((nd->lastau >= 0) && ((now - nd->lastau) > nd->maxgapus)) {
+                nd->maxgapus = now - nd->lastau;
+            }
+            if ((now - nd->austart) > nd->maxauus) {
+                nd->maxauus = now - nd->austart;
+            }
+            nd->lastau = now;
+        }
+        nd->aulen = 0;
+        nd->austart = -1;
+    }
+    nd->total.sinkus += cpu_us (CLOCK_THREAD_CPUTIME_ID) - start;
+    return 0;
+}
+
+static int32_t null_play_audio (void* ctx, const uint8_t* data, int32_t len);
+static int32_t null_play_audio (void* ctx, const uint8_t* data, int32_t len)
+{
+    nulldecoder* nd = (nulldecoder*)ctx;
+    int64_t start = cpu_us (CLOCK_THREAD_CPUTIME_ID);
+    nd->audiosum = fnv1a (nd->audiosum, data, len);
+    nd->total.audiobytes += len;
+    nd->total.sinkus += cpu_us (CLOCK_THREAD_CPUTIME_ID) - start;
+    return 0;
+}
+
+static void null_received (void* ctx, const uint8_t* packet, int32_t len);
+static void null_received (void* ctx, const uint8_t* packet, int32_t len)
+{
+    nulldecoder* nd = (nulldecoder*)ctx;
+    int32_t seq = (packet[2] << 8) + packet[3];
+    if (nd->lastthreadcpu < 0) {
+        /* measure from the first packet on, not from start-up */
+        nd->lastthreadcpu = cpu_us (CLOCK_THREAD_CPUTIME_ID);
+        nd->lastproccpu = receive_cpu_us();
+        nd->lastreport = stats_now_us();
+    }
+    if (nd->nextseq >= 0) {
+        /* the reorder thread skips what it gave up waiting for */
+        nd->total.lost += 0xFFFF & (seq - nd->nextseq);
+    }
+    nd->nextseq = 0xFFFF & (seq + 1);
+    nd->total.packets++;
+    nd->total.bytes += len;
+    int64_t now = stats_now_us();
+    if ((now - nd->lastreport) >= ((int64_t)NULL_REPORT_INTERVAL * 1000000)) {
+        report (nd, now);
+    }
+}
+
+const decoderops null_decoder = {
+    .name = "null",
+    .open = null_open,
+    .get_buffer = null_get_buffer,
+    .submit = null_submit,
+    .play_audio = null_play_audio,
+    .close = null_close,
+    .received = null_received,
+};
@@ -0,0 +1,378 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+Copyright (c) 2018, Hsun-Wei Cho
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the copyright holder nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* OpenMAX IL decoder backend: video_decode tunnelled to video_render */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bcm_host.h"
+#include "ilclient.h"
+#include "audio.h"
+#include "decoder.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+typedef struct somxdecoder {
+    ILCLIENT_T* client;
+    COMPONENT_T* list[6]; /* ends with NULL for ilclient */
+    TUNNEL_T tunnel[4];
+    COMPONENT_T* audio_render;
+    bool executing;
+    int32_t port_settings_changed;
+    bool rendering;      /* video_scheduler and video_render are set up */
+    atomic_bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t emptied;    /* input buffers video_decode gave back */
+    decoderbuf buf;      /* wraps the header handed out last */
+} omxdecoder;
+
+#define INLINE static inline
+
+/* Called by ilclient for every OMX_EventError. */
+static void omx_error (void* userdata, COMPONENT_T* comp, OMX_U32 data);
+static void omx_error (void* userdata, COMPONENT_T* comp, OMX_U32 data)
+{
+    omxdecoder* omx = (omxdecoder*)userdata;
+    /* corrupt input is concealed, same state comes from our own transitions */
+    if ((comp == omx->list[0]) && (data != (OMX_U32)OMX_ErrorSameState) && (data != (OMX_U32)OMX_ErrorStreamCorrupt)) {
+        DBG_PRINTF_ERROR ("video_decode error %x\n", (unsigned int)data);
+        atomic_store (&omx->failed, true);
+    }
+}
+
+static void omx_emptied (void* userdata, COMPONENT_T* comp);
+static void omx_emptied (void* userdata, COMPONENT_T* comp)
+{
+    omxdecoder* omx = (omxdecoder*)userdata;
+    if (comp == omx->list[0]) {
+        (void)pthread_mutex_lock (&omx->lock);
+        omx->emptied++;
+        (void)pthread_cond_broadcast (&omx->cond);
+        (void)pthread_mutex_unlock (&omx->lock);
+    }
+}
+
+INLINE void create_new_audio_renderer (COMPONENT_T** audio_render, ILCLIENT_T* client, COMPONENT_T** list);
+INLINE void create_new_audio_renderer (COMPONENT_T** audio_render, ILCLIENT_T* client, COMPONENT_T** list)
+{
+    if (audioplay_create (client, audio_render, list, 4) != 0) {
+        DBG_PRINTF_ERROR ("create error\n");
+    }
+    /*if (audiodest == 0) {*/
+        (void)audioplay_set_dest (*audio_render, "hdmi");
+    /*} else if (audiodest == 1) {
+        (void)audioplay_set_dest (*audio_render, "local");
+    } else {
+        (void)audioplay_set_dest (*audio_render, "alsa");
+    }*/
+}
+
+static void omx_close (void* ctx);
+static void omx_close (void* ctx)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    if ((omx->executing) && (!atomic_load (&omx->failed))) {
+        OMX_BUFFERHEADERTYPE* buf = ilclient_get_input_buffer (omx->list[0], 130, 1);
+        if (buf != NULL) {
+            buf->nFilledLen = 0;
+            buf->nFlags = OMX_BUFFERFLAG_TIME_UNKNOWN | OMX_BUFFERFLAG_EOS;
+            if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (omx->list[0]), buf) != OMX_ErrorNone) {
+                DBG_PRINTF_ERROR ("cannot send EOS\n");
+            }
+        }
+        /* without a picture decoded there is no tunnel the EOS could come through */
+        if ((omx->port_settings_changed != 0) && (omx->rendering)) {
+            ilclient_wait_for_event (omx->list[1], OMX_EventBufferFlag, 90, 0, OMX_BUFFERFLAG_EOS, 0, ILCLIENT_BUFFER_FLAG_EOS, -1); // wait for EOS from render
+            ilclient_flush_tunnels (omx->tunnel, 0); // need to flush the renderer to allow video_decode to disable its input port
+        }
+    }
+    if (omx->client != NULL) {
+        ilclient_disable_tunnel (omx->tunnel);
+        ilclient_disable_tunnel (omx->tunnel + 1);
+        ilclient_disable_tunnel (omx->tunnel + 2);
+        ilclient_disable_port_buffers (omx->list[0], 130, NULL, NULL, NULL);
+        if (omx->audio_render != NULL) {
+            /* Idle to Loaded only completes once the buffers are freed */
+            ilclient_disable_port_buffers (omx->audio_render, 100, NULL, NULL, NULL);
+        }
+        ilclient_teardown_tunnels (omx->tunnel);
+        ilclient_state_transition (omx->list, OMX_StateIdle);
+        ilclient_state_transition (omx->list, OMX_StateLoaded);
+        ilclient_cleanup_components (omx->list);
+        OMX_Deinit();
+        ilclient_destroy (omx->client);
+    }
+    (void)pthread_cond_destroy (&omx->cond);
+    (void)pthread_mutex_destroy (&omx->lock);
+    free (omx);
+}
+
+static int32_t omx_open (void** ctx);
+static int32_t omx_open (void** ctx)
+{
+    int32_t status = 0;
+    omxdecoder* omx = (omxdecoder*)calloc (1, sizeof (omxdecoder));
+    pthread_condattr_t attr;
+    (void)pthread_condattr_init (&attr);
+    (void)pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    (void)pthread_mutex_init (&omx->lock, NULL);
+    (void)pthread_cond_init (&omx->cond, &attr);
+    (void)pthread_condattr_destroy (&attr);
+    bcm_host_init();
+    ILCLIENT_T* client = ilclient_init();
+    if (client == NULL) {
+        status = -3;
+    } else if (OMX_Init() != OMX_ErrorNone) {
+        ilclient_destroy (client);
+        status = -4;
+    } else {
+        omx->client = client;
+        ilclient_set_error_callback (client, omx_error, omx);
+        ilclient_set_empty_buffer_done_callback (client, omx_emptied, omx);
+        COMPONENT_T** list = omx->list;
+        TUNNEL_T* tunnel = omx->tunnel;
+        // create video_decode
+        if (ilclient_create_component (client, &list[0], "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0) {
+            status = -14;
+        }
+        // create video_render
+        if ((status == 0) && (ilclient_create_component (client, &list[1], "video_render", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
+            status = -14;
+        }
+        // create clock
+        if ((status == 0) && (ilclient_create_component (client, &list[2], "clock", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
+            status = -14;
+        }
+        OMX_TIME_CONFIG_CLOCKSTATETYPE cstate = {.nSize = sizeof(cstate), .nVersion.nVersion = OMX_VERSION, .eState = OMX_TIME_ClockStateWaitingForStartTime, .nWaitMask = 1};
+        if ((list[2] != NULL) && (OMX_SetParameter (ILC_GET_HANDLE (list[2]), OMX_IndexConfigTimeClockState, &cstate) != OMX_ErrorNone)) {
+            status = -13;
+        }
+        // create video_scheduler
+        if ((status == 0) && (ilclient_create_component (client, &list[3], "video_scheduler", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
+            status = -14;
+        }
+        create_new_audio_renderer (&omx->audio_render, client, list);
+        set_tunnel (tunnel, list[0], 131, list[3], 10);
+        set_tunnel (tunnel + 1, list[3], 11, list[1], 90);
+        set_tunnel (tunnel + 2, list[2], 80, list[3], 12);
+        // setup clock tunnel first
+        if ((status == 0) && (ilclient_setup_tunnel (tunnel + 2, 0, 0) != 0)) {
+            status = -15;
+        } else {
+            ilclient_change_component_state (list[2], OMX_StateExecuting);
+        }
+        if (status == 0) {
+            ilclient_change_component_state (list[0], OMX_StateIdle);
+        }
+        OMX_VIDEO_PARAM_PORTFORMATTYPE format = {.nSize = sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE), .nVersion.nVersion = OMX_VERSION, .nPortIndex = 130, .eCompressionFormat = OMX_VIDEO_CodingAVC};
+        /* start-up is held back by sendtodecoder() instead, so that a recovery point can start output as well as an IDR */
+        OMX_PARAM_BRCMVIDEODECODEERRORCONCEALMENTTYPE errconceal = {.nSize = sizeof (errconceal), .nVersion.nVersion = OMX_VERSION, .bStartWithValidFrame = OMX_FALSE};
+        if ((status == 0) && (OMX_SetParameter (ILC_GET_HANDLE (list[0]), OMX_IndexParamBrcmVideoDecodeErrorConcealment, &errconceal) != OMX_ErrorNone)) {
+            DBG_PRINTF_WARNING ("cannot set error concealment\n");
+        }
+
+        if ((status == 0) && (OMX_SetParameter (ILC_GET_HANDLE (list[0]), OMX_IndexParamVideoPortFormat, &format) == OMX_ErrorNone) && (ilclient_enable_port_buffers (list[0], 130, NULL, NULL, NULL) == 0)) {
+            ilclient_change_component_state (list[0], OMX_StateExecuting);
+            omx->executing = true;
+        } else if (status == 0) {
+            status = -16;
+        } else {
+            /* empty */
+        }
+    }
+    *ctx = omx;
+    return status;
+}
+
+static decoderbuf* omx_get_buffer (void* ctx);
+static decoderbuf* omx_get_buffer (void* ctx)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    decoderbuf* ret = NULL;
+    OMX_BUFFERHEADERTYPE* hdr = NULL;
+    struct timespec deadline;
+    (void)clock_gettime (CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += DECODER_STALL_MS / 1000;
+    deadline.tv_nsec += (long)(DECODER_STALL_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    bool waiting = !atomic_load (&omx->failed);
+    while (waiting) {
+        (void)pthread_mutex_lock (&omx->lock);
+        uint32_t emptied = omx->emptied;
+        (void)pthread_mutex_unlock (&omx->lock);
+        /* a hung video_decode never gives its buffers back, so do not block in ilclient */
+        hdr = ilclient_get_input_buffer (omx->list[0], 130, 0);
+        if (hdr != NULL) {
+            waiting = false;
+        } else {
+            int err = 0;
+            (void)pthread_mutex_lock (&omx->lock);
+            while ((omx->emptied == emptied) && (err == 0)) {
+                err = pthread_cond_timedwait (&omx->cond, &omx->lock, &deadline);
+            }
+            (void)pthread_mutex_unlock (&omx->lock);
+            if (err != 0) {
+                DBG_PRINTF_ERROR ("video_decode stalled\n");
+                atomic_store (&omx->failed, true);
+                waiting = false;
+            }
+        }
+    }
+    if (hdr != NULL) {
+        omx->buf.data = hdr->pBuffer;
+        /* room for the side data behind the last buffer of a frame */
+        omx->buf.maxlen = (int32_t)hdr->nAllocLen - 14;
+        omx->buf.len = 0;
+        omx->buf.flags = 0;
+        omx->buf.priv = hdr;
+        ret = &omx->buf;
+    }
+    return ret;
+}
+
+static int32_t omx_submit (void* ctx, decoderbuf* buf);
+static int32_t omx_submit (void* ctx, decoderbuf* buf)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    COMPONENT_T** list = omx->list;
+    TUNNEL_T* tunnel = omx->tunnel;
+    OMX_BUFFERHEADERTYPE* hdr = (OMX_BUFFERHEADERTYPE*)buf->priv;
+    int32_t data_len = buf->len;
+    /* a bare end of frame marker has nothing the decoder could report on */
+    bool marker = (data_len == 0) && ((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u);
+    if (((buf->flags & DECODER_FLAG_CODECCONFIG) == 0u) && (!marker) && (omx->port_settings_changed == 0) &&
+            (((data_len > 0) && ilclient_remove_event (list[0], OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) ||
+             ((data_len == 0) && ilclient_wait_for_event (list[0], OMX_EventPortSettingsChanged, 131, 0, 0, 1, ILCLIENT_EVENT_ERROR | ILCLIENT_PARAMETER_CHANGED, 10000) == 0))) {
+        omx->port_settings_changed = 1;
+        if (ilclient_setup_tunnel (tunnel, 0, 0) == 0) {
+            if (!omx->rendering) {
+                ilclient_change_component_state (list[3], OMX_StateExecuting);
+                // now setup tunnel to video_render
+                if (ilclient_setup_tunnel (tunnel + 1, 0, 1000) == 0) {
+                    ilclient_change_component_state (list[1], OMX_StateExecuting);
+                    omx->rendering = true;
+                } else {
+                    return -1;
+                }
+            }
+        } else {
+            return -1;
+        }
+    }
+    hdr->nFilledLen = data_len;
+    hdr->nOffset = 0;
+    hdr->nFlags = 0;
+    if ((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u) {
+        const uint8_t sidedata[14] = { 0xea, 0x00, 0x00, 0x00, 0x01, 0xce, 0x8c, 0x4d, 0x9d, 0x10, 0x8e, 0x25, 0xe9, 0xfe };
+        (void)memcpy (hdr->pBuffer + data_len, sidedata, 14);
+        hdr->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+    }
+    if ((buf->flags & DECODER_FLAG_CODECCONFIG) != 0u) {
+        hdr->nFlags |= OMX_BUFFERFLAG_CODECCONFIG;
+    } else if ((buf->flags & DECODER_FLAG_STARTTIME) != 0u) {
+        hdr->nFlags |= OMX_BUFFERFLAG_STARTTIME;
+    } else {
+        hdr->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
+    }
+    if ((buf->flags & DECODER_FLAG_DECODEONLY) != 0u) {
+        hdr->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
+    }
+    if ((buf->flags & DECODER_FLAG_CORRUPT) != 0u) {
+        hdr->nFlags |= OMX_BUFFERFLAG_DATACORRUPT;
+    }
+    return (OMX_EmptyThisBuffer (ILC_GET_HANDLE (list[0]), hdr) == OMX_ErrorNone) ? 0 : -1;
+}
+
+static int32_t omx_play_audio (void* ctx, const uint8_t* data, int32_t len);
+static int32_t omx_play_audio (void* ctx, const uint8_t* data, int32_t len)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    return audioplay_play_buffer (omx->audio_render, (uint8_t*)data, (uint32_t)len);
+}
+
+static bool omx_failed (void* ctx);
+static bool omx_failed (void* ctx)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    return atomic_load (&omx->failed);
+}
+
+/* Takes video_decode back to Loaded and up again. video_scheduler and
+ * video_render keep running, only the tunnel between the decoder and the
+ * scheduler is set up again at the next port settings change. */
+static int32_t omx_recover (void* ctx);
+static int32_t omx_recover (void* ctx)
+{
+    omxdecoder* omx = (omxdecoder*)ctx;
+    COMPONENT_T** list = omx->list;
+    int32_t status = 0;
+    ilclient_flush_tunnels (omx->tunnel, 0);
+    if (omx->port_settings_changed != 0) {
+        ilclient_disable_tunnel (omx->tunnel);
+        omx->port_settings_changed = 0;
+    }
+    ilclient_disable_port_buffers (list[0], 130, NULL, NULL, NULL);
+    /* an error may have left it in Invalid, from where only Loaded is reachable */
+    (void)ilclient_change_component_state (list[0], OMX_StateIdle);
+    (void)ilclient_change_component_state (list[0], OMX_StateLoaded);
+    /* whatever it reported before the reset is stale */
+    while (ilclient_remove_event (list[0], OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) {
+        /* empty */
+    }
+    if (ilclient_change_component_state (list[0], OMX_StateIdle) != 0) {
+        status = -1;
+    } else if (ilclient_enable_port_buffers (list[0], 130, NULL, NULL, NULL) != 0) {
+        status = -2;
+    } else if (ilclient_change_component_state (list[0], OMX_StateExecuting) != 0) {
+        status = -3;
+    } else {
+        atomic_store (&omx->failed, false);
+    }
+    return status;
+}
+
+const decoderops omx_decoder = {
+    .name = "omx",
+    .open = omx_open,
+    .get_buffer = omx_get_buffer,
+    .submit = omx_submit,
+    .play_audio = omx_play_audio,
+    .close = omx_close,
+    .failed = omx_failed,
+    .recover = omx_recover,
+};
@@ -0,0 +1,376 @@
+/* Stand-in for the OpenMAX IL decoder, to run the receive and feed path of
+ * h264.bin on machines without VideoCore. A worker thread consumes the input
+ * buffers at the pace of a decode time model, so that the feed code sees the
+ * same back pressure as with video_decode, and reports throughput and stalls. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "decoder.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#ifndef STUB_INPUT_BUFFERS
+/**
+ * Input buffers of the modelled decoder, video_decode has 20 by default
+ */
+#define STUB_INPUT_BUFFERS (20)
+#endif /* STUB_INPUT_BUFFERS */
+
+#ifndef STUB_BUFFER_SIZE
+/**
+ * Size of one input buffer, 80 kB like video_decode
+ */
+#define STUB_BUFFER_SIZE (80 * 1024)
+#endif /* STUB_BUFFER_SIZE */
+
+#ifndef STUB_FRAME_US
+/**
+ * Decode time of an access unit regardless of its size
+ */
+#define STUB_FRAME_US (4000)
+#endif /* STUB_FRAME_US */
+
+#ifndef STUB_BYTE_NS
+/**
+ * Decode time of each byte on top of STUB_FRAME_US
+ */
+#define STUB_BYTE_NS (20)
+#endif /* STUB_BYTE_NS */
+
+#ifndef STUB_PORT_SETTINGS_US
+/**
+ * Delay of the first picture, the time video_decode takes to report its output
+ * format and to set up the tunnels to the renderer
+ */
+#define STUB_PORT_SETTINGS_US (50000)
+#endif /* STUB_PORT_SETTINGS_US */
+
+#ifndef STUB_HANG_FRAMES
+/**
+ * Frames after which the modelled decoder stops taking input until it is
+ * reset, to try the recovery; 0 never hangs
+ */
+#define STUB_HANG_FRAMES (0)
+#endif /* STUB_HANG_FRAMES */
+
+#ifndef STUB_RESET_US
+/**
+ * Time a reset of the decoder component takes
+ */
+#define STUB_RESET_US (30000)
+#endif /* STUB_RESET_US */
+
+#ifndef STUB_AUDIO_BUFFER
+/**
+ * Bytes of PCM audio_render holds, 4 buffers of 4 kB
+ */
+#define STUB_AUDIO_BUFFER (4 * 4096)
+#endif /* STUB_AUDIO_BUFFER */
+
+#ifndef STUB_REPORT_INTERVAL
+/**
+ * Seconds between two throughput reports on stdout, 0 disables them
+ */
+#define STUB_REPORT_INTERVAL (1)
+#endif /* STUB_REPORT_INTERVAL */
+
+/* 48 kHz 16 bit stereo */
+#define STUB_AUDIO_BYTES_PER_S (48000 * 4)
+
+typedef struct sstubcounters {
+    int64_t frames;
+    int64_t bytes;
+    int64_t busyus;       /* time the modelled decoder was decoding */
+    int64_t stalls;       /* get_buffer calls that had to wait */
+    int64_t stallus;
+    int64_t maxstallus;
+    int64_t audiobytes;
+    int64_t audiodrops;   /* packets audio_render had no room for */
+    int64_t underruns;
+} stubcounters;
+
+typedef struct sstubdecoder {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    uint8_t* mem;
+    decoderbuf bufs[STUB_INPUT_BUFFERS];
+    decoderbuf* freebufs[STUB_INPUT_BUFFERS];
+    int32_t numfree;
+    decoderbuf* queue[STUB_INPUT_BUFFERS];
+    int32_t queuehead;
+    int32_t queuelen;
+    bool configured;      /* port settings were reported */
+    bool hung;            /* takes no input, see STUB_HANG_FRAMES */
+    bool failed;          /* get_buffer gave up waiting */
+    int64_t audioend;     /* when the queued PCM has played out */
+    stubcounters total;
+    stubcounters last;    /* totals at the last report */
+    int64_t lastreport;
+    char tag[16];         /* stats_tag of the opening thread, the worker reports as well */
+} stubdecoder;
+
+#define INLINE static inline
+
+/* Prints the counters since the last report, called with the lock held. */
+INLINE void report (stubdecoder* stub, int64_t now);
+INLINE void report (stubdecoder* stub, int64_t now)
+{
+    const stubcounters* t = &stub->total;
+    const stubcounters* l = &stub->last;
+    int64_t us = now - stub->lastreport;
+    if (us > 0) {
+        (void)printf ("%sstub %.1f fps %.2f Mbps, decoder busy %lld%%, %lld stalls %lld ms max %lld ms, audio %lld kB %lld dropped %lld underruns\n",
+                      stub->tag, (double)(t->frames - l->frames) * 1e6 / (double)us, (double)(t->bytes - l->bytes) * 8.0 / (double)us,
+                      (long long)(((t->busyus - l->busyus) * 100) / us), (long long)(t->stalls - l->stalls),
+                      (long long)((t->stallus - l->stallus) / 1000), (long long)(t->maxstallus / 1000),
+                      (long long)((t->audiobytes - l->audiobytes) / 1024), (long long)(t->audiodrops - l->audiodrops),
+                      (long long)(t->underruns - l->underruns));
+        (void)fflush (stdout);
+    }
+    stub->last = stub->total;
+    stub->total.maxstallus = 0;
+    stub->lastreport = now;
+}
+
+static void* stub_worker (void* arg);
+static void* stub_worker (void* arg)
+{
+    stubdecoder* stub = (stubdecoder*)arg;
+    int64_t aulen = 0;
+    (void)pthread_mutex_lock (&stub->lock);
+    while (stub->running) {
+        if ((stub->queuelen == 0) || (stub->hung)) {
+            (void)pthread_cond_wait (&stub->cond, &stub->lock);
+        } else {
+            decoderbuf* buf = stub->queue[stub->queuehead];
+            stub->queuehead = (stub->queuehead + 1) % STUB_INPUT_BUFFERS;
+            stub->queuelen--;
+            (void)pthread_mutex_unlock (&stub->lock);
+
+            /* the buffer stays with the decoder while it is parsed */
+            int64_t us = ((int64_t)buf->len * STUB_BYTE_NS) / 1000;
+            bool frame = ((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u) && ((buf->flags & DECODER_FLAG_CODECCONFIG) == 0u);
+            aulen += buf->len;
+            if ((frame) && (aulen > 0)) {
+                us += STUB_FRAME_US;
+                if (!stub->configured) {
+                    us += STUB_PORT_SETTINGS_US;
+                    stub->configured = true;
+                }
+            }
+            if (us > 0) {
+                (void)usleep ((useconds_t)us);
+            }
+
+            (void)pthread_mutex_lock (&stub->lock);
+            stub->total.busyus += us;
+            stub->total.bytes += buf->len;
+            if ((frame) && (aulen > 0)) {
+                stub->total.frames++;
+                aulen = 0;
+                if ((STUB_HANG_FRAMES > 0) && ((stub->total.frames % STUB_HANG_FRAMES) == 0)) {
+                    stub->hung = true;
+                }
+            }
+            stub->freebufs[stub->numfree] = buf;
+            stub->numfree++;
+            (void)pthread_cond_broadcast (&stub->cond);
+            int64_t now = stats_now_us();
+            if ((STUB_REPORT_INTERVAL > 0) && ((now - stub->lastreport) >= ((int64_t)STUB_REPORT_INTERVAL * 1000000))) {
+                report (stub, now);
+            }
+        }
+    }
+    (void)pthread_mutex_unlock (&stub->lock);
+    return NULL;
+}
+
+static void stub_close (void* ctx);
+static void stub_close (void* ctx)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    if (stub != NULL) {
+        if (stub->running) {
+            (void)pthread_mutex_lock (&stub->lock);
+            stub->running = false;
+            (void)pthread_cond_broadcast (&stub->cond);
+            (void)pthread_mutex_unlock (&stub->lock);
+            (void)pthread_join (stub->thread, NULL);
+            report (stub, stats_now_us());
+        }
+        (void)pthread_cond_destroy (&stub->cond);
+        (void)pthread_mutex_destroy (&stub->lock);
+        free (stub->mem);
+        free (stub);
+    }
+}
+
+static int32_t stub_open (void** ctx);
+static int32_t stub_open (void** ctx)
+{
+    int32_t status = 0;
+    stubdecoder* stub = (stubdecoder*)calloc (1, sizeof (stubdecoder));
+    if (stub == NULL) {
+        status = -1;
+    } else {
+        pthread_condattr_t attr;
+        (void)pthread_condattr_init (&attr);
+        (void)pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+        (void)pthread_mutex_init (&stub->lock, NULL);
+        (void)pthread_cond_init (&stub->cond, &attr);
+        (void)pthread_condattr_destroy (&attr);
+        stub->mem = (uint8_t*)malloc ((size_t)STUB_INPUT_BUFFERS * STUB_BUFFER_SIZE);
+        if (stub->mem == NULL) {
+            status = -2;
+        }
+    }
+    if (status == 0) {
+        for (int32_t i = 0; i < STUB_INPUT_BUFFERS; i++) {
+            stub->bufs[i].data = stub->mem + ((size_t)i * STUB_BUFFER_SIZE);
+            stub->freebufs[i] = &stub->bufs[i];
+        }
+        stub->numfree = STUB_INPUT_BUFFERS;
+        stub->lastreport = stats_now_us();
+        (void)snprintf (stub->tag, sizeof (stub->tag), "%s", stats_tag());
+        stub->running = true;
+        if (pthread_create (&stub->thread, NULL, stub_worker, stub) != 0) {
+            stub->running = false;
+            status = -3;
+        }
+    }
+    *ctx = stub;
+    return status;
+}
+
+static decoderbuf* stub_get_buffer (void* ctx);
+static decoderbuf* stub_get_buffer (void* ctx)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    decoderbuf* buf = NULL;
+    (void)pthread_mutex_lock (&stub->lock);
+    if ((stub->numfree == 0) && (!stub->failed)) {
+        /* the feed is faster than the modelled decoder */
+        int64_t start = stats_now_us();
+        struct timespec deadline;
+        (void)clock_gettime (CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += DECODER_STALL_MS / 1000;
+        deadline.tv_nsec += (long)(DECODER_STALL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        int err = 0;
+        while ((stub->numfree == 0) && (err == 0)) {
+            err = pthread_cond_timedwait (&stub->cond, &stub->lock, &deadline);
+        }
+        stub->failed = (stub->numfree == 0);
+        int64_t us = stats_now_us() - start;
+        stub->total.stalls++;
+        stub->total.stallus += us;
+        if (us > stub->total.maxstallus) {
+            stub->total.maxstallus = us;
+        }
+    }
+    if (!stub->failed) {
+        stub->numfree--;
+        buf = stub->freebufs[stub->numfree];
+    }
+    (void)pthread_mutex_unlock (&stub->lock);
+    if (buf != NULL) {
+        buf->maxlen = STUB_BUFFER_SIZE;
+        buf->len = 0;
+        buf->flags = 0;
+        buf->priv = NULL;
+    }
+    return buf;
+}
+
+static int32_t stub_submit (void* ctx, decoderbuf* buf);
+static int32_t stub_submit (void* ctx, decoderbuf* buf)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    (void)pthread_mutex_lock (&stub->lock);
+    stub->queue[(stub->queuehead + stub->queuelen) % STUB_INPUT_BUFFERS] = buf;
+    stub->queuelen++;
+    (void)pthread_cond_broadcast (&stub->cond);
+    (void)pthread_mutex_unlock (&stub->lock);
+    return 0;
+}
+
+static int32_t stub_play_audio (void* ctx, const uint8_t* data, int32_t len);
+static int32_t stub_play_audio (void* ctx, const uint8_t* data, int32_t len)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    int32_t ret = 0;
+    (void)data;
+    int64_t now = stats_now_us();
+    (void)pthread_mutex_lock (&stub->lock);
+    if (stub->audioend < now) {
+        if (stub->audioend > 0) {
+            stub->total.underruns++;
+        }
+        stub->audioend = now;
+    }
+    /* audio_render plays out in real time, like video_decode it has a fixed number of buffers */
+    int64_t queued = ((stub->audioend - now) * STUB_AUDIO_BYTES_PER_S) / 1000000;
+    if ((queued + len) > STUB_AUDIO_BUFFER) {
+        stub->total.audiodrops++;
+        ret = -1;
+    } else {
+        stub->audioend += ((int64_t)len * 1000000) / STUB_AUDIO_BYTES_PER_S;
+        stub->total.audiobytes += len;
+    }
+    (void)pthread_mutex_unlock (&stub->lock);
+    return ret;
+}
+
+static bool stub_failed (void* ctx);
+static bool stub_failed (void* ctx)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    (void)pthread_mutex_lock (&stub->lock);
+    bool failed = stub->failed;
+    (void)pthread_mutex_unlock (&stub->lock);
+    return failed;
+}
+
+static int32_t stub_recover (void* ctx);
+static int32_t stub_recover (void* ctx)
+{
+    stubdecoder* stub = (stubdecoder*)ctx;
+    (void)usleep (STUB_RESET_US);
+    (void)pthread_mutex_lock (&stub->lock);
+    /* the queued input is flushed, the port settings come again */
+    while (stub->queuelen > 0) {
+        stub->freebufs[stub->numfree] = stub->queue[stub->queuehead];
+        stub->numfree++;
+        stub->queuehead = (stub->queuehead + 1) % STUB_INPUT_BUFFERS;
+        stub->queuelen--;
+    }
+    stub->configured = false;
+    stub->hung = false;
+    stub->failed = false;
+    (void)pthread_cond_broadcast (&stub->cond);
+    (void)pthread_mutex_unlock (&stub->lock);
+    return 0;
+}
+
+const decoderops stub_decoder = {
+    .name = "stub",
+    .open = stub_open,
+    .get_buffer = stub_get_buffer,
+    .submit = stub_submit,
+    .play_audio = stub_play_audio,
+    .close = stub_close,
+    .failed = stub_failed,
+    .recover = stub_recover,
+};
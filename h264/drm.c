@@ -0,0 +1,557 @@
+/* DRM/KMS output of decoded pictures, for hosts without X and video_render
+ *
+ * Pictures are copied into dumb buffers and put on screen with atomic
+ * commits. A plane that scans out YUV 4:2:0 and can scale is used if the
+ * driver has one, otherwise the primary plane with XRGB8888 converted by
+ * libswscale. Four buffers rotate between the decoder and the page flip
+ * thread: one on screen, one waiting for its flip, one queued and one being
+ * written, so that neither side ever waits for the other. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <libswscale/swscale.h>
+
+#include "drm.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#define DRM_MAX_CARDS 8
+#define DRM_SLOTS 4
+#define DRM_NONE (-1)
+
+/* Atomic properties set by the commits */
+#define PROP_CONN_CRTC_ID 0
+#define PROP_CRTC_MODE_ID 1
+#define PROP_CRTC_ACTIVE 2
+#define PROP_FB_ID 3
+#define PROP_CRTC_ID 4
+#define PROP_SRC_X 5
+#define PROP_SRC_Y 6
+#define PROP_SRC_W 7
+#define PROP_SRC_H 8
+#define PROP_CRTC_X 9
+#define PROP_CRTC_Y 10
+#define PROP_CRTC_W 11
+#define PROP_CRTC_H 12
+#define PROP_COUNT 13
+
+typedef struct sdrmslot {
+    uint32_t fb;
+    uint32_t handle;
+    uint8_t* map;
+    uint64_t size;
+    uint32_t pitch;
+    int32_t width;       /* of the picture in it */
+    int32_t height;
+    int32_t srcwidth;    /* of the decoded picture scaled into it */
+    int32_t srcheight;
+} drmslot;
+
+struct sdrmout {
+    int fd;
+    uint32_t connector;
+    uint32_t crtc;
+    uint32_t plane;
+    uint32_t format;     /* DRM_FORMAT_ of the plane, 0 before the first picture */
+    uint32_t modeblob;
+    int32_t modew;
+    int32_t modeh;
+    uint32_t props[PROP_COUNT];
+    bool modeset;        /* the first commit has to enable the CRTC */
+    bool unusable;       /* no plane can show the pictures */
+    struct SwsContext* sws;
+    drmslot slots[DRM_SLOTS];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    int32_t onscreen;    /* slot indices or DRM_NONE */
+    int32_t flipping;
+    int32_t queued;
+    int32_t writing;
+    int64_t replaced;    /* pictures never shown because a newer one came */
+};
+
+#define INLINE static inline
+
+INLINE uint32_t find_prop (int fd, uint32_t obj, uint32_t type, const char* name);
+INLINE uint32_t find_prop (int fd, uint32_t obj, uint32_t type, const char* name)
+{
+    uint32_t id = 0;
+    drmModeObjectProperties* props = drmModeObjectGetProperties (fd, obj, type);
+    if (props != NULL) {
+        for (uint32_t i = 0; (i < props->count_props) && (id == 0); i++) {
+            drmModePropertyRes* prop = drmModeGetProperty (fd, props->props[i]);
+            if (prop != NULL) {
+                if (strcmp (prop->name, name) == 0) {
+                    id = prop->prop_id;
+                }
+                drmModeFreeProperty (prop);
+            }
+        }
+        drmModeFreeObjectProperties (props);
+    }
+    return id;
+}
+
+INLINE uint64_t plane_type (int fd, uint32_t plane);
+INLINE uint64_t plane_type (int fd, uint32_t plane)
+{
+    uint64_t type = DRM_PLANE_TYPE_OVERLAY;
+    uint32_t prop = find_prop (fd, plane, DRM_MODE_OBJECT_PLANE, "type");
+    drmModeObjectProperties* props = drmModeObjectGetProperties (fd, plane, DRM_MODE_OBJECT_PLANE);
+    if (props != NULL) {
+        for (uint32_t i = 0; i < props->count_props; i++) {
+            if (props->props[i] == prop) {
+                type = props->prop_values[i];
+            }
+        }
+        drmModeFreeObjectProperties (props);
+    }
+    return type;
+}
+
+INLINE bool plane_has_format (const drmModePlane* plane, uint32_t format);
+INLINE bool plane_has_format (const drmModePlane* plane, uint32_t format)
+{
+    bool found = false;
+    for (uint32_t i = 0; (i < plane->count_formats) && (!found); i++) {
+        found = (plane->formats[i] == format);
+    }
+    return found;
+}
+
+/* Picks connector, mode and CRTC, returns false if no display is connected. */
+static bool find_display (drmout* out);
+static bool find_display (drmout* out)
+{
+    bool found = false;
+    drmModeRes* res = drmModeGetResources (out->fd);
+    for (int i = 0; (res != NULL) && (i < res->count_connectors) && (!found); i++) {
+        drmModeConnector* conn = drmModeGetConnector (out->fd, res->connectors[i]);
+        if ((conn != NULL) && (conn->connection == DRM_MODE_CONNECTED) && (conn->count_modes > 0)) {
+            drmModeModeInfo* mode = &conn->modes[0];
+            for (int m = 0; m < conn->count_modes; m++) {
+                if ((conn->modes[m].type & DRM_MODE_TYPE_PREFERRED) != 0u) {
+                    mode = &conn->modes[m];
+                    break;
+                }
+            }
+            for (int e = 0; (e < conn->count_encoders) && (!found); e++) {
+                drmModeEncoder* enc = drmModeGetEncoder (out->fd, conn->encoders[e]);
+                for (int c = 0; (enc != NULL) && (c < res->count_crtcs) && (!found); c++) {
+                    if ((enc->possible_crtcs & (1u << c)) != 0u) {
+                        out->connector = conn->connector_id;
+                        out->crtc = res->crtcs[c];
+                        found = (drmModeCreatePropertyBlob (out->fd, mode, sizeof (*mode), &out->modeblob) == 0);
+                        out->modew = mode->hdisplay;
+                        out->modeh = mode->vdisplay;
+                    }
+                }
+                drmModeFreeEncoder (enc);
+            }
+        }
+        drmModeFreeConnector (conn);
+    }
+    drmModeFreeResources (res);
+    return found;
+}
+
+/* Fits width x height into the mode keeping the aspect ratio. */
+INLINE void fit (const drmout* out, int32_t width, int32_t height, int32_t* rect);
+INLINE void fit (const drmout* out, int32_t width, int32_t height, int32_t* rect)
+{
+    if (((int64_t)width * out->modeh) > ((int64_t)height * out->modew)) {
+        rect[2] = out->modew;
+        rect[3] = (int32_t)(((int64_t)height * out->modew) / width) & ~1;
+    } else {
+        rect[2] = (int32_t)(((int64_t)width * out->modeh) / height) & ~1;
+        rect[3] = out->modeh;
+    }
+    rect[0] = (out->modew - rect[2]) / 2;
+    rect[1] = (out->modeh - rect[3]) / 2;
+}
+
+static int commit (drmout* out, uint32_t plane, const drmslot* slot, uint32_t flags);
+static int commit (drmout* out, uint32_t plane, const drmslot* slot, uint32_t flags)
+{
+    int32_t rect[4];
+    fit (out, slot->width, slot->height, rect);
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    if (out->modeset) {
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        (void)drmModeAtomicAddProperty (req, out->connector, out->props[PROP_CONN_CRTC_ID], out->crtc);
+        (void)drmModeAtomicAddProperty (req, out->crtc, out->props[PROP_CRTC_MODE_ID], out->modeblob);
+        (void)drmModeAtomicAddProperty (req, out->crtc, out->props[PROP_CRTC_ACTIVE], 1);
+    }
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_FB_ID], slot->fb);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_CRTC_ID], out->crtc);
+    /* source in 16.16 fixed point */
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_SRC_X], 0);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_SRC_Y], 0);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_SRC_W], (uint64_t)slot->width << 16);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_SRC_H], (uint64_t)slot->height << 16);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_CRTC_X], (uint64_t)rect[0]);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_CRTC_Y], (uint64_t)rect[1]);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_CRTC_W], (uint64_t)rect[2]);
+    (void)drmModeAtomicAddProperty (req, plane, out->props[PROP_CRTC_H], (uint64_t)rect[3]);
+    int err = drmModeAtomicCommit (out->fd, req, flags, out);
+    drmModeAtomicFree (req);
+    return err;
+}
+
+static void free_slot (drmout* out, drmslot* slot);
+static void free_slot (drmout* out, drmslot* slot)
+{
+    if (slot->fb != 0u) {
+        (void)drmModeRmFB (out->fd, slot->fb);
+    }
+    if (slot->map != NULL) {
+        (void)munmap (slot->map, slot->size);
+    }
+    if (slot->handle != 0u) {
+        struct drm_mode_destroy_dumb destroy = {.handle = slot->handle};
+        (void)drmIoctl (out->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    (void)memset (slot, 0, sizeof (*slot));
+}
+
+/* (Re)creates a dumb buffer of the plane's format for a width x height picture. */
+static bool alloc_slot (drmout* out, drmslot* slot, uint32_t format, int32_t width, int32_t height);
+static bool alloc_slot (drmout* out, drmslot* slot, uint32_t format, int32_t width, int32_t height)
+{
+    bool yuv = (format != DRM_FORMAT_XRGB8888);
+    struct drm_mode_create_dumb create = {.width = (uint32_t)width, .height = yuv ? (uint32_t)((height * 3) / 2) : (uint32_t)height, .bpp = yuv ? 8u : 32u};
+    bool ok = (drmIoctl (out->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) == 0);
+    if (ok) {
+        slot->handle = create.handle;
+        slot->pitch = create.pitch;
+        slot->size = create.size;
+        slot->width = width;
+        slot->height = height;
+        struct drm_mode_map_dumb map = {.handle = create.handle};
+        ok = (drmIoctl (out->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) == 0);
+        if (ok) {
+            void* mem = mmap (NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, (off_t)map.offset);
+            ok = (mem != MAP_FAILED);
+            slot->map = ok ? (uint8_t*)mem : NULL;
+        }
+    }
+    if (ok) {
+        uint32_t handles[4] = {slot->handle, 0, 0, 0};
+        uint32_t pitches[4] = {slot->pitch, 0, 0, 0};
+        uint32_t offsets[4] = {0, 0, 0, 0};
+        uint32_t luma = slot->pitch * (uint32_t)height;
+        if (format == DRM_FORMAT_NV12) {
+            handles[1] = slot->handle;
+            pitches[1] = slot->pitch;
+            offsets[1] = luma;
+        } else if (format == DRM_FORMAT_YUV420) {
+            handles[1] = slot->handle;
+            handles[2] = slot->handle;
+            pitches[1] = slot->pitch / 2u;
+            pitches[2] = slot->pitch / 2u;
+            offsets[1] = luma;
+            offsets[2] = luma + ((slot->pitch / 2u) * ((uint32_t)height / 2u));
+        } else {
+            /* empty */
+        }
+        ok = (drmModeAddFB2 (out->fd, (uint32_t)width, (uint32_t)height, format, handles, pitches, offsets, &slot->fb, 0) == 0);
+    }
+    if (!ok) {
+        free_slot (out, slot);
+    }
+    return ok;
+}
+
+INLINE void plane_props (drmout* out, uint32_t plane);
+INLINE void plane_props (drmout* out, uint32_t plane)
+{
+    static const char* const names[PROP_COUNT - PROP_FB_ID] = {"FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+                                                               "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H"};
+    for (int32_t i = PROP_FB_ID; i < PROP_COUNT; i++) {
+        out->props[i] = find_prop (out->fd, plane, DRM_MODE_OBJECT_PLANE, names[i - PROP_FB_ID]);
+    }
+}
+
+/* Chooses the plane on the first picture: a YUV plane that passes a test
+ * commit with this picture size, else the primary plane with XRGB8888. */
+static bool choose_plane (drmout* out, int32_t width, int32_t height);
+static bool choose_plane (drmout* out, int32_t width, int32_t height)
+{
+    const uint32_t yuvformats[2] = {DRM_FORMAT_YUV420, DRM_FORMAT_NV12};
+    uint32_t primary = 0;
+    int crtcindex = -1;
+    drmModeRes* res = drmModeGetResources (out->fd);
+    for (int c = 0; (res != NULL) && (c < res->count_crtcs); c++) {
+        if (res->crtcs[c] == out->crtc) {
+            crtcindex = c;
+        }
+    }
+    drmModeFreeResources (res);
+    drmModePlaneRes* planes = drmModeGetPlaneResources (out->fd);
+    for (uint32_t i = 0; (planes != NULL) && (i < planes->count_planes) && (out->format == 0u); i++) {
+        drmModePlane* plane = drmModeGetPlane (out->fd, planes->planes[i]);
+        if ((plane != NULL) && (crtcindex >= 0) && ((plane->possible_crtcs & (1u << crtcindex)) != 0u)) {
+            if ((primary == 0u) && (plane_type (out->fd, plane->plane_id) == DRM_PLANE_TYPE_PRIMARY)) {
+                primary = plane->plane_id;
+            }
+            for (int32_t f = 0; (f < 2) && (out->format == 0u); f++) {
+                drmslot test = {0};
+                if (plane_has_format (plane, yuvformats[f]) && alloc_slot (out, &test, yuvformats[f], width, height)) {
+                    plane_props (out, plane->plane_id);
+                    if (commit (out, plane->plane_id, &test, DRM_MODE_ATOMIC_TEST_ONLY) == 0) {
+                        out->plane = plane->plane_id;
+                        out->format = yuvformats[f];
+                    }
+                    free_slot (out, &test);
+                }
+            }
+        }
+        drmModeFreePlane (plane);
+    }
+    drmModeFreePlaneResources (planes);
+    if ((out->format == 0u) && (primary != 0u)) {
+        out->plane = primary;
+        out->format = DRM_FORMAT_XRGB8888;
+        plane_props (out, primary);
+    }
+    DBG_PRINTF_DEBUG ("plane %u format %.4s\n", out->plane, (const char*)&out->format);
+    return out->format != 0u;
+}
+
+INLINE void copy_plane (uint8_t* dst, uint32_t dstpitch, const uint8_t* src, int32_t srcpitch, int32_t width, int32_t height);
+INLINE void copy_plane (uint8_t* dst, uint32_t dstpitch, const uint8_t* src, int32_t srcpitch, int32_t width, int32_t height)
+{
+    for (int32_t y = 0; y < height; y++) {
+        (void)memcpy (dst + ((size_t)y * dstpitch), src + ((ptrdiff_t)y * srcpitch), (size_t)width);
+    }
+}
+
+static bool fill_slot (drmout* out, drmslot* slot, const AVFrame* frame);
+static bool fill_slot (drmout* out, drmslot* slot, const AVFrame* frame)
+{
+    bool ok = true;
+    int32_t width = frame->width & ~1;
+    int32_t height = frame->height & ~1;
+    bool planar = (frame->format == AV_PIX_FMT_YUV420P) || (frame->format == AV_PIX_FMT_YUVJ420P);
+    if (out->format == DRM_FORMAT_XRGB8888) {
+        width = out->modew;
+        height = out->modeh;
+    }
+    if ((slot->fb == 0u) || (slot->width != width) || (slot->height != height)) {
+        free_slot (out, slot);
+        ok = alloc_slot (out, slot, out->format, width, height);
+    }
+    uint8_t* luma = slot->map;
+    uint8_t* chroma = (slot->map != NULL) ? (slot->map + ((size_t)slot->pitch * (size_t)height)) : NULL;
+    if (!ok) {
+        /* empty */
+    } else if ((out->format == DRM_FORMAT_YUV420) && (planar)) {
+        copy_plane (luma, slot->pitch, frame->data[0], frame->linesize[0], width, height);
+        copy_plane (chroma, slot->pitch / 2u, frame->data[1], frame->linesize[1], width / 2, height / 2);
+        copy_plane (chroma + ((size_t)(slot->pitch / 2u) * (size_t)(height / 2)), slot->pitch / 2u, frame->data[2], frame->linesize[2], width / 2, height / 2);
+    } else if ((out->format == DRM_FORMAT_NV12) && (planar)) {
+        copy_plane (luma, slot->pitch, frame->data[0], frame->linesize[0], width, height);
+        for (int32_t y = 0; y < (height / 2); y++) {
+            uint8_t* dst = chroma + ((size_t)y * slot->pitch);
+            const uint8_t* u = frame->data[1] + ((ptrdiff_t)y * frame->linesize[1]);
+            const uint8_t* v = frame->data[2] + ((ptrdiff_t)y * frame->linesize[2]);
+            for (int32_t x = 0; x < (width / 2); x++) {
+                dst[2 * x] = u[x];
+                dst[(2 * x) + 1] = v[x];
+            }
+        }
+    } else if (out->format == DRM_FORMAT_XRGB8888) {
+        if ((frame->width != slot->srcwidth) || (frame->height != slot->srcheight)) {
+            /* black borders around the scaled picture */
+            (void)memset (slot->map, 0, slot->size);
+            slot->srcwidth = frame->width;
+            slot->srcheight = frame->height;
+        }
+        int32_t rect[4];
+        fit (out, frame->width, frame->height, rect);
+        out->sws = sws_getCachedContext (out->sws, frame->width, frame->height, (enum AVPixelFormat)frame->format,
+                                         rect[2], rect[3], AV_PIX_FMT_BGR0, SWS_BILINEAR, NULL, NULL, NULL);
+        uint8_t* dst[4] = {slot->map + ((size_t)rect[1] * slot->pitch) + ((size_t)rect[0] * 4u), NULL, NULL, NULL};
+        int dstpitch[4] = {(int)slot->pitch, 0, 0, 0};
+        ok = (out->sws != NULL) && (sws_scale (out->sws, (const uint8_t* const*)frame->data, frame->linesize, 0, frame->height, dst, dstpitch) > 0);
+        /* the whole buffer is scanned out, not just the picture */
+        slot->width = out->modew;
+        slot->height = out->modeh;
+    } else {
+        /* a YUV plane but not 8 bit 4:2:0 */
+        ok = false;
+    }
+    return ok;
+}
+
+static void page_flipped (int fd, unsigned int frame, unsigned int sec, unsigned int usec, void* data);
+static void page_flipped (int fd, unsigned int frame, unsigned int sec, unsigned int usec, void* data)
+{
+    drmout* out = (drmout*)data;
+    (void)fd;
+    (void)frame;
+    (void)sec;
+    (void)usec;
+    (void)pthread_mutex_lock (&out->lock);
+    out->onscreen = out->flipping;
+    out->flipping = DRM_NONE;
+    (void)pthread_mutex_unlock (&out->lock);
+}
+
+static void* flip_thread (void* arg);
+static void* flip_thread (void* arg)
+{
+    drmout* out = (drmout*)arg;
+    drmEventContext events = {.version = 2, .page_flip_handler = page_flipped};
+    (void)pthread_mutex_lock (&out->lock);
+    while (out->running) {
+        if (out->flipping != DRM_NONE) {
+            /* wait for the vblank that puts it on screen */
+            (void)pthread_mutex_unlock (&out->lock);
+            struct pollfd pfd = {.fd = out->fd, .events = POLLIN};
+            if (poll (&pfd, 1, 100) > 0) {
+                (void)drmHandleEvent (out->fd, &events);
+            }
+            (void)pthread_mutex_lock (&out->lock);
+        } else if (out->queued != DRM_NONE) {
+            int32_t slot = out->queued;
+            out->queued = DRM_NONE;
+            out->flipping = slot;
+            (void)pthread_mutex_unlock (&out->lock);
+            int err = commit (out, out->plane, &out->slots[slot], DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT);
+            (void)pthread_mutex_lock (&out->lock);
+            if (err == 0) {
+                out->modeset = false;
+            } else {
+                DBG_PRINTF_WARNING ("commit failed %d\n", err);
+                out->flipping = DRM_NONE;
+            }
+        } else {
+            (void)pthread_cond_wait (&out->cond, &out->lock);
+        }
+    }
+    (void)pthread_mutex_unlock (&out->lock);
+    return NULL;
+}
+
+drmout* drm_open (void)
+{
+    drmout* out = (drmout*)calloc (1, sizeof (drmout));
+    bool found = false;
+    for (int32_t card = 0; (out != NULL) && (card < DRM_MAX_CARDS) && (!found); card++) {
+        char path[32];
+        (void)snprintf (path, sizeof (path), "/dev/dri/card%d", card);
+        out->fd = open (path, O_RDWR | O_CLOEXEC);
+        if (out->fd >= 0) {
+            found = (drmSetClientCap (out->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0) &&
+                    (drmSetClientCap (out->fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0) && find_display (out);
+            if (!found) {
+                (void)close (out->fd);
+            } else {
+                DBG_PRINTF_DEBUG ("%s %dx%d\n", path, out->modew, out->modeh);
+            }
+        }
+    }
+    if (found) {
+        /* the plane properties are looked up once the plane is chosen */
+        out->props[PROP_CONN_CRTC_ID] = find_prop (out->fd, out->connector, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+        out->props[PROP_CRTC_MODE_ID] = find_prop (out->fd, out->crtc, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+        out->props[PROP_CRTC_ACTIVE] = find_prop (out->fd, out->crtc, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+        out->modeset = true;
+        out->onscreen = DRM_NONE;
+        out->flipping = DRM_NONE;
+        out->queued = DRM_NONE;
+        out->writing = DRM_NONE;
+        (void)pthread_mutex_init (&out->lock, NULL);
+        (void)pthread_cond_init (&out->cond, NULL);
+        out->running = true;
+        if (pthread_create (&out->thread, NULL, flip_thread, out) != 0) {
+            out->running = false;
+            found = false;
+        }
+        if (!found) {
+            drm_close (out);
+            out = NULL;
+        }
+    } else {
+        free (out);
+        out = NULL;
+    }
+    return out;
+}
+
+int32_t drm_show (drmout* out, const AVFrame* frame)
+{
+    int32_t ret = 0;
+    if ((out->format == 0u) && (!out->unusable) && (!choose_plane (out, frame->width & ~1, frame->height & ~1))) {
+        DBG_PRINTF_ERROR ("no plane for the pictures\n");
+        out->unusable = true;
+    }
+    if (out->unusable) {
+        ret = -1;
+    } else {
+        (void)pthread_mutex_lock (&out->lock);
+        for (int32_t i = 0; (i < DRM_SLOTS) && (out->writing == DRM_NONE); i++) {
+            if ((i != out->onscreen) && (i != out->flipping) && (i != out->queued)) {
+                out->writing = i;
+            }
+        }
+        (void)pthread_mutex_unlock (&out->lock);
+        int32_t slot = out->writing;
+        bool ok = fill_slot (out, &out->slots[slot], frame);
+        (void)pthread_mutex_lock (&out->lock);
+        out->writing = DRM_NONE;
+        if (ok) {
+            if (out->queued != DRM_NONE) {
+                out->replaced++;
+            }
+            out->queued = slot;
+            (void)pthread_cond_signal (&out->cond);
+        } else {
+            ret = -1;
+        }
+        (void)pthread_mutex_unlock (&out->lock);
+    }
+    return ret;
+}
+
+void drm_close (drmout* out)
+{
+    if (out != NULL) {
+        if (out->running) {
+            (void)pthread_mutex_lock (&out->lock);
+            out->running = false;
+            (void)pthread_cond_signal (&out->cond);
+            (void)pthread_mutex_unlock (&out->lock);
+            (void)pthread_join (out->thread, NULL);
+        }
+        DBG_PRINTF_DEBUG ("%lld pictures replaced before they were shown\n", (long long)out->replaced);
+        /* switching the CRTC off releases the buffer on screen */
+        drmModeAtomicReq* req = drmModeAtomicAlloc();
+        (void)drmModeAtomicAddProperty (req, out->crtc, out->props[PROP_CRTC_ACTIVE], 0);
+        (void)drmModeAtomicCommit (out->fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
+        drmModeAtomicFree (req);
+        for (int32_t i = 0; i < DRM_SLOTS; i++) {
+            free_slot (out, &out->slots[i]);
+        }
+        (void)drmModeDestroyPropertyBlob (out->fd, out->modeblob);
+        sws_freeContext (out->sws);
+        (void)pthread_cond_destroy (&out->cond);
+        (void)pthread_mutex_destroy (&out->lock);
+        (void)close (out->fd);
+        free (out);
+    }
+}
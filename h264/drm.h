@@ -0,0 +1,20 @@
+/* DRM/KMS output of decoded pictures, for hosts without X and video_render */
+
+#ifndef DRM_H
+#define DRM_H
+
+#include <stdint.h>
+#include <libavutil/frame.h>
+
+typedef struct sdrmout drmout;
+
+/* Takes the first /dev/dri/card with a connected display and sets up a page
+ * flip thread on it. Returns NULL if there is none. */
+drmout* drm_open (void);
+/* Copies the picture into a free scanout buffer and queues it for the next
+ * vblank. A queued picture that was not on screen yet is replaced, so the
+ * display always shows the latest one. Never waits for the display. */
+int32_t drm_show (drmout* out, const AVFrame* frame);
+void drm_close (drmout* out);
+
+#endif /* DRM_H */
@@ -0,0 +1,443 @@
+/* Decoded picture export to other processes, see framering.h
+ *
+ * The access units the display decoder gets are copied to a queue and decoded
+ * once more with libavcodec on a thread of their own, so neither a slow
+ * software decode nor slow consumers hold up the display path. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <libavcodec/avcodec.h>
+
+#include "export.h"
+#include "framering.h"
+#include "nal.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#ifndef EXPORT_SLOTS
+/**
+ * Pictures the ring holds, consumers have this many frame times to read one
+ */
+#define EXPORT_SLOTS (4)
+#endif /* EXPORT_SLOTS */
+
+#ifndef EXPORT_MAX_WIDTH
+/**
+ * Largest picture the slots have room for, larger ones are not exported
+ */
+#define EXPORT_MAX_WIDTH (1920)
+#define EXPORT_MAX_HEIGHT (1088)
+#endif /* EXPORT_MAX_WIDTH */
+
+/* Access units waiting for the decode thread */
+#define EXPORT_QUEUE 8
+#define EXPORT_MAX_CONSUMERS 8
+/* Frames the decoder may still hold back, to look up hidden ones by pts */
+#define EXPORT_PTS_RING 32
+
+#define ALIGN64(x) (((x) + 63u) & ~63u)
+
+struct sexporter {
+    char shmname[32];    /* EXPORT_SHM_NAME and EXPORT_SOCKET_NAME of the session */
+    char socketname[32];
+    framering* ring;
+    size_t ringsize;
+    AVCodecContext* codec;
+    AVPacket* pkt;
+    AVFrame* frame;
+    uint8_t* au;         /* access unit being collected by export_feed */
+    int32_t aulen;
+    int32_t ausize;
+    bool resync;         /* an access unit was dropped, wait for an IDR */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool running;
+    uint8_t* queue[EXPORT_QUEUE];
+    int32_t queuelen[EXPORT_QUEUE];
+    bool queuehidden[EXPORT_QUEUE];
+    int32_t queuehead;
+    int32_t queued;
+    bool hidden[EXPORT_PTS_RING];
+    int64_t seq;
+    pthread_t decoder;
+    pthread_t listener;
+    bool listening;      /* the listener thread was started */
+    int listenfd;
+    int wakefd;          /* stops the listener */
+    int conns[EXPORT_MAX_CONSUMERS];
+    int events[EXPORT_MAX_CONSUMERS];
+    int64_t dropped;
+};
+
+#define INLINE static inline
+
+INLINE bool hasidr (const uint8_t* data, int32_t len);
+INLINE bool hasidr (const uint8_t* data, int32_t len)
+{
+    bool found = false;
+    nalunit nal;
+    int32_t pos = 0;
+    while ((!found) && ((pos = nal_next (data, len, pos, &nal)) >= 0)) {
+        found = (nal.type == NAL_TYPE_IDR);
+    }
+    return found;
+}
+
+INLINE frameslot* slot_at (const exporter* exp, uint64_t n);
+INLINE frameslot* slot_at (const exporter* exp, uint64_t n)
+{
+    return (frameslot*)((uint8_t*)exp->ring + exp->ring->slotoffset + ((n % exp->ring->slots) * exp->ring->slotsize));
+}
+
+static void publish (exporter* exp, const AVFrame* frame);
+static void publish (exporter* exp, const AVFrame* frame)
+{
+    bool planar = (frame->format == AV_PIX_FMT_YUV420P) || (frame->format == AV_PIX_FMT_YUVJ420P);
+    if ((planar) && (frame->width <= EXPORT_MAX_WIDTH) && (frame->height <= EXPORT_MAX_HEIGHT)) {
+        uint64_t n = atomic_load_explicit (&exp->ring->head, memory_order_relaxed) + 1u;
+        frameslot* slot = slot_at (exp, n);
+        uint8_t* base = (uint8_t*)slot;
+        uint32_t seq = atomic_load_explicit (&slot->seq, memory_order_relaxed);
+        /* odd: readers that started on the old picture see the change */
+        atomic_store_explicit (&slot->seq, seq + 1u, memory_order_relaxed);
+        atomic_thread_fence (memory_order_release);
+        uint32_t width = (uint32_t)frame->width;
+        uint32_t height = (uint32_t)frame->height;
+        slot->width = width;
+        slot->height = height;
+        slot->format = FRAMERING_FORMAT_I420;
+        slot->pitch[0] = ALIGN64 (width);
+        slot->pitch[1] = slot->pitch[0] / 2u;
+        slot->pitch[2] = slot->pitch[0] / 2u;
+        slot->offset[0] = ALIGN64 ((uint32_t)sizeof (frameslot));
+        slot->offset[1] = slot->offset[0] + (slot->pitch[0] * height);
+        slot->offset[2] = slot->offset[1] + (slot->pitch[1] * ((height + 1u) / 2u));
+        slot->frame = n;
+        slot->timeus = stats_now_us();
+        for (uint32_t p = 0; p < 3u; p++) {
+            uint32_t rows = (p == 0u) ? height : ((height + 1u) / 2u);
+            uint32_t bytes = (p == 0u) ? width : ((width + 1u) / 2u);
+            for (uint32_t y = 0; y < rows; y++) {
+                (void)memcpy (base + slot->offset[p] + (y * slot->pitch[p]), frame->data[p] + ((ptrdiff_t)y * frame->linesize[p]), bytes);
+            }
+        }
+        atomic_store_explicit (&slot->seq, seq + 2u, memory_order_release);
+        atomic_store_explicit (&exp->ring->head, n, memory_order_release);
+        const uint64_t one = 1;
+        (void)pthread_mutex_lock (&exp->lock);
+        for (int32_t i = 0; i < EXPORT_MAX_CONSUMERS; i++) {
+            if ((exp->events[i] >= 0) && (write (exp->events[i], &one, sizeof (one)) < 0)) {
+                /* the counter is full, the consumer is asleep anyway */
+            }
+        }
+        (void)pthread_mutex_unlock (&exp->lock);
+    }
+}
+
+static void decode (exporter* exp, uint8_t* au, int32_t len, bool hidden);
+static void decode (exporter* exp, uint8_t* au, int32_t len, bool hidden)
+{
+    (void)memset (au + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    exp->pkt->data = au;
+    exp->pkt->size = len;
+    exp->pkt->pts = exp->seq;
+    exp->pkt->dts = exp->seq;
+    exp->hidden[exp->seq % EXPORT_PTS_RING] = hidden;
+    exp->seq++;
+    if (avcodec_send_packet (exp->codec, exp->pkt) < 0) {
+        DBG_PRINTF_WARNING ("export decode error\n");
+    }
+    while (avcodec_receive_frame (exp->codec, exp->frame) >= 0) {
+        if ((exp->frame->pts < 0) || (!exp->hidden[exp->frame->pts % EXPORT_PTS_RING])) {
+            publish (exp, exp->frame);
+        }
+        av_frame_unref (exp->frame);
+    }
+}
+
+static void* decode_thread (void* arg);
+static void* decode_thread (void* arg)
+{
+    exporter* exp = (exporter*)arg;
+    (void)pthread_mutex_lock (&exp->lock);
+    while (exp->running) {
+        if (exp->queued == 0) {
+            (void)pthread_cond_wait (&exp->cond, &exp->lock);
+        } else {
+            uint8_t* au = exp->queue[exp->queuehead];
+            int32_t len = exp->queuelen[exp->queuehead];
+            bool hidden = exp->queuehidden[exp->queuehead];
+            exp->queuehead = (exp->queuehead + 1) % EXPORT_QUEUE;
+            exp->queued--;
+            (void)pthread_mutex_unlock (&exp->lock);
+            decode (exp, au, len, hidden);
+            free (au);
+            (void)pthread_mutex_lock (&exp->lock);
+        }
+    }
+    (void)pthread_mutex_unlock (&exp->lock);
+    return NULL;
+}
+
+/* Hands a new consumer its eventfd over the connection. */
+static void add_consumer (exporter* exp, int conn);
+static void add_consumer (exporter* exp, int conn)
+{
+    int efd = -1;
+    (void)pthread_mutex_lock (&exp->lock);
+    for (int32_t i = 0; (i < EXPORT_MAX_CONSUMERS) && (efd < 0); i++) {
+        if (exp->conns[i] < 0) {
+            efd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+            char byte = 0;
+            char control[CMSG_SPACE (sizeof (int))];
+            struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+            struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof (control)};
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR (&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+            (void)memcpy (CMSG_DATA (cmsg), &efd, sizeof (int));
+            if ((efd >= 0) && (sendmsg (conn, &msg, MSG_NOSIGNAL) == 1)) {
+                exp->conns[i] = conn;
+                exp->events[i] = efd;
+            } else if (efd >= 0) {
+                (void)close (efd);
+            } else {
+                /* empty */
+            }
+        }
+    }
+    (void)pthread_mutex_unlock (&exp->lock);
+    if (efd < 0) {
+        (void)close (conn);
+    }
+}
+
+static void* listen_thread (void* arg);
+static void* listen_thread (void* arg)
+{
+    exporter* exp = (exporter*)arg;
+    bool running = true;
+    while (running) {
+        struct pollfd pfds[EXPORT_MAX_CONSUMERS + 2];
+        pfds[0] = (struct pollfd){.fd = exp->wakefd, .events = POLLIN};
+        pfds[1] = (struct pollfd){.fd = exp->listenfd, .events = POLLIN};
+        for (int32_t i = 0; i < EXPORT_MAX_CONSUMERS; i++) {
+            /* negative fds are skipped by poll */
+            pfds[i + 2] = (struct pollfd){.fd = exp->conns[i], .events = POLLIN};
+        }
+        if (poll (pfds, EXPORT_MAX_CONSUMERS + 2, -1) > 0) {
+            running = (pfds[0].revents == 0);
+            if ((running) && ((pfds[1].revents & POLLIN) != 0)) {
+                int conn = accept (exp->listenfd, NULL, NULL);
+                if (conn >= 0) {
+                    add_consumer (exp, conn);
+                }
+            }
+            for (int32_t i = 0; i < EXPORT_MAX_CONSUMERS; i++) {
+                if (pfds[i + 2].revents != 0) {
+                    /* consumers never send anything, this is the hang up */
+                    (void)pthread_mutex_lock (&exp->lock);
+                    (void)close (exp->conns[i]);
+                    (void)close (exp->events[i]);
+                    exp->conns[i] = -1;
+                    exp->events[i] = -1;
+                    (void)pthread_mutex_unlock (&exp->lock);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool create_ring (exporter* exp);
+static bool create_ring (exporter* exp)
+{
+    uint32_t slotsize = ALIGN64 ((uint32_t)sizeof (frameslot)) + ((ALIGN64 ((uint32_t)EXPORT_MAX_WIDTH) * EXPORT_MAX_HEIGHT * 3u) / 2u);
+    uint32_t slotoffset = ALIGN64 ((uint32_t)sizeof (framering));
+    exp->ringsize = (size_t)slotoffset + ((size_t)slotsize * EXPORT_SLOTS);
+    int fd = shm_open (exp->shmname, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    bool ok = (fd >= 0) && (ftruncate (fd, (off_t)exp->ringsize) == 0);
+    if (ok) {
+        void* mem = mmap (NULL, exp->ringsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ok = (mem != MAP_FAILED);
+        exp->ring = ok ? (framering*)mem : NULL;
+    }
+    if (fd >= 0) {
+        (void)close (fd);
+    }
+    if (ok) {
+        /* the slots are zero and with that readable as empty */
+        exp->ring->slots = EXPORT_SLOTS;
+        exp->ring->slotsize = slotsize;
+        exp->ring->slotoffset = slotoffset;
+        exp->ring->version = FRAMERING_VERSION;
+        atomic_store (&exp->ring->head, 0);
+        atomic_thread_fence (memory_order_release);
+        exp->ring->magic = FRAMERING_MAGIC;
+    }
+    return ok;
+}
+
+static bool create_socket (exporter* exp);
+static bool create_socket (exporter* exp)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    /* abstract namespace, nothing to clean up in the file system */
+    size_t len = strlen (exp->socketname);
+    (void)memcpy (addr.sun_path + 1, exp->socketname, len);
+    socklen_t addrlen = (socklen_t)(offsetof (struct sockaddr_un, sun_path) + 1u + len);
+    exp->listenfd = socket (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    exp->wakefd = eventfd (0, EFD_CLOEXEC);
+    return (exp->listenfd >= 0) && (exp->wakefd >= 0) && (bind (exp->listenfd, (struct sockaddr*)&addr, addrlen) == 0) &&
+           (listen (exp->listenfd, EXPORT_MAX_CONSUMERS) == 0);
+}
+
+exporter* export_open (int32_t session)
+{
+    bool ok = true;
+    exporter* exp = (exporter*)calloc (1, sizeof (exporter));
+    const AVCodec* h264 = avcodec_find_decoder (AV_CODEC_ID_H264);
+    if ((exp == NULL) || (h264 == NULL)) {
+        free (exp);
+        exp = NULL;
+    } else {
+        if (session > 0) {
+            (void)snprintf (exp->shmname, sizeof (exp->shmname), "%s-%d", EXPORT_SHM_NAME, session);
+            (void)snprintf (exp->socketname, sizeof (exp->socketname), "%s-%d", EXPORT_SOCKET_NAME, session);
+        } else {
+            (void)snprintf (exp->shmname, sizeof (exp->shmname), "%s", EXPORT_SHM_NAME);
+            (void)snprintf (exp->socketname, sizeof (exp->socketname), "%s", EXPORT_SOCKET_NAME);
+        }
+        exp->listenfd = -1;
+        exp->wakefd = -1;
+        for (int32_t i = 0; i < EXPORT_MAX_CONSUMERS; i++) {
+            exp->conns[i] = -1;
+            exp->events[i] = -1;
+        }
+        (void)pthread_mutex_init (&exp->lock, NULL);
+        (void)pthread_cond_init (&exp->cond, NULL);
+        exp->codec = avcodec_alloc_context3 (h264);
+        exp->pkt = av_packet_alloc();
+        exp->frame = av_frame_alloc();
+        ok = (exp->codec != NULL) && (exp->pkt != NULL) && (exp->frame != NULL);
+    }
+    if (ok && (exp != NULL)) {
+        exp->codec->thread_count = 0;
+        exp->codec->thread_type = FF_THREAD_SLICE;
+        exp->codec->flags |= AV_CODEC_FLAG_LOW_DELAY;
+        ok = (avcodec_open2 (exp->codec, h264, NULL) >= 0) && create_ring (exp) && create_socket (exp);
+    }
+    if (ok && (exp != NULL)) {
+        exp->running = true;
+        if (pthread_create (&exp->decoder, NULL, decode_thread, exp) != 0) {
+            exp->running = false;
+            ok = false;
+        } else if (pthread_create (&exp->listener, NULL, listen_thread, exp) != 0) {
+            ok = false;
+        } else {
+            exp->listening = true;
+        }
+    }
+    if ((!ok) && (exp != NULL)) {
+        DBG_PRINTF_ERROR ("cannot export pictures\n");
+        export_close (exp);
+        exp = NULL;
+    }
+    return exp;
+}
+
+void export_feed (exporter* exp, const uint8_t* data, int32_t len, bool last, bool hidden)
+{
+    int32_t need = exp->aulen + len + AV_INPUT_BUFFER_PADDING_SIZE;
+    if (need > exp->ausize) {
+        uint8_t* au = (uint8_t*)realloc (exp->au, need);
+        if (au != NULL) {
+            exp->au = au;
+            exp->ausize = need;
+        }
+    }
+    if (need <= exp->ausize) {
+        (void)memcpy (exp->au + exp->aulen, data, len);
+        exp->aulen += len;
+    }
+    if ((last) && (exp->aulen > 0)) {
+        if ((exp->resync) && hasidr (exp->au, exp->aulen)) {
+            exp->resync = false;
+        }
+        (void)pthread_mutex_lock (&exp->lock);
+        if ((!exp->resync) && (exp->queued < EXPORT_QUEUE)) {
+            int32_t tail = (exp->queuehead + exp->queued) % EXPORT_QUEUE;
+            exp->queue[tail] = exp->au;
+            exp->queuelen[tail] = exp->aulen;
+            exp->queuehidden[tail] = hidden;
+            exp->queued++;
+            exp->au = NULL;
+            exp->ausize = 0;
+            (void)pthread_cond_signal (&exp->cond);
+        } else {
+            /* later pictures refer to this one, they are of no use until the next IDR */
+            exp->resync = true;
+            exp->dropped++;
+        }
+        (void)pthread_mutex_unlock (&exp->lock);
+        exp->aulen = 0;
+    }
+}
+
+void export_close (exporter* exp)
+{
+    if (exp != NULL) {
+        const uint64_t one = 1;
+        if (exp->running) {
+            (void)pthread_mutex_lock (&exp->lock);
+            exp->running = false;
+            (void)pthread_cond_signal (&exp->cond);
+            (void)pthread_mutex_unlock (&exp->lock);
+            (void)pthread_join (exp->decoder, NULL);
+        }
+        if ((exp->listening) && (write (exp->wakefd, &one, sizeof (one)) == (ssize_t)sizeof (one))) {
+            (void)pthread_join (exp->listener, NULL);
+        }
+        DBG_PRINTF_DEBUG ("%lld access units not exported\n", (long long)exp->dropped);
+        for (int32_t i = 0; i < EXPORT_MAX_CONSUMERS; i++) {
+            if (exp->conns[i] >= 0) {
+                (void)close (exp->conns[i]);
+                (void)close (exp->events[i]);
+            }
+        }
+        while (exp->queued > 0) {
+            free (exp->queue[exp->queuehead]);
+            exp->queuehead = (exp->queuehead + 1) % EXPORT_QUEUE;
+            exp->queued--;
+        }
+        if (exp->ring != NULL) {
+            (void)munmap (exp->ring, exp->ringsize);
+            (void)shm_unlink (exp->shmname);
+        }
+        if (exp->listenfd >= 0) {
+            (void)close (exp->listenfd);
+        }
+        if (exp->wakefd >= 0) {
+            (void)close (exp->wakefd);
+        }
+        avcodec_free_context (&exp->codec);
+        av_packet_free (&exp->pkt);
+        av_frame_free (&exp->frame);
+        (void)pthread_cond_destroy (&exp->cond);
+        (void)pthread_mutex_destroy (&exp->lock);
+        free (exp->au);
+        free (exp);
+    }
+}
@@ -0,0 +1,23 @@
+/* Decoded picture export to other processes, see framering.h */
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EXPORT_SHM_NAME "/lazycast-frames"
+#define EXPORT_SOCKET_NAME "lazycast-frames"
+
+typedef struct sexporter exporter;
+
+/* Creates the ring and starts the decode thread. Returns NULL on failure.
+ * Sessions after the first, 0, add "-" and their number to both names. */
+exporter* export_open (int32_t session);
+/* Takes a copy of a piece of an access unit, last ends it. Access units the
+ * decode thread has no room for are dropped up to the next IDR, so that the
+ * caller never waits. */
+void export_feed (exporter* exp, const uint8_t* data, int32_t len, bool last, bool hidden);
+void export_close (exporter* exp);
+
+#endif /* EXPORT_H */
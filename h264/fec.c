@@ -0,0 +1,188 @@
+/* SMPTE 2022-1 forward error correction of the stream h264.bin receives */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+/* RTP header without CSRC and extension, then the 2022-1 FEC header */
+#define FEC_RTP_HEADER 12
+#define FEC_HEADER 16
+
+#define INLINE static inline
+
+INLINE uint32_t get32 (const uint8_t* p);
+INLINE uint32_t get32 (const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+INLINE void report (fecreceiver* f, int64_t now);
+INLINE void report (fecreceiver* f, int64_t now)
+{
+    if (stats_due (f->lastreport, now)) {
+        (void)printf ("%sfec packets %d, recovered %d\n", stats_tag(), f->fecpackets, f->recovered);
+        f->lastreport = now;
+    }
+}
+
+INLINE const fecmedia* findmedia (const fecreceiver* f, uint16_t seq);
+INLINE const fecmedia* findmedia (const fecreceiver* f, uint16_t seq)
+{
+    const fecmedia* m = &f->media[seq % FEC_MEDIA_SLOTS];
+    return (m->seq == (int32_t)seq) ? m : NULL;
+}
+
+/* True if seq is one of the group, the only one missing */
+INLINE bool onlymissing (const fecreceiver* f, const fecpacket* p, uint16_t seq);
+INLINE bool onlymissing (const fecreceiver* f, const fecpacket* p, uint16_t seq)
+{
+    uint16_t d = (uint16_t)(seq - p->snbase);
+    bool ok = ((d % p->offset) == 0u) && ((d / p->offset) < p->na);
+    for (int32_t i = 0; (ok) && (i < p->na); i++) {
+        uint16_t s = (uint16_t)(p->snbase + (i * p->offset));
+        if ((s != seq) && (findmedia (f, s) == NULL)) {
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+INLINE void keep (fecreceiver* f, uint16_t seq, uint8_t pt, uint32_t ts, const uint8_t* payload, int32_t len);
+INLINE void keep (fecreceiver* f, uint16_t seq, uint8_t pt, uint32_t ts, const uint8_t* payload, int32_t len)
+{
+    fecmedia* m = &f->media[seq % FEC_MEDIA_SLOTS];
+    m->seq = seq;
+    m->pt = pt;
+    m->ts = ts;
+    m->len = len;
+    (void)memcpy (m->payload, payload, (size_t)len);
+}
+
+bool fec_init (fecreceiver* f, int64_t now)
+{
+    f->media = (fecmedia*)malloc (FEC_MEDIA_SLOTS * sizeof (fecmedia));
+    f->fec = (fecpacket*)malloc (FEC_SLOTS * sizeof (fecpacket));
+    f->fecpackets = 0;
+    f->recovered = 0;
+    f->lastreport = now;
+    if ((f->media == NULL) || (f->fec == NULL)) {
+        fec_close (f);
+    } else {
+        fec_reset (f);
+    }
+    return f->media != NULL;
+}
+
+void fec_reset (fecreceiver* f)
+{
+    if (f->media != NULL) {
+        for (int32_t i = 0; i < FEC_MEDIA_SLOTS; i++) {
+            f->media[i].seq = -1;
+        }
+        for (int32_t i = 0; i < FEC_SLOTS; i++) {
+            f->fec[i].valid = false;
+        }
+    }
+    f->nextslot = 0;
+    f->span = 0;
+    f->ssrc = 0;
+}
+
+void fec_close (fecreceiver* f)
+{
+    free (f->media);
+    free (f->fec);
+    f->media = NULL;
+    f->fec = NULL;
+}
+
+void fec_media (fecreceiver* f, const uint8_t* rtp, int32_t len)
+{
+    int32_t paylen = len - FEC_RTP_HEADER;
+    /* nothing to keep them for without FEC */
+    if ((f->span > 0) && (f->media != NULL) && (paylen >= 0) && (paylen <= FEC_PAYLOAD_MAX) && ((rtp[0] & 0x1Fu) == 0u)) {
+        f->ssrc = get32 (rtp + 8);
+        keep (f, (uint16_t)(((uint16_t)rtp[2] << 8) | rtp[3]), rtp[1] & 0x7Fu, get32 (rtp + 4), rtp + FEC_RTP_HEADER, paylen);
+    }
+}
+
+void fec_packet (fecreceiver* f, const uint8_t* data, int32_t len, int64_t now)
+{
+    int32_t paylen = len - FEC_RTP_HEADER - FEC_HEADER;
+    if ((f->media != NULL) && (paylen >= 0) && (paylen <= FEC_PAYLOAD_MAX)) {
+        const uint8_t* h = data + FEC_RTP_HEADER;
+        fecpacket* p = &f->fec[f->nextslot];
+        p->snbase = (uint16_t)(((uint16_t)h[0] << 8) | h[1]);
+        p->lenrecovery = (uint16_t)(((uint16_t)h[2] << 8) | h[3]);
+        p->ptrecovery = h[4] & 0x7Fu;
+        p->tsrecovery = get32 (h + 8);
+        p->offset = h[13];
+        p->na = h[14];
+        int32_t span = ((p->na - 1) * p->offset) + 1;
+        if ((p->offset > 0u) && (p->na > 0u) && (span <= (FEC_MEDIA_SLOTS / 2))) {
+            p->len = paylen;
+            (void)memcpy (p->payload, h + FEC_HEADER, (size_t)paylen);
+            p->valid = true;
+            f->nextslot = (f->nextslot + 1) % FEC_SLOTS;
+            if (span > f->span) {
+                f->span = span;
+            }
+            f->fecpackets++;
+        } else {
+            DBG_PRINTF_WARNING ("FEC group offset %d na %d not supported\n", p->offset, p->na);
+        }
+    }
+    report (f, now);
+}
+
+int32_t fec_recover (fecreceiver* f, uint16_t seq, uint8_t* out, int64_t now)
+{
+    int32_t len = 0;
+    for (int32_t i = 0; (len == 0) && (f->span > 0) && (i < FEC_SLOTS); i++) {
+        const fecpacket* p = &f->fec[i];
+        if ((p->valid) && onlymissing (f, p, seq)) {
+            uint8_t* payload = out + FEC_RTP_HEADER;
+            uint16_t paylen = p->lenrecovery;
+            uint8_t pt = p->ptrecovery;
+            uint32_t ts = p->tsrecovery;
+            (void)memcpy (payload, p->payload, (size_t)p->len);
+            for (int32_t j = 0; j < p->na; j++) {
+                const fecmedia* m = findmedia (f, (uint16_t)(p->snbase + (j * p->offset)));
+                if (m != NULL) {
+                    paylen ^= (uint16_t)m->len;
+                    pt ^= m->pt;
+                    ts ^= m->ts;
+                    /* shorter payloads count as padded with zeros */
+                    for (int32_t k = 0; (k < m->len) && (k < p->len); k++) {
+                        payload[k] ^= m->payload[k];
+                    }
+                }
+            }
+            if (paylen <= p->len) {
+                out[0] = 0x80;
+                out[1] = pt & 0x7Fu;
+                out[2] = (uint8_t)(seq >> 8);
+                out[3] = (uint8_t)seq;
+                out[4] = (uint8_t)(ts >> 24);
+                out[5] = (uint8_t)(ts >> 16);
+                out[6] = (uint8_t)(ts >> 8);
+                out[7] = (uint8_t)ts;
+                out[8] = (uint8_t)(f->ssrc >> 24);
+                out[9] = (uint8_t)(f->ssrc >> 16);
+                out[10] = (uint8_t)(f->ssrc >> 8);
+                out[11] = (uint8_t)f->ssrc;
+                keep (f, seq, pt & 0x7Fu, ts, payload, paylen);
+                len = FEC_RTP_HEADER + paylen;
+                f->recovered++;
+            }
+        }
+    }
+    report (f, now);
+    return len;
+}
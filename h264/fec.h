@@ -0,0 +1,66 @@
+/* SMPTE 2022-1 forward error correction of the stream h264.bin receives */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Column FEC two and row FEC four above the RTP port 1028 of the first
+ * session */
+#define FEC_COLUMN_PORT 1030
+#define FEC_ROW_PORT 1032
+
+/* Media packets kept to rebuild others from, a power of two above the
+ * largest group of 2022-1 (L * D <= 100) */
+#define FEC_MEDIA_SLOTS 256
+/* FEC packets kept until their group is complete */
+#define FEC_SLOTS 64
+/* Largest RTP payload that can be rebuilt */
+#define FEC_PAYLOAD_MAX 1500
+
+typedef struct sfecmedia {
+    int32_t seq;          /* -1 if the slot is empty */
+    uint8_t pt;
+    uint32_t ts;
+    int32_t len;          /* of the payload */
+    uint8_t payload[FEC_PAYLOAD_MAX];
+} fecmedia;
+
+typedef struct sfecpacket {
+    bool valid;
+    uint16_t snbase;
+    uint8_t offset;       /* 1 for a row, L for a column */
+    uint8_t na;           /* packets in the group */
+    uint16_t lenrecovery;
+    uint8_t ptrecovery;
+    uint32_t tsrecovery;
+    int32_t len;
+    uint8_t payload[FEC_PAYLOAD_MAX];
+} fecpacket;
+
+typedef struct sfecreceiver {
+    fecmedia* media;      /* FEC_MEDIA_SLOTS, NULL if there was no memory */
+    fecpacket* fec;       /* FEC_SLOTS */
+    int32_t nextslot;     /* the FEC slot overwritten next */
+    int32_t span;         /* most packets a group spans, 0 before the first FEC packet */
+    uint32_t ssrc;        /* of the media packets */
+    int32_t fecpackets;
+    int32_t recovered;
+    int64_t lastreport;
+} fecreceiver;
+
+/* Returns false without memory, FEC is not used then. */
+bool fec_init (fecreceiver* f, int64_t now);
+/* Forgets the old stream. */
+void fec_reset (fecreceiver* f);
+void fec_close (fecreceiver* f);
+/* Keeps a media packet for later recoveries, once FEC packets came in. */
+void fec_media (fecreceiver* f, const uint8_t* rtp, int32_t len);
+/* Takes an FEC packet as received from the column or row port. */
+void fec_packet (fecreceiver* f, const uint8_t* data, int32_t len, int64_t now);
+/* Rebuilds the media packet seq into out (2048 bytes) if a group it is in
+ * lacks only it. Returns its length, 0 if it cannot be rebuilt yet. */
+int32_t fec_recover (fecreceiver* f, uint16_t seq, uint8_t* out, int64_t now);
+
+#endif /* FEC_H */
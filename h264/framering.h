@@ -0,0 +1,50 @@
+/* Layout of the shared-memory ring h264.bin publishes decoded pictures in
+ *
+ * The ring is the POSIX shared memory object EXPORT_SHM_NAME. A consumer maps
+ * it read-only and reads the pictures in place:
+ *
+ *   1. n = head; slot = n % slots
+ *   2. s = slot seq, retry later if odd (being written)
+ *   3. use the picture
+ *   4. if slot seq != s the writer overwrote it meanwhile, drop what was read
+ *
+ * The writer never waits for consumers, a slow one only loses pictures. To be
+ * woken up instead of polling head, a consumer connects to the abstract unix
+ * socket EXPORT_SOCKET_NAME and receives an eventfd (SCM_RIGHTS) that is
+ * signalled on every new picture for as long as the connection stays open.
+ *
+ * With several sessions in one h264.bin, the first uses these names and
+ * session n the names with "-n" added. */
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define FRAMERING_MAGIC 0x52465a4cu   /* "LZFR" */
+#define FRAMERING_VERSION 1u
+#define FRAMERING_FORMAT_I420 0x30323449u /* "I420", Y then U then V, 8 bit */
+
+typedef struct sframeslot {
+    _Atomic uint32_t seq;  /* odd while the slot is being written */
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;       /* FRAMERING_FORMAT_ */
+    uint32_t pitch[3];
+    uint32_t offset[3];    /* of the planes from the start of the slot */
+    uint64_t frame;        /* picture number since start-up */
+    int64_t timeus;        /* CLOCK_MONOTONIC when it was decoded */
+} frameslot;
+
+typedef struct sframering {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slotsize;     /* bytes from one slot to the next */
+    uint32_t slotoffset;   /* of the first slot from the start of the ring */
+    uint32_t pad;
+    _Atomic uint64_t head; /* number of the newest picture, 0 for none yet */
+} framering;
+
+#endif /* FRAMERING_H */
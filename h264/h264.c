@@ -27,37 +27,257 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 // Video deocode demo using OpenMAX IL though the ilcient helper library
+/* recvmmsg */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
-#include "bcm_host.h"
-#include "ilclient.h"
-#include "audio.h"
+#include "decoder.h"
+#include "nal.h"
+#include "stats.h"
+#include "sps.h"
+#include "conceal.h"
+#include "rtsp.h"
+#include "idr.h"
+#include "rtcp.h"
+#include "latency.h"
+#include "fec.h"
+#include "srtp.h"
 
 #define DBG_PRINT_ENABLED 0
 #include "debug_print.h"
 
+#ifndef PASS_CORRUPT_FRAMES
+/**
+ * Send a PES with lost TS packets to the decoder flagged as corrupt and let
+ * its error concealment repair it, instead of dropping the whole frame
+ */
+#define PASS_CORRUPT_FRAMES (0)
+#endif /* PASS_CORRUPT_FRAMES */
+
+#ifndef CONCEAL_LOST_SLICES
+/**
+ * Rewrite a PES with lost TS packets before decoding: slices that lost data
+ * are replaced by skip slices repeating the previous picture. Frames that
+ * cannot be rewritten are handled as PASS_CORRUPT_FRAMES says
+ */
+#define CONCEAL_LOST_SLICES (0)
+#endif /* CONCEAL_LOST_SLICES */
+
+#ifndef FORCE_LOW_DELAY
+/**
+ * Add max_num_reorder_frames = 0 to SPSs that do not say how many frames
+ * may be reordered, so that the decoder does not hold back pictures
+ */
+#define FORCE_LOW_DELAY (1)
+#endif /* FORCE_LOW_DELAY */
+
+#ifndef SLICE_FEED
+/**
+ * Hand each slice to the decoder as soon as it has arrived instead of
+ * waiting for the whole frame, so that decoding overlaps reception
+ */
+#define SLICE_FEED (1)
+#endif /* SLICE_FEED */
+
+#ifndef STREAM_LOSS_MS
+/**
+ * Silence after which the stream is taken as lost at the latest
+ */
+#define STREAM_LOSS_MS (500)
+#endif /* STREAM_LOSS_MS */
+
+#ifndef STREAM_LOSS_MIN_MS
+/**
+ * Silence after which the stream is taken as lost at the earliest
+ */
+#define STREAM_LOSS_MIN_MS (150)
+#endif /* STREAM_LOSS_MIN_MS */
+
+#ifndef STREAM_LOSS_PACKETS
+/**
+ * Between the two, the stream is lost after the time this many packets take
+ * at the rate they have been coming in
+ */
+#define STREAM_LOSS_PACKETS (50)
+#endif /* STREAM_LOSS_PACKETS */
+
+#ifndef RTCP_INTERVAL_MS
+/**
+ * Time between two RTCP receiver reports to the source, 0 sends none
+ */
+#define RTCP_INTERVAL_MS (1000)
+#endif /* RTCP_INTERVAL_MS */
+
+#ifndef FRAME_EXPORT
+/**
+ * Decode the stream once more with libavcodec and publish the pictures in a
+ * shared-memory ring for other local processes, see framering.h
+ */
+#define FRAME_EXPORT (0)
+#endif /* FRAME_EXPORT */
+
+#if FRAME_EXPORT != 0
+#include "export.h"
+#endif
+
+#define CONCEAL_BUFFER_SIZE (1024 * 1024)
+#define CONCEAL_MAX_GAPS 32
+
 typedef struct srtppacket {
     uint8_t buf[2048];
     int32_t recvlen;
     int32_t seqnum;
+    bool newstream;       /* first packet of a stream after a session change */
+    int64_t arrival;      /* stats_now_us when it arrived */
+    int64_t networkus;    /* one-way delay by the sender reports, INT64_MIN if unknown */
     struct srtppacket* next;
 } rtppacket;
 
-atomic_int numofnode;
+/* Packets read from the socket with one call, and decrypted together */
+#define RECV_BATCH 16
+
+typedef struct sstreamwatch {
+    struct ssink* sk;
+    int64_t lastpacket;   /* stats_now_us of the last packet, -1 before the first */
+    int64_t intervalus;   /* mean time between two packets */
+    bool lost;
+    rtcpreceiver rtcp;
+    struct sockaddr_in rtcpaddr; /* where the source wants RTCP, port 0 if not known */
+    bool rtcpheard;       /* rtcpaddr is where the source's RTCP came from */
+    int64_t nextreport;
+    char cname[64];
+    fecreceiver fec;
+    int32_t fecfd[2];     /* column and row FEC, -1 if not open */
+    srtpsession srtp;
+    int32_t srtpgen;      /* of the key srtp was set up with */
+    rtppacket* batch[RECV_BATCH]; /* from 1 on, read but not handed out yet, or spare */
+    struct sockaddr_in batchfrom[RECV_BATCH];
+    int32_t batched;      /* packets the last read got */
+    int32_t batchnext;    /* the one handed out next */
+} streamwatch;
+
+/* Packets the RTSP thread reads from an interleaved TCP session, handed to
+ * the receiver in order through a ring only each side moves its end of */
+#define TCP_RING 1024
+
+typedef struct stcpfeed {
+    rtppacket* ring[TCP_RING];
+    atomic_uint head;     /* moved by the RTSP thread */
+    atomic_uint tail;     /* moved by the receiver */
+    rtppacket* next;      /* the one the next frame is read into */
+    int32_t wakefd;       /* -1 if there is none, TCP is not offered then */
+    int32_t dropped;      /* frames the full ring had no room for */
+} tcpfeed;
+
+/* Sessions one process runs at the same time, see main */
+#define SINK_MAX_SESSIONS 16
+/* RTP port of the first session; RTCP, column and row FEC follow as in
+ * rtcp.h and fec.h, and each further session takes the ports SINK_PORT_STEP
+ * above the one before */
+#define SINK_RTP_PORT 1028
+#define SINK_PORT_STEP 8
+/* Longest source address taken, with its end */
+#define SINK_SOURCE_SIZE 64
+
+#ifndef PIN_RECEIVERS
+/**
+ * With several sessions, keep the receiver of each on a CPU of its own,
+ * round robin over the CPUs online, so that they do not take turns on one
+ */
+#define PIN_RECEIVERS (1)
+#endif /* PIN_RECEIVERS */
+
+#ifndef PACKET_POOL_MAX
+/**
+ * Packets the decoders are done with kept for the receivers to read into
+ * again, shared by all sessions; more go back to the heap
+ */
+#define PACKET_POOL_MAX (8192)
+#endif /* PACKET_POOL_MAX */
+
+/* One session: its ports, the receiver and decoder threads and what they
+ * share with each other and with the thread running the RTSP session */
+typedef struct ssink {
+    int32_t index;
+    uint16_t port;        /* RTP, the others at the same distance as to 1028 */
+    rtppacket* beg;       /* the receiver appends, the decoder takes from here */
+    atomic_int numofnode;
+    atomic_int intrarefresh;
+    atomic_int newsession;  /* set before a session starts, the receiver takes the next stream as new */
+    atomic_int idrneeded;   /* set by the decode thread, the receiver asks for an IDR */
+    _Atomic int64_t idrat;  /* set by the decode thread when an IDR reached the decoder */
+    _Atomic int64_t sessionstart;
+    rtspsession* _Atomic rtsp;
+    tcpfeed tcpin;
+    rtspframes tcpframes; /* into tcpin */
+    /* SRTP master key and salt of the session, set before srtpgen is counted
+     * up and left alone until the session is over */
+    uint8_t srtpmaster[SRTP_MASTER_SIZE];
+    bool srtpkeyed;
+    atomic_int srtpgen;
+    bool offertcp;
+    char source[SINK_SOURCE_SIZE]; /* of the session running, "" for a free service slot */
+    int32_t result;       /* of the last session */
+    pthread_t receiver;
+    pthread_t decoder;
+    pthread_t runner;
+} sink;
+
+typedef struct sdecodestate {
+    sink* sk;
+    const decoderops* dec;
+    void* decctx;
+    int32_t first;
+    paramsets ps;
+    refreshstate rs;
+    lossstats ls;
+    latency lat;
+    bool infiller;        /* the last buffer ended inside a filler NAL unit */
+    bool aupending;       /* part of the access unit went to the decoder already */
+    int32_t nextcc;       /* continuity counter expected next within the PES */
+    uint8_t* au;          /* scratch buffers of CONCEAL_LOST_SLICES */
+    uint8_t* concealed;
+    int64_t streamstart;  /* stats_now_us of the session start, 0 once on screen */
+#if FRAME_EXPORT != 0
+    exporter* exp;        /* NULL if the ring could not be set up */
+#endif
+} decodestate;
+
+/* Packets no session needs, see PACKET_POOL_MAX */
+typedef struct spacketpool {
+    pthread_mutex_t lock;
+    rtppacket* free;
+    int32_t count;
+} packetpool;
+
+bool service = false;     /* sessions one after another, see main */
 int32_t audiodest = 0;
 int32_t idrsockport = -1;
 char* sinkip = "192.168.173.1";
+char* decodername = NULL;
+sink sinks[SINK_MAX_SESSIONS];
+int32_t numsinks = 1;
+packetpool pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .free = NULL, .count = 0};
+/* Guards the source of the service slots; the runners and main wait on
+ * slotchange for a session to hand out or a slot to become free */
+pthread_mutex_t slotlock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t slotchange = PTHREAD_COND_INITIALIZER;
+bool slotsquit = false;
 
 static bool largers (int32_t a, int32_t b);
 static bool largers (int32_t a, int32_t b)
@@ -76,18 +296,48 @@ static bool largers (int32_t a, int32_t b)
 #define INLINE static inline
 #define STATIC static
 
+INLINE void release_packet (rtppacket* p);
+INLINE void release_packet (rtppacket* p)
+{
+    (void)pthread_mutex_lock (&pool.lock);
+    if (pool.count < PACKET_POOL_MAX) {
+        p->next = pool.free;
+        pool.free = p;
+        pool.count++;
+        p = NULL;
+    }
+    (void)pthread_mutex_unlock (&pool.lock);
+    free (p);
+}
+
 INLINE void advance_packet (rtppacket** beg);
 INLINE void advance_packet (rtppacket** beg)
 {
     rtppacket* nexttemp = (*beg)->next;
-    free ((*beg));
+    release_packet ((*beg));
     (*beg) = nexttemp;
 }
 
 
 INLINE rtppacket* allocate_new_packet (void);
 INLINE rtppacket* allocate_new_packet (void) {
-    rtppacket* p1 = (rtppacket*)calloc (1, sizeof (rtppacket));
+    (void)pthread_mutex_lock (&pool.lock);
+    rtppacket* p1 = pool.free;
+    if (p1 != NULL) {
+        pool.free = p1->next;
+        pool.count--;
+    }
+    (void)pthread_mutex_unlock (&pool.lock);
+    if (p1 != NULL) {
+        /* the buffer is written before it is read */
+        p1->recvlen = 0;
+        p1->newstream = false;
+        p1->arrival = 0;
+        p1->networkus = 0;
+        p1->next = NULL;
+    } else {
+        p1 = (rtppacket*)calloc (1, sizeof (rtppacket));
+    }
     p1->seqnum = -1;
     return p1;
 }
@@ -102,22 +352,6 @@ INLINE bool newpesstart (uint8_t* buffer, int32_t shift)
     return start;
 }
 
-INLINE void create_new_audio_renderer (COMPONENT_T** audio_render, ILCLIENT_T* client, COMPONENT_T** list);
-INLINE void create_new_audio_renderer (COMPONENT_T** audio_render, ILCLIENT_T* client, COMPONENT_T** list)
-{
-    if (audioplay_create (client, audio_render, list, 4) != 0) {
-        DBG_PRINTF_ERROR ("create error\n");
-    }
-    /*if (audiodest == 0) {*/
-        (void)audioplay_set_dest (*audio_render, "hdmi");
-    /*} else if (audiodest == 1) {
-        (void)audioplay_set_dest (*audio_render, "local");
-    } else {
-        (void)audioplay_set_dest (*audio_render, "alsa");
-    }*/
-}
-
-
 INLINE int32_t get_numofts (rtppacket* p1);
 INLINE int32_t get_numofts (rtppacket* p1) {
     int32_t numofts = (p1->recvlen - 12) / 188;
@@ -169,6 +403,18 @@ INLINE int32_t extract_ad (uint8_t* buffer) {
     return ad;
 }
 
+/* The PCR of a TS packet in microseconds, -1 if it carries none */
+INLINE int64_t extract_pcr (uint8_t* buffer, int32_t ad);
+INLINE int64_t extract_pcr (uint8_t* buffer, int32_t ad) {
+    int64_t pcr = -1;
+    if (((ad & 2) != 0) && (buffer[4] >= 7u) && ((buffer[5] & 0x10u) != 0u)) {
+        /* the 33 bit base at 90 kHz, the 27 MHz extension is not needed here */
+        int64_t base = ((int64_t)buffer[6] << 25) | ((int64_t)buffer[7] << 17) | ((int64_t)buffer[8] << 9) | ((int64_t)buffer[9] << 1) | ((int64_t)buffer[10] >> 7);
+        pcr = (base * 100) / 9;
+    }
+    return pcr;
+}
+
 INLINE int32_t extract_shift (uint8_t* buffer,int32_t ad);
 INLINE int32_t extract_shift (uint8_t* buffer,int32_t ad) {
     int32_t adlen = buffer[4];
@@ -176,26 +422,390 @@ INLINE int32_t extract_shift (uint8_t* buffer,int32_t ad) {
     return shift;
 }
 
-INLINE void receive_data (rtppacket* p1, int32_t fd);
-INLINE void receive_data (rtppacket* p1, int32_t fd) {
-    struct sockaddr_in sourceaddr;
-    socklen_t addrlen = sizeof (sourceaddr);
-    p1->recvlen = recvfrom (fd, p1->buf, 2048, 0, (struct sockaddr*)&sourceaddr, &addrlen);
-    if(p1->recvlen>=0) {
-        p1->seqnum = (p1->buf[2] << 8) + p1->buf[3];
+/* Reads what the socket holds, up to RECV_BATCH packets, into p1 and the
+ * spare packets of sw->batch and decrypts them in place in one go. The
+ * next calls of receive_packet hand out the others. */
+INLINE void receive_data (rtppacket* p1, int32_t fd, streamwatch* sw, int64_t now);
+INLINE void receive_data (rtppacket* p1, int32_t fd, streamwatch* sw, int64_t now) {
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    uint8_t* bufs[RECV_BATCH];
+    int32_t lens[RECV_BATCH];
+    sw->batch[0] = p1;
+    for (int32_t i = 0; i < RECV_BATCH; i++) {
+        if (sw->batch[i] == NULL) {
+            sw->batch[i] = allocate_new_packet();
+        }
+        iov[i].iov_base = sw->batch[i]->buf;
+        iov[i].iov_len = sizeof (sw->batch[i]->buf);
+        msgs[i].msg_hdr = (struct msghdr){.msg_name = &sw->batchfrom[i], .msg_namelen = sizeof (sw->batchfrom[i]), .msg_iov = &iov[i], .msg_iovlen = 1};
+    }
+    int n = recvmmsg (fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+    n = (n > 0) ? n : 0;
+    for (int32_t i = 0; i < n; i++) {
+        rtppacket* p = sw->batch[i];
+        p->recvlen = (int32_t)msgs[i].msg_len;
+        p->seqnum = (p->buf[2] << 8) + p->buf[3];
+        bufs[i] = p->buf;
+        lens[i] = p->recvlen;
+    }
+    srtp_unprotect (&sw->srtp, bufs, lens, n, now);
+    for (int32_t i = 0; i < n; i++) {
+        sw->batch[i]->recvlen = lens[i];
+    }
+    sw->batch[0] = NULL;
+    sw->batched = n;
+    sw->batchnext = 1;
+}
+
+
+/* How long the stream may be silent before it is taken as lost */
+INLINE int64_t silencelimit (const streamwatch* sw);
+INLINE int64_t silencelimit (const streamwatch* sw)
+{
+    int64_t us = STREAM_LOSS_PACKETS * sw->intervalus;
+    if (us < ((int64_t)STREAM_LOSS_MIN_MS * 1000)) {
+        us = (int64_t)STREAM_LOSS_MIN_MS * 1000;
+    } else if (us > ((int64_t)STREAM_LOSS_MS * 1000)) {
+        us = (int64_t)STREAM_LOSS_MS * 1000;
+    } else {
+        /* empty */
     }
+    return us;
 }
 
+/* rtspframes of a sink's tcpin; RTCP frames are skipped, the connection
+ * tells about the source and the reports would only go back the same way */
+static uint8_t* tcp_buffer (void* ctx, bool rtcp);
 
-static void sendtodecoder (COMPONENT_T** list, TUNNEL_T* tunnel, OMX_BUFFERHEADERTYPE** buf, rtppacket** beg, rtppacket* scan, int* port_settings_changed, int* first);
+static uint8_t* tcp_buffer (void* ctx, bool rtcp)
+{
+    tcpfeed* f = (tcpfeed*)ctx;
+    uint8_t* buf = NULL;
+    if (!rtcp) {
+        if (f->next == NULL) {
+            f->next = allocate_new_packet();
+        }
+        buf = f->next->buf;
+    }
+    return buf;
+}
 
-static void sendtodecoder (COMPONENT_T** list, TUNNEL_T* tunnel, OMX_BUFFERHEADERTYPE** buf, rtppacket** beg, rtppacket* scan, int* port_settings_changed, int* first)
+static void tcp_frame (void* ctx, bool rtcp, int32_t len);
+
+static void tcp_frame (void* ctx, bool rtcp, int32_t len)
 {
-    bool loop = true;
+    tcpfeed* f = (tcpfeed*)ctx;
+    const uint64_t one = 1;
+    uint32_t head = atomic_load (&f->head);
+    if ((rtcp) || (len < 12)) {
+        /* empty */
+    } else if ((head - atomic_load (&f->tail)) < TCP_RING) {
+        rtppacket* p = f->next;
+        p->recvlen = len;
+        p->seqnum = (p->buf[2] << 8) + p->buf[3];
+        f->ring[head % TCP_RING] = p;
+        f->next = NULL;
+        atomic_store (&f->head, head + 1u);
+        if (write (f->wakefd, &one, sizeof (one)) < 0) {
+            /* the counter is full, the receiver wakes up anyway */
+        }
+    } else {
+        /* the receiver is stuck, the buffer is read into again */
+        f->dropped++;
+    }
+}
+
+/* The next packet that came over TCP, NULL if there is none */
+INLINE rtppacket* tcp_take (tcpfeed* f);
+INLINE rtppacket* tcp_take (tcpfeed* f)
+{
+    rtppacket* p = NULL;
+    uint32_t tail = atomic_load (&f->tail);
+    if (tail != atomic_load (&f->head)) {
+        p = f->ring[tail % TCP_RING];
+        atomic_store (&f->tail, tail + 1u);
+    }
+    return p;
+}
+
+/* Sends a receiver report once RTCP_INTERVAL_MS have passed since the last. */
+INLINE void sendreport (streamwatch* sw, int32_t rtcpfd, int64_t now);
+INLINE void sendreport (streamwatch* sw, int32_t rtcpfd, int64_t now)
+{
+    if ((RTCP_INTERVAL_MS > 0) && (now >= sw->nextreport)) {
+        /* the time moves on without a destination too, it bounds the poll;
+         * an SRTP source only takes SRTCP, which is not done here */
+        if ((rtcpfd >= 0) && (sw->rtcpaddr.sin_port != 0u) && (!sw->srtp.keyed)) {
+            uint8_t report[RTCP_REPORT_SIZE];
+            int32_t len = rtcp_write_report (&sw->rtcp, sw->cname, report, sizeof (report), now);
+            if ((len > 0) && (sendto (rtcpfd, report, (size_t)len, 0, (struct sockaddr*)&sw->rtcpaddr, sizeof (sw->rtcpaddr)) < 0)) {
+                DBG_PRINTF_WARNING ("cannot send RTCP\n");
+            }
+        }
+        sw->nextreport = now + ((int64_t)RTCP_INTERVAL_MS * 1000);
+    }
+}
+
+/* Waits for the next RTP packet. recvlen is -1 once the stream is lost, that
+ * is silent for longer than silencelimit or ended by an RTCP BYE, and 0 after
+ * a wake-up without a packet. Receiver reports go out and FEC packets are
+ * taken in meanwhile. A packet that came over TCP or was read in a batch
+ * before takes the place of *pp. */
+INLINE void receive_packet (rtppacket** pp, int32_t fd, int32_t rtcpfd, streamwatch* sw);
+INLINE void receive_packet (rtppacket** pp, int32_t fd, int32_t rtcpfd, streamwatch* sw)
+{
+    sink* sk = sw->sk;
+    /* poll skips the sockets that are not open */
+    struct pollfd pfds[5] = {{.fd = fd, .events = POLLIN}, {.fd = rtcpfd, .events = POLLIN},
+                             {.fd = sw->fecfd[0], .events = POLLIN}, {.fd = sw->fecfd[1], .events = POLLIN},
+                             {.fd = sk->tcpin.wakefd, .events = POLLIN}};
+    int ready = 0;
+    if (atomic_load (&sk->srtpgen) != sw->srtpgen) {
+        /* a new session, maybe with another key */
+        sw->srtpgen = atomic_load (&sk->srtpgen);
+        srtp_init (&sw->srtp, sk->srtpkeyed ? sk->srtpmaster : NULL, stats_now_us());
+    }
+    bool batched = (sw->batchnext < sw->batched);
+    rtppacket* tcp = batched ? NULL : tcp_take (&sk->tcpin);
+    if ((!batched) && (tcp == NULL)) {
+        int timeout = -1;
+        if ((sw->lastpacket >= 0) && (!sw->lost)) {
+            int64_t deadline = sw->lastpacket + silencelimit (sw);
+            if ((RTCP_INTERVAL_MS > 0) && (sw->nextreport < deadline)) {
+                deadline = sw->nextreport;
+            }
+            int64_t left = deadline - stats_now_us();
+            timeout = (left > 0) ? (int)((left + 999) / 1000) : 0;
+        }
+        ready = poll (pfds, 5, timeout);
+        if ((ready > 0) && ((pfds[4].revents & POLLIN) != 0)) {
+            uint64_t count;
+            if (read (sk->tcpin.wakefd, &count, sizeof (count)) < 0) {
+                /* nothing to reset */
+            }
+            tcp = tcp_take (&sk->tcpin);
+        }
+    }
+    struct sockaddr_in from;
+    int64_t now = stats_now_us();
+    if (tcp != NULL) {
+        release_packet (*pp);
+        *pp = tcp;
+        uint8_t* buf = tcp->buf;
+        srtp_unprotect (&sw->srtp, &buf, &tcp->recvlen, 1, now);
+    } else if (batched) {
+        /* *pp is the spare in its place */
+        rtppacket* spare = *pp;
+        *pp = sw->batch[sw->batchnext];
+        sw->batch[sw->batchnext] = spare;
+        from = sw->batchfrom[sw->batchnext];
+        sw->batchnext++;
+    } else {
+        (*pp)->recvlen = 0;
+        if ((ready > 0) && ((pfds[0].revents & POLLIN) != 0)) {
+            receive_data (*pp, fd, sw, now);
+            from = sw->batchfrom[0];
+        }
+    }
+    rtppacket* p1 = *pp;
+    if (p1->recvlen > 0) {
+        rtcp_received (&sw->rtcp, p1->buf, p1->recvlen, now);
+        fec_media (&sw->fec, p1->buf, p1->recvlen);
+        p1->arrival = now;
+        p1->networkus = INT64_MIN;
+        int64_t sent = (p1->recvlen >= 12) ? rtcp_source_time (&sw->rtcp, ((uint32_t)p1->buf[4] << 24) | ((uint32_t)p1->buf[5] << 16) | ((uint32_t)p1->buf[6] << 8) | p1->buf[7]) : -1;
+        if (sent >= 0) {
+            struct timespec ts;
+            (void)clock_gettime (CLOCK_REALTIME, &ts);
+            p1->networkus = (((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000)) - sent;
+        }
+        if ((tcp == NULL) && (!sw->rtcpheard)) {
+            /* until the source sends RTCP itself, one above its RTP port */
+            sw->rtcpaddr = from;
+            sw->rtcpaddr.sin_port = htons ((uint16_t)(ntohs (from.sin_port) + 1u));
+        }
+    }
+    bool bye = false;
+    if ((ready > 0) && (rtcpfd >= 0) && ((pfds[1].revents & POLLIN) != 0)) {
+        uint8_t rtcp[1500];
+        socklen_t addrlen = sizeof (from);
+        ssize_t len = recvfrom (rtcpfd, rtcp, sizeof (rtcp), 0, (struct sockaddr*)&from, &addrlen);
+        if ((len > 0) && (!sw->srtp.keyed)) {
+            bye = rtcp_has_bye (rtcp, (int32_t)len);
+            rtcp_sender_report (&sw->rtcp, rtcp, (int32_t)len, now);
+            sw->rtcpaddr = from;
+            sw->rtcpheard = true;
+        }
+    }
+    for (int32_t i = 0; (ready > 0) && (i < 2); i++) {
+        if ((pfds[2 + i].revents & POLLIN) != 0) {
+            uint8_t fec[2048];
+            ssize_t len = recv (sw->fecfd[i], fec, sizeof (fec), 0);
+            if (len > 0) {
+                fec_packet (&sw->fec, fec, (int32_t)len, now);
+            }
+        }
+    }
+    if (p1->recvlen > 0) {
+        if (sw->lastpacket >= 0) {
+            sw->intervalus = ((7 * sw->intervalus) + (now - sw->lastpacket)) / 8;
+        }
+        sw->lastpacket = now;
+        sw->lost = false;
+    } else if ((!sw->lost) && (sw->lastpacket >= 0) && ((bye) || ((now - sw->lastpacket) >= silencelimit (sw)))) {
+        printf ("%sstream lost after %lld ms of silence%s\n", stats_tag(), (long long)((now - sw->lastpacket) / 1000), bye ? ", source said bye" : "");
+        (void)fflush (stdout);
+        sw->lost = true;
+        p1->recvlen = -1;
+    } else {
+        /* empty */
+    }
+    if (!sw->lost) {
+        sendreport (sw, rtcpfd, now);
+    }
+}
+
+INLINE bool hasslicestart (const uint8_t* payload, int32_t len);
+INLINE bool hasslicestart (const uint8_t* payload, int32_t len)
+{
+    bool found = false;
+    nalunit nal;
+    int32_t pos = 0;
+    while ((!found) && ((pos = nal_next (payload, len, pos, &nal)) >= 0)) {
+        found = (nal.type == NAL_TYPE_SLICE) || (nal.type == NAL_TYPE_IDR);
+    }
+    return found;
+}
+
+INLINE void sendparamsets (const decodestate* ds);
+INLINE void sendparamsets (const decodestate* ds)
+{
+    decoderbuf* buf = ds->dec->get_buffer (ds->decctx);
+    if (buf != NULL) {
+        buf->len = paramsets_write (&ds->ps, buf->data, buf->maxlen);
+        buf->flags = DECODER_FLAG_CODECCONFIG | DECODER_FLAG_ENDOFFRAME;
+        if (ds->dec->submit (ds->decctx, buf) != 0) {
+            DBG_PRINTF_ERROR ("cannot send parameter sets\n");
+        }
+    }
+}
+
+static bool submitbuffer (decoderbuf* buf, int32_t data_len, bool aufirst, bool last, decodestate* ds, int32_t kind);
+
+static bool submitbuffer (decoderbuf* buf, int32_t data_len, bool aufirst, bool last, decodestate* ds, int32_t kind)
+{
+    /* CBR sources pad with filler data the decoder would only parse and drop */
+    int32_t stripped = nal_strip_filler (buf->data, data_len, &ds->infiller);
+    ds->ls.fillerbytes += data_len - stripped;
+    data_len = stripped;
+    if ((FORCE_LOW_DELAY != 0) && (aufirst)) {
+        /* the cached copy is taken from the patched buffer as well */
+        data_len = sps_patch_low_delay (buf->data, data_len, buf->maxlen);
+    }
+    paramsets_update (&ds->ps, buf->data, data_len);
+    if (aufirst) {
+        bool held = ds->rs.hold;
+        int32_t autype = refresh_update (&ds->rs, buf->data, data_len);
+        atomic_store (&ds->sk->intrarefresh, refresh_active (&ds->rs) ? 1 : 0);
+        if (autype == AU_KEYFRAME) {
+            atomic_store (&ds->sk->idrat, stats_now_us());
+        }
+        if ((!ds->rs.hold) && (ds->streamstart != 0)) {
+            printf ("%sfirst picture %lld ms after the session started\n", stats_tag(), (long long)((stats_now_us() - ds->streamstart) / 1000));
+            (void)fflush (stdout);
+            ds->streamstart = 0;
+        }
+        if (ds->rs.hold) {
+            stats_frame (&ds->ls, FRAME_HELD);
+        } else if (kind != FRAME_CLEAN) {
+            stats_frame (&ds->ls, kind);
+        } else if ((autype == AU_KEYFRAME) || (held)) {
+            stats_frame (&ds->ls, FRAME_REFRESH);
+        } else {
+            stats_frame (&ds->ls, FRAME_CLEAN);
+        }
+    }
+    buf->len = data_len;
+    buf->flags = 0;
+    if (ds->rs.hold) {
+        buf->flags |= DECODER_FLAG_DECODEONLY;
+    }
+    if (kind == FRAME_CORRUPT) {
+        buf->flags |= DECODER_FLAG_CORRUPT;
+    }
+    if (last) {
+        buf->flags |= DECODER_FLAG_ENDOFFRAME;
+    }
+    if (ds->first != 0) {
+        buf->flags |= DECODER_FLAG_STARTTIME;
+        ds->first = 0;
+    }
+#if FRAME_EXPORT != 0
+    if (ds->exp != NULL) {
+        export_feed (ds->exp, buf->data, data_len, last, ds->rs.hold);
+    }
+#endif
+    return ds->dec->submit (ds->decctx, buf) == 0;
+}
+
+/* Forgets the stream that ended, the next one is taken like the first. */
+static void restartstream (decodestate* ds);
+
+static void restartstream (decodestate* ds)
+{
+    ds->first = 1;
+    ds->aupending = false;
+    ds->ps.spslen = 0;
+    ds->ps.ppslen = 0;
+    refresh_init (&ds->rs);
+    ds->streamstart = atomic_load (&ds->sk->sessionstart);
+    latency_end (&ds->lat);
+    latency_init (&ds->lat, stats_now_us());
+}
+
+/* Sends the TS packets from beg up to scan. Unless last is set the access
+ * unit continues in the next call. */
+static void sendtodecoder (rtppacket** beg, rtppacket* scan, decodestate* ds, bool corrupt, bool last);
+
+static void sendtodecoder (rtppacket** beg, rtppacket* scan, decodestate* ds, bool corrupt, bool last)
+{
+    bool loop = ((*beg) != scan);
+    bool aufirst = !ds->aupending;
+    if (aufirst) {
+        ds->nextcc = -1;
+    }
+    if ((!loop) && (last) && (ds->aupending)) {
+        /* all slices went out already, only end the frame */
+        decoderbuf* buf = ds->dec->get_buffer (ds->decctx);
+        if (buf != NULL) {
+            buf->len = 0;
+            buf->flags = DECODER_FLAG_ENDOFFRAME;
+#if FRAME_EXPORT != 0
+            if (ds->exp != NULL) {
+                export_feed (ds->exp, buf->data, 0, true, ds->rs.hold);
+            }
+#endif
+            if (ds->dec->submit (ds->decctx, buf) != 0) {
+                DBG_PRINTF_ERROR ("cannot end frame\n");
+            }
+        }
+        ds->aupending = false;
+    }
+    if ((ds->first != 0) && (aufirst)) {
+        if ((ds->rs.frames == 0) || refresh_active (&ds->rs)) {
+            /* render again from the next IDR or completed recovery point */
+            refresh_hold (&ds->rs);
+        }
+        if (paramsets_valid (&ds->ps)) {
+            /* resync the decoder before the first frame after a discontinuity */
+            sendparamsets (ds);
+        }
+    }
     while (loop) {
-        *buf = ilclient_get_input_buffer (list[0], 130, 1);
-        if (*buf != NULL) {
-            uint8_t* dest = (*buf)->pBuffer;
+        decoderbuf* buf = ds->dec->get_buffer (ds->decctx);
+        if (buf != NULL) {
+            uint8_t* dest = buf->data;
             int32_t data_len = 0;
             do {
                 uint8_t* buffer = (*beg)->buf + 12u;
@@ -207,6 +817,14 @@ static void sendtodecoder (COMPONENT_T** list, TUNNEL_T* tunnel, OMX_BUFFERHEADE
 		    uint32_t bytes_to_copy = 188 - shift;
 		    buffer += shift;
                     if ((pid == 0x1110) && ((ad & 1) == 1)) {
+                        int32_t cc = extract_cc (buffer - shift);
+                        if ((corrupt) && (ds->nextcc >= 0) && (cc != ds->nextcc)) {
+                            /* end the damaged NAL unit where the data is missing */
+                            (void)memset (dest, 0, 4);
+                            dest += 4;
+                            data_len += 4;
+                        }
+                        ds->nextcc = 0xF & (cc + 1);
                         (void)memcpy (dest, buffer, bytes_to_copy);
 			dest += bytes_to_copy;
                         data_len += bytes_to_copy;
@@ -218,64 +836,193 @@ static void sendtodecoder (COMPONENT_T** list, TUNNEL_T* tunnel, OMX_BUFFERHEADE
                 if ((*beg) == scan) {
                     loop = false;
                 }
-            } while ((loop) && (((*buf)->nAllocLen - data_len) >= 1500));
-            if (((*port_settings_changed) == 0) &&
-                    (((data_len > 0) && ilclient_remove_event (list[0], OMX_EventPortSettingsChanged, 131, 0, 0, 1) == 0) ||
-                     ((data_len == 0) && ilclient_wait_for_event (list[0], OMX_EventPortSettingsChanged, 131, 0, 0, 1, ILCLIENT_EVENT_ERROR | ILCLIENT_PARAMETER_CHANGED, 10000) == 0))) {
-                *port_settings_changed = 1;
-                if (ilclient_setup_tunnel (tunnel, 0, 0) == 0) {
-                    ilclient_change_component_state (list[3], OMX_StateExecuting);
-                    // now setup tunnel to video_render
-                    if (ilclient_setup_tunnel (tunnel + 1, 0, 1000) == 0) {
-                        ilclient_change_component_state (list[1], OMX_StateExecuting);
-                    } else {
-                        return;
+            } while ((loop) && ((buf->maxlen - data_len) >= 1500));
+            if (!submitbuffer (buf, data_len, aufirst, (!loop) && (last), ds, corrupt ? FRAME_CORRUPT : FRAME_CLEAN)) {
+                loop = false;
+            }
+            aufirst = false;
+            ds->aupending = !last;
+        } else {
+            loop = false;
+        }
+    }
+    return;
+}
+
+static void sendlinear (const uint8_t* data, int32_t len, decodestate* ds, int32_t kind);
+
+static void sendlinear (const uint8_t* data, int32_t len, decodestate* ds, int32_t kind)
+{
+    bool loop = true;
+    int32_t pos = 0;
+    while (loop) {
+        decoderbuf* buf = ds->dec->get_buffer (ds->decctx);
+        if (buf != NULL) {
+            int32_t data_len = ((len - pos) < buf->maxlen) ? (len - pos) : buf->maxlen;
+            (void)memcpy (buf->data, data + pos, data_len);
+            bool aufirst = (pos == 0);
+            pos += data_len;
+            loop = submitbuffer (buf, data_len, aufirst, pos >= len, ds, kind) && (pos < len);
+        } else {
+            loop = false;
+        }
+    }
+}
+
+static void sendconcealed (rtppacket** beg, rtppacket* scan, decodestate* ds);
+
+static void sendconcealed (rtppacket** beg, rtppacket* scan, decodestate* ds)
+{
+    int32_t gaps[CONCEAL_MAX_GAPS];
+    int32_t numgaps = 0;
+    int32_t len = 0;
+    int32_t nextcc = -1;
+    for (rtppacket* p = *beg; p != scan; p = p->next) {
+        len += get_numofts (p) * (188 + 4);
+    }
+    /* the PES has to fit the scratch buffers */
+    bool fits = (ds->au != NULL) && (ds->concealed != NULL) && (len <= (CONCEAL_BUFFER_SIZE - 4));
+    len = 0;
+    while ((fits) && ((*beg) != scan)) {
+        uint8_t* buffer = (*beg)->buf + 12u;
+        for (int32_t i = 0; i < get_numofts((*beg)); i++) {
+            int32_t pid = extract_pid(buffer);
+            int32_t ad = extract_ad(buffer);
+            int32_t shift = extract_shift(buffer,ad);
+            if ((pid == 0x1110) && ((ad & 1) == 1)) {
+                int32_t cc = extract_cc (buffer);
+                if ((nextcc >= 0) && (cc != nextcc)) {
+                    /* end the damaged NAL unit where the data is missing */
+                    (void)memset (ds->au + len, 0, 4);
+                    if (numgaps < CONCEAL_MAX_GAPS) {
+                        gaps[numgaps] = len;
                     }
-                } else {
-                    return;
+                    numgaps++;
+                    len += 4;
                 }
+                nextcc = 0xF & (cc + 1);
+                (void)memcpy (ds->au + len, buffer + shift, 188 - shift);
+                len += 188 - shift;
             }
-            (*buf)->nFilledLen = data_len;
-            (*buf)->nOffset = 0;
-
-            if (!loop) {
-                const uint8_t sidedata[14] = { 0xea, 0x00, 0x00, 0x00, 0x01, 0xce, 0x8c, 0x4d, 0x9d, 0x10, 0x8e, 0x25, 0xe9, 0xfe };
-                (void)memcpy (dest, sidedata, 14);
-		dest += 14;
-                data_len += 14;
-                (*buf)->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
-            }
-            if ((*first) != 0) {
-                (*buf)->nFlags |= OMX_BUFFERFLAG_STARTTIME;
-                *first = 0;
-            } else {
-                (*buf)->nFlags |= OMX_BUFFERFLAG_TIME_UNKNOWN;
-            }
-            if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (list[0]), (*buf)) != OMX_ErrorNone) {
-		loop = false;
+            buffer += 188u;
+        }
+        advance_packet(beg);
+    }
+    if (fits) {
+        /* TS packets lost right before the next PES */
+        uint8_t* buffer = scan->buf + 12u;
+        for (int32_t i = 0; i < get_numofts(scan); i++) {
+            if (extract_pid (buffer) == 0x1110) {
+                if ((nextcc >= 0) && (extract_cc (buffer) != nextcc) && (numgaps < CONCEAL_MAX_GAPS)) {
+                    (void)memset (ds->au + len, 0, 4);
+                    gaps[numgaps] = len;
+                    numgaps++;
+                    len += 4;
+                }
+                break;
             }
-        } else {
-            loop = false;
+            buffer += 188u;
+        }
+    }
+
+    int32_t outlen = -1;
+    if ((fits) && (numgaps <= CONCEAL_MAX_GAPS)) {
+        outlen = conceal_au (&ds->ps, ds->au, len, gaps, numgaps, ds->concealed, CONCEAL_BUFFER_SIZE);
+    }
+    if (outlen >= 0) {
+        sendlinear (ds->concealed, outlen, ds, FRAME_CONCEALED);
+    } else if ((PASS_CORRUPT_FRAMES != 0) && (fits)) {
+        /* the decoder's own concealment has to do */
+        sendlinear (ds->au, len, ds, FRAME_CORRUPT);
+    } else if (PASS_CORRUPT_FRAMES != 0) {
+        sendtodecoder (beg, scan, ds, true, true);
+    } else {
+        stats_frame (&ds->ls, FRAME_DROPPED);
+        ds->first = 1;
+        while ((*beg) != scan) {
+            advance_packet (beg);
         }
     }
     return;
 }
 
-static void* addnullpacket (rtppacket* beg)
+/* Asks the source for an IDR picture, over the RTSP session if h264.bin has
+ * one and through project.py otherwise. */
+static void requestidr (sink* sk, int32_t fd, const struct sockaddr_in* addr);
+
+static void requestidr (sink* sk, int32_t fd, const struct sockaddr_in* addr)
+{
+    const char topython[] = "send idr";
+    rtspsession* rtsp = sk->rtsp;
+    if (rtsp != NULL) {
+        rtsp_request_idr (rtsp);
+    } else if ((idrsockport > 0) && (sendto (fd, topython, sizeof (topython), 0, (const struct sockaddr*)addr, sizeof (*addr)) < 0)) {
+        perror ("sendto error");
+    } else {
+        /* empty */
+    }
+}
+
+/* A UDP socket on sinkip, -1 if the port cannot be had. */
+static int32_t openport (uint16_t port);
+
+static int32_t openport (uint16_t port)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = inet_addr (sinkip), .sin_port = htons (port)};
+    int32_t fd = socket (AF_INET, SOCK_DGRAM, 0);
+    if ((fd >= 0) && (bind (fd, (struct sockaddr*)&addr, sizeof (addr)) < 0)) {
+        (void)fprintf (stderr, "cannot receive on port %d: %s\n", port, strerror (errno));
+        (void)close (fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* Names the calling thread after its job and session, for top and for
+ * bench.py to tell the CPU time of the sessions apart */
+static void threadname (const char* job, const sink* sk);
+
+static void threadname (const char* job, const sink* sk)
+{
+    char name[16];
+    (void)snprintf (name, sizeof (name), "%s %d", job, sk->index);
+    (void)pthread_setname_np (pthread_self(), name);
+}
+
+/* Puts the receiver of the session on a CPU of its own, see PIN_RECEIVERS */
+static void pinreceiver (const sink* sk);
+
+static void pinreceiver (const sink* sk)
+{
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    if ((PIN_RECEIVERS != 0) && (numsinks > 1) && (cpus > 1)) {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        CPU_SET ((int)(sk->index % cpus), &set);
+        if (pthread_setaffinity_np (pthread_self(), sizeof (set), &set) != 0) {
+            DBG_PRINTF_WARNING ("cannot pin the receiver of session %d\n", sk->index);
+        }
+    }
+}
+
+static void* addnullpacket (sink* sk)
 {
+    rtppacket* beg = sk->beg;
+    stats_session (sk->index, numsinks > 1);
+    threadname ("recv", sk);
+    pinreceiver (sk);
     int32_t fd = socket (AF_INET, SOCK_DGRAM, 0);
     if (fd >= 0) {
-        struct sockaddr_in addr1 = {.sin_family = AF_INET, .sin_addr.s_addr = inet_addr (sinkip), .sin_port = htons (1028)};
+        struct sockaddr_in addr1 = {.sin_family = AF_INET, .sin_addr.s_addr = inet_addr (sinkip), .sin_port = htons (sk->port)};
         socklen_t addrlen = sizeof (addr1);
 
-        struct timeval tv = {.tv_sec = 10};
-        if (setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv)) < 0) {
-            perror ("cannot set timeout\n");
-            return 0;
-        } else if (bind (fd, (struct sockaddr*)&addr1, sizeof (addr1)) < 0) {
+        if (bind (fd, (struct sockaddr*)&addr1, sizeof (addr1)) < 0) {
             perror ("bind failed");
             return 0;
         }
+        /* reports go out and sender reports and BYE come in here; the stream
+         * works without RTCP */
+        int32_t rtcpfd = openport ((uint16_t)(sk->port + (RTCP_PORT - SINK_RTP_PORT)));
         struct sockaddr_in addr2 = {.sin_family = AF_INET,.sin_addr.s_addr = htonl (INADDR_LOOPBACK)};
         int32_t fd2 = 0;
         if (idrsockport > 0) {
@@ -288,9 +1035,26 @@ static void* addnullpacket (rtppacket* beg)
             }
         }
 
+        streamwatch sw = {.sk = sk, .lastpacket = -1, .intervalus = 0, .lost = false, .rtcpheard = false, .nextreport = INT64_MAX, .fecfd = {-1, -1}, .srtpgen = -1};
+        /* and without FEC */
+        if (fec_init (&sw.fec, stats_now_us())) {
+            sw.fecfd[0] = openport ((uint16_t)(sk->port + (FEC_COLUMN_PORT - SINK_RTP_PORT)));
+            sw.fecfd[1] = openport ((uint16_t)(sk->port + (FEC_ROW_PORT - SINK_RTP_PORT)));
+        }
+        rtcp_init (&sw.rtcp, (uint32_t)(stats_now_us() ^ (int64_t)getpid()));
+        (void)snprintf (sw.cname, sizeof (sw.cname), "lazycast@%s", sinkip);
+        rtppacket* first = allocate_new_packet();
         do {
-	    receive_data(beg,fd);
-        } while (beg->recvlen <= 0);
+            receive_packet (&first, fd, rtcpfd, &sw);
+        } while (first->recvlen <= 0);
+        /* the decoder starts at beg */
+        (void)memcpy (beg->buf, first->buf, (size_t)first->recvlen);
+        beg->recvlen = first->recvlen;
+        beg->seqnum = first->seqnum;
+        beg->arrival = first->arrival;
+        beg->networkus = first->networkus;
+        release_packet (first);
+        sw.nextreport = sw.lastpacket + ((int64_t)RTCP_INTERVAL_MS * 1000);
 
         bool hold = false;
         int32_t numofpacket = 1;
@@ -302,8 +1066,65 @@ static void* addnullpacket (rtppacket* beg)
 
         rtppacket* p1 = allocate_new_packet();
 
+        idrcontrol ic;
+        idr_init (&ic, stats_now_us());
+        bool resync = false;
         do {
-            receive_data(p1,fd);
+            /* a hole FEC can fill goes through like a received packet */
+            int32_t rebuilt = ((hold) && (numofpacket > 0)) ? fec_recover (&sw.fec, (uint16_t)osn, p1->buf, stats_now_us()) : 0;
+            if (rebuilt > 0) {
+                p1->recvlen = rebuilt;
+                p1->seqnum = osn;
+                p1->arrival = stats_now_us();
+                p1->networkus = INT64_MIN;
+            } else {
+                receive_packet (&p1, fd, rtcpfd, &sw);
+            }
+            int64_t now = stats_now_us();
+            int64_t idrtime = atomic_exchange (&sk->idrat, 0);
+            if (idrtime != 0) {
+                idr_received (&ic, idrtime);
+            }
+            if (atomic_exchange (&sk->idrneeded, 0) != 0) {
+                /* a reset decoder shows nothing until the IDR */
+                if (idr_loss (&ic, now, true)) {
+                    requestidr (sk, fd2, &addr2);
+                }
+            } else if (idr_poll (&ic, now)) {
+                requestidr (sk, fd2, &addr2);
+            } else {
+                /* empty */
+            }
+            if ((p1->recvlen > 0) && (atomic_exchange (&sk->newsession, 0) != 0)) {
+                resync = true;
+            }
+            if ((p1->recvlen > 0) && (resync) && (oldhead != NULL) && (p1->seqnum != osn)) {
+                /* a new stream numbers its packets from anywhere; the packets
+                 * still waiting for a gap to fill are of the old one */
+                while (numofpacket > 0) {
+                    advance_packet (&head);
+                    numofpacket--;
+                }
+                osn = p1->seqnum;
+                p1->newstream = true;
+                idr_init (&ic, now);
+                /* the next source may send its RTCP from elsewhere */
+                sw.rtcpheard = false;
+                fec_reset (&sw.fec);
+            }
+            if (p1->recvlen > 0) {
+                resync = false;
+            } else if (p1->recvlen < 0) {
+                /* the source is gone, the next packets may start another stream */
+                resync = true;
+                /* unless it ended and the next session started meanwhile */
+                rtspsession* rtsp = sk->rtsp;
+                if ((rtsp != NULL) && (atomic_load (&sk->sessionstart) < sw.lastpacket)) {
+                    rtsp_stream_lost (rtsp);
+                }
+            } else {
+                /* empty */
+            }
             if (p1->recvlen > 0) {
                 if (largers (osn, p1->seqnum)) {
                     DBG_PRINTF_WARNING ("drop:%d\n", p1->seqnum);
@@ -317,15 +1138,17 @@ static void* addnullpacket (rtppacket* beg)
                     numofpacket++;
                     if (osn == head->seqnum) {
                         hold = false;
-                    } else if (numofpacket > 14) {
+                    } else if (numofpacket > (14 + sw.fec.span)) {
                         hold = false;
                         osn = head->seqnum;
-                    } else if ((idrsockport > 0) && (numofpacket == 12)) {
-                        const char topython[] = "send idr";
-                        if (sendto (fd2, topython, sizeof (topython), 0, (struct sockaddr*)&addr2, addrlen) < 0) {
-                            perror ("sendto error");
+                        /* the hole is given up on, FEC would have filled it by
+                         * now; not needed while the source heals the picture
+                         * with intra refresh */
+                        if ((atomic_load (&sk->intrarefresh) == 0) && idr_loss (&ic, now, false)) {
+                            requestidr (sk, fd2, &addr2);
                         }
-                        DBG_PRINTF_TRACE ("idr:%d\n", numofpacket);
+                    } else {
+                        /* empty */
                     }
                     if ((numofpacket > 0) && (osn == head->seqnum) && (oldhead != NULL)) {
                         oldhead->next = head;
@@ -336,7 +1159,7 @@ static void* addnullpacket (rtppacket* beg)
                             oldhead = head;
                             head = head->next;
                             numofpacket--;
-                            atomic_fetch_add (&numofnode, 1);
+                            atomic_fetch_add (&sk->numofnode, 1);
                         } else {
                             hold = true;
                         }
@@ -345,14 +1168,13 @@ static void* addnullpacket (rtppacket* beg)
 		    p1 = allocate_new_packet();
                 }
 	    }
-        } while (p1->recvlen>=0);
+        } while ((p1->recvlen >= 0) || (service) || (sk->rtsp != NULL));
 
-	if (p1->recvlen<0) {
-            const char topython[] = "recv timeout";
-            if (sendto (fd2, topython, sizeof (topython), 0, (struct sockaddr*)&addr2, addrlen) < 0) {
-                perror ("recv timeout");
-            }
-	}
+        /* project.py runs the session, it ends it */
+        const char topython[] = "recv timeout";
+        if ((idrsockport > 0) && (sendto (fd2, topython, sizeof (topython), 0, (struct sockaddr*)&addr2, addrlen) < 0)) {
+            perror ("recv timeout");
+        }
     } else {
         perror ("cannot create socket\n");
     }
@@ -360,141 +1182,286 @@ static void* addnullpacket (rtppacket* beg)
 }
 
 
-static int32_t video_decode_test (rtppacket* beg)
+/* Resets a failed decoder in place of restarting the process. The receiver
+ * keeps buffering meanwhile; the stream resumes with the cached parameter
+ * sets and is held until the IDR asked for here arrives. A decoder that
+ * cannot be reset ends its session with -1 and is closed and opened anew,
+ * the other sessions of the process go on as they were. */
+static void recoverdecoder (decodestate* ds);
+
+static void recoverdecoder (decodestate* ds)
 {
-    int32_t status = 0;
-    ILCLIENT_T* client = ilclient_init();
-    if (client == NULL) {
-        status = -3;
-    } else if (OMX_Init() != OMX_ErrorNone) {
-        ilclient_destroy (client);
-        status = -4;
+    int64_t start = stats_now_us();
+    if (ds->dec->recover (ds->decctx) == 0) {
+        printf ("%sdecoder recovered in %lld ms\n", stats_tag(), (long long)((stats_now_us() - start) / 1000));
     } else {
-        // create video_decode
-        COMPONENT_T* list[5] = {0};
-        if (ilclient_create_component (client, &list[0], "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS) != 0) {
-            status = -14;
-        }
-        // create video_render
-        if ((status == 0) && (ilclient_create_component (client, &list[1], "video_render", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
-            status = -14;
-        }
-        // create clock
-        if ((status == 0) && (ilclient_create_component (client, &list[2], "clock", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
-            status = -14;
-        }
-        OMX_TIME_CONFIG_CLOCKSTATETYPE cstate = {.nSize = sizeof(cstate), .nVersion.nVersion = OMX_VERSION, .eState = OMX_TIME_ClockStateWaitingForStartTime, .nWaitMask = 1};
-        if ((list[2] != NULL) && (OMX_SetParameter (ILC_GET_HANDLE (list[2]), OMX_IndexConfigTimeClockState, &cstate) != OMX_ErrorNone)) {
-            status = -13;
-        }
-        // create video_scheduler
-        if ((status == 0) && (ilclient_create_component (client, &list[3], "video_scheduler", ILCLIENT_DISABLE_ALL_PORTS) != 0)) {
-            status = -14;
-        }
-        COMPONENT_T* audio_render = NULL;
-        create_new_audio_renderer (&audio_render, client, list);
-        TUNNEL_T tunnel[4] = {0};
-        set_tunnel (tunnel, list[0], 131, list[3], 10);
-        set_tunnel (tunnel + 1, list[3], 11, list[1], 90);
-        set_tunnel (tunnel + 2, list[2], 80, list[3], 12);
-        // setup clock tunnel first
-        if ((status == 0) && (ilclient_setup_tunnel (tunnel + 2, 0, 0) != 0)) {
-            status = -15;
-        } else {
-            ilclient_change_component_state (list[2], OMX_StateExecuting);
+        DBG_PRINTF_ERROR ("cannot recover the decoder, ending the session\n");
+        rtspsession* rtsp = ds->sk->rtsp;
+        if (rtsp != NULL) {
+            rtsp_stream_lost (rtsp);
         }
-        if (status == 0) {
-            ilclient_change_component_state (list[0], OMX_StateIdle);
+        ds->dec->close (ds->decctx);
+        ds->decctx = NULL;
+        if (ds->dec->open (&ds->decctx) != 0) {
+            /* nothing is left to show this session's streams with */
+            DBG_PRINTF_ERROR ("cannot open the decoder again\n");
+            exit (EXIT_FAILURE);
         }
-        OMX_VIDEO_PARAM_PORTFORMATTYPE format = {.nSize = sizeof (OMX_VIDEO_PARAM_PORTFORMATTYPE), .nVersion.nVersion = OMX_VERSION, .nPortIndex = 130, .eCompressionFormat = OMX_VIDEO_CodingAVC};
+        printf ("%sdecoder reopened in %lld ms\n", stats_tag(), (long long)((stats_now_us() - start) / 1000));
+    }
+    ds->first = 1;
+    ds->aupending = false;
+    refresh_hold (&ds->rs);
+    atomic_store (&ds->sk->idrneeded, 1);
+    (void)fflush (stdout);
+}
 
-        if ((status == 0) && (OMX_SetParameter (ILC_GET_HANDLE (list[0]), OMX_IndexParamVideoPortFormat, &format) == OMX_ErrorNone) && (ilclient_enable_port_buffers (list[0], 130, NULL, NULL, NULL) == 0)) {
-            OMX_BUFFERHEADERTYPE* buf = NULL;
-            int32_t port_settings_changed = 0;
-            ilclient_change_component_state (list[0], OMX_StateExecuting);
-            int32_t oldcc = 0;
-            int32_t peserror = 1;
-            int32_t first = 1;
-            rtppacket* scan = beg;
-            do {
-                int32_t non = atomic_load (&numofnode);
-                if (non < 2) {
+static int32_t video_decode_test (sink* sk)
+{
+    rtppacket* beg = sk->beg;
+    stats_session (sk->index, numsinks > 1);
+    /* the threads of the decoder inherit it */
+    threadname ("decode", sk);
+    clockid_t receiver;
+    if ((numsinks > 1) && (pthread_getcpuclockid (sk->receiver, &receiver) == 0)) {
+        /* the process time is that of all sessions */
+        stats_receiver (receiver);
+    }
+    const decoderops* dec = decoder_find (decodername);
+    void* decctx = NULL;
+    int32_t status = dec->open (&decctx);
+    if (status == 0) {
+        int32_t oldcc = 0;
+        int32_t peserror = 1;
+        decodestate ds = {.sk = sk, .dec = dec, .decctx = decctx, .first = 1, .ps.spslen = 0, .streamstart = atomic_load (&sk->sessionstart)};
+        refresh_init (&ds.rs);
+        stats_init (&ds.ls);
+        latency_init (&ds.lat, stats_now_us());
+        if (CONCEAL_LOST_SLICES != 0) {
+            ds.au = (uint8_t*)malloc (CONCEAL_BUFFER_SIZE);
+            ds.concealed = (uint8_t*)malloc (CONCEAL_BUFFER_SIZE);
+        }
+#if FRAME_EXPORT != 0
+        ds.exp = export_open (sk->index);
+#endif
+        rtppacket* scan = beg;
+        do {
+            int32_t non = atomic_load (&sk->numofnode);
+            if (non < 2) {
 		    /* need at least two nodes, so one can be consumed */
-                    usleep (1);
-                } else {
+                usleep (1);
+            } else {
 		    /* consume one node */
 		    uint8_t* buffer = scan->buf + 12u;
-                    for (int32_t i = 0; i < get_numofts(scan); i++) {
-                        if (buffer[0] == 0x47u) {
-                            int32_t ad = extract_ad(buffer);
-                            int32_t shift = extract_shift(buffer,ad);
-                            int32_t pid = extract_pid(buffer);
-                            int32_t cc = extract_cc(buffer);
-
-                            if (pid == 0x1110) {
-                                if (cc != oldcc) {
-                                    DBG_PRINTF_TRACE ("oldcc %d cc %d\n", oldcc, cc);
-                                    peserror = 1;
-                                }
-                                oldcc = 0xF & (cc + 1);
-
-                                if ((ad & 1) != 0) {
-                                    if (newpesstart (buffer, shift)) {
-                                        if (peserror == 0) {
-                                            sendtodecoder (list, tunnel, &buf, &beg, scan, &port_settings_changed, &first);
-                                        } else {
-                                            first = 1;
-                                            while (beg != scan) {
-                                                advance_packet (&beg);
-                                            }
+                bool slicestart = false;
+                if ((dec->failed != NULL) && (dec->recover != NULL) && dec->failed (ds.decctx)) {
+                    /* what the decoder did not take is lost with it */
+                    while (beg != scan) {
+                        advance_packet (&beg);
+                    }
+                    recoverdecoder (&ds);
+                    peserror = 1;
+                }
+                if (scan->newstream) {
+                    /* what is left of the old stream goes with the next PES start */
+                    restartstream (&ds);
+                    peserror = 1;
+                }
+                if (scan->networkus != INT64_MIN) {
+                    latency_network (&ds.lat, scan->networkus);
+                }
+                for (int32_t i = 0; i < get_numofts(scan); i++) {
+                    if (buffer[0] == 0x47u) {
+                        int32_t ad = extract_ad(buffer);
+                        int32_t shift = extract_shift(buffer,ad);
+                        int32_t pid = extract_pid(buffer);
+                        int32_t cc = extract_cc(buffer);
+                        int64_t pcr = extract_pcr (buffer, ad);
+                        if (pcr >= 0) {
+                            latency_pcr (&ds.lat, pcr, scan->arrival);
+                        }
+
+                        if (pid == 0x1110) {
+                            if (cc != oldcc) {
+                                DBG_PRINTF_TRACE ("oldcc %d cc %d\n", oldcc, cc);
+                                peserror = 1;
+                            }
+                            oldcc = 0xF & (cc + 1);
+
+                            if ((ad & 1) != 0) {
+                                if (newpesstart (buffer, shift)) {
+                                    /* how long the oldest data of the access unit waited */
+                                    int64_t arrival = (beg != scan) ? beg->arrival : -1;
+                                    if (peserror == 0) {
+                                        sendtodecoder (&beg, scan, &ds, false, true);
+                                    } else if ((CONCEAL_LOST_SLICES != 0) && (ds.first == 0) && (!ds.aupending)) {
+                                        sendconcealed (&beg, scan, &ds);
+                                    } else if ((PASS_CORRUPT_FRAMES != 0) && (ds.first == 0)) {
+                                        sendtodecoder (&beg, scan, &ds, true, true);
+                                    } else {
+                                        stats_frame (&ds.ls, FRAME_DROPPED);
+                                        ds.first = 1;
+                                        ds.aupending = false;
+                                        while (beg != scan) {
+                                            advance_packet (&beg);
                                         }
-                                        peserror = 0;
+                                        arrival = -1;
                                     }
+                                    if (arrival >= 0) {
+                                        latency_buffer (&ds.lat, arrival, stats_now_us());
+                                    }
+                                    peserror = 0;
+                                }
+                                if ((SLICE_FEED != 0) && (peserror == 0) && hasslicestart (buffer + shift, 188 - shift)) {
+                                    slicestart = true;
                                 }
                             }
+                        }
 			    if (pid == 0x0011) {
-                                if ((ad & 1) != 0) {
-                                    if (newpesstart (buffer, shift)) {
-                                        shift += 20;
-                                    }
-                                    if (audioplay_play_buffer (audio_render, buffer + shift, 188 - shift) < 0) {
-                                        DBG_PRINTF_ERROR ("sound error\n");
-                                    }
+                            if ((ad & 1) != 0) {
+                                if (newpesstart (buffer, shift)) {
+                                    shift += 20;
+                                }
+                                if (dec->play_audio (ds.decctx, buffer + shift, 188 - shift) < 0) {
+                                    DBG_PRINTF_ERROR ("sound error\n");
                                 }
                             }
                         }
-                        buffer += 188u;
                     }
-                    atomic_fetch_sub (&numofnode, 1);
-                    scan = scan->next;
+                    buffer += 188u;
                 }
-            } while (true);
-            if (buf != NULL) {
-                buf->nFilledLen = 0;
-                buf->nFlags = OMX_BUFFERFLAG_TIME_UNKNOWN | OMX_BUFFERFLAG_EOS;
-            }
-            if (OMX_EmptyThisBuffer (ILC_GET_HANDLE (list[0]), buf) != OMX_ErrorNone) {
-                status = -20;
+                if (dec->received != NULL) {
+                    dec->received (ds.decctx, scan->buf, scan->recvlen);
+                }
+                rtppacket* next = scan->next;
+                if ((slicestart) && (peserror == 0) && (ds.first == 0)) {
+                    /* the slice before the one starting here is complete */
+                    sendtodecoder (&beg, next, &ds, false, false);
+                }
+                atomic_fetch_sub (&sk->numofnode, 1);
+                scan = next;
             }
-            ilclient_wait_for_event (list[1], OMX_EventBufferFlag, 90, 0, OMX_BUFFERFLAG_EOS, 0, ILCLIENT_BUFFER_FLAG_EOS, -1); // wait for EOS from render
-            ilclient_flush_tunnels (tunnel, 0); // need to flush the renderer to allow video_decode to disable its input port
-        }
-        ilclient_disable_tunnel (tunnel);
-        ilclient_disable_tunnel (tunnel + 1);
-        ilclient_disable_tunnel (tunnel + 2);
-        ilclient_disable_port_buffers (list[0], 130, NULL, NULL, NULL);
-        ilclient_teardown_tunnels (tunnel);
-        ilclient_state_transition (list, OMX_StateIdle);
-        ilclient_state_transition (list, OMX_StateLoaded);
-        ilclient_cleanup_components (list);
-        OMX_Deinit();
-        ilclient_destroy (client);
+        } while (true);
+        free (ds.au);
+        free (ds.concealed);
+#if FRAME_EXPORT != 0
+        export_close (ds.exp);
+#endif
+        /* recoverdecoder may have opened another */
+        decctx = ds.decctx;
     }
+    dec->close (decctx);
     return status;
 }
 
+/* A word after the source address: "tcp" offers RTP interleaved on the
+ * RTSP connection, for sessions over a wired network; "srtp=" and 60 hex
+ * digits of master key and salt decrypt the stream */
+static void sessionword (sink* sk, const char* word);
+
+static void sessionword (sink* sk, const char* word)
+{
+    if (strcmp (word, "tcp") == 0) {
+        sk->offertcp = true;
+    } else if (strncmp (word, "srtp=", 5) == 0) {
+        sk->srtpkeyed = srtp_parse_key (word + 5, sk->srtpmaster);
+        if (!sk->srtpkeyed) {
+            (void)fprintf (stderr, "SRTP key is not 60 hex digits\n");
+        }
+    } else {
+        (void)fprintf (stderr, "unknown session option %s\n", word);
+    }
+}
+
+/* What rtsp_open and rtsp_reconnect are given: the sink's feed if TCP is to
+ * be offered and can be */
+INLINE const rtspframes* tcpoffer (sink* sk);
+INLINE const rtspframes* tcpoffer (sink* sk)
+{
+    return ((sk->offertcp) && (sk->tcpin.wakefd >= 0)) ? &sk->tcpframes : NULL;
+}
+
+/* Sets up session index up to its threads, the source is left as it is */
+static void sink_init (sink* sk, int32_t index);
+
+static void sink_init (sink* sk, int32_t index)
+{
+    sk->index = index;
+    sk->port = (uint16_t)(SINK_RTP_PORT + (index * SINK_PORT_STEP));
+    sk->beg = allocate_new_packet();
+    atomic_store (&sk->numofnode, 0);
+    atomic_store (&sk->intrarefresh, 0);
+    atomic_store (&sk->newsession, 0);
+    atomic_store (&sk->idrneeded, 0);
+    atomic_store (&sk->idrat, 0);
+    atomic_store (&sk->sessionstart, stats_now_us());
+    sk->rtsp = NULL;
+    sk->tcpin.next = NULL;
+    sk->tcpin.wakefd = eventfd (0, EFD_NONBLOCK);
+    sk->tcpin.dropped = 0;
+    atomic_store (&sk->tcpin.head, 0);
+    atomic_store (&sk->tcpin.tail, 0);
+    sk->tcpframes = (rtspframes){.ctx = &sk->tcpin, .buffer = tcp_buffer, .frame = tcp_frame};
+    sk->srtpkeyed = false;
+    atomic_store (&sk->srtpgen, 0);
+    sk->offertcp = false;
+    sk->result = 0;
+}
+
+/* Runs the session a sink was opened for, on a thread of its own when
+ * there are several */
+static void* runsink (void* arg);
+
+static void* runsink (void* arg)
+{
+    sink* sk = (sink*)arg;
+    threadname ("rtsp", sk);
+    sk->result = rtsp_run (sk->rtsp);
+    return NULL;
+}
+
+/* Runs the sessions main hands a service slot one after another, until
+ * there are no more */
+static void* runslot (void* arg);
+
+static void* runslot (void* arg)
+{
+    sink* sk = (sink*)arg;
+    threadname ("rtsp", sk);
+    (void)pthread_mutex_lock (&slotlock);
+    while ((!slotsquit) || (sk->source[0] != '\0')) {
+        if (sk->source[0] == '\0') {
+            (void)pthread_cond_wait (&slotchange, &slotlock);
+        } else {
+            char source[sizeof (sk->source)];
+            (void)memcpy (source, sk->source, sizeof (source));
+            (void)pthread_mutex_unlock (&slotlock);
+            atomic_fetch_add (&sk->srtpgen, 1);
+            bool connecting;
+            atomic_store (&sk->sessionstart, stats_now_us());
+            atomic_store (&sk->newsession, 1);
+            if (sk->rtsp == NULL) {
+                sk->rtsp = rtsp_open (source, RTSP_PORT, sk->port, tcpoffer (sk));
+                connecting = (sk->rtsp != NULL);
+            } else {
+                connecting = (rtsp_reconnect (sk->rtsp, source, RTSP_PORT, tcpoffer (sk)) == 0);
+            }
+            int32_t result = connecting ? rtsp_run (sk->rtsp) : -1;
+            (void)pthread_mutex_lock (&slotlock);
+            /* before the slot is free, so that no next session ends first */
+            printf ("session ended %d %s %d\n", result, source, (int)(sk - sinks));
+            (void)fflush (stdout);
+            sk->source[0] = '\0';
+            (void)pthread_cond_broadcast (&slotchange);
+        }
+    }
+    (void)pthread_mutex_unlock (&slotlock);
+    return NULL;
+}
+
 int main (int argc, char** argv)
 {
+    (void)stats_interval();
     if (argc > 1) {
         idrsockport = atoi (argv[1]);
         DBG_PRINTF_DEBUG ("idrport:%d\n", idrsockport);
@@ -507,26 +1474,143 @@ int main (int argc, char** argv)
         sinkip = argv[3];
         DBG_PRINTF_DEBUG ("sinkip:%s\n", sinkip);
     }
-    atomic_store (&numofnode, 0);
-    pthread_t npthread;
-    pthread_t dthread;
-    rtppacket* beg = allocate_new_packet();
-    
-    bcm_host_init();
+    if ((argc > 4) && (argv[4][0] != '\0')) {
+        decodername = argv[4];
+        DBG_PRINTF_DEBUG ("decoder:%s\n", decodername);
+    }
+    bool negotiate = false;
+    if ((argc > 5) && (argv[5][0] == '-')) {
+        /* "-" for one service slot, "-2" for two sessions at a time and so on */
+        service = true;
+        numsinks = (argv[5][1] != '\0') ? atoi (argv[5] + 1) : 1;
+    } else if (argc > 5) {
+        /* one session per address, separated by commas */
+        char* save = NULL;
+        negotiate = true;
+        numsinks = 0;
+        for (char* ip = strtok_r (argv[5], ",", &save); ip != NULL; ip = strtok_r (NULL, ",", &save)) {
+            if (numsinks < SINK_MAX_SESSIONS) {
+                (void)snprintf (sinks[numsinks].source, sizeof (sinks[numsinks].source), "%s", ip);
+                DBG_PRINTF_DEBUG ("sourceip:%s\n", ip);
+            }
+            numsinks++;
+        }
+    } else {
+        /* empty */
+    }
+
     int retval = 0;
-    if (pthread_create (&npthread, NULL, addnullpacket, beg) != 0) {
+    if ((numsinks < 1) || (numsinks > SINK_MAX_SESSIONS)) {
+        (void)fprintf (stderr, "between 1 and %d sessions at a time\n", SINK_MAX_SESSIONS);
         retval = 1;
     }
-    if ((retval == 0) && (pthread_create (&dthread, NULL, video_decode_test, beg) != 0)) {
+    if (decoder_find (decodername) == NULL) {
+        DBG_PRINTF_ERROR ("unknown decoder %s\n", decodername);
         retval = 1;
     }
-    if ((retval == 0) && (pthread_join (npthread, NULL) != 0)) {
-        retval = 1;
+    for (int32_t i = 0; (retval == 0) && (i < numsinks); i++) {
+        sink* sk = &sinks[i];
+        sink_init (sk, i);
+        /* the words after the addresses are for all of them */
+        for (int32_t j = 6; (i == 0) && (j < argc); j++) {
+            sessionword (sk, argv[j]);
+        }
+        if (i > 0) {
+            sk->offertcp = sinks[0].offertcp;
+            sk->srtpkeyed = sinks[0].srtpkeyed;
+            (void)memcpy (sk->srtpmaster, sinks[0].srtpmaster, sizeof (sk->srtpmaster));
+        }
+        if (negotiate) {
+            sk->rtsp = rtsp_open (sk->source, RTSP_PORT, sk->port, tcpoffer (sk));
+            retval = (sk->rtsp == NULL) ? 1 : 0;
+        }
+        if ((retval == 0) && (pthread_create (&sk->receiver, NULL, addnullpacket, sk) != 0)) {
+            retval = 1;
+        }
+        if ((retval == 0) && (pthread_create (&sk->decoder, NULL, video_decode_test, sk) != 0)) {
+            retval = 1;
+        }
+        if ((retval == 0) && (service) && (pthread_create (&sk->runner, NULL, runslot, sk) != 0)) {
+            retval = 1;
+        }
     }
-    if ((retval == 0) && (pthread_join (dthread, NULL) != 0)) {
-        retval = 1;
+    if ((retval == 0) && (service)) {
+        /* one source address per line, the words after it as on the command
+         * line. It goes to the first free slot, once there is one; the
+         * receivers and the decoders stay set up in between and only start
+         * over on the next stream */
+        char line[192];
+        while (fgets (line, sizeof (line), stdin) != NULL) {
+            size_t end = strcspn (line, " \r\n");
+            char* words = line + end + ((line[end] == ' ') ? 1 : 0);
+            line[end] = '\0';
+            if (line[0] != '\0') {
+                sink* sk = NULL;
+                (void)pthread_mutex_lock (&slotlock);
+                while (sk == NULL) {
+                    for (int32_t i = 0; (sk == NULL) && (i < numsinks); i++) {
+                        if (sinks[i].source[0] == '\0') {
+                            sk = &sinks[i];
+                        }
+                    }
+                    if (sk == NULL) {
+                        (void)pthread_cond_wait (&slotchange, &slotlock);
+                    }
+                }
+                char* save = NULL;
+                sk->offertcp = false;
+                sk->srtpkeyed = false;
+                for (char* w = strtok_r (words, " \r\n", &save); w != NULL; w = strtok_r (NULL, " \r\n", &save)) {
+                    sessionword (sk, w);
+                }
+                (void)snprintf (sk->source, sizeof (sk->source), "%.*s", SINK_SOURCE_SIZE - 1, line);
+                /* in the order of the lines, and after the session ended
+                 * that was in the slot before */
+                printf ("session started %s %d\n", sk->source, (int)(sk - sinks));
+                (void)fflush (stdout);
+                (void)pthread_cond_broadcast (&slotchange);
+                (void)pthread_mutex_unlock (&slotlock);
+            }
+        }
+        /* the sessions still running end on their own */
+        (void)pthread_mutex_lock (&slotlock);
+        slotsquit = true;
+        (void)pthread_cond_broadcast (&slotchange);
+        (void)pthread_mutex_unlock (&slotlock);
+        for (int32_t i = 0; i < numsinks; i++) {
+            (void)pthread_join (sinks[i].runner, NULL);
+        }
+    } else if ((retval == 0) && (negotiate)) {
+        /* the receivers and the decoders got ready while negotiating, they
+         * end with the process when the sessions do */
+        if (numsinks == 1) {
+            (void)runsink (&sinks[0]);
+        } else {
+            bool running[SINK_MAX_SESSIONS];
+            for (int32_t i = 0; i < numsinks; i++) {
+                running[i] = (pthread_create (&sinks[i].runner, NULL, runsink, &sinks[i]) == 0);
+                if (!running[i]) {
+                    sinks[i].result = -1;
+                }
+            }
+            for (int32_t i = 0; i < numsinks; i++) {
+                if (running[i]) {
+                    (void)pthread_join (sinks[i].runner, NULL);
+                }
+            }
+        }
+        for (int32_t i = 0; i < numsinks; i++) {
+            if (sinks[i].result != 0) {
+                retval = 1;
+            }
+        }
+    } else {
+        if ((retval == 0) && (pthread_join (sinks[0].receiver, NULL) != 0)) {
+            retval = 1;
+        }
+        if ((retval == 0) && (pthread_join (sinks[0].decoder, NULL) != 0)) {
+            retval = 1;
+        }
     }
     return retval;
 }
-
-
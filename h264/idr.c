@@ -0,0 +1,121 @@
+/* IDR request controller of h264.bin and player.bin */
+
+#include <stdio.h>
+
+#include "idr.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#define INLINE static inline
+
+INLINE void report (idrcontrol* ic, int64_t now);
+INLINE void report (idrcontrol* ic, int64_t now)
+{
+    if (stats_due (ic->lastreport, now)) {
+        (void)printf ("%sidr losses %d requests %d merged %d limited %d timeouts %d, idrs %d answered %d, rtt %lld ms min %lld max %lld\n",
+                      stats_tag(), ic->losses, ic->sent, ic->merged, ic->limited, ic->timeouts, ic->idrs, ic->answered,
+                      (long long)(ic->srttus / 1000), (long long)(ic->minrttus / 1000), (long long)(ic->maxrttus / 1000));
+        ic->lastreport = now;
+    }
+}
+
+/* The first wait for a request, twice the round trip once that is known */
+INLINE int64_t basewait (const idrcontrol* ic);
+INLINE int64_t basewait (const idrcontrol* ic)
+{
+    int64_t us = (ic->srttus > 0) ? (2 * ic->srttus) : ((int64_t)IDR_TIMEOUT_MS * 1000);
+    if (us > ((int64_t)IDR_MAX_BACKOFF_MS * 1000)) {
+        us = (int64_t)IDR_MAX_BACKOFF_MS * 1000;
+    }
+    return us;
+}
+
+void idr_init (idrcontrol* ic, int64_t now)
+{
+    ic->pending = false;
+    ic->urgent = false;
+    ic->sentat = -1;
+    ic->waitus = 0;
+    ic->lastidr = -1;
+    ic->srttus = 0;
+    ic->minrttus = 0;
+    ic->maxrttus = 0;
+    ic->losses = 0;
+    ic->sent = 0;
+    ic->merged = 0;
+    ic->limited = 0;
+    ic->timeouts = 0;
+    ic->answered = 0;
+    ic->idrs = 0;
+    ic->lastreport = now;
+}
+
+bool idr_poll (idrcontrol* ic, int64_t now)
+{
+    bool send = false;
+    if (!ic->pending) {
+        /* empty */
+    } else if ((ic->sentat >= 0) && ((now - ic->sentat) < ic->waitus)) {
+        /* the IDR asked for is on its way */
+    } else if (ic->sentat >= 0) {
+        /* lost itself or ignored by the source */
+        ic->timeouts++;
+        ic->waitus *= 2;
+        if (ic->waitus > ((int64_t)IDR_MAX_BACKOFF_MS * 1000)) {
+            ic->waitus = (int64_t)IDR_MAX_BACKOFF_MS * 1000;
+        }
+        send = true;
+    } else if ((!ic->urgent) && (ic->lastidr >= 0) && ((now - ic->lastidr) < ((int64_t)IDR_MIN_INTERVAL_MS * 1000))) {
+        /* asked again once the spike of the last one has passed */
+    } else {
+        ic->waitus = basewait (ic);
+        send = true;
+    }
+    if (send) {
+        DBG_PRINTF_TRACE ("idr request, wait %lld ms\n", (long long)(ic->waitus / 1000));
+        ic->sentat = now;
+        ic->sent++;
+    }
+    report (ic, now);
+    return send;
+}
+
+bool idr_loss (idrcontrol* ic, int64_t now, bool urgent)
+{
+    ic->losses++;
+    ic->pending = true;
+    ic->urgent = ic->urgent || urgent;
+    bool send = idr_poll (ic, now);
+    if ((!send) && (ic->sentat >= 0)) {
+        /* the IDR asked for heals this loss as well */
+        ic->merged++;
+    } else if (!send) {
+        ic->limited++;
+    } else {
+        /* empty */
+    }
+    return send;
+}
+
+void idr_received (idrcontrol* ic, int64_t now)
+{
+    ic->idrs++;
+    if (ic->sentat >= 0) {
+        int64_t rtt = now - ic->sentat;
+        ic->srttus = (ic->srttus == 0) ? rtt : (((7 * ic->srttus) + rtt) / 8);
+        if ((ic->answered == 0) || (rtt < ic->minrttus)) {
+            ic->minrttus = rtt;
+        }
+        if (rtt > ic->maxrttus) {
+            ic->maxrttus = rtt;
+        }
+        ic->answered++;
+        ic->sentat = -1;
+    }
+    ic->pending = false;
+    ic->urgent = false;
+    ic->lastidr = now;
+    report (ic, now);
+}
@@ -0,0 +1,62 @@
+/* IDR request controller of h264.bin and player.bin */
+
+#ifndef IDR_H
+#define IDR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef IDR_TIMEOUT_MS
+/**
+ * Wait for the IDR before asking again while the round trip is not measured,
+ * twice the round trip after
+ */
+#define IDR_TIMEOUT_MS (500)
+#endif /* IDR_TIMEOUT_MS */
+
+#ifndef IDR_MAX_BACKOFF_MS
+/**
+ * Longest wait for the IDR, the wait doubles with each unanswered request
+ */
+#define IDR_MAX_BACKOFF_MS (4000)
+#endif /* IDR_MAX_BACKOFF_MS */
+
+#ifndef IDR_MIN_INTERVAL_MS
+/**
+ * Losses this soon after an IDR arrived are likely caused by its bitrate
+ * spike; asking again right away would only cause the next one
+ */
+#define IDR_MIN_INTERVAL_MS (500)
+#endif /* IDR_MIN_INTERVAL_MS */
+
+typedef struct sidrcontrol {
+    bool pending;        /* a loss no IDR has healed yet */
+    bool urgent;
+    int64_t sentat;      /* the request being waited for, -1 if none */
+    int64_t waitus;      /* how long to wait for it */
+    int64_t lastidr;     /* when the last IDR arrived, -1 if none did */
+    int64_t srttus;      /* smoothed request to IDR time, 0 until measured */
+    int64_t minrttus;
+    int64_t maxrttus;
+    int32_t losses;      /* unrecoverable losses reported */
+    int32_t sent;
+    int32_t merged;      /* losses covered by a request in flight */
+    int32_t limited;     /* losses held back after an IDR */
+    int32_t timeouts;    /* requests asked again */
+    int32_t answered;    /* IDRs that arrived with a request in flight */
+    int32_t idrs;
+    int64_t lastreport;
+} idrcontrol;
+
+void idr_init (idrcontrol* ic, int64_t now);
+/* Reports a loss the stream does not recover from by itself. Returns true if
+ * an IDR request is to be sent now. urgent skips IDR_MIN_INTERVAL_MS, for a
+ * decoder that shows nothing until the IDR. */
+bool idr_loss (idrcontrol* ic, int64_t now, bool urgent);
+/* Returns true if a loss that was held back or a request that went
+ * unanswered needs a request now. To be called regularly. */
+bool idr_poll (idrcontrol* ic, int64_t now);
+/* Reports an IDR that reached the decoder, asked for or not. */
+void idr_received (idrcontrol* ic, int64_t now);
+
+#endif /* IDR_H */
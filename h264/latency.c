@@ -0,0 +1,168 @@
+/* Latency estimate of h264.bin */
+
+#include <stdio.h>
+
+#include "latency.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+/* A PCR further off than this from where the last one and the time since
+ * put it is a new time base */
+#define LATENCY_PCR_JUMP_US 1000000
+
+#define INLINE static inline
+
+/* x += (sample - x) / 16, as RFC 3550 smooths the jitter */
+INLINE int64_t smooth (int64_t x, int64_t sample);
+INLINE int64_t smooth (int64_t x, int64_t sample)
+{
+    return x + ((sample - x) / 16);
+}
+
+INLINE double ms (int64_t us);
+INLINE double ms (int64_t us)
+{
+    return (double)us / 1000.0;
+}
+
+/* The end-to-end delay in ms that share of the access units stayed below */
+INLINE int32_t percentile (const latency* l, int32_t percent);
+INLINE int32_t percentile (const latency* l, int32_t percent)
+{
+    int32_t n = (int32_t)(((int64_t)l->buffercount * percent) / 100);
+    int32_t i = 0;
+    for (int32_t seen = l->histogram[0]; (seen <= n) && (i < (LATENCY_HISTOGRAM_MS - 1)); seen += l->histogram[i]) {
+        i++;
+    }
+    return i + 1;
+}
+
+INLINE double mean (int64_t sum, int32_t count);
+INLINE double mean (int64_t sum, int32_t count)
+{
+    return (count > 0) ? ((double)sum / (double)count / 1000.0) : 0.0;
+}
+
+INLINE void report (latency* l, int64_t now);
+INLINE void report (latency* l, int64_t now)
+{
+    if (stats_due (l->lastreport, now)) {
+        if (l->networkcount > 0) {
+            (void)printf ("%slatency network %.1f ms, queuing %.1f ms max %.1f, buffer %.1f ms max %.1f, end to end %.1f ms, p50 %d p95 %d p99 %d ms\n",
+                          stats_tag(), ms (l->networkus), ms (l->queueus), ms (l->queuemax), ms (l->bufferus), ms (l->buffermax),
+                          ms (l->networkus + l->bufferus), percentile (l, 50), percentile (l, 95), percentile (l, 99));
+        } else {
+            /* without sender reports only the part above the best case is known */
+            (void)printf ("%slatency network unknown, queuing %.1f ms max %.1f, buffer %.1f ms max %.1f, end to end %.1f ms above the lowest, p50 %d p95 %d p99 %d ms\n",
+                          stats_tag(), ms (l->queueus), ms (l->queuemax), ms (l->bufferus), ms (l->buffermax), ms (l->queueus + l->bufferus),
+                          percentile (l, 50), percentile (l, 95), percentile (l, 99));
+        }
+        l->lastreport = now;
+    }
+}
+
+void latency_init (latency* l, int64_t now)
+{
+    l->networkus = INT64_MIN;
+    l->networksum = 0;
+    l->networkcount = 0;
+    l->queueus = 0;
+    l->queuemax = 0;
+    l->queuesum = 0;
+    l->queuecount = 0;
+    l->minoffset = INT64_MAX;
+    l->prevminoffset = INT64_MAX;
+    l->windowstart = now;
+    l->lastpcr = -1;
+    l->lastarrival = 0;
+    l->bufferus = 0;
+    l->buffermax = 0;
+    l->buffersum = 0;
+    l->buffercount = 0;
+    for (int32_t i = 0; i < LATENCY_HISTOGRAM_MS; i++) {
+        l->histogram[i] = 0;
+    }
+    l->lastreport = now;
+}
+
+void latency_network (latency* l, int64_t networkus)
+{
+    l->networkus = (l->networkcount == 0) ? networkus : smooth (l->networkus, networkus);
+    l->networksum += networkus;
+    l->networkcount++;
+}
+
+void latency_pcr (latency* l, int64_t pcrus, int64_t arrival)
+{
+    int64_t offset = arrival - pcrus;
+    if (l->lastpcr >= 0) {
+        int64_t off = (pcrus - l->lastpcr) - (arrival - l->lastarrival);
+        if ((off > LATENCY_PCR_JUMP_US) || (off < -LATENCY_PCR_JUMP_US)) {
+            /* PCR discontinuity or wrap, the old minimum means nothing now */
+            DBG_PRINTF_DEBUG ("PCR jumped by %lld us\n", (long long)off);
+            l->minoffset = INT64_MAX;
+            l->prevminoffset = INT64_MAX;
+            l->windowstart = arrival;
+        }
+    }
+    l->lastpcr = pcrus;
+    l->lastarrival = arrival;
+    if ((arrival - l->windowstart) >= ((int64_t)LATENCY_WINDOW_MS * 1000)) {
+        l->prevminoffset = l->minoffset;
+        l->minoffset = INT64_MAX;
+        l->windowstart = arrival;
+    }
+    if (offset < l->minoffset) {
+        l->minoffset = offset;
+    }
+    int64_t base = (l->prevminoffset < l->minoffset) ? l->prevminoffset : l->minoffset;
+    int64_t queue = offset - base;
+    l->queueus = smooth (l->queueus, queue);
+    if (queue > l->queuemax) {
+        l->queuemax = queue;
+    }
+    l->queuesum += queue;
+    l->queuecount++;
+}
+
+void latency_buffer (latency* l, int64_t arrival, int64_t now)
+{
+    int64_t us = now - arrival;
+    l->bufferus = (l->buffercount == 0) ? us : smooth (l->bufferus, us);
+    if (us > l->buffermax) {
+        l->buffermax = us;
+    }
+    l->buffersum += us;
+    l->buffercount++;
+    /* end to end as the reports have it, above the lowest without the network delay */
+    int64_t e2e = (us + ((l->networkcount > 0) ? l->networkus : l->queueus)) / 1000;
+    if (e2e < 0) {
+        /* the clocks of source and sink are off */
+        e2e = 0;
+    } else if (e2e > (LATENCY_HISTOGRAM_MS - 1)) {
+        e2e = LATENCY_HISTOGRAM_MS - 1;
+    } else {
+        /* empty */
+    }
+    l->histogram[e2e]++;
+    report (l, now);
+}
+
+void latency_end (const latency* l)
+{
+    if ((stats_interval() > 0) && (l->buffercount > 0)) {
+        if (l->networkcount > 0) {
+            (void)printf ("%ssession latency network %.1f ms, queuing %.1f ms max %.1f, buffer %.1f ms max %.1f, end to end %.1f ms, p50 %d p95 %d p99 %d ms\n",
+                          stats_tag(), mean (l->networksum, l->networkcount), mean (l->queuesum, l->queuecount), ms (l->queuemax),
+                          mean (l->buffersum, l->buffercount), ms (l->buffermax),
+                          mean (l->networksum, l->networkcount) + mean (l->buffersum, l->buffercount),
+                          percentile (l, 50), percentile (l, 95), percentile (l, 99));
+        } else {
+            (void)printf ("%ssession latency network unknown, queuing %.1f ms max %.1f, buffer %.1f ms max %.1f, p50 %d p95 %d p99 %d ms above the lowest\n",
+                          stats_tag(), mean (l->queuesum, l->queuecount), ms (l->queuemax), mean (l->buffersum, l->buffercount), ms (l->buffermax),
+                          percentile (l, 50), percentile (l, 95), percentile (l, 99));
+        }
+    }
+}
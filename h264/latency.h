@@ -0,0 +1,57 @@
+/* Latency estimate of h264.bin */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef LATENCY_WINDOW_MS
+/**
+ * The queuing delay is the PCR delay above the lowest one of the last one to
+ * two windows, so that the drift of the source clock does not add up
+ */
+#define LATENCY_WINDOW_MS (5000)
+#endif /* LATENCY_WINDOW_MS */
+
+/* End-to-end delays of the access units are counted in 1 ms steps up to
+ * this, for the percentiles; the last step takes all longer ones */
+#define LATENCY_HISTOGRAM_MS 1000
+
+/* Delays of one session in microseconds. network is the one-way delay from
+ * the RTCP sender reports, which needs source and sink clocks in sync;
+ * queuing is how much later than at best the PCR arrived, the part of the
+ * network delay that varies; buffer is how long the sink held the data
+ * before the decoder took it. */
+typedef struct slatency {
+    int64_t networkus;    /* smoothed, INT64_MIN before the first estimate */
+    int64_t networksum;
+    int32_t networkcount;
+    int64_t queueus;      /* smoothed */
+    int64_t queuemax;
+    int64_t queuesum;
+    int32_t queuecount;
+    int64_t minoffset;    /* lowest arrival minus PCR in this window */
+    int64_t prevminoffset; /* and in the last one */
+    int64_t windowstart;
+    int64_t lastpcr;      /* -1 before the first */
+    int64_t lastarrival;
+    int64_t bufferus;     /* smoothed */
+    int64_t buffermax;
+    int64_t buffersum;
+    int32_t buffercount;
+    int32_t histogram[LATENCY_HISTOGRAM_MS]; /* of the session so far */
+    int64_t lastreport;
+} latency;
+
+void latency_init (latency* l, int64_t now);
+/* A packet the source sent networkus before it arrived. */
+void latency_network (latency* l, int64_t networkus);
+/* A PCR in microseconds that arrived at stats_now_us arrival. */
+void latency_pcr (latency* l, int64_t pcrus, int64_t arrival);
+/* Data that arrived at arrival went to the decoder at now. */
+void latency_buffer (latency* l, int64_t arrival, int64_t now);
+/* Prints the means of the session that ended. */
+void latency_end (const latency* l);
+
+#endif /* LATENCY_H */
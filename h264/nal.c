@@ -0,0 +1,380 @@
+/* H.264 NAL unit helpers used by the demux stage of h264.bin */
+
+#include <string.h>
+
+#include "nal.h"
+
+static int32_t find_start_code (const uint8_t* data, int32_t len, int32_t pos);
+static int32_t find_start_code (const uint8_t* data, int32_t len, int32_t pos)
+{
+    int32_t ret = -1;
+    for (int32_t i = pos; (i + 2) < len; i++) {
+        if (data[i + 2] > 1u) {
+            i += 2;
+        } else if ((data[i] == 0u) && (data[i + 1] == 0u) && (data[i + 2] == 1u)) {
+            ret = i;
+            break;
+        } else {
+            /* empty */
+        }
+    }
+    return ret;
+}
+
+int32_t nal_next (const uint8_t* data, int32_t len, int32_t pos, nalunit* nal)
+{
+    int32_t ret = -1;
+    int32_t start = find_start_code (data, len, pos);
+    if ((start >= 0) && ((start + 3) < len)) {
+        int32_t begin = start + 3;
+        int32_t end = find_start_code (data, len, begin);
+        nal->complete = (end >= 0);
+        if (end < 0) {
+            end = len;
+            ret = len;
+        } else {
+            ret = end;
+        }
+        /* trailing_zero_8bits and the leading zero of a 4-byte start code */
+        while ((end > begin) && (data[end - 1] == 0u)) {
+            end--;
+        }
+        nal->data = data + begin;
+        nal->len = end - begin;
+        nal->type = data[begin] & 0x1Fu;
+    }
+    return ret;
+}
+
+void paramsets_update (paramsets* ps, const uint8_t* data, int32_t len)
+{
+    nalunit nal;
+    int32_t pos = 0;
+    while ((pos = nal_next (data, len, pos, &nal)) >= 0) {
+        if ((nal.complete) && (nal.len > 1) && (nal.len <= PARAMSET_MAX_SIZE)) {
+            if (nal.type == NAL_TYPE_SPS) {
+                (void)memcpy (ps->sps, nal.data, nal.len);
+                ps->spslen = nal.len;
+            } else if (nal.type == NAL_TYPE_PPS) {
+                (void)memcpy (ps->pps, nal.data, nal.len);
+                ps->ppslen = nal.len;
+            } else if ((nal.type == NAL_TYPE_SLICE) || (nal.type == NAL_TYPE_IDR)) {
+                /* parameter sets always precede the first slice */
+                break;
+            } else {
+                /* empty */
+            }
+        }
+    }
+}
+
+bool paramsets_valid (const paramsets* ps)
+{
+    return (ps->spslen > 0) && (ps->ppslen > 0);
+}
+
+int32_t paramsets_write (const paramsets* ps, uint8_t* dest, int32_t maxlen)
+{
+    const uint8_t startcode[4] = { 0x00, 0x00, 0x00, 0x01 };
+    int32_t len = 0;
+    if (paramsets_valid (ps) && ((ps->spslen + ps->ppslen + 8) <= maxlen)) {
+        (void)memcpy (dest, startcode, 4);
+        (void)memcpy (dest + 4, ps->sps, ps->spslen);
+        len = ps->spslen + 4;
+        (void)memcpy (dest + len, startcode, 4);
+        (void)memcpy (dest + len + 4, ps->pps, ps->ppslen);
+        len += ps->ppslen + 4;
+    }
+    return len;
+}
+
+int32_t nal_strip_filler (uint8_t* data, int32_t len, bool* infiller)
+{
+    int32_t out = 0;
+    int32_t pos = 0;
+    if (*infiller) {
+        /* ff_byte run and rbsp_trailing_bits of the filler the last call cut */
+        while ((pos < len) && (data[pos] == 0xFFu)) {
+            pos++;
+        }
+        if ((pos < len) && (data[pos] == 0x80u)) {
+            pos++;
+        }
+        *infiller = false;
+    }
+    int32_t next = find_start_code (data, len, pos);
+    next = (next < 0) ? len : next;
+    (void)memmove (data, data + pos, next - pos);
+    out = next - pos;
+    pos = next;
+    nalunit nal;
+    while ((next = nal_next (data, len, pos, &nal)) >= 0) {
+        int32_t keep = next - pos;
+        int32_t from = pos;
+        if (nal.type == NAL_TYPE_FILLER) {
+            /* the zeros after it may begin the next start code */
+            from = (int32_t)(nal.data - data) + nal.len;
+            keep = next - from;
+            *infiller = !nal.complete;
+        }
+        (void)memmove (data + out, data + from, keep);
+        out += keep;
+        pos = next;
+    }
+    (void)memmove (data + out, data + pos, len - pos);
+    return out + len - pos;
+}
+
+int32_t nal_unescape (const uint8_t* src, int32_t len, uint8_t* dst, int32_t maxlen)
+{
+    int32_t zeros = 0;
+    int32_t n = 0;
+    for (int32_t i = 0; (i < len) && (n < maxlen); i++) {
+        if ((zeros >= 2) && (src[i] == 3u)) {
+            /* emulation_prevention_three_byte */
+            zeros = 0;
+        } else {
+            dst[n] = src[i];
+            n++;
+            zeros = (src[i] == 0u) ? (zeros + 1) : 0;
+        }
+    }
+    return n;
+}
+
+void br_init (bitreader* br, const uint8_t* data, int32_t len)
+{
+    br->data = data;
+    br->len = len;
+    br->bitpos = 0;
+    br->overrun = false;
+}
+
+uint32_t br_read (bitreader* br, int32_t bits)
+{
+    uint32_t val = 0;
+    for (int32_t i = 0; i < bits; i++) {
+        int32_t byte = br->bitpos >> 3;
+        uint32_t bit = 0;
+        if (byte < br->len) {
+            bit = 1u & (br->data[byte] >> (7 - (br->bitpos & 7)));
+        } else {
+            br->overrun = true;
+        }
+        val = (val << 1) | bit;
+        br->bitpos++;
+    }
+    return val;
+}
+
+uint32_t br_read_ue (bitreader* br)
+{
+    int32_t zeros = 0;
+    while ((br_read (br, 1) == 0u) && (zeros < 32) && (!br->overrun)) {
+        zeros++;
+    }
+    uint32_t val = 0;
+    if (zeros < 32) {
+        val = ((1u << zeros) - 1u) + br_read (br, zeros);
+    } else {
+        br->overrun = true;
+    }
+    return val;
+}
+
+int32_t br_read_se (bitreader* br)
+{
+    uint32_t code = br_read_ue (br);
+    int32_t val = (int32_t)((code + 1u) >> 1);
+    return ((code & 1u) != 0u) ? val : -val;
+}
+
+int32_t nal_escape (const uint8_t* src, int32_t len, uint8_t* dst, int32_t maxlen)
+{
+    int32_t zeros = 0;
+    int32_t n = 0;
+    for (int32_t i = 0; (i < len) && (n >= 0); i++) {
+        if ((zeros >= 2) && (src[i] <= 3u)) {
+            if (n < maxlen) {
+                dst[n] = 3u;
+                n++;
+            } else {
+                n = -1;
+            }
+            zeros = 0;
+        }
+        if ((n >= 0) && (n < maxlen)) {
+            dst[n] = src[i];
+            n++;
+            zeros = (src[i] == 0u) ? (zeros + 1) : 0;
+        } else {
+            n = -1;
+        }
+    }
+    return n;
+}
+
+void bw_init (bitwriter* bw, uint8_t* data, int32_t maxlen)
+{
+    bw->data = data;
+    bw->maxlen = maxlen;
+    bw->bitpos = 0;
+    bw->overrun = false;
+}
+
+void bw_write (bitwriter* bw, uint32_t val, int32_t bits)
+{
+    for (int32_t i = bits - 1; i >= 0; i--) {
+        int32_t byte = bw->bitpos >> 3;
+        if (byte < bw->maxlen) {
+            uint8_t mask = (uint8_t)(0x80u >> (bw->bitpos & 7));
+            if ((bw->bitpos & 7) == 0) {
+                bw->data[byte] = 0;
+            }
+            if (((val >> i) & 1u) != 0u) {
+                bw->data[byte] |= mask;
+            }
+        } else {
+            bw->overrun = true;
+        }
+        bw->bitpos++;
+    }
+}
+
+void bw_write_ue (bitwriter* bw, uint32_t val)
+{
+    uint32_t code = val + 1u;
+    int32_t bits = 0;
+    while ((code >> bits) > 1u) {
+        bits++;
+    }
+    bw_write (bw, 0, bits);
+    bw_write (bw, code, bits + 1);
+}
+
+void bw_write_se (bitwriter* bw, int32_t val)
+{
+    bw_write_ue (bw, (val > 0) ? (uint32_t)((2 * val) - 1) : (uint32_t)(-2 * val));
+}
+
+void bw_copy (bitwriter* bw, const bitreader* br, int32_t from, int32_t to)
+{
+    bitreader copy = *br;
+    copy.bitpos = from;
+    while (copy.bitpos < to) {
+        int32_t bits = ((to - copy.bitpos) > 24) ? 24 : (to - copy.bitpos);
+        bw_write (bw, br_read (&copy, bits), bits);
+    }
+}
+
+int32_t bw_finish (bitwriter* bw)
+{
+    bw_write (bw, 1, 1);
+    while ((bw->bitpos & 7) != 0) {
+        bw_write (bw, 0, 1);
+    }
+    return bw->bitpos >> 3;
+}
+
+int32_t sei_recovery_frames (const nalunit* nal)
+{
+    uint8_t rbsp[256];
+    int32_t len = nal_unescape (nal->data + 1, nal->len - 1, rbsp, (int32_t)sizeof (rbsp));
+    int32_t pos = 0;
+    int32_t ret = -1;
+    /* sei_message() loop, stops at rbsp_trailing_bits */
+    while ((ret < 0) && ((pos + 2) <= len) && (rbsp[pos] != 0x80u)) {
+        int32_t type = 0;
+        int32_t size = 0;
+        while ((pos < len) && (rbsp[pos] == 0xFFu)) {
+            type += 255;
+            pos++;
+        }
+        type += (pos < len) ? rbsp[pos] : 0;
+        pos++;
+        while ((pos < len) && (rbsp[pos] == 0xFFu)) {
+            size += 255;
+            pos++;
+        }
+        size += (pos < len) ? rbsp[pos] : 0;
+        pos++;
+        if ((type == SEI_RECOVERY_POINT) && (pos < len)) {
+            bitreader br;
+            br_init (&br, rbsp + pos, len - pos);
+            uint32_t frames = br_read_ue (&br);
+            if ((!br.overrun) && (frames < 256u)) {
+                ret = (int32_t)frames;
+            }
+        }
+        pos += size;
+    }
+    return ret;
+}
+
+/* Refresh cycles longer than this heal slower than an IDR round trip */
+#define REFRESH_MAX_PERIOD 120
+
+void refresh_init (refreshstate* rs)
+{
+    rs->frames = 0;
+    rs->lastpoint = -1;
+    rs->period = 0;
+    rs->cleanat = -1;
+    rs->hold = false;
+}
+
+int32_t refresh_update (refreshstate* rs, const uint8_t* data, int32_t len)
+{
+    int32_t ret = AU_NORMAL;
+    int32_t recovery = -1;
+    nalunit nal;
+    int32_t pos = 0;
+    while ((pos = nal_next (data, len, pos, &nal)) >= 0) {
+        if (nal.type == NAL_TYPE_SEI) {
+            int32_t frames = sei_recovery_frames (&nal);
+            if (frames >= 0) {
+                recovery = frames;
+                ret = AU_RECOVERYPOINT;
+            }
+        } else if (nal.type == NAL_TYPE_IDR) {
+            ret = AU_KEYFRAME;
+            break;
+        } else if (nal.type == NAL_TYPE_SLICE) {
+            break;
+        } else {
+            /* empty */
+        }
+    }
+    if (ret == AU_KEYFRAME) {
+        rs->hold = false;
+        rs->cleanat = -1;
+    } else if (ret == AU_RECOVERYPOINT) {
+        if (rs->lastpoint >= 0) {
+            rs->period = rs->frames - rs->lastpoint;
+        }
+        rs->lastpoint = rs->frames;
+        if ((rs->hold) && (rs->cleanat < 0)) {
+            rs->cleanat = rs->frames + recovery;
+        }
+    } else {
+        /* empty */
+    }
+    if ((rs->hold) && (rs->cleanat >= 0) && (rs->frames >= rs->cleanat)) {
+        rs->hold = false;
+        rs->cleanat = -1;
+    }
+    rs->frames++;
+    return ret;
+}
+
+void refresh_hold (refreshstate* rs)
+{
+    rs->hold = true;
+    rs->cleanat = -1;
+}
+
+bool refresh_active (const refreshstate* rs)
+{
+    return (rs->lastpoint >= 0) && (rs->period > 0) && (rs->period <= REFRESH_MAX_PERIOD) &&
+           ((rs->frames - rs->lastpoint) <= (2 * rs->period));
+}
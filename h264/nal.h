@@ -0,0 +1,114 @@
+/* H.264 NAL unit helpers used by the demux stage of h264.bin */
+
+#ifndef NAL_H
+#define NAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NAL_TYPE_SLICE 1
+#define NAL_TYPE_IDR 5
+#define NAL_TYPE_SEI 6
+#define NAL_TYPE_SPS 7
+#define NAL_TYPE_PPS 8
+#define NAL_TYPE_AUD 9
+#define NAL_TYPE_FILLER 12
+
+#define SEI_RECOVERY_POINT 6
+
+#define AU_NORMAL 0
+#define AU_KEYFRAME 1
+#define AU_RECOVERYPOINT 2
+
+#define PARAMSET_MAX_SIZE 256
+
+typedef struct snalunit {
+    const uint8_t* data; /* NAL header byte, start code not included */
+    int32_t len;
+    int32_t type;
+    bool complete;       /* false if the unit runs into the end of the buffer */
+} nalunit;
+
+typedef struct sparamsets {
+    uint8_t sps[PARAMSET_MAX_SIZE];
+    int32_t spslen;
+    uint8_t pps[PARAMSET_MAX_SIZE];
+    int32_t ppslen;
+} paramsets;
+
+typedef struct sbitreader {
+    const uint8_t* data; /* RBSP, emulation prevention bytes removed */
+    int32_t len;
+    int32_t bitpos;
+    bool overrun;
+} bitreader;
+
+typedef struct sbitwriter {
+    uint8_t* data;       /* RBSP, emulation prevention is added by nal_escape */
+    int32_t maxlen;
+    int32_t bitpos;
+    bool overrun;
+} bitwriter;
+
+typedef struct srefreshstate {
+    int32_t frames;      /* access units seen */
+    int32_t lastpoint;   /* frame index of the last recovery point, -1 if none */
+    int32_t period;      /* frames between the last two recovery points */
+    int32_t cleanat;     /* frame index at which output is clean again, -1 if unknown */
+    bool hold;           /* output is not clean yet */
+} refreshstate;
+
+/* Finds the next NAL unit starting at or after pos. Returns the position to
+ * continue scanning from, or -1 when there is no further start code. */
+int32_t nal_next (const uint8_t* data, int32_t len, int32_t pos, nalunit* nal);
+
+/* Remembers every complete SPS/PPS found in data. */
+void paramsets_update (paramsets* ps, const uint8_t* data, int32_t len);
+bool paramsets_valid (const paramsets* ps);
+/* Writes the cached SPS and PPS with 4-byte start codes, returns the length
+ * written or 0 if nothing is cached or maxlen is too small. */
+int32_t paramsets_write (const paramsets* ps, uint8_t* dest, int32_t maxlen);
+
+/* Removes filler data NAL units from data in place and returns the new
+ * length. A filler unit cut off at the end of data is removed too, and
+ * infiller makes the next call drop the rest of it. */
+int32_t nal_strip_filler (uint8_t* data, int32_t len, bool* infiller);
+
+/* Copies a NAL payload to dst dropping emulation prevention bytes, returns
+ * the RBSP length. At most maxlen bytes are written. */
+int32_t nal_unescape (const uint8_t* src, int32_t len, uint8_t* dst, int32_t maxlen);
+
+void br_init (bitreader* br, const uint8_t* data, int32_t len);
+uint32_t br_read (bitreader* br, int32_t bits);
+uint32_t br_read_ue (bitreader* br);
+int32_t br_read_se (bitreader* br);
+
+/* Copies an RBSP to dst inserting emulation prevention bytes, returns the
+ * escaped length or -1 if it does not fit into maxlen. */
+int32_t nal_escape (const uint8_t* src, int32_t len, uint8_t* dst, int32_t maxlen);
+
+void bw_init (bitwriter* bw, uint8_t* data, int32_t maxlen);
+void bw_write (bitwriter* bw, uint32_t val, int32_t bits);
+void bw_write_ue (bitwriter* bw, uint32_t val);
+void bw_write_se (bitwriter* bw, int32_t val);
+/* Copies the bits [from, to) of the reader's RBSP. */
+void bw_copy (bitwriter* bw, const bitreader* br, int32_t from, int32_t to);
+/* rbsp_trailing_bits(), returns the RBSP length in bytes */
+int32_t bw_finish (bitwriter* bw);
+
+/* Returns recovery_frame_cnt of the recovery point SEI in the NAL unit, or
+ * -1 if it carries none. */
+int32_t sei_recovery_frames (const nalunit* nal);
+
+/* Tracks IDRs and recovery point SEIs of consecutive access units so that
+ * output can resume at a recovery point and periodic intra refresh sources
+ * can be recognised. refresh_update returns one of the AU_ values. */
+void refresh_init (refreshstate* rs);
+int32_t refresh_update (refreshstate* rs, const uint8_t* data, int32_t len);
+/* Holds output until the next IDR or completed recovery point. */
+void refresh_hold (refreshstate* rs);
+/* True while the source refreshes the picture with recovery points often
+ * enough that a lost region heals without an IDR. */
+bool refresh_active (const refreshstate* rs);
+
+#endif /* NAL_H */
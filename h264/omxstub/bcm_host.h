@@ -0,0 +1,8 @@
+/* Fake bcm_host for make OMX=stub, see ilclient.h */
+
+#ifndef BCM_HOST_H
+#define BCM_HOST_H
+
+void bcm_host_init (void);
+
+#endif /* BCM_HOST_H */
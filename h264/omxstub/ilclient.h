@@ -0,0 +1,273 @@
+/* Fake ilclient for make OMX=stub: the part of the ilclient helper library
+ * and of the OpenMAX IL headers that decoder_omx.c and audio.c use, with the
+ * values of the Broadcom headers in /opt/vc. Implemented by omxstub.c. */
+
+#ifndef ILCLIENT_H
+#define ILCLIENT_H
+
+#include <stdint.h>
+
+typedef uint8_t OMX_U8;
+typedef uint32_t OMX_U32;
+typedef int32_t OMX_S32;
+typedef void* OMX_PTR;
+typedef void* OMX_HANDLETYPE;
+
+typedef enum OMX_BOOL {
+    OMX_FALSE = 0,
+    OMX_TRUE = 1
+} OMX_BOOL;
+
+/* OMX_SKIP64BIT is set by the Makefile as for the firmware */
+typedef struct OMX_TICKS {
+    OMX_U32 nLowPart;
+    OMX_U32 nHighPart;
+} OMX_TICKS;
+
+typedef union OMX_VERSIONTYPE {
+    OMX_U32 nVersion;
+} OMX_VERSIONTYPE;
+
+/* 1.1.2 */
+#define OMX_VERSION (0x00020101u)
+
+typedef enum OMX_ERRORTYPE {
+    OMX_ErrorNone = 0,
+    OMX_ErrorInsufficientResources = (int32_t)0x80001000,
+    OMX_ErrorUndefined = (int32_t)0x80001001,
+    OMX_ErrorComponentNotFound = (int32_t)0x80001003,
+    OMX_ErrorBadParameter = (int32_t)0x80001005,
+    OMX_ErrorNotImplemented = (int32_t)0x80001006,
+    OMX_ErrorHardware = (int32_t)0x80001009,
+    OMX_ErrorStreamCorrupt = (int32_t)0x8000100B,
+    OMX_ErrorSameState = (int32_t)0x80001012,
+    OMX_ErrorIncorrectStateTransition = (int32_t)0x80001017,
+    OMX_ErrorIncorrectStateOperation = (int32_t)0x80001018,
+    OMX_ErrorBadPortIndex = (int32_t)0x8000101B
+} OMX_ERRORTYPE;
+
+typedef enum OMX_STATETYPE {
+    OMX_StateInvalid = 0,
+    OMX_StateLoaded,
+    OMX_StateIdle,
+    OMX_StateExecuting,
+    OMX_StatePause,
+    OMX_StateWaitForResources
+} OMX_STATETYPE;
+
+typedef enum OMX_EVENTTYPE {
+    OMX_EventCmdComplete = 0,
+    OMX_EventError,
+    OMX_EventMark,
+    OMX_EventPortSettingsChanged,
+    OMX_EventBufferFlag
+} OMX_EVENTTYPE;
+
+typedef enum OMX_COMMANDTYPE {
+    OMX_CommandStateSet = 0,
+    OMX_CommandFlush,
+    OMX_CommandPortDisable,
+    OMX_CommandPortEnable,
+    OMX_CommandMarkBuffer
+} OMX_COMMANDTYPE;
+
+typedef enum OMX_INDEXTYPE {
+    OMX_IndexParamPortDefinition = 0x02000001,
+    OMX_IndexParamAudioPcm = 0x04000002,
+    OMX_IndexParamVideoPortFormat = 0x06000001,
+    OMX_IndexConfigTimeClockState = 0x09000007,
+    OMX_IndexConfigAudioRenderingLatency = 0x7F000030,
+    OMX_IndexConfigBrcmAudioDestination = 0x7F000041,
+    OMX_IndexParamBrcmVideoDecodeErrorConcealment = 0x7F00007A
+} OMX_INDEXTYPE;
+
+#define OMX_BUFFERFLAG_EOS (0x00000001u)
+#define OMX_BUFFERFLAG_STARTTIME (0x00000002u)
+#define OMX_BUFFERFLAG_DECODEONLY (0x00000004u)
+#define OMX_BUFFERFLAG_DATACORRUPT (0x00000008u)
+#define OMX_BUFFERFLAG_ENDOFFRAME (0x00000010u)
+#define OMX_BUFFERFLAG_SYNCFRAME (0x00000020u)
+#define OMX_BUFFERFLAG_EXTRADATA (0x00000040u)
+#define OMX_BUFFERFLAG_CODECCONFIG (0x00000080u)
+/* Broadcom extension */
+#define OMX_BUFFERFLAG_TIME_UNKNOWN (0x00000100u)
+
+typedef struct OMX_BUFFERHEADERTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U8* pBuffer;
+    OMX_U32 nAllocLen;
+    OMX_U32 nFilledLen;
+    OMX_U32 nOffset;
+    OMX_PTR pAppPrivate;
+    OMX_PTR pPlatformPrivate;
+    OMX_PTR pInputPortPrivate;
+    OMX_PTR pOutputPortPrivate;
+    OMX_TICKS nTimeStamp;
+    OMX_U32 nFlags;
+    OMX_U32 nOutputPortIndex;
+    OMX_U32 nInputPortIndex;
+} OMX_BUFFERHEADERTYPE;
+
+typedef struct OMX_PARAM_PORTDEFINITIONTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nBufferCountActual;
+    OMX_U32 nBufferCountMin;
+    OMX_U32 nBufferSize;
+    OMX_BOOL bEnabled;
+    OMX_BOOL bPopulated;
+    OMX_U32 nBufferAlignment;
+} OMX_PARAM_PORTDEFINITIONTYPE;
+
+typedef struct OMX_PARAM_U32TYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nU32;
+} OMX_PARAM_U32TYPE;
+
+typedef enum OMX_VIDEO_CODINGTYPE {
+    OMX_VIDEO_CodingUnused = 0,
+    OMX_VIDEO_CodingAutoDetect,
+    OMX_VIDEO_CodingMPEG2,
+    OMX_VIDEO_CodingH263,
+    OMX_VIDEO_CodingMPEG4,
+    OMX_VIDEO_CodingWMV,
+    OMX_VIDEO_CodingRV,
+    OMX_VIDEO_CodingAVC
+} OMX_VIDEO_CODINGTYPE;
+
+typedef struct OMX_VIDEO_PARAM_PORTFORMATTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nIndex;
+    OMX_VIDEO_CODINGTYPE eCompressionFormat;
+    OMX_U32 eColorFormat;
+    OMX_U32 xFramerate;
+} OMX_VIDEO_PARAM_PORTFORMATTYPE;
+
+typedef struct OMX_PARAM_BRCMVIDEODECODEERRORCONCEALMENTTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_BOOL bStartWithValidFrame;
+} OMX_PARAM_BRCMVIDEODECODEERRORCONCEALMENTTYPE;
+
+typedef enum OMX_TIME_CLOCKSTATE {
+    OMX_TIME_ClockStateRunning = 0,
+    OMX_TIME_ClockStateWaitingForStartTime,
+    OMX_TIME_ClockStateStopped
+} OMX_TIME_CLOCKSTATE;
+
+typedef struct OMX_TIME_CONFIG_CLOCKSTATETYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_TIME_CLOCKSTATE eState;
+    OMX_TICKS nStartTime;
+    OMX_TICKS nOffset;
+    OMX_U32 nWaitMask;
+} OMX_TIME_CONFIG_CLOCKSTATETYPE;
+
+typedef enum OMX_NUMERICALDATATYPE {
+    OMX_NumericalDataSigned = 0,
+    OMX_NumericalDataUnsigned
+} OMX_NUMERICALDATATYPE;
+
+typedef enum OMX_ENDIANTYPE {
+    OMX_EndianBig = 0,
+    OMX_EndianLittle
+} OMX_ENDIANTYPE;
+
+typedef enum OMX_AUDIO_PCMMODETYPE {
+    OMX_AUDIO_PCMModeLinear = 0
+} OMX_AUDIO_PCMMODETYPE;
+
+typedef enum OMX_AUDIO_CHANNELTYPE {
+    OMX_AUDIO_ChannelNone = 0,
+    OMX_AUDIO_ChannelLF,
+    OMX_AUDIO_ChannelRF
+} OMX_AUDIO_CHANNELTYPE;
+
+typedef struct OMX_AUDIO_PARAM_PCMMODETYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nChannels;
+    OMX_NUMERICALDATATYPE eNumData;
+    OMX_ENDIANTYPE eEndian;
+    OMX_BOOL bInterleaved;
+    OMX_U32 nBitPerSample;
+    OMX_U32 nSamplingRate;
+    OMX_AUDIO_PCMMODETYPE ePCMMode;
+    OMX_AUDIO_CHANNELTYPE eChannelMapping[16];
+} OMX_AUDIO_PARAM_PCMMODETYPE;
+
+typedef struct OMX_CONFIG_BRCMAUDIODESTINATIONTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U8 sName[16];
+} OMX_CONFIG_BRCMAUDIODESTINATIONTYPE;
+
+OMX_ERRORTYPE OMX_Init (void);
+OMX_ERRORTYPE OMX_Deinit (void);
+OMX_ERRORTYPE OMX_GetParameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param);
+OMX_ERRORTYPE OMX_SetParameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param);
+OMX_ERRORTYPE OMX_GetConfig (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config);
+OMX_ERRORTYPE OMX_SetConfig (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config);
+OMX_ERRORTYPE OMX_SendCommand (OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd, OMX_U32 param, OMX_PTR data);
+OMX_ERRORTYPE OMX_EmptyThisBuffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE* hdr);
+
+typedef struct _ILCLIENT_T ILCLIENT_T;
+typedef struct _COMPONENT_T COMPONENT_T;
+
+typedef struct {
+    COMPONENT_T* source;
+    int source_port;
+    COMPONENT_T* sink;
+    int sink_port;
+} TUNNEL_T;
+
+typedef void (*ILCLIENT_CALLBACK_T) (void* userdata, COMPONENT_T* comp, OMX_U32 data);
+typedef void (*ILCLIENT_BUFFER_CALLBACK_T) (void* userdata, COMPONENT_T* comp);
+
+/* ilclient_create_component flags */
+#define ILCLIENT_FLAGS_NONE (0x0)
+#define ILCLIENT_ENABLE_INPUT_BUFFERS (0x1)
+#define ILCLIENT_ENABLE_OUTPUT_BUFFERS (0x2)
+#define ILCLIENT_DISABLE_ALL_PORTS (0x4)
+
+/* ilclient_wait_for_event flags */
+#define ILCLIENT_EMPTY_BUFFER_DONE (0x1)
+#define ILCLIENT_FILL_BUFFER_DONE (0x2)
+#define ILCLIENT_PORT_DISABLED (0x4)
+#define ILCLIENT_PORT_ENABLED (0x8)
+#define ILCLIENT_STATE_CHANGED (0x10)
+#define ILCLIENT_BUFFER_FLAG_EOS (0x20)
+#define ILCLIENT_PARAMETER_CHANGED (0x40)
+#define ILCLIENT_EVENT_ERROR (0x80)
+
+#define ILC_GET_HANDLE(x) ilclient_get_handle (x)
+
+ILCLIENT_T* ilclient_init (void);
+void ilclient_destroy (ILCLIENT_T* client);
+void ilclient_set_error_callback (ILCLIENT_T* client, ILCLIENT_CALLBACK_T func, void* userdata);
+void ilclient_set_empty_buffer_done_callback (ILCLIENT_T* client, ILCLIENT_BUFFER_CALLBACK_T func, void* userdata);
+int ilclient_create_component (ILCLIENT_T* client, COMPONENT_T** comp, char* name, int flags);
+void ilclient_cleanup_components (COMPONENT_T* list[]);
+OMX_HANDLETYPE ilclient_get_handle (COMPONENT_T* comp);
+int ilclient_change_component_state (COMPONENT_T* comp, OMX_STATETYPE state);
+void ilclient_state_transition (COMPONENT_T* list[], OMX_STATETYPE state);
+void set_tunnel (TUNNEL_T* tunnel, COMPONENT_T* source, unsigned int source_port, COMPONENT_T* sink, unsigned int sink_port);
+int ilclient_setup_tunnel (TUNNEL_T* tunnel, unsigned int portflags, int timeout);
+void ilclient_disable_tunnel (TUNNEL_T* tunnel);
+void ilclient_flush_tunnels (TUNNEL_T* tunnel, int max);
+void ilclient_teardown_tunnels (TUNNEL_T* tunnels);
+int ilclient_enable_port_buffers (COMPONENT_T* comp, int portIndex, void* ilclient_malloc, void* ilclient_free, void* userdata);
+void ilclient_disable_port_buffers (COMPONENT_T* comp, int portIndex, OMX_BUFFERHEADERTYPE* bufferList, void* ilclient_free, void* userdata);
+OMX_BUFFERHEADERTYPE* ilclient_get_input_buffer (COMPONENT_T* comp, int portIndex, int block);
+int ilclient_remove_event (COMPONENT_T* comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1, OMX_U32 nData2, int ignore2);
+int ilclient_wait_for_event (COMPONENT_T* comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1, OMX_U32 nData2, int ignore2, int event_flag, int timeout);
+
+#endif /* ILCLIENT_H */
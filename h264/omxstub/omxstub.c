@@ -0,0 +1,967 @@
+/* Fake ilclient and OpenMAX IL for make OMX=stub: just enough of
+ * video_decode, video_scheduler, video_render, clock and audio_render for
+ * decoder_omx.c and audio.c to run unchanged where there is no VideoCore.
+ * It keeps to the rules of the firmware that code depends on: input only in
+ * Executing, an output format only after the first SPS, tunnels only from a
+ * port that has a format, buffers freed before Loaded. Whatever breaks them
+ * is counted in omxstubstats. video_decode takes its input on a thread of
+ * its own and gives the buffers back through the empty buffer done callback,
+ * and can be made to hang or fail, see omxstub.h. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bcm_host.h"
+#include "ilclient.h"
+#include "omxstub.h"
+
+#ifndef OMXSTUB_INPUT_BUFFERS
+/**
+ * Input buffers of video_decode, the firmware has 20 by default
+ */
+#define OMXSTUB_INPUT_BUFFERS (20)
+#endif /* OMXSTUB_INPUT_BUFFERS */
+
+#ifndef OMXSTUB_INPUT_SIZE
+/**
+ * Size of one input buffer of video_decode
+ */
+#define OMXSTUB_INPUT_SIZE (80 * 1024)
+#endif /* OMXSTUB_INPUT_SIZE */
+
+#ifndef OMXSTUB_AUDIO_BUFFERS
+/**
+ * Input buffers of audio_render
+ */
+#define OMXSTUB_AUDIO_BUFFERS (4)
+#endif /* OMXSTUB_AUDIO_BUFFERS */
+
+#ifndef OMXSTUB_AUDIO_SIZE
+/**
+ * Size of one input buffer of audio_render
+ */
+#define OMXSTUB_AUDIO_SIZE (4096)
+#endif /* OMXSTUB_AUDIO_SIZE */
+
+#ifndef OMXSTUB_FRAME_US
+/**
+ * Time video_decode spends on the last buffer of a frame
+ */
+#define OMXSTUB_FRAME_US (1000)
+#endif /* OMXSTUB_FRAME_US */
+
+#ifndef OMXSTUB_FOREVER_MS
+/**
+ * ilclient waits without a timeout for ever, the fake gives up after this
+ * long and counts it in forever
+ */
+#define OMXSTUB_FOREVER_MS (2000)
+#endif /* OMXSTUB_FOREVER_MS */
+
+#define STUB_MAX_BUFFERS 32
+#define STUB_MAX_PORTS 3
+#define STUB_MAX_EVENTS 16
+
+#define KIND_DECODE 0
+#define KIND_SCHEDULER 1
+#define KIND_RENDER 2
+#define KIND_CLOCK 3
+#define KIND_AUDIO 4
+
+#define OWNER_FREE 0       /* back with ilclient */
+#define OWNER_CLIENT 1     /* handed out by ilclient_get_input_buffer */
+#define OWNER_COMPONENT 2  /* queued in the component */
+
+typedef struct sstubport {
+    OMX_U32 index;
+    bool output;
+    bool configured;     /* has a format a tunnel can take */
+    bool tunnelled;
+} stubport;
+
+typedef struct sstubevent {
+    OMX_EVENTTYPE type;
+    OMX_U32 data1;
+    OMX_U32 data2;
+} stubevent;
+
+struct _COMPONENT_T {
+    ILCLIENT_T* client;
+    int32_t kind;
+    OMX_STATETYPE state;
+    stubport ports[STUB_MAX_PORTS];
+    int32_t numports;
+    OMX_U32 inport;      /* the port with buffers, 0 for none */
+    int32_t count;
+    OMX_U32 size;
+    bool populated;
+    OMX_BUFFERHEADERTYPE headers[STUB_MAX_BUFFERS];
+    int32_t owner[STUB_MAX_BUFFERS];
+    int32_t next;        /* where ilclient_get_input_buffer looks first */
+    stubevent events[STUB_MAX_EVENTS];
+    int32_t numevents;
+    bool stopped;        /* hung or failed until the next Loaded */
+};
+
+struct _ILCLIENT_T {
+    ILCLIENT_CALLBACK_T error;
+    void* errordata;
+    ILCLIENT_BUFFER_CALLBACK_T emptied;
+    void* emptieddata;
+    COMPONENT_T* decode;
+    COMPONENT_T* scheduler;
+    COMPONENT_T* render;
+    OMX_BUFFERHEADERTYPE* queue[STUB_MAX_BUFFERS];  /* input of video_decode */
+    int32_t head;
+    int32_t queued;
+    uint32_t generation; /* bumped when the queue is dropped */
+    bool quit;
+    pthread_t worker;
+};
+
+/* one lock for all of it, components call back without holding it */
+static pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stub_cond = PTHREAD_COND_INITIALIZER;
+static omxstubstats stub_stats;
+static int32_t stub_fault = OMXSTUB_FAULT_NONE;
+static int32_t stub_after = 0;
+
+#define INLINE static inline
+
+INLINE void stub_deadline (struct timespec* ts, int32_t ms);
+INLINE void stub_deadline (struct timespec* ts, int32_t ms)
+{
+    (void)clock_gettime (CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static stubport* findport (COMPONENT_T* comp, OMX_U32 index);
+static stubport* findport (COMPONENT_T* comp, OMX_U32 index)
+{
+    stubport* ret = NULL;
+    for (int32_t i = 0; (comp != NULL) && (i < comp->numports); i++) {
+        if (comp->ports[i].index == index) {
+            ret = &comp->ports[i];
+        }
+    }
+    return ret;
+}
+
+INLINE void addport (COMPONENT_T* comp, OMX_U32 index, bool output);
+INLINE void addport (COMPONENT_T* comp, OMX_U32 index, bool output)
+{
+    stubport* port = &comp->ports[comp->numports];
+    port->index = index;
+    port->output = output;
+    /* the clock knows its format from the start, video_decode from the stream */
+    port->configured = (comp->kind == KIND_CLOCK);
+    comp->numports++;
+}
+
+/* Call with stub_lock held. A full list drops its oldest event. */
+static void pushevent (COMPONENT_T* comp, OMX_EVENTTYPE type, OMX_U32 data1, OMX_U32 data2);
+static void pushevent (COMPONENT_T* comp, OMX_EVENTTYPE type, OMX_U32 data1, OMX_U32 data2)
+{
+    if (comp->numevents == STUB_MAX_EVENTS) {
+        (void)memmove (comp->events, comp->events + 1, (STUB_MAX_EVENTS - 1) * sizeof (stubevent));
+        comp->numevents--;
+    }
+    comp->events[comp->numevents].type = type;
+    comp->events[comp->numevents].data1 = data1;
+    comp->events[comp->numevents].data2 = data2;
+    comp->numevents++;
+    if (type == OMX_EventError) {
+        stub_stats.errors++;
+    }
+    (void)pthread_cond_broadcast (&stub_cond);
+}
+
+/* Call with stub_lock held. Returns 0 and takes the event off the list if
+ * there is one that matches. */
+static int32_t takeevent (COMPONENT_T* comp, OMX_EVENTTYPE type, OMX_U32 data1, bool ignore1, OMX_U32 data2, bool ignore2);
+static int32_t takeevent (COMPONENT_T* comp, OMX_EVENTTYPE type, OMX_U32 data1, bool ignore1, OMX_U32 data2, bool ignore2)
+{
+    int32_t ret = -1;
+    for (int32_t i = 0; (ret != 0) && (i < comp->numevents); i++) {
+        const stubevent* ev = &comp->events[i];
+        if ((ev->type == type) && ((ignore1) || (ev->data1 == data1)) && ((ignore2) || (ev->data2 == data2))) {
+            (void)memmove (comp->events + i, comp->events + i + 1, (size_t)(comp->numevents - i - 1) * sizeof (stubevent));
+            comp->numevents--;
+            ret = 0;
+        }
+    }
+    return ret;
+}
+
+/* Called without stub_lock, as ilclient does for every OMX_EventError. The
+ * client outlives its components, comp may be gone already. */
+INLINE void notifyerror (const ILCLIENT_T* client, COMPONENT_T* comp, OMX_ERRORTYPE error);
+INLINE void notifyerror (const ILCLIENT_T* client, COMPONENT_T* comp, OMX_ERRORTYPE error)
+{
+    if ((error != OMX_ErrorNone) && (client->error != NULL)) {
+        client->error (client->errordata, comp, (OMX_U32)error);
+    }
+}
+
+INLINE void notifyemptied (const ILCLIENT_T* client, COMPONENT_T* comp, int32_t count);
+INLINE void notifyemptied (const ILCLIENT_T* client, COMPONENT_T* comp, int32_t count)
+{
+    for (int32_t i = 0; (i < count) && (client->emptied != NULL); i++) {
+        client->emptied (client->emptieddata, comp);
+    }
+}
+
+/* Call with stub_lock held. Takes back the buffers video_decode has queued,
+ * returns how many. */
+static int32_t dropqueue (COMPONENT_T* comp);
+static int32_t dropqueue (COMPONENT_T* comp)
+{
+    int32_t dropped = 0;
+    ILCLIENT_T* client = comp->client;
+    if (client->decode == comp) {
+        for (int32_t i = 0; i < client->queued; i++) {
+            OMX_BUFFERHEADERTYPE* hdr = client->queue[(client->head + i) % STUB_MAX_BUFFERS];
+            comp->owner[hdr - comp->headers] = OWNER_FREE;
+            dropped++;
+        }
+        stub_stats.queued -= client->queued;
+        client->queued = 0;
+        client->head = 0;
+        client->generation++;
+    }
+    return dropped;
+}
+
+/* Call with stub_lock held. */
+static void freebuffers (COMPONENT_T* comp);
+static void freebuffers (COMPONENT_T* comp)
+{
+    if (comp->populated) {
+        (void)dropqueue (comp);
+        for (int32_t i = 0; i < comp->count; i++) {
+            if (comp->owner[i] == OWNER_CLIENT) {
+                stub_stats.held++;
+            }
+            free (comp->headers[i].pBuffer);
+            comp->headers[i].pBuffer = NULL;
+        }
+        comp->populated = false;
+        (void)pthread_cond_broadcast (&stub_cond);
+    }
+}
+
+/* Call with stub_lock held. *returned counts the buffers the component gave
+ * back on the way to Idle. */
+static OMX_ERRORTYPE changestate (COMPONENT_T* comp, OMX_STATETYPE state, int32_t* returned);
+static OMX_ERRORTYPE changestate (COMPONENT_T* comp, OMX_STATETYPE state, int32_t* returned)
+{
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    OMX_STATETYPE from = comp->state;
+    bool running = (from == OMX_StateExecuting) || (from == OMX_StatePause);
+    if (state == from) {
+        ret = OMX_ErrorSameState;
+    } else if (!(((from == OMX_StateLoaded) && (state == OMX_StateIdle)) ||
+                 ((from == OMX_StateIdle) && ((state == OMX_StateLoaded) || (state == OMX_StateExecuting) || (state == OMX_StatePause))) ||
+                 ((running) && ((state == OMX_StateIdle) || (state == OMX_StateExecuting) || (state == OMX_StatePause))) ||
+                 ((from == OMX_StateInvalid) && (state == OMX_StateLoaded)))) {
+        ret = OMX_ErrorIncorrectStateTransition;
+    } else {
+        if ((running) && (state == OMX_StateIdle)) {
+            *returned += dropqueue (comp);
+        }
+        if (state == OMX_StateLoaded) {
+            if ((comp->populated) && (from == OMX_StateIdle)) {
+                /* Idle to Loaded completes only once the buffers are freed */
+                stub_stats.forever++;
+            }
+            freebuffers (comp);
+            for (int32_t i = 0; i < comp->numports; i++) {
+                if (comp->ports[i].tunnelled) {
+                    stub_stats.misuse++;
+                }
+            }
+            if (comp->kind == KIND_DECODE) {
+                stub_stats.resets++;
+                comp->stopped = false;
+                findport (comp, 131)->configured = false;
+            }
+        }
+        if (comp->kind == KIND_RENDER) {
+            stub_stats.rendering = (state == OMX_StateExecuting) ? 1 : 0;
+        }
+        comp->state = state;
+    }
+    if (ret != OMX_ErrorNone) {
+        pushevent (comp, OMX_EventError, (OMX_U32)ret, 0);
+    }
+    return ret;
+}
+
+INLINE bool hassps (const OMX_BUFFERHEADERTYPE* hdr);
+INLINE bool hassps (const OMX_BUFFERHEADERTYPE* hdr)
+{
+    bool found = false;
+    const uint8_t* data = hdr->pBuffer + hdr->nOffset;
+    for (OMX_U32 i = 0; (!found) && (i + 3 < hdr->nFilledLen); i++) {
+        found = (data[i] == 0) && (data[i + 1] == 0) && (data[i + 2] == 1) && ((data[i + 3] & 0x1fu) == 7u);
+    }
+    return found;
+}
+
+/* Call with stub_lock held. True if a picture of video_decode gets as far
+ * as video_render. */
+static bool throughtorender (const ILCLIENT_T* client);
+static bool throughtorender (const ILCLIENT_T* client)
+{
+    const stubport* out = findport (client->decode, 131);
+    const stubport* sched = findport (client->scheduler, 11);
+    return (out != NULL) && (out->tunnelled) && (sched != NULL) && (sched->tunnelled) &&
+           (client->scheduler->state == OMX_StateExecuting) && (client->render != NULL) &&
+           (client->render->state == OMX_StateExecuting);
+}
+
+/* video_decode: takes one buffer after the other from the queue. */
+static void* decodeloop (void* arg);
+static void* decodeloop (void* arg)
+{
+    ILCLIENT_T* client = (ILCLIENT_T*)arg;
+    (void)pthread_mutex_lock (&stub_lock);
+    while (!client->quit) {
+        COMPONENT_T* comp = client->decode;
+        if ((comp == NULL) || (client->queued == 0) || (comp->stopped) || (comp->state != OMX_StateExecuting)) {
+            (void)pthread_cond_wait (&stub_cond, &stub_lock);
+            continue;
+        }
+        if ((stub_fault != OMXSTUB_FAULT_NONE) && (stub_after <= 0)) {
+            int32_t fault = stub_fault;
+            stub_fault = OMXSTUB_FAULT_NONE;
+            if (fault == OMXSTUB_FAULT_HANG) {
+                comp->stopped = true;
+                continue;
+            }
+            OMX_ERRORTYPE error = OMX_ErrorStreamCorrupt;
+            if (fault == OMXSTUB_FAULT_ERROR) {
+                error = OMX_ErrorHardware;
+                comp->stopped = true;
+                comp->state = OMX_StateInvalid;
+            }
+            pushevent (comp, OMX_EventError, (OMX_U32)error, 0);
+            (void)pthread_mutex_unlock (&stub_lock);
+            notifyerror (client, comp, error);
+            (void)pthread_mutex_lock (&stub_lock);
+            continue;
+        }
+        OMX_BUFFERHEADERTYPE* hdr = client->queue[client->head];
+        uint32_t generation = client->generation;
+        if ((hdr->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) != 0u) {
+            (void)pthread_mutex_unlock (&stub_lock);
+            (void)usleep (OMXSTUB_FRAME_US);
+            (void)pthread_mutex_lock (&stub_lock);
+        }
+        if ((generation != client->generation) || (client->decode != comp)) {
+            /* flushed or reset meanwhile */
+            continue;
+        }
+        client->head = (client->head + 1) % STUB_MAX_BUFFERS;
+        client->queued--;
+        stub_stats.queued--;
+        comp->owner[hdr - comp->headers] = OWNER_FREE;
+        if (stub_fault != OMXSTUB_FAULT_NONE) {
+            stub_after--;
+        }
+        stubport* out = findport (comp, 131);
+        if ((!out->configured) && (hassps (hdr))) {
+            out->configured = true;
+            stub_stats.portsettings++;
+            pushevent (comp, OMX_EventPortSettingsChanged, 131, 0);
+        }
+        if (throughtorender (client)) {
+            if (((hdr->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) != 0u) &&
+                    ((hdr->nFlags & (OMX_BUFFERFLAG_DECODEONLY | OMX_BUFFERFLAG_CODECCONFIG)) == 0u)) {
+                stub_stats.shown++;
+            }
+            if ((hdr->nFlags & OMX_BUFFERFLAG_EOS) != 0u) {
+                stub_stats.rendereos++;
+                pushevent (client->render, OMX_EventBufferFlag, 90, OMX_BUFFERFLAG_EOS);
+            }
+        }
+        (void)pthread_cond_broadcast (&stub_cond);
+        (void)pthread_mutex_unlock (&stub_lock);
+        notifyemptied (client, comp, 1);
+        (void)pthread_mutex_lock (&stub_lock);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return NULL;
+}
+
+void bcm_host_init (void)
+{
+}
+
+OMX_ERRORTYPE OMX_Init (void)
+{
+    const char* fault = getenv ("OMXSTUB_FAULT");
+    int after = 0;
+    if (fault != NULL) {
+        if (sscanf (fault, "hang:%d", &after) == 1) {
+            omxstub_fault (OMXSTUB_FAULT_HANG, after);
+        } else if (sscanf (fault, "error:%d", &after) == 1) {
+            omxstub_fault (OMXSTUB_FAULT_ERROR, after);
+        } else if (sscanf (fault, "corrupt:%d", &after) == 1) {
+            omxstub_fault (OMXSTUB_FAULT_CORRUPT, after);
+        } else {
+            (void)fprintf (stderr, "OMXSTUB_FAULT is hang:N, error:N or corrupt:N\n");
+        }
+    }
+    (void)pthread_mutex_lock (&stub_lock);
+    stub_stats.inits++;
+    (void)pthread_mutex_unlock (&stub_lock);
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_Deinit (void)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    stub_stats.inits--;
+    (void)pthread_mutex_unlock (&stub_lock);
+    return OMX_ErrorNone;
+}
+
+/* Call with stub_lock held. nSize and nVersion lead every structure. */
+static OMX_ERRORTYPE checkheader (const void* param, OMX_U32 size);
+static OMX_ERRORTYPE checkheader (const void* param, OMX_U32 size)
+{
+    OMX_U32 head[2];
+    (void)memcpy (head, param, sizeof (head));
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    if ((head[0] != size) || (head[1] != OMX_VERSION)) {
+        stub_stats.misuse++;
+        ret = OMX_ErrorBadParameter;
+    }
+    return ret;
+}
+
+/* Call with stub_lock held. */
+static OMX_ERRORTYPE misused (OMX_ERRORTYPE error);
+static OMX_ERRORTYPE misused (OMX_ERRORTYPE error)
+{
+    stub_stats.misuse++;
+    return error;
+}
+
+OMX_ERRORTYPE OMX_GetParameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param)
+{
+    COMPONENT_T* comp = (COMPONENT_T*)handle;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    (void)pthread_mutex_lock (&stub_lock);
+    if (index == OMX_IndexParamPortDefinition) {
+        OMX_PARAM_PORTDEFINITIONTYPE* def = (OMX_PARAM_PORTDEFINITIONTYPE*)param;
+        ret = checkheader (param, sizeof (*def));
+        if ((ret == OMX_ErrorNone) && ((comp->inport == 0u) || (def->nPortIndex != comp->inport))) {
+            ret = misused (OMX_ErrorBadPortIndex);
+        } else if (ret == OMX_ErrorNone) {
+            def->nBufferCountActual = (OMX_U32)comp->count;
+            def->nBufferCountMin = 1;
+            def->nBufferSize = comp->size;
+            def->bEnabled = comp->populated ? OMX_TRUE : OMX_FALSE;
+            def->bPopulated = comp->populated ? OMX_TRUE : OMX_FALSE;
+            def->nBufferAlignment = 16;
+        } else {
+            /* empty */
+        }
+    } else {
+        ret = misused (OMX_ErrorNotImplemented);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+OMX_ERRORTYPE OMX_SetParameter (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR param)
+{
+    COMPONENT_T* comp = (COMPONENT_T*)handle;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    (void)pthread_mutex_lock (&stub_lock);
+    if (index == OMX_IndexParamPortDefinition) {
+        const OMX_PARAM_PORTDEFINITIONTYPE* def = (const OMX_PARAM_PORTDEFINITIONTYPE*)param;
+        ret = checkheader (param, sizeof (*def));
+        if ((ret == OMX_ErrorNone) && ((comp->inport == 0u) || (def->nPortIndex != comp->inport))) {
+            ret = misused (OMX_ErrorBadPortIndex);
+        } else if ((ret == OMX_ErrorNone) && ((comp->populated) || (def->nBufferCountActual == 0u) || (def->nBufferCountActual > STUB_MAX_BUFFERS))) {
+            ret = misused (OMX_ErrorBadParameter);
+        } else if (ret == OMX_ErrorNone) {
+            comp->count = (int32_t)def->nBufferCountActual;
+            comp->size = def->nBufferSize;
+        } else {
+            /* empty */
+        }
+    } else if ((index == OMX_IndexParamVideoPortFormat) && (comp->kind == KIND_DECODE)) {
+        const OMX_VIDEO_PARAM_PORTFORMATTYPE* format = (const OMX_VIDEO_PARAM_PORTFORMATTYPE*)param;
+        ret = checkheader (param, sizeof (*format));
+        if ((ret == OMX_ErrorNone) && (format->nPortIndex != 130u)) {
+            ret = misused (OMX_ErrorBadPortIndex);
+        } else if (ret == OMX_ErrorNone) {
+            stub_stats.avc = (format->eCompressionFormat == OMX_VIDEO_CodingAVC) ? 1 : 0;
+        } else {
+            /* empty */
+        }
+    } else if ((index == OMX_IndexParamBrcmVideoDecodeErrorConcealment) && (comp->kind == KIND_DECODE)) {
+        const OMX_PARAM_BRCMVIDEODECODEERRORCONCEALMENTTYPE* conceal = (const OMX_PARAM_BRCMVIDEODECODEERRORCONCEALMENTTYPE*)param;
+        ret = checkheader (param, sizeof (*conceal));
+        if (ret == OMX_ErrorNone) {
+            stub_stats.startvalid = (conceal->bStartWithValidFrame == OMX_TRUE) ? 1 : 0;
+        }
+    } else if ((index == OMX_IndexConfigTimeClockState) && (comp->kind == KIND_CLOCK)) {
+        ret = checkheader (param, sizeof (OMX_TIME_CONFIG_CLOCKSTATETYPE));
+    } else if ((index == OMX_IndexParamAudioPcm) && (comp->kind == KIND_AUDIO)) {
+        ret = checkheader (param, sizeof (OMX_AUDIO_PARAM_PCMMODETYPE));
+    } else {
+        ret = misused (OMX_ErrorBadParameter);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+OMX_ERRORTYPE OMX_GetConfig (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+    const COMPONENT_T* comp = (const COMPONENT_T*)handle;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    (void)pthread_mutex_lock (&stub_lock);
+    if ((index == OMX_IndexConfigAudioRenderingLatency) && (comp->kind == KIND_AUDIO)) {
+        ret = checkheader (config, sizeof (OMX_PARAM_U32TYPE));
+        if (ret == OMX_ErrorNone) {
+            ((OMX_PARAM_U32TYPE*)config)->nU32 = 0;
+        }
+    } else {
+        ret = misused (OMX_ErrorNotImplemented);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+OMX_ERRORTYPE OMX_SetConfig (OMX_HANDLETYPE handle, OMX_INDEXTYPE index, OMX_PTR config)
+{
+    const COMPONENT_T* comp = (const COMPONENT_T*)handle;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    (void)pthread_mutex_lock (&stub_lock);
+    if ((index == OMX_IndexConfigBrcmAudioDestination) && (comp->kind == KIND_AUDIO)) {
+        ret = checkheader (config, sizeof (OMX_CONFIG_BRCMAUDIODESTINATIONTYPE));
+    } else {
+        ret = misused (OMX_ErrorNotImplemented);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+OMX_ERRORTYPE OMX_SendCommand (OMX_HANDLETYPE handle, OMX_COMMANDTYPE cmd, OMX_U32 param, OMX_PTR data)
+{
+    COMPONENT_T* comp = (COMPONENT_T*)handle;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    int32_t returned = 0;
+    (void)data;
+    (void)pthread_mutex_lock (&stub_lock);
+    if (cmd == OMX_CommandStateSet) {
+        ret = changestate (comp, (OMX_STATETYPE)param, &returned);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    notifyemptied (comp->client, comp, returned);
+    notifyerror (comp->client, comp, ret);
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_EmptyThisBuffer (OMX_HANDLETYPE handle, OMX_BUFFERHEADERTYPE* hdr)
+{
+    COMPONENT_T* comp = (COMPONENT_T*)handle;
+    ILCLIENT_T* client = comp->client;
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+    bool played = false;
+    (void)pthread_mutex_lock (&stub_lock);
+    ptrdiff_t i = hdr - comp->headers;
+    if ((!comp->populated) || (i < 0) || (i >= comp->count) || (comp->owner[i] != OWNER_CLIENT) ||
+            ((hdr->nOffset + hdr->nFilledLen) > hdr->nAllocLen)) {
+        ret = misused (OMX_ErrorBadParameter);
+    } else if (comp->state == OMX_StateInvalid) {
+        /* video_decode failed and the client has not seen it yet */
+        ret = OMX_ErrorIncorrectStateOperation;
+    } else if ((comp->state != OMX_StateExecuting) && (comp->state != OMX_StatePause)) {
+        ret = misused (OMX_ErrorIncorrectStateOperation);
+    } else if (comp->kind == KIND_AUDIO) {
+        comp->owner[i] = OWNER_FREE;
+        stub_stats.audio++;
+        played = true;
+    } else {
+        OMX_U32 flags = hdr->nFlags;
+        const uint8_t sidedata[14] = { 0xea, 0x00, 0x00, 0x00, 0x01, 0xce, 0x8c, 0x4d, 0x9d, 0x10, 0x8e, 0x25, 0xe9, 0xfe };
+        stub_stats.buffers++;
+        if ((flags & OMX_BUFFERFLAG_ENDOFFRAME) != 0u) {
+            stub_stats.frames++;
+            OMX_U32 end = hdr->nOffset + hdr->nFilledLen;
+            if (((end + 14u) <= hdr->nAllocLen) && (memcmp (hdr->pBuffer + end, sidedata, 14) == 0)) {
+                stub_stats.sidedata++;
+            }
+        }
+        stub_stats.codecconfig += ((flags & OMX_BUFFERFLAG_CODECCONFIG) != 0u) ? 1 : 0;
+        stub_stats.starttime += ((flags & OMX_BUFFERFLAG_STARTTIME) != 0u) ? 1 : 0;
+        stub_stats.timeunknown += ((flags & OMX_BUFFERFLAG_TIME_UNKNOWN) != 0u) ? 1 : 0;
+        stub_stats.decodeonly += ((flags & OMX_BUFFERFLAG_DECODEONLY) != 0u) ? 1 : 0;
+        stub_stats.corrupt += ((flags & OMX_BUFFERFLAG_DATACORRUPT) != 0u) ? 1 : 0;
+        stub_stats.eos += ((flags & OMX_BUFFERFLAG_EOS) != 0u) ? 1 : 0;
+        comp->owner[i] = OWNER_COMPONENT;
+        client->queue[(client->head + client->queued) % STUB_MAX_BUFFERS] = hdr;
+        client->queued++;
+        stub_stats.queued++;
+        (void)pthread_cond_broadcast (&stub_cond);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    if (played) {
+        notifyemptied (client, comp, 1);
+    }
+    return ret;
+}
+
+void omxstub_fault (int32_t fault, int32_t after)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    stub_fault = fault;
+    stub_after = after;
+    (void)pthread_cond_broadcast (&stub_cond);
+    (void)pthread_mutex_unlock (&stub_lock);
+}
+
+void omxstub_stats (omxstubstats* stats)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    *stats = stub_stats;
+    (void)pthread_mutex_unlock (&stub_lock);
+}
+
+ILCLIENT_T* ilclient_init (void)
+{
+    ILCLIENT_T* client = (ILCLIENT_T*)calloc (1, sizeof (ILCLIENT_T));
+    if ((client != NULL) && (pthread_create (&client->worker, NULL, decodeloop, client) != 0)) {
+        free (client);
+        client = NULL;
+    }
+    return client;
+}
+
+void ilclient_destroy (ILCLIENT_T* client)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    client->quit = true;
+    (void)pthread_cond_broadcast (&stub_cond);
+    (void)pthread_mutex_unlock (&stub_lock);
+    (void)pthread_join (client->worker, NULL);
+    free (client);
+}
+
+void ilclient_set_error_callback (ILCLIENT_T* client, ILCLIENT_CALLBACK_T func, void* userdata)
+{
+    client->error = func;
+    client->errordata = userdata;
+}
+
+void ilclient_set_empty_buffer_done_callback (ILCLIENT_T* client, ILCLIENT_BUFFER_CALLBACK_T func, void* userdata)
+{
+    client->emptied = func;
+    client->emptieddata = userdata;
+}
+
+int ilclient_create_component (ILCLIENT_T* client, COMPONENT_T** comp, char* name, int flags)
+{
+    int ret = 0;
+    COMPONENT_T* c = (COMPONENT_T*)calloc (1, sizeof (COMPONENT_T));
+    (void)flags;
+    if (c == NULL) {
+        ret = -1;
+    } else if (strcmp (name, "video_decode") == 0) {
+        c->kind = KIND_DECODE;
+        addport (c, 130, false);
+        addport (c, 131, true);
+        c->inport = 130;
+        c->count = OMXSTUB_INPUT_BUFFERS;
+        c->size = OMXSTUB_INPUT_SIZE;
+    } else if (strcmp (name, "video_scheduler") == 0) {
+        c->kind = KIND_SCHEDULER;
+        addport (c, 10, false);
+        addport (c, 11, true);
+        addport (c, 12, false);
+    } else if (strcmp (name, "video_render") == 0) {
+        c->kind = KIND_RENDER;
+        addport (c, 90, false);
+    } else if (strcmp (name, "clock") == 0) {
+        c->kind = KIND_CLOCK;
+        addport (c, 80, true);
+        addport (c, 81, true);
+    } else if (strcmp (name, "audio_render") == 0) {
+        c->kind = KIND_AUDIO;
+        addport (c, 100, false);
+        c->inport = 100;
+        c->count = OMXSTUB_AUDIO_BUFFERS;
+        c->size = OMXSTUB_AUDIO_SIZE;
+    } else {
+        free (c);
+        c = NULL;
+        ret = -1;
+    }
+    if (c != NULL) {
+        c->client = client;
+        c->state = OMX_StateLoaded;
+        (void)pthread_mutex_lock (&stub_lock);
+        if (c->kind == KIND_DECODE) {
+            client->decode = c;
+        } else if (c->kind == KIND_SCHEDULER) {
+            client->scheduler = c;
+        } else if (c->kind == KIND_RENDER) {
+            client->render = c;
+        } else {
+            /* empty */
+        }
+        stub_stats.components++;
+        (void)pthread_mutex_unlock (&stub_lock);
+    }
+    *comp = c;
+    return ret;
+}
+
+/* list ends at the first NULL, as in ilclient */
+void ilclient_cleanup_components (COMPONENT_T* list[])
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    for (int32_t i = 0; list[i] != NULL; i++) {
+        COMPONENT_T* comp = list[i];
+        ILCLIENT_T* client = comp->client;
+        freebuffers (comp);
+        if (client->decode == comp) {
+            client->decode = NULL;
+        } else if (client->scheduler == comp) {
+            client->scheduler = NULL;
+        } else if (client->render == comp) {
+            client->render = NULL;
+        } else {
+            /* empty */
+        }
+        stub_stats.components--;
+        free (comp);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+}
+
+OMX_HANDLETYPE ilclient_get_handle (COMPONENT_T* comp)
+{
+    return (OMX_HANDLETYPE)comp;
+}
+
+int ilclient_change_component_state (COMPONENT_T* comp, OMX_STATETYPE state)
+{
+    int32_t returned = 0;
+    (void)pthread_mutex_lock (&stub_lock);
+    OMX_ERRORTYPE error = changestate (comp, state, &returned);
+    (void)pthread_mutex_unlock (&stub_lock);
+    notifyemptied (comp->client, comp, returned);
+    notifyerror (comp->client, comp, error);
+    return (error == OMX_ErrorNone) ? 0 : -1;
+}
+
+void ilclient_state_transition (COMPONENT_T* list[], OMX_STATETYPE state)
+{
+    for (int32_t i = 0; list[i] != NULL; i++) {
+        (void)ilclient_change_component_state (list[i], state);
+    }
+}
+
+void set_tunnel (TUNNEL_T* tunnel, COMPONENT_T* source, unsigned int source_port, COMPONENT_T* sink, unsigned int sink_port)
+{
+    tunnel->source = source;
+    tunnel->source_port = (int)source_port;
+    tunnel->sink = sink;
+    tunnel->sink_port = (int)sink_port;
+}
+
+/* Returns -1 if the source port has no format within timeout ms, -5 for a
+ * tunnel the firmware refuses. */
+int ilclient_setup_tunnel (TUNNEL_T* tunnel, unsigned int portflags, int timeout)
+{
+    int ret = 0;
+    (void)portflags;
+    (void)pthread_mutex_lock (&stub_lock);
+    stubport* out = findport (tunnel->source, (OMX_U32)tunnel->source_port);
+    stubport* in = findport (tunnel->sink, (OMX_U32)tunnel->sink_port);
+    if ((out == NULL) || (in == NULL) || (!out->output) || (in->output) || (out->tunnelled) || (in->tunnelled)) {
+        stub_stats.misuse++;
+        ret = -5;
+    } else {
+        struct timespec deadline;
+        stub_deadline (&deadline, timeout);
+        int err = 0;
+        while ((!out->configured) && (timeout > 0) && (err == 0)) {
+            err = pthread_cond_timedwait (&stub_cond, &stub_lock, &deadline);
+        }
+        if (!out->configured) {
+            ret = -1;
+        } else {
+            out->tunnelled = true;
+            in->tunnelled = true;
+            /* ilclient takes the ends of the tunnel to Idle to enable their ports */
+            if (tunnel->source->state == OMX_StateLoaded) {
+                tunnel->source->state = OMX_StateIdle;
+            }
+            if (tunnel->sink->state == OMX_StateLoaded) {
+                tunnel->sink->state = OMX_StateIdle;
+            }
+            if ((tunnel->sink->kind == KIND_SCHEDULER) && (in->index == 10u)) {
+                findport (tunnel->sink, 11)->configured = true;
+            }
+            stub_stats.tunnels++;
+        }
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+void ilclient_disable_tunnel (TUNNEL_T* tunnel)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    stubport* out = findport (tunnel->source, (OMX_U32)tunnel->source_port);
+    stubport* in = findport (tunnel->sink, (OMX_U32)tunnel->sink_port);
+    if ((out != NULL) && (in != NULL)) {
+        out->tunnelled = false;
+        in->tunnelled = false;
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+}
+
+void ilclient_flush_tunnels (TUNNEL_T* tunnel, int max)
+{
+    /* pictures are not held anywhere */
+    (void)tunnel;
+    (void)max;
+}
+
+void ilclient_teardown_tunnels (TUNNEL_T* tunnels)
+{
+    for (int32_t i = 0; tunnels[i].source != NULL; i++) {
+        ilclient_disable_tunnel (tunnels + i);
+    }
+}
+
+int ilclient_enable_port_buffers (COMPONENT_T* comp, int portIndex, void* ilclient_malloc, void* ilclient_free, void* userdata)
+{
+    int ret = 0;
+    (void)ilclient_malloc;
+    (void)ilclient_free;
+    (void)userdata;
+    (void)pthread_mutex_lock (&stub_lock);
+    if ((comp->inport == 0u) || ((OMX_U32)portIndex != comp->inport) || (comp->populated) ||
+            (comp->state == OMX_StateLoaded) || (comp->state == OMX_StateInvalid)) {
+        stub_stats.misuse++;
+        ret = -1;
+    } else {
+        for (int32_t i = 0; i < comp->count; i++) {
+            OMX_BUFFERHEADERTYPE* hdr = &comp->headers[i];
+            (void)memset (hdr, 0, sizeof (*hdr));
+            hdr->nSize = sizeof (*hdr);
+            hdr->nVersion.nVersion = OMX_VERSION;
+            hdr->pBuffer = (OMX_U8*)malloc (comp->size);
+            hdr->nAllocLen = comp->size;
+            hdr->nInputPortIndex = comp->inport;
+            comp->owner[i] = OWNER_FREE;
+        }
+        comp->next = 0;
+        comp->populated = true;
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+void ilclient_disable_port_buffers (COMPONENT_T* comp, int portIndex, OMX_BUFFERHEADERTYPE* bufferList, void* ilclient_free, void* userdata)
+{
+    (void)bufferList;
+    (void)ilclient_free;
+    (void)userdata;
+    (void)pthread_mutex_lock (&stub_lock);
+    if ((comp->inport == 0u) || ((OMX_U32)portIndex != comp->inport)) {
+        stub_stats.misuse++;
+    } else {
+        freebuffers (comp);
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+}
+
+OMX_BUFFERHEADERTYPE* ilclient_get_input_buffer (COMPONENT_T* comp, int portIndex, int block)
+{
+    OMX_BUFFERHEADERTYPE* ret = NULL;
+    struct timespec deadline;
+    stub_deadline (&deadline, OMXSTUB_FOREVER_MS);
+    (void)pthread_mutex_lock (&stub_lock);
+    if ((comp->inport == 0u) || ((OMX_U32)portIndex != comp->inport) || (!comp->populated)) {
+        stub_stats.misuse++;
+    } else {
+        bool waiting = true;
+        while (waiting) {
+            for (int32_t n = 0; (ret == NULL) && (n < comp->count); n++) {
+                int32_t i = (comp->next + n) % comp->count;
+                if (comp->owner[i] == OWNER_FREE) {
+                    comp->owner[i] = OWNER_CLIENT;
+                    comp->next = (i + 1) % comp->count;
+                    ret = &comp->headers[i];
+                }
+            }
+            if ((ret != NULL) || (block == 0) || (!comp->populated)) {
+                waiting = false;
+            } else if (pthread_cond_timedwait (&stub_cond, &stub_lock, &deadline) == ETIMEDOUT) {
+                stub_stats.forever++;
+                waiting = false;
+            } else {
+                /* empty */
+            }
+        }
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+int ilclient_remove_event (COMPONENT_T* comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1, OMX_U32 nData2, int ignore2)
+{
+    (void)pthread_mutex_lock (&stub_lock);
+    int ret = takeevent (comp, event, nData1, ignore1 != 0, nData2, ignore2 != 0);
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
+
+/* Returns 0 for the event, -1 after timeout ms, -2 for an error event if
+ * event_flag has ILCLIENT_EVENT_ERROR. A negative timeout waits for ever. */
+int ilclient_wait_for_event (COMPONENT_T* comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1, OMX_U32 nData2, int ignore2, int event_flag, int timeout)
+{
+    int ret = 1;
+    struct timespec deadline;
+    stub_deadline (&deadline, (timeout < 0) ? OMXSTUB_FOREVER_MS : timeout);
+    (void)pthread_mutex_lock (&stub_lock);
+    while (ret > 0) {
+        if (takeevent (comp, event, nData1, ignore1 != 0, nData2, ignore2 != 0) == 0) {
+            ret = 0;
+        } else if (((event_flag & ILCLIENT_EVENT_ERROR) != 0) && (takeevent (comp, OMX_EventError, 0, true, 0, true) == 0)) {
+            ret = -2;
+        } else if (pthread_cond_timedwait (&stub_cond, &stub_lock, &deadline) == ETIMEDOUT) {
+            if (timeout < 0) {
+                stub_stats.forever++;
+            }
+            ret = -1;
+        } else {
+            /* empty */
+        }
+    }
+    (void)pthread_mutex_unlock (&stub_lock);
+    return ret;
+}
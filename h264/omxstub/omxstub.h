@@ -0,0 +1,49 @@
+/* What the fake ilclient of make OMX=stub saw, and the faults it can play */
+
+#ifndef OMXSTUB_H
+#define OMXSTUB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OMXSTUB_FAULT_NONE 0     /* no fault armed */
+#define OMXSTUB_FAULT_HANG 1     /* video_decode keeps its input until it is reset */
+#define OMXSTUB_FAULT_ERROR 2    /* video_decode goes to Invalid with OMX_ErrorHardware */
+#define OMXSTUB_FAULT_CORRUPT 3  /* video_decode reports OMX_ErrorStreamCorrupt and goes on */
+
+typedef struct somxstubstats {
+    int32_t inits;         /* OMX_Init calls not matched by OMX_Deinit */
+    int32_t components;    /* created and not cleaned up */
+    int32_t buffers;       /* input buffers video_decode took */
+    int32_t queued;        /* of those, not given back yet */
+    int32_t frames;        /* with OMX_BUFFERFLAG_ENDOFFRAME */
+    int32_t sidedata;      /* frames followed by the side data video_decode expects */
+    int32_t codecconfig;   /* buffer flags seen */
+    int32_t starttime;
+    int32_t timeunknown;
+    int32_t decodeonly;
+    int32_t corrupt;
+    int32_t eos;
+    int32_t avc;           /* input port set to OMX_VIDEO_CodingAVC */
+    int32_t startvalid;    /* bStartWithValidFrame of the error concealment */
+    int32_t portsettings;  /* OMX_EventPortSettingsChanged on port 131 */
+    int32_t tunnels;       /* tunnels set up */
+    int32_t rendering;     /* video_render is executing */
+    int32_t shown;         /* frames that got through to video_render */
+    int32_t rendereos;     /* EOS that got through to video_render */
+    int32_t resets;        /* video_decode back in Loaded */
+    int32_t errors;        /* error events raised, OMX_ErrorSameState included */
+    int32_t audio;         /* buffers played by audio_render */
+    int32_t held;          /* input buffers the client still had when the port went */
+    int32_t forever;       /* waits without timeout that could never have ended */
+    int32_t misuse;        /* calls the firmware would refuse or hang on */
+} omxstubstats;
+
+/* Arms a fault that hits after video_decode took that many more buffers, the
+ * environment variable OMXSTUB_FAULT=hang:N, error:N or corrupt:N does the
+ * same at OMX_Init. The fault is gone once it hit and the decoder was reset. */
+void omxstub_fault (int32_t fault, int32_t after);
+
+void omxstub_stats (omxstubstats* stats);
+
+#endif /* OMXSTUB_H */
@@ -0,0 +1,199 @@
+/* RTCP of the stream h264.bin receives */
+
+#include <string.h>
+
+#include "rtcp.h"
+
+/* RFC 3550 A.1 */
+#define RTCP_MAX_DROPOUT 3000u
+#define RTCP_MAX_MISORDER 100u
+/* RTP clock of MP2T */
+#define RTCP_CLOCK_HZ 90000
+/* NTP counts from 1900 */
+#define RTCP_NTP_UNIX 2208988800
+
+#define INLINE static inline
+
+INLINE uint32_t get32 (const uint8_t* p);
+INLINE uint32_t get32 (const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+INLINE void put32 (uint8_t* p, uint32_t v);
+INLINE void put32 (uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+INLINE void restart (rtcpreceiver* r, uint16_t seq);
+INLINE void restart (rtcpreceiver* r, uint16_t seq)
+{
+    r->maxseq = seq;
+    r->cycles = 0;
+    r->baseseq = seq;
+    r->badseq = 0x10000u + 1u;
+    r->received = 0;
+    r->expectedprior = 0;
+    r->receivedprior = 0;
+}
+
+void rtcp_init (rtcpreceiver* r, uint32_t ownssrc)
+{
+    (void)memset (r, 0, sizeof (*r));
+    r->ownssrc = ownssrc;
+    r->lsrat = -1;
+}
+
+void rtcp_received (rtcpreceiver* r, const uint8_t* rtp, int32_t len, int64_t now)
+{
+    if (len >= 12) {
+        uint16_t seq = (uint16_t)(((uint16_t)rtp[2] << 8) | rtp[3]);
+        uint32_t ts = get32 (rtp + 4);
+        uint32_t ssrc = get32 (rtp + 8);
+        bool count = true;
+        if ((!r->started) || (ssrc != r->ssrc)) {
+            if (r->started) {
+                /* a new stream, nothing of the old one carries over */
+                uint32_t own = r->ownssrc;
+                rtcp_init (r, own);
+            }
+            r->ssrc = ssrc;
+            r->started = true;
+            restart (r, seq);
+            r->transit = (uint32_t)((now * RTCP_CLOCK_HZ) / 1000000) - ts;
+        } else {
+            uint16_t delta = (uint16_t)(seq - r->maxseq);
+            if (delta < RTCP_MAX_DROPOUT) {
+                if (seq < r->maxseq) {
+                    r->cycles += 0x10000u;
+                }
+                r->maxseq = seq;
+            } else if (delta <= (0x10000u - RTCP_MAX_MISORDER)) {
+                /* a jump; two packets in a row after it mean the source restarted */
+                if (seq == r->badseq) {
+                    restart (r, seq);
+                } else {
+                    r->badseq = (seq + 1u) & 0xFFFFu;
+                    count = false;
+                }
+            } else {
+                /* duplicate or late */
+            }
+        }
+        if (count) {
+            r->received++;
+            uint32_t transit = (uint32_t)((now * RTCP_CLOCK_HZ) / 1000000) - ts;
+            int32_t d = (int32_t)(transit - r->transit);
+            r->transit = transit;
+            if (d < 0) {
+                d = -d;
+            }
+            /* J += (|D| - J) / 16, kept 16 times larger (A.8) */
+            r->jitter += (uint32_t)d - ((r->jitter + 8u) >> 4);
+        }
+    }
+}
+
+void rtcp_sender_report (rtcpreceiver* r, const uint8_t* data, int32_t len, int64_t now)
+{
+    int32_t pos = 0;
+    while (((pos + 20) <= len) && ((data[pos] >> 6) == 2u)) {
+        if (data[pos + 1] == RTCP_TYPE_SR) {
+            /* the middle 32 bits of the 64 bit NTP timestamp */
+            r->lsr = (get32 (data + pos + 8) << 16) | (get32 (data + pos + 12) >> 16);
+            r->lsrat = now;
+            r->srntp = ((uint64_t)get32 (data + pos + 8) << 32) | get32 (data + pos + 12);
+            r->srrtp = get32 (data + pos + 16);
+        }
+        pos += ((((int32_t)data[pos + 2] << 8) | data[pos + 3]) + 1) * 4;
+    }
+}
+
+int64_t rtcp_source_time (const rtcpreceiver* r, uint32_t rtpts)
+{
+    int64_t us = -1;
+    if (r->lsrat >= 0) {
+        int64_t sec = (int64_t)(r->srntp >> 32) - RTCP_NTP_UNIX;
+        int64_t frac = (int64_t)(((r->srntp & 0xFFFFFFFFu) * 1000000u) >> 32);
+        /* RTP timestamps may run backwards relative to the SR's */
+        int64_t ticks = (int32_t)(rtpts - r->srrtp);
+        us = (sec * 1000000) + frac + ((ticks * 1000000) / RTCP_CLOCK_HZ);
+    }
+    return us;
+}
+
+int32_t rtcp_write_report (rtcpreceiver* r, const char* cname, uint8_t* out, int32_t size, int64_t now)
+{
+    int32_t len = 0;
+    int32_t namelen = (int32_t)strlen (cname);
+    /* the RR, and the SDES header, SSRC, item header and END in whole words */
+    int32_t room = ((size - 32) & ~3) - 11;
+    if (namelen > room) {
+        namelen = room;
+    }
+    if (namelen > 255) {
+        namelen = 255;
+    }
+    /* SDES: header, SSRC, CNAME item, END, padded to 32 bits */
+    int32_t sdeslen = (8 + 2 + namelen + 1 + 3) & ~3;
+    if ((r->started) && (room >= 0) && ((32 + sdeslen) <= size)) {
+        uint32_t extmax = r->cycles + r->maxseq;
+        uint32_t expected = extmax - r->baseseq + 1u;
+        int64_t lost = (int64_t)expected - r->received;
+        if (lost > 0x7FFFFF) {
+            lost = 0x7FFFFF;
+        } else if (lost < -0x800000) {
+            lost = -0x800000;
+        } else {
+            /* empty */
+        }
+        uint32_t expint = expected - r->expectedprior;
+        uint32_t recint = r->received - r->receivedprior;
+        int64_t lostint = (int64_t)expint - recint;
+        uint32_t fraction = ((expint == 0u) || (lostint <= 0)) ? 0u : (uint32_t)((lostint << 8) / expint);
+        r->expectedprior = expected;
+        r->receivedprior = r->received;
+        uint32_t dlsr = (r->lsrat >= 0) ? (uint32_t)(((now - r->lsrat) * 65536) / 1000000) : 0u;
+
+        out[0] = 0x81; /* version 2, one report block */
+        out[1] = RTCP_TYPE_RR;
+        out[2] = 0;
+        out[3] = 7;
+        put32 (out + 4, r->ownssrc);
+        put32 (out + 8, r->ssrc);
+        put32 (out + 12, (((fraction > 255u) ? 255u : fraction) << 24) | ((uint32_t)lost & 0xFFFFFFu));
+        put32 (out + 16, extmax);
+        put32 (out + 20, r->jitter >> 4);
+        put32 (out + 24, (r->lsrat >= 0) ? r->lsr : 0u);
+        put32 (out + 28, dlsr);
+
+        uint8_t* sdes = out + 32;
+        (void)memset (sdes, 0, (size_t)sdeslen);
+        sdes[0] = 0x81; /* one chunk */
+        sdes[1] = RTCP_TYPE_SDES;
+        sdes[2] = (uint8_t)(((sdeslen / 4) - 1) >> 8);
+        sdes[3] = (uint8_t)((sdeslen / 4) - 1);
+        put32 (sdes + 4, r->ownssrc);
+        sdes[8] = 1; /* CNAME */
+        sdes[9] = (uint8_t)namelen;
+        (void)memcpy (sdes + 10, cname, (size_t)namelen);
+        len = 32 + sdeslen;
+    }
+    return len;
+}
+
+bool rtcp_has_bye (const uint8_t* data, int32_t len)
+{
+    bool bye = false;
+    int32_t pos = 0;
+    /* version 2, each packet gives its length in 32 bit words minus one */
+    while ((!bye) && ((pos + 4) <= len) && ((data[pos] >> 6) == 2u)) {
+        bye = (data[pos + 1] == RTCP_TYPE_BYE);
+        pos += ((((int32_t)data[pos + 2] << 8) | data[pos + 3]) + 1) * 4;
+    }
+    return bye;
+}
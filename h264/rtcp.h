@@ -0,0 +1,56 @@
+/* RTCP of the stream h264.bin receives */
+
+#ifndef RTCP_H
+#define RTCP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* One above the RTP port 1028 of the first session */
+#define RTCP_PORT 1029
+
+#define RTCP_TYPE_SR 200
+#define RTCP_TYPE_RR 201
+#define RTCP_TYPE_SDES 202
+#define RTCP_TYPE_BYE 203
+
+/* Room for a receiver report (32 bytes) and the SDES with a CNAME of the
+ * longest an SDES item can take, 255 bytes (268 with its headers and END) */
+#define RTCP_REPORT_SIZE (32 + 268)
+
+/* Reception statistics of one source as RFC 3550 appendix A keeps them */
+typedef struct srtcpreceiver {
+    uint32_t ssrc;            /* of the source */
+    uint32_t ownssrc;
+    bool started;             /* a packet of ssrc has been seen */
+    uint16_t maxseq;          /* highest sequence number seen */
+    uint32_t cycles;          /* sequence number wraps, shifted by 16 */
+    uint32_t baseseq;
+    uint32_t badseq;          /* the next sequence number after a jump */
+    uint32_t received;
+    uint32_t expectedprior;   /* at the last report */
+    uint32_t receivedprior;
+    uint32_t transit;         /* arrival minus RTP timestamp of the last packet */
+    uint32_t jitter;          /* interarrival jitter in 1/16 RTP timestamp units */
+    uint32_t lsr;             /* middle of the NTP timestamp of the last SR */
+    int64_t lsrat;            /* when it arrived, -1 before the first */
+    uint64_t srntp;           /* NTP and RTP timestamp of the last SR */
+    uint32_t srrtp;
+} rtcpreceiver;
+
+void rtcp_init (rtcpreceiver* r, uint32_t ownssrc);
+/* Accounts an RTP packet the moment it arrived. A new SSRC starts over. */
+void rtcp_received (rtcpreceiver* r, const uint8_t* rtp, int32_t len, int64_t now);
+/* Takes note of sender reports in the compound packet, for LSR and DLSR. */
+void rtcp_sender_report (rtcpreceiver* r, const uint8_t* data, int32_t len, int64_t now);
+/* The source's wall clock in microseconds since 1970 when it stamped an RTP
+ * packet with rtpts, going by the last sender report. -1 without one. */
+int64_t rtcp_source_time (const rtcpreceiver* r, uint32_t rtpts);
+/* Writes a receiver report with the statistics since the last one, followed
+ * by an SDES with the CNAME, cut short if it does not fit into size. Returns
+ * the length, or 0 before the first packet. */
+int32_t rtcp_write_report (rtcpreceiver* r, const char* cname, uint8_t* out, int32_t size, int64_t now);
+/* True if the compound packet holds a BYE, the source ended the stream. */
+bool rtcp_has_bye (const uint8_t* data, int32_t len);
+
+#endif /* RTCP_H */
@@ -0,0 +1,758 @@
+/* RTSP/WFD sink session of h264.bin
+ *
+ * One non-blocking connection served by an event loop: messages are parsed
+ * as their bytes arrive, and the response and keep-alive timeouts live on a
+ * timer wheel, so nothing ever blocks on the source. The capabilities sent
+ * in M3 are the ones project.py advertises. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "rtsp.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+#ifndef RTSP_RESPONSE_TIMEOUT_MS
+/**
+ * Time the source has to connect and to answer a request of the sink
+ */
+#define RTSP_RESPONSE_TIMEOUT_MS (5000)
+#endif /* RTSP_RESPONSE_TIMEOUT_MS */
+
+#ifndef RTSP_IDLE_TIMEOUT_MS
+/**
+ * The session ends when nothing arrives from the source for this long,
+ * unless the source gives its keep-alive timeout in the SETUP response
+ */
+#define RTSP_IDLE_TIMEOUT_MS (70000)
+#endif /* RTSP_IDLE_TIMEOUT_MS */
+
+#ifndef RTSP_TCP_RCVBUF
+/**
+ * Receive buffer of a connection that may carry the stream, so that the
+ * window stays open while the receiver catches up
+ */
+#define RTSP_TCP_RCVBUF (1024 * 1024)
+#endif /* RTSP_TCP_RCVBUF */
+
+#define RTSP_BUFFER_SIZE 8192
+/* reads in one go while frames arrive, before the loop looks at the rest */
+#define RTSP_MAX_READS 64
+#define RTSP_MAX_PENDING 4
+#define RTSP_URL_SIZE 256
+#define RTSP_SESSION_SIZE 64
+#define RTSP_TICK_MS 100
+#define RTSP_WHEEL_SLOTS 64
+
+/* The M3 answer project.py builds in get_video_parameter, keep the two in
+ * step: CBP and CHP up to level 4.2, the CEA modes up to 1080p30 except
+ * 720p60 and slice encoding. The RTP port of the session goes in at %d. */
+#define RTSP_SINK_PARAMS \
+    "wfd_client_rtp_ports: RTP/AVP/UDP;unicast %d 0 mode=play\r\n" \
+    "wfd_audio_codecs: LPCM 00000002 00\r\n" \
+    "wfd_video_formats: 08 00 03 10 00019CBF 00000000 00000000 00 0078 1C43 00 none none\r\n" \
+    "wfd_3d_video_formats: none\r\n" \
+    "wfd_coupled_sink: none\r\n" \
+    "wfd_display_edid: none\r\n" \
+    "wfd_connector_type: 05\r\n" \
+    "wfd_uibc_capability: none\r\n" \
+    "wfd_standby_resume_capability: none\r\n" \
+    "wfd_content_protection: none\r\n"
+
+#define STATE_CONNECTING 0
+#define STATE_NEGOTIATING 1 /* M1 to M5 */
+#define STATE_PLAYING 2
+#define STATE_TEARDOWN 3
+#define STATE_DONE 4
+
+#define REQ_OPTIONS 0
+#define REQ_SETUP 1
+#define REQ_PLAY 2
+#define REQ_PAUSE 3
+#define REQ_TEARDOWN 4
+#define REQ_IDR 5
+
+typedef struct srtsptimer rtsptimer;
+typedef void (*rtsptimerfn) (rtspsession* s, rtsptimer* t);
+
+struct srtsptimer {
+    rtsptimer* next;
+    rtsptimer* prev;
+    uint32_t slot;
+    uint32_t rounds;     /* turns of the wheel left before it fires */
+    bool armed;
+    rtsptimerfn fire;    /* must not cancel or arm other timers */
+};
+
+typedef struct srtsppending {
+    rtsptimer timer;     /* first, the timeout finds the request through it */
+    int32_t cseq;
+    int32_t kind;        /* REQ_, -1 for a free entry */
+} rtsppending;
+
+struct srtspsession {
+    int fd;
+    int wakefd;          /* rtsp_request_idr and rtsp_stream_lost wake the event loop with it */
+    atomic_bool idrwanted;
+    atomic_bool streamlost;
+    bool paused;         /* the source paused the stream, silence is expected */
+    int32_t state;
+    int32_t result;
+    int32_t cseq;
+    bool optionssent;
+    int64_t connectus;
+    int32_t idlems;
+    char url[RTSP_URL_SIZE];
+    char session[RTSP_SESSION_SIZE];
+    char rx[RTSP_BUFFER_SIZE];
+    int32_t rxlen;
+    int32_t scanned;     /* bytes of rx known not to hold the end of the headers */
+    char tx[RTSP_BUFFER_SIZE];
+    int32_t txlen;
+    uint16_t rtpport;    /* the stream is wanted on, RTCP one above */
+    const rtspframes* frames; /* NULL if only UDP is offered */
+    bool interleaved;    /* the source sends the stream on this connection */
+    uint8_t rtpchannel;
+    uint8_t rtcpchannel;
+    uint8_t* frame;      /* buffer of the frame being read, NULL to skip it */
+    int32_t framelen;    /* -1 outside a frame */
+    int32_t framegot;
+    bool framertcp;
+    rtsppending pending[RTSP_MAX_PENDING];
+    rtsptimer idle;
+    rtsptimer* wheel[RTSP_WHEEL_SLOTS];
+    uint32_t tick;
+    int64_t nexttick;
+};
+
+#define INLINE static inline
+
+static void finish (rtspsession* s, int32_t result);
+static void finish (rtspsession* s, int32_t result)
+{
+    if (s->state != STATE_DONE) {
+        s->state = STATE_DONE;
+        s->result = result;
+    }
+}
+
+INLINE void timer_cancel (rtspsession* s, rtsptimer* t);
+INLINE void timer_cancel (rtspsession* s, rtsptimer* t)
+{
+    if (t->armed) {
+        if (t->prev != NULL) {
+            t->prev->next = t->next;
+        } else {
+            s->wheel[t->slot] = t->next;
+        }
+        if (t->next != NULL) {
+            t->next->prev = t->prev;
+        }
+        t->armed = false;
+    }
+}
+
+INLINE void timer_arm (rtspsession* s, rtsptimer* t, int32_t ms);
+INLINE void timer_arm (rtspsession* s, rtsptimer* t, int32_t ms)
+{
+    uint32_t ticks = (uint32_t)((ms + RTSP_TICK_MS - 1) / RTSP_TICK_MS);
+    if (ticks == 0u) {
+        ticks = 1u;
+    }
+    timer_cancel (s, t);
+    t->slot = (s->tick + ticks) % RTSP_WHEEL_SLOTS;
+    t->rounds = (ticks - 1u) / RTSP_WHEEL_SLOTS;
+    t->prev = NULL;
+    t->next = s->wheel[t->slot];
+    if (t->next != NULL) {
+        t->next->prev = t;
+    }
+    s->wheel[t->slot] = t;
+    t->armed = true;
+}
+
+static void timer_advance (rtspsession* s, int64_t now);
+static void timer_advance (rtspsession* s, int64_t now)
+{
+    while ((s->state != STATE_DONE) && (now >= s->nexttick)) {
+        s->tick++;
+        s->nexttick += RTSP_TICK_MS * 1000;
+        rtsptimer* t = s->wheel[s->tick % RTSP_WHEEL_SLOTS];
+        while (t != NULL) {
+            rtsptimer* next = t->next;
+            if (t->rounds == 0u) {
+                timer_cancel (s, t);
+                t->fire (s, t);
+            } else {
+                t->rounds--;
+            }
+            t = next;
+        }
+    }
+}
+
+static void idle_expired (rtspsession* s, rtsptimer* t);
+static void idle_expired (rtspsession* s, rtsptimer* t)
+{
+    (void)t;
+    DBG_PRINTF_ERROR ("source silent in state %d\n", s->state);
+    finish (s, -1);
+}
+
+static void response_expired (rtspsession* s, rtsptimer* t);
+static void response_expired (rtspsession* s, rtsptimer* t)
+{
+    rtsppending* p = (rtsppending*)t;
+    DBG_PRINTF_WARNING ("no response to request %d\n", p->cseq);
+    if (p->kind == REQ_TEARDOWN) {
+        finish (s, 0);
+    } else if ((p->kind == REQ_SETUP) || (p->kind == REQ_PLAY)) {
+        finish (s, -1);
+    } else {
+        /* empty */
+    }
+    p->kind = -1;
+}
+
+static void flush (rtspsession* s);
+static void flush (rtspsession* s)
+{
+    if ((s->txlen > 0) && (s->state != STATE_CONNECTING)) {
+        ssize_t sent = send (s->fd, s->tx, (size_t)s->txlen, MSG_NOSIGNAL);
+        if (sent > 0) {
+            s->txlen -= (int32_t)sent;
+            (void)memmove (s->tx, s->tx + sent, (size_t)s->txlen);
+        } else if ((sent < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+            DBG_PRINTF_ERROR ("send failed\n");
+            finish (s, -1);
+        } else {
+            /* empty */
+        }
+    }
+}
+
+static void queue (rtspsession* s, const char* msg, int32_t len);
+static void queue (rtspsession* s, const char* msg, int32_t len)
+{
+    if ((len < 0) || (len > (RTSP_BUFFER_SIZE - s->txlen))) {
+        DBG_PRINTF_ERROR ("send buffer full\n");
+        finish (s, -1);
+    } else {
+        (void)memcpy (s->tx + s->txlen, msg, (size_t)len);
+        s->txlen += len;
+        flush (s);
+    }
+}
+
+static void reply (rtspsession* s, int32_t cseq, const char* status, const char* headers, const char* body);
+static void reply (rtspsession* s, int32_t cseq, const char* status, const char* headers, const char* body)
+{
+    char msg[RTSP_BUFFER_SIZE / 2];
+    int32_t len;
+    if (body != NULL) {
+        len = snprintf (msg, sizeof (msg), "RTSP/1.0 %s\r\nCSeq: %d\r\n%sContent-Type: text/parameters\r\nContent-Length: %d\r\n\r\n%s",
+                        status, cseq, headers, (int)strlen (body), body);
+    } else {
+        len = snprintf (msg, sizeof (msg), "RTSP/1.0 %s\r\nCSeq: %d\r\n%s\r\n", status, cseq, headers);
+    }
+    queue (s, msg, (len < (int32_t)sizeof (msg)) ? len : -1);
+}
+
+static void request (rtspsession* s, const char* method, const char* url, const char* headers, const char* body, int32_t kind);
+static void request (rtspsession* s, const char* method, const char* url, const char* headers, const char* body, int32_t kind)
+{
+    char msg[RTSP_BUFFER_SIZE / 2];
+    char session[RTSP_SESSION_SIZE + 16] = "";
+    int32_t len;
+    int32_t cseq = s->cseq;
+    s->cseq++;
+    if (s->session[0] != '\0') {
+        (void)snprintf (session, sizeof (session), "Session: %s\r\n", s->session);
+    }
+    if (body != NULL) {
+        len = snprintf (msg, sizeof (msg), "%s %s RTSP/1.0\r\nCSeq: %d\r\n%s%sContent-Type: text/parameters\r\nContent-Length: %d\r\n\r\n%s",
+                        method, url, cseq, session, headers, (int)strlen (body), body);
+    } else {
+        len = snprintf (msg, sizeof (msg), "%s %s RTSP/1.0\r\nCSeq: %d\r\n%s%s\r\n", method, url, cseq, session, headers);
+    }
+    queue (s, msg, (len < (int32_t)sizeof (msg)) ? len : -1);
+    for (int32_t i = 0; i < RTSP_MAX_PENDING; i++) {
+        if (s->pending[i].kind < 0) {
+            s->pending[i].kind = kind;
+            s->pending[i].cseq = cseq;
+            timer_arm (s, &s->pending[i].timer, RTSP_RESPONSE_TIMEOUT_MS);
+            break;
+        }
+    }
+}
+
+/* Position of needle in the len bytes at hay, -1 if it is not there */
+static int32_t find (const char* hay, int32_t len, const char* needle);
+static int32_t find (const char* hay, int32_t len, const char* needle)
+{
+    int32_t ret = -1;
+    int32_t nlen = (int32_t)strlen (needle);
+    for (int32_t i = 0; (i + nlen) <= len; i++) {
+        if ((hay[i] == needle[0]) && (memcmp (hay + i, needle, (size_t)nlen) == 0)) {
+            ret = i;
+            break;
+        }
+    }
+    return ret;
+}
+
+/* Copies the value of a header, names compare case-insensitively */
+static bool header (const char* hdr, int32_t len, const char* name, char* value, size_t size);
+static bool header (const char* hdr, int32_t len, const char* name, char* value, size_t size)
+{
+    bool found = false;
+    size_t nlen = strlen (name);
+    int32_t pos = 0;
+    while ((!found) && (pos < len)) {
+        int32_t end = find (hdr + pos, len - pos, "\r\n");
+        int32_t linelen = (end < 0) ? (len - pos) : end;
+        const char* line = hdr + pos;
+        if (((size_t)linelen > nlen) && (line[nlen] == ':') && (strncasecmp (line, name, nlen) == 0)) {
+            size_t v = nlen + 1u;
+            while ((v < (size_t)linelen) && (line[v] == ' ')) {
+                v++;
+            }
+            size_t n = (size_t)linelen - v;
+            n = (n < (size_t)(size - 1u)) ? n : (size - 1u);
+            (void)memcpy (value, line + v, n);
+            value[n] = '\0';
+            found = true;
+        }
+        pos += linelen + 2;
+    }
+    return found;
+}
+
+static void on_request (rtspsession* s, const char* method, int32_t cseq, const char* body, int32_t bodylen);
+static void on_request (rtspsession* s, const char* method, int32_t cseq, const char* body, int32_t bodylen)
+{
+    if (strcmp (method, "OPTIONS") == 0) {
+        /* M1, answered by M2 */
+        reply (s, cseq, "200 OK", "Public: org.wfa.wfd1.0, SET_PARAMETER, GET_PARAMETER\r\n", NULL);
+        if (!s->optionssent) {
+            request (s, "OPTIONS", "*", "Require: org.wfa.wfd1.0\r\n", NULL, REQ_OPTIONS);
+            s->optionssent = true;
+        }
+    } else if (strcmp (method, "GET_PARAMETER") == 0) {
+        /* M3, or a keep-alive (M16) when empty */
+        char params[sizeof (RTSP_SINK_PARAMS) + 8];
+        (void)snprintf (params, sizeof (params), RTSP_SINK_PARAMS, s->rtpport);
+        reply (s, cseq, "200 OK", "", (bodylen > 0) ? params : NULL);
+    } else if (strcmp (method, "SET_PARAMETER") == 0) {
+        reply (s, cseq, "200 OK", "", NULL);
+        int32_t url = find (body, bodylen, "wfd_presentation_URL: ");
+        if (url >= 0) {
+            /* M4 */
+            int32_t from = url + (int32_t)strlen ("wfd_presentation_URL: ");
+            int32_t n = 0;
+            while (((from + n) < bodylen) && (body[from + n] != ' ') && (body[from + n] != '\r') && (n < (RTSP_URL_SIZE - 1))) {
+                n++;
+            }
+            (void)memcpy (s->url, body + from, (size_t)n);
+            s->url[n] = '\0';
+        }
+        if (find (body, bodylen, "wfd_trigger_method: SETUP") >= 0) {
+            /* M5, answered by M6 */
+            char transport[128];
+            (void)snprintf (transport, sizeof (transport), "Transport: %sRTP/AVP/UDP;unicast;client_port=%d-%d\r\n",
+                            (s->frames != NULL) ? "RTP/AVP/TCP;unicast;interleaved=0-1," : "", s->rtpport, s->rtpport + 1);
+            request (s, "SETUP", s->url, transport, NULL, REQ_SETUP);
+        } else if (find (body, bodylen, "wfd_trigger_method: TEARDOWN") >= 0) {
+            request (s, "TEARDOWN", s->url, "", NULL, REQ_TEARDOWN);
+            s->state = STATE_TEARDOWN;
+        } else if (find (body, bodylen, "wfd_trigger_method: PLAY") >= 0) {
+            request (s, "PLAY", s->url, "", NULL, REQ_PLAY);
+        } else if (find (body, bodylen, "wfd_trigger_method: PAUSE") >= 0) {
+            request (s, "PAUSE", s->url, "", NULL, REQ_PAUSE);
+        } else {
+            /* empty */
+        }
+    } else {
+        reply (s, cseq, "501 Not Implemented", "", NULL);
+    }
+}
+
+static void on_response (rtspsession* s, int32_t status, int32_t cseq, const char* session, const char* transport);
+static void on_response (rtspsession* s, int32_t status, int32_t cseq, const char* session, const char* transport)
+{
+    int32_t kind = -1;
+    for (int32_t i = 0; i < RTSP_MAX_PENDING; i++) {
+        if ((s->pending[i].kind >= 0) && (s->pending[i].cseq == cseq)) {
+            kind = s->pending[i].kind;
+            s->pending[i].kind = -1;
+            timer_cancel (s, &s->pending[i].timer);
+        }
+    }
+    if ((status != 200) && (kind >= 0)) {
+        DBG_PRINTF_WARNING ("request %d failed with %d\n", cseq, status);
+    }
+    if ((kind == REQ_SETUP) && (status == 200) && (session[0] != '\0')) {
+        /* M6: "Session: id;timeout=seconds" */
+        const char* timeout = strstr (session, ";timeout=");
+        size_t n = strcspn (session, ";");
+        n = (n < (RTSP_SESSION_SIZE - 1)) ? n : (RTSP_SESSION_SIZE - 1);
+        (void)memcpy (s->session, session, n);
+        s->session[n] = '\0';
+        if (timeout != NULL) {
+            s->idlems = (atoi (timeout + strlen (";timeout=")) * 1000) + RTSP_RESPONSE_TIMEOUT_MS;
+        }
+        /* the source picked one of the transports offered */
+        const char* channels = strstr (transport, "interleaved=");
+        if ((s->frames != NULL) && (strstr (transport, "RTP/AVP/TCP") != NULL)) {
+            s->interleaved = true;
+            s->rtpchannel = 0;
+            s->rtcpchannel = 1;
+            if (channels != NULL) {
+                s->rtpchannel = (uint8_t)atoi (channels + strlen ("interleaved="));
+                const char* dash = strchr (channels, '-');
+                s->rtcpchannel = (dash != NULL) ? (uint8_t)atoi (dash + 1) : (uint8_t)(s->rtpchannel + 1u);
+            }
+            DBG_PRINTF_DEBUG ("RTP interleaved on channel %d\n", s->rtpchannel);
+        }
+        request (s, "PLAY", s->url, "", NULL, REQ_PLAY);
+    } else if ((kind == REQ_SETUP) || ((kind == REQ_PLAY) && (status != 200) && (s->state != STATE_PLAYING))) {
+        finish (s, -1);
+    } else if ((kind == REQ_PLAY) && (status == 200) && (s->state == STATE_NEGOTIATING)) {
+        /* M7 */
+        s->state = STATE_PLAYING;
+        DBG_PRINTF_DEBUG ("playing %lld ms after connecting\n", (long long)((stats_now_us() - s->connectus) / 1000));
+    } else if (((kind == REQ_PLAY) || (kind == REQ_PAUSE)) && (status == 200)) {
+        s->paused = (kind == REQ_PAUSE);
+    } else if (kind == REQ_TEARDOWN) {
+        finish (s, 0);
+    } else {
+        /* empty */
+    }
+}
+
+/* Hands the frame on once all of it is in */
+static void endframe (rtspsession* s);
+static void endframe (rtspsession* s)
+{
+    if (s->framegot == s->framelen) {
+        if (s->frame != NULL) {
+            s->frames->frame (s->frames->ctx, s->framertcp, s->framelen);
+        }
+        s->frame = NULL;
+        s->framelen = -1;
+    }
+}
+
+/* Starts the interleaved frame at the start of rx; what of it came with the
+ * last read is copied, receive reads the rest into its buffer. Returns false
+ * until the 4 byte header is in. */
+static bool beginframe (rtspsession* s);
+static bool beginframe (rtspsession* s)
+{
+    bool begun = s->rxlen >= 4;
+    if (begun) {
+        uint8_t channel = (uint8_t)s->rx[1];
+        int32_t len = ((int32_t)(uint8_t)s->rx[2] << 8) | (uint8_t)s->rx[3];
+        int32_t have = ((s->rxlen - 4) < len) ? (s->rxlen - 4) : len;
+        s->framertcp = (channel == s->rtcpchannel);
+        s->frame = NULL;
+        if (((channel == s->rtpchannel) || (s->framertcp)) && (len <= RTSP_FRAME_MAX)) {
+            s->frame = s->frames->buffer (s->frames->ctx, s->framertcp);
+        }
+        if (s->frame != NULL) {
+            (void)memcpy (s->frame, s->rx + 4, (size_t)have);
+        }
+        s->framelen = len;
+        s->framegot = have;
+        s->rxlen -= 4 + have;
+        (void)memmove (s->rx, s->rx + 4 + have, (size_t)s->rxlen);
+        s->scanned = 0;
+        endframe (s);
+    }
+    return begun;
+}
+
+/* Handles every complete message in rx, the rest stays for the next read */
+static void parse (rtspsession* s);
+static void parse (rtspsession* s)
+{
+    bool more = true;
+    while ((more) && (s->state != STATE_DONE) && (s->framelen < 0) && (s->rxlen > 0)) {
+        int32_t end = -1;
+        more = false;
+        if ((s->interleaved) && (s->rx[0] == '$')) {
+            more = beginframe (s);
+        } else {
+            end = find (s->rx + s->scanned, s->rxlen - s->scanned, "\r\n\r\n");
+        }
+        if (more) {
+            /* empty */
+        } else if ((s->interleaved) && (s->rx[0] == '$')) {
+            /* the rest of the header is on its way */
+        } else if (end < 0) {
+            s->scanned = (s->rxlen > 3) ? (s->rxlen - 3) : 0;
+            if (s->rxlen == RTSP_BUFFER_SIZE) {
+                DBG_PRINTF_ERROR ("header too long\n");
+                finish (s, -1);
+            }
+        } else {
+            int32_t hdrlen = s->scanned + end + 2;
+            char value[RTSP_URL_SIZE];
+            int32_t bodylen = header (s->rx, hdrlen, "Content-Length", value, sizeof (value)) ? atoi (value) : 0;
+            int32_t total = hdrlen + 2 + bodylen;
+            if ((bodylen < 0) || (total > RTSP_BUFFER_SIZE)) {
+                DBG_PRINTF_ERROR ("message too long\n");
+                finish (s, -1);
+            } else if (total <= s->rxlen) {
+                int32_t cseq = header (s->rx, hdrlen, "CSeq", value, sizeof (value)) ? atoi (value) : -1;
+                const char* body = s->rx + hdrlen + 2;
+                if (strncmp (s->rx, "RTSP/1.0 ", 9) == 0) {
+                    char session[RTSP_SESSION_SIZE * 2] = "";
+                    char transport[RTSP_URL_SIZE] = "";
+                    (void)header (s->rx, hdrlen, "Session", session, sizeof (session));
+                    (void)header (s->rx, hdrlen, "Transport", transport, sizeof (transport));
+                    on_response (s, atoi (s->rx + 9), cseq, session, transport);
+                } else {
+                    char method[32];
+                    size_t n = strcspn (s->rx, " \r");
+                    n = (n < (sizeof (method) - 1u)) ? n : (sizeof (method) - 1u);
+                    (void)memcpy (method, s->rx, n);
+                    method[n] = '\0';
+                    on_request (s, method, cseq, body, bodylen);
+                }
+                s->rxlen -= total;
+                (void)memmove (s->rx, s->rx + total, (size_t)s->rxlen);
+                s->scanned = 0;
+                more = true;
+            } else {
+                /* the body is still on its way, the headers are parsed again then */
+            }
+        }
+    }
+}
+
+static void receive (rtspsession* s);
+static void receive (rtspsession* s)
+{
+    ssize_t got;
+    int32_t reads = 0;
+    do {
+        if (s->framelen >= 0) {
+            /* the rest of an interleaved frame, straight into its buffer; rx
+             * is empty meanwhile and takes a skipped one */
+            int32_t want = s->framelen - s->framegot;
+            if (s->frame != NULL) {
+                got = recv (s->fd, s->frame + s->framegot, (size_t)want, 0);
+            } else {
+                got = recv (s->fd, s->rx, (size_t)((want < RTSP_BUFFER_SIZE) ? want : RTSP_BUFFER_SIZE), 0);
+            }
+            if (got > 0) {
+                s->framegot += (int32_t)got;
+                endframe (s);
+            }
+        } else {
+            /* only the header of what may be a frame, so that the frame
+             * itself is not read into rx and copied */
+            size_t want = (size_t)(RTSP_BUFFER_SIZE - s->rxlen);
+            if ((s->interleaved) && (s->rxlen < 4) && ((s->rxlen == 0) || (s->rx[0] == '$'))) {
+                want = (size_t)(4 - s->rxlen);
+            }
+            got = recv (s->fd, s->rx + s->rxlen, want, 0);
+            if (got > 0) {
+                s->rxlen += (int32_t)got;
+                parse (s);
+            }
+        }
+        reads++;
+    } while ((got > 0) && (s->interleaved) && (s->state != STATE_DONE) && (reads < RTSP_MAX_READS));
+    if (got > 0) {
+        timer_arm (s, &s->idle, s->idlems);
+    } else if (got == 0) {
+        DBG_PRINTF_DEBUG ("source closed the connection\n");
+        finish (s, 0);
+    } else if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) {
+        DBG_PRINTF_ERROR ("recv failed\n");
+        finish (s, -1);
+    } else if (reads > 1) {
+        /* read something before running dry */
+        timer_arm (s, &s->idle, s->idlems);
+    } else {
+        /* empty */
+    }
+}
+
+/* Resets the session and starts connecting to the source */
+static bool start (rtspsession* s, const char* sourceip, uint16_t port, const rtspframes* frames);
+static bool start (rtspsession* s, const char* sourceip, uint16_t port, const rtspframes* frames)
+{
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = inet_addr (sourceip), .sin_port = htons (port)};
+    int one = 1;
+    int rcvbuf = RTSP_TCP_RCVBUF;
+    timer_cancel (s, &s->idle);
+    for (int32_t i = 0; i < RTSP_MAX_PENDING; i++) {
+        timer_cancel (s, &s->pending[i].timer);
+        s->pending[i].kind = -1;
+    }
+    s->fd = socket (AF_INET, SOCK_STREAM, 0);
+    s->state = STATE_CONNECTING;
+    s->result = 0;
+    s->cseq = 1;
+    s->optionssent = false;
+    s->idlems = RTSP_IDLE_TIMEOUT_MS;
+    s->connectus = stats_now_us();
+    s->nexttick = s->connectus + (RTSP_TICK_MS * 1000);
+    s->session[0] = '\0';
+    s->rxlen = 0;
+    s->scanned = 0;
+    s->txlen = 0;
+    s->frames = frames;
+    s->interleaved = false;
+    s->frame = NULL;
+    s->framelen = -1;
+    s->framegot = 0;
+    atomic_store (&s->idrwanted, false);
+    atomic_store (&s->streamlost, false);
+    s->paused = false;
+    (void)snprintf (s->url, sizeof (s->url), "rtsp://%s/wfd1.0/streamid=0", sourceip);
+    bool ok = (s->fd >= 0) && (fcntl (s->fd, F_SETFL, O_NONBLOCK) == 0) &&
+              (setsockopt (s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one)) == 0) &&
+              /* before connecting, the window scale is agreed on then */
+              ((frames == NULL) || (setsockopt (s->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf)) == 0)) &&
+              ((connect (s->fd, (struct sockaddr*)&addr, sizeof (addr)) == 0) || (errno == EINPROGRESS));
+    if (ok) {
+        timer_arm (s, &s->idle, RTSP_RESPONSE_TIMEOUT_MS);
+    } else {
+        DBG_PRINTF_ERROR ("cannot connect to %s\n", sourceip);
+        finish (s, -1);
+    }
+    return ok;
+}
+
+rtspsession* rtsp_open (const char* sourceip, uint16_t port, uint16_t rtpport, const rtspframes* frames)
+{
+    rtspsession* s = (rtspsession*)calloc (1, sizeof (rtspsession));
+    if (s != NULL) {
+        s->fd = -1;
+        s->rtpport = rtpport;
+        s->wakefd = eventfd (0, EFD_NONBLOCK);
+        s->idle.fire = idle_expired;
+        for (int32_t i = 0; i < RTSP_MAX_PENDING; i++) {
+            s->pending[i].timer.fire = response_expired;
+        }
+        if ((s->wakefd < 0) || (!start (s, sourceip, port, frames))) {
+            rtsp_close (s);
+            s = NULL;
+        }
+    }
+    return s;
+}
+
+int32_t rtsp_reconnect (rtspsession* s, const char* sourceip, uint16_t port, const rtspframes* frames)
+{
+    if (s->fd >= 0) {
+        (void)close (s->fd);
+        s->fd = -1;
+    }
+    return start (s, sourceip, port, frames) ? 0 : -1;
+}
+
+int32_t rtsp_run (rtspsession* s)
+{
+    while (s->state != STATE_DONE) {
+        struct pollfd pfds[2] = {
+            {.fd = s->fd, .events = (short)(POLLIN | (((s->txlen > 0) || (s->state == STATE_CONNECTING)) ? POLLOUT : 0))},
+            {.fd = s->wakefd, .events = POLLIN}};
+        int64_t wait = (s->nexttick - stats_now_us() + 999) / 1000;
+        int ready = poll (pfds, 2, (wait > 0) ? (int)wait : 0);
+        if ((ready > 0) && (s->state == STATE_CONNECTING) && (pfds[0].revents != 0)) {
+            int err = 0;
+            socklen_t len = sizeof (err);
+            if ((getsockopt (s->fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0) && (err == 0)) {
+                s->state = STATE_NEGOTIATING;
+                timer_arm (s, &s->idle, s->idlems);
+            } else {
+                DBG_PRINTF_ERROR ("connect failed\n");
+                finish (s, -1);
+            }
+        }
+        if ((ready > 0) && (s->state != STATE_DONE) && (s->state != STATE_CONNECTING)) {
+            if ((pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                receive (s);
+            }
+            if ((pfds[0].revents & POLLOUT) != 0) {
+                flush (s);
+            }
+        }
+        if ((ready > 0) && ((pfds[1].revents & POLLIN) != 0)) {
+            uint64_t count;
+            if (read (s->wakefd, &count, sizeof (count)) < 0) {
+                /* another wake-up consumed it */
+            }
+        }
+        if ((s->state == STATE_PLAYING) && atomic_exchange (&s->idrwanted, false)) {
+            bool outstanding = false;
+            for (int32_t i = 0; i < RTSP_MAX_PENDING; i++) {
+                outstanding = outstanding || (s->pending[i].kind == REQ_IDR);
+            }
+            if (!outstanding) {
+                request (s, "SET_PARAMETER", "rtsp://localhost/wfd1.0", "", "wfd_idr_request\r\n", REQ_IDR);
+            }
+        }
+        if (atomic_exchange (&s->streamlost, false) && (s->state == STATE_PLAYING) && (!s->paused)) {
+            /* the source is likely out of reach, tell it in case it is not
+             * but do not wait for the answer */
+            DBG_PRINTF_WARNING ("stream lost\n");
+            request (s, "TEARDOWN", s->url, "", NULL, REQ_TEARDOWN);
+            finish (s, -1);
+        }
+        timer_advance (s, stats_now_us());
+    }
+    flush (s);
+    return s->result;
+}
+
+void rtsp_request_idr (rtspsession* s)
+{
+    const uint64_t one = 1;
+    atomic_store (&s->idrwanted, true);
+    if (write (s->wakefd, &one, sizeof (one)) < 0) {
+        /* the counter is full, the loop wakes up anyway */
+    }
+}
+
+void rtsp_stream_lost (rtspsession* s)
+{
+    const uint64_t one = 1;
+    atomic_store (&s->streamlost, true);
+    if (write (s->wakefd, &one, sizeof (one)) < 0) {
+        /* the counter is full, the loop wakes up anyway */
+    }
+}
+
+void rtsp_close (rtspsession* s)
+{
+    if (s != NULL) {
+        if (s->fd >= 0) {
+            (void)close (s->fd);
+        }
+        if (s->wakefd >= 0) {
+            (void)close (s->wakefd);
+        }
+        free (s);
+    }
+}
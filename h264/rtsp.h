@@ -0,0 +1,47 @@
+/* RTSP/WFD sink session of h264.bin, the negotiation project.py did before */
+
+#ifndef RTSP_H
+#define RTSP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RTSP_PORT 7236
+
+/* Largest interleaved frame taken, longer ones are skipped */
+#define RTSP_FRAME_MAX 2048
+
+typedef struct srtspsession rtspsession;
+
+/* Where RTP interleaved on the RTSP connection goes. Both are called on the
+ * thread of rtsp_run. */
+typedef struct srtspframes {
+    void* ctx;
+    /* A buffer of RTSP_FRAME_MAX bytes the next frame is read into, NULL to
+     * skip it. rtcp tells the RTCP channel from the RTP one. */
+    uint8_t* (*buffer) (void* ctx, bool rtcp);
+    /* The frame is complete in the buffer */
+    void (*frame) (void* ctx, bool rtcp, int32_t len);
+} rtspframes;
+
+/* Starts connecting to the source without waiting. Returns NULL on failure.
+ * The stream is asked for on rtpport, with frames RTP/AVP/TCP interleaved is
+ * offered before UDP. */
+rtspsession* rtsp_open (const char* sourceip, uint16_t port, uint16_t rtpport, const rtspframes* frames);
+/* Answers and sends the M1-M8 and keep-alive messages until the session ends.
+ * Returns 0 after a teardown or when the source closed the connection, -1 on
+ * a failed negotiation, a source that went silent or a lost stream. */
+int32_t rtsp_run (rtspsession* s);
+/* Starts the next session of the same object on the same RTP port, rtsp_run
+ * has to have returned. Returns 0 when connecting has started. */
+int32_t rtsp_reconnect (rtspsession* s, const char* sourceip, uint16_t port, const rtspframes* frames);
+/* Asks the source for an IDR picture (wfd_idr_request). Callable from any
+ * thread and never waits; requests while one is outstanding are merged. */
+void rtsp_request_idr (rtspsession* s);
+/* Ends the session with -1 unless the source paused the stream. Callable
+ * from any thread, for a receiver that has not heard from the source. */
+void rtsp_stream_lost (rtspsession* s);
+/* Only after rtsp_run returned and no thread calls rtsp_request_idr any more */
+void rtsp_close (rtspsession* s);
+
+#endif /* RTSP_H */
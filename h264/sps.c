@@ -0,0 +1,385 @@
+/* H.264 parameter set and slice header parsing for the demux stage */
+
+#include <string.h>
+
+#include "sps.h"
+
+#define SLICE_P 0
+#define SLICE_B 1
+#define SLICE_I 2
+#define SLICE_SP 3
+#define SLICE_SI 4
+
+static void skip_scaling_list (bitreader* br, int32_t size);
+static void skip_scaling_list (bitreader* br, int32_t size)
+{
+    int32_t last = 8;
+    int32_t next = 8;
+    for (int32_t j = 0; (j < size) && (!br->overrun); j++) {
+        if (next != 0) {
+            next = (last + br_read_se (br) + 256) % 256;
+        }
+        last = (next == 0) ? last : next;
+    }
+}
+
+static void skip_hrd_parameters (bitreader* br);
+static void skip_hrd_parameters (bitreader* br)
+{
+    uint32_t cpb_cnt = br_read_ue (br) + 1u;
+    (void)br_read (br, 8);
+    for (uint32_t i = 0; (i < cpb_cnt) && (i < 32u); i++) {
+        (void)br_read_ue (br);
+        (void)br_read_ue (br);
+        (void)br_read (br, 1);
+    }
+    (void)br_read (br, 20);
+}
+
+static void parse_vui (bitreader* br, spsinfo* sps);
+static void parse_vui (bitreader* br, spsinfo* sps)
+{
+    if (br_read (br, 1) != 0u) {
+        /* aspect_ratio_info */
+        if (br_read (br, 8) == 255u) {
+            (void)br_read (br, 32);
+        }
+    }
+    if (br_read (br, 1) != 0u) {
+        /* overscan_info */
+        (void)br_read (br, 1);
+    }
+    if (br_read (br, 1) != 0u) {
+        /* video_signal_type */
+        (void)br_read (br, 4);
+        if (br_read (br, 1) != 0u) {
+            (void)br_read (br, 24);
+        }
+    }
+    if (br_read (br, 1) != 0u) {
+        /* chroma_loc_info */
+        (void)br_read_ue (br);
+        (void)br_read_ue (br);
+    }
+    if (br_read (br, 1) != 0u) {
+        /* timing_info */
+        (void)br_read (br, 32);
+        (void)br_read (br, 32);
+        (void)br_read (br, 1);
+    }
+    bool nal_hrd = (br_read (br, 1) != 0u);
+    if (nal_hrd) {
+        skip_hrd_parameters (br);
+    }
+    bool vcl_hrd = (br_read (br, 1) != 0u);
+    if (vcl_hrd) {
+        skip_hrd_parameters (br);
+    }
+    if ((nal_hrd) || (vcl_hrd)) {
+        /* low_delay_hrd_flag */
+        (void)br_read (br, 1);
+    }
+    /* pic_struct_present_flag */
+    (void)br_read (br, 1);
+    sps->restrictpos = br->bitpos;
+    if (br_read (br, 1) != 0u) {
+        (void)br_read (br, 1);
+        for (int32_t i = 0; i < 4; i++) {
+            (void)br_read_ue (br);
+        }
+        sps->max_num_reorder_frames = (int32_t)br_read_ue (br);
+        (void)br_read_ue (br);
+    }
+}
+
+bool sps_parse (const uint8_t* nal, int32_t len, spsinfo* sps)
+{
+    uint8_t rbsp[PARAMSET_MAX_SIZE];
+    int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+    bitreader br;
+    br_init (&br, rbsp, rbsplen);
+
+    sps->profile_idc = (int32_t)br_read (&br, 8);
+    (void)br_read (&br, 16);
+    sps->sps_id = (int32_t)br_read_ue (&br);
+    sps->chroma_format_idc = 1;
+    sps->separate_colour_plane = false;
+    switch (sps->profile_idc) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83: case 86: case 118: case 128: case 138:
+    case 139: case 134: case 135:
+        sps->chroma_format_idc = (int32_t)br_read_ue (&br);
+        if (sps->chroma_format_idc == 3) {
+            sps->separate_colour_plane = (br_read (&br, 1) != 0u);
+        }
+        (void)br_read_ue (&br);
+        (void)br_read_ue (&br);
+        (void)br_read (&br, 1);
+        if (br_read (&br, 1) != 0u) {
+            int32_t lists = (sps->chroma_format_idc != 3) ? 8 : 12;
+            for (int32_t i = 0; i < lists; i++) {
+                if (br_read (&br, 1) != 0u) {
+                    skip_scaling_list (&br, (i < 6) ? 16 : 64);
+                }
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    sps->log2_max_frame_num = (int32_t)br_read_ue (&br) + 4;
+    sps->poc_type = (int32_t)br_read_ue (&br);
+    sps->log2_max_poc_lsb = 0;
+    sps->delta_pic_order_always_zero = false;
+    if (sps->poc_type == 0) {
+        sps->log2_max_poc_lsb = (int32_t)br_read_ue (&br) + 4;
+    } else if (sps->poc_type == 1) {
+        sps->delta_pic_order_always_zero = (br_read (&br, 1) != 0u);
+        (void)br_read_se (&br);
+        (void)br_read_se (&br);
+        uint32_t cycle = br_read_ue (&br);
+        for (uint32_t i = 0; (i < cycle) && (i < 256u); i++) {
+            (void)br_read_se (&br);
+        }
+    } else {
+        /* empty */
+    }
+    sps->max_num_ref_frames = (int32_t)br_read_ue (&br);
+    (void)br_read (&br, 1);
+    sps->width_mbs = (int32_t)br_read_ue (&br) + 1;
+    sps->height_mbs = (int32_t)br_read_ue (&br) + 1;
+    sps->frame_mbs_only = (br_read (&br, 1) != 0u);
+    if (!sps->frame_mbs_only) {
+        sps->height_mbs *= 2;
+        (void)br_read (&br, 1);
+    }
+    (void)br_read (&br, 1);
+    if (br_read (&br, 1) != 0u) {
+        /* frame_cropping */
+        for (int32_t i = 0; i < 4; i++) {
+            (void)br_read_ue (&br);
+        }
+    }
+    sps->vuipos = br.bitpos;
+    sps->restrictpos = -1;
+    sps->max_num_reorder_frames = -1;
+    if (br_read (&br, 1) != 0u) {
+        parse_vui (&br, sps);
+    }
+    return (!br.overrun) && (sps->log2_max_frame_num <= 16) && (sps->log2_max_poc_lsb <= 16);
+}
+
+bool pps_parse (const uint8_t* nal, int32_t len, ppsinfo* pps)
+{
+    uint8_t rbsp[PARAMSET_MAX_SIZE];
+    int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+    bitreader br;
+    br_init (&br, rbsp, rbsplen);
+
+    pps->pps_id = (int32_t)br_read_ue (&br);
+    pps->sps_id = (int32_t)br_read_ue (&br);
+    pps->cabac = (br_read (&br, 1) != 0u);
+    pps->bottom_field_pic_order = (br_read (&br, 1) != 0u);
+    pps->num_slice_groups = (int32_t)br_read_ue (&br) + 1;
+    bool ret = false;
+    if (pps->num_slice_groups == 1) {
+        pps->num_ref_idx_l0 = (int32_t)br_read_ue (&br) + 1;
+        (void)br_read_ue (&br);
+        pps->weighted_pred = (br_read (&br, 1) != 0u);
+        (void)br_read (&br, 2);
+        pps->pic_init_qp = 26 + br_read_se (&br);
+        (void)br_read_se (&br);
+        (void)br_read_se (&br);
+        pps->deblocking_filter_control = (br_read (&br, 1) != 0u);
+        (void)br_read (&br, 1);
+        pps->redundant_pic_cnt_present = (br_read (&br, 1) != 0u);
+        ret = !br.overrun;
+    }
+    return ret;
+}
+
+static void skip_ref_pic_list_modification (bitreader* br);
+static void skip_ref_pic_list_modification (bitreader* br)
+{
+    if (br_read (br, 1) != 0u) {
+        uint32_t idc = 0;
+        do {
+            idc = br_read_ue (br);
+            if (idc < 3u) {
+                (void)br_read_ue (br);
+            }
+        } while ((idc != 3u) && (!br->overrun));
+    }
+}
+
+static void skip_pred_weight_table (bitreader* br, const spsinfo* sps, int32_t num_ref);
+static void skip_pred_weight_table (bitreader* br, const spsinfo* sps, int32_t num_ref)
+{
+    bool chroma = (!sps->separate_colour_plane) && (sps->chroma_format_idc != 0);
+    (void)br_read_ue (br);
+    if (chroma) {
+        (void)br_read_ue (br);
+    }
+    for (int32_t i = 0; (i < num_ref) && (!br->overrun); i++) {
+        if (br_read (br, 1) != 0u) {
+            (void)br_read_se (br);
+            (void)br_read_se (br);
+        }
+        if ((chroma) && (br_read (br, 1) != 0u)) {
+            for (int32_t j = 0; j < 4; j++) {
+                (void)br_read_se (br);
+            }
+        }
+    }
+}
+
+bool slice_parse (bitreader* br, int32_t nal_ref_idc, bool idr, const spsinfo* sps, const ppsinfo* pps, slicehdr* sh)
+{
+    sh->nal_ref_idc = nal_ref_idc;
+    sh->first_mb = (int32_t)br_read_ue (br);
+    sh->slice_type = (int32_t)(br_read_ue (br) % 5u);
+    sh->pps_id = (int32_t)br_read_ue (br);
+    if (sps->separate_colour_plane) {
+        (void)br_read (br, 2);
+    }
+    sh->frame_num = (int32_t)br_read (br, sps->log2_max_frame_num);
+    sh->field_pic = false;
+    if (!sps->frame_mbs_only) {
+        sh->field_pic = (br_read (br, 1) != 0u);
+        if (sh->field_pic) {
+            (void)br_read (br, 1);
+        }
+    }
+    if (idr) {
+        (void)br_read_ue (br);
+    }
+    sh->poc_lsb = 0;
+    sh->delta_poc_bottom = 0;
+    sh->delta_poc[0] = 0;
+    sh->delta_poc[1] = 0;
+    if (sps->poc_type == 0) {
+        sh->poc_lsb = (int32_t)br_read (br, sps->log2_max_poc_lsb);
+        if ((pps->bottom_field_pic_order) && (!sh->field_pic)) {
+            sh->delta_poc_bottom = br_read_se (br);
+        }
+    }
+    if ((sps->poc_type == 1) && (!sps->delta_pic_order_always_zero)) {
+        sh->delta_poc[0] = br_read_se (br);
+        if ((pps->bottom_field_pic_order) && (!sh->field_pic)) {
+            sh->delta_poc[1] = br_read_se (br);
+        }
+    }
+    bool ret = (sh->slice_type != SLICE_B);
+    if ((pps->redundant_pic_cnt_present) && (br_read_ue (br) != 0u)) {
+        /* redundant coded picture */
+        ret = false;
+    }
+    if ((ret) && ((sh->slice_type == SLICE_P) || (sh->slice_type == SLICE_SP))) {
+        int32_t num_ref = pps->num_ref_idx_l0;
+        if (br_read (br, 1) != 0u) {
+            num_ref = (int32_t)br_read_ue (br) + 1;
+        }
+        skip_ref_pic_list_modification (br);
+        if (pps->weighted_pred) {
+            skip_pred_weight_table (br, sps, num_ref);
+        }
+    }
+    sh->markingpos = br->bitpos;
+    if ((ret) && (nal_ref_idc != 0)) {
+        if (idr) {
+            (void)br_read (br, 2);
+        } else if (br_read (br, 1) != 0u) {
+            /* adaptive_ref_pic_marking_mode */
+            uint32_t op = 0;
+            do {
+                op = br_read_ue (br);
+                if ((op == 1u) || (op == 2u) || (op == 3u) || (op == 4u) || (op == 6u)) {
+                    (void)br_read_ue (br);
+                }
+                if (op == 3u) {
+                    (void)br_read_ue (br);
+                }
+            } while ((op != 0u) && (!br->overrun));
+        } else {
+            /* empty */
+        }
+    }
+    sh->markingend = br->bitpos;
+    return (ret) && (!br->overrun);
+}
+
+int32_t slice_first_mb (const uint8_t* nal, int32_t len)
+{
+    uint8_t rbsp[8];
+    int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+    bitreader br;
+    br_init (&br, rbsp, rbsplen);
+    int32_t first_mb = (int32_t)br_read_ue (&br);
+    return br.overrun ? -1 : first_mb;
+}
+
+int32_t sps_low_delay (const uint8_t* nal, int32_t len, uint8_t* out, int32_t maxout)
+{
+    spsinfo sps;
+    int32_t ret = -1;
+    /* an explicit max_num_reorder_frames is the source's to keep */
+    if ((maxout > 1) && sps_parse (nal, len, &sps) && (sps.max_num_reorder_frames < 0)) {
+        uint8_t rbsp[PARAMSET_MAX_SIZE];
+        uint8_t patched[PARAMSET_MAX_SIZE];
+        int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+        bitreader br;
+        bitwriter bw;
+        br_init (&br, rbsp, rbsplen);
+        bw_init (&bw, patched, (int32_t)sizeof (patched));
+        if (sps.restrictpos >= 0) {
+            bw_copy (&bw, &br, 0, sps.restrictpos);
+        } else {
+            bw_copy (&bw, &br, 0, sps.vuipos);
+            /* vui_parameters_present_flag, then no aspect ratio, overscan,
+             * video signal, chroma location, timing, HRD or pic_struct */
+            bw_write (&bw, 1, 1);
+            bw_write (&bw, 0, 8);
+        }
+        /* bitstream_restriction_flag, motion_vectors_over_pic_boundaries_flag */
+        bw_write (&bw, 3, 2);
+        /* the inferred values of max_bytes_per_pic_denom,
+         * max_bits_per_mb_denom and log2_max_mv_length */
+        bw_write_ue (&bw, 2);
+        bw_write_ue (&bw, 1);
+        bw_write_ue (&bw, 15);
+        bw_write_ue (&bw, 15);
+        bw_write_ue (&bw, 0);
+        bw_write_ue (&bw, (sps.max_num_ref_frames > 0) ? (uint32_t)sps.max_num_ref_frames : 1u);
+        int32_t patchedlen = bw_finish (&bw);
+        if (!bw.overrun) {
+            out[0] = nal[0];
+            int32_t n = nal_escape (patched, patchedlen, out + 1, maxout - 1);
+            ret = (n < 0) ? -1 : (n + 1);
+        }
+    }
+    return ret;
+}
+
+int32_t sps_patch_low_delay (uint8_t* data, int32_t len, int32_t maxlen)
+{
+    nalunit nal;
+    int32_t pos = 0;
+    while ((pos = nal_next (data, len, pos, &nal)) >= 0) {
+        if ((nal.type == NAL_TYPE_SLICE) || (nal.type == NAL_TYPE_IDR)) {
+            break;
+        }
+        if ((nal.type == NAL_TYPE_SPS) && (nal.complete)) {
+            uint8_t patched[PARAMSET_MAX_SIZE];
+            int32_t n = sps_low_delay (nal.data, nal.len, patched, (int32_t)sizeof (patched));
+            int32_t start = (int32_t)(nal.data - data);
+            int32_t grow = n - nal.len;
+            if ((n > 0) && ((len + grow) <= maxlen)) {
+                (void)memmove (data + start + n, data + start + nal.len, len - start - nal.len);
+                (void)memcpy (data + start, patched, n);
+                len += grow;
+                pos += grow;
+            }
+        }
+    }
+    return len;
+}
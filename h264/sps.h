@@ -0,0 +1,74 @@
+/* H.264 parameter set and slice header parsing for the demux stage */
+
+#ifndef SPS_H
+#define SPS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nal.h"
+
+typedef struct sspsinfo {
+    int32_t profile_idc;
+    int32_t sps_id;
+    int32_t chroma_format_idc;
+    bool separate_colour_plane;
+    int32_t log2_max_frame_num;
+    int32_t poc_type;
+    int32_t log2_max_poc_lsb;
+    bool delta_pic_order_always_zero;
+    int32_t max_num_ref_frames;
+    int32_t width_mbs;
+    int32_t height_mbs;
+    bool frame_mbs_only;
+    int32_t vuipos;        /* bit position of vui_parameters_present_flag */
+    int32_t restrictpos;   /* bit position of bitstream_restriction_flag, -1 without VUI */
+    int32_t max_num_reorder_frames; /* -1 if not signalled */
+} spsinfo;
+
+typedef struct sppsinfo {
+    int32_t pps_id;
+    int32_t sps_id;
+    bool cabac;
+    bool bottom_field_pic_order;
+    int32_t num_slice_groups;
+    int32_t num_ref_idx_l0;
+    bool weighted_pred;
+    int32_t pic_init_qp;
+    bool deblocking_filter_control;
+    bool redundant_pic_cnt_present;
+} ppsinfo;
+
+typedef struct sslicehdr {
+    int32_t nal_ref_idc;
+    int32_t first_mb;
+    int32_t slice_type;    /* 0 P, 1 B, 2 I, 3 SP, 4 SI */
+    int32_t pps_id;
+    int32_t frame_num;
+    bool field_pic;
+    int32_t poc_lsb;
+    int32_t delta_poc_bottom;
+    int32_t delta_poc[2];
+    int32_t markingpos;    /* bits [markingpos, markingend) hold dec_ref_pic_marking() */
+    int32_t markingend;
+} slicehdr;
+
+/* The parsers take a NAL unit without start code and return false if it is
+ * malformed or uses features the demux stage does not handle. */
+bool sps_parse (const uint8_t* nal, int32_t len, spsinfo* sps);
+bool pps_parse (const uint8_t* nal, int32_t len, ppsinfo* pps);
+/* Parses the slice header up to dec_ref_pic_marking(). The reader is left
+ * on the RBSP so that the marking bits can be copied. */
+bool slice_parse (bitreader* br, int32_t nal_ref_idc, bool idr, const spsinfo* sps, const ppsinfo* pps, slicehdr* sh);
+/* Only reads first_mb_in_slice. */
+int32_t slice_first_mb (const uint8_t* nal, int32_t len);
+/* Writes a copy of an SPS without bitstream restriction that signals
+ * max_num_reorder_frames 0 and a DPB of max_num_ref_frames, so that the
+ * decoder outputs each picture as soon as it is decoded. Returns the new
+ * length, or -1 if the SPS is left as it is. */
+int32_t sps_low_delay (const uint8_t* nal, int32_t len, uint8_t* out, int32_t maxout);
+/* Applies sps_low_delay() to the SPS in front of the first slice of data,
+ * growing it in place up to maxlen. Returns the new length. */
+int32_t sps_patch_low_delay (uint8_t* data, int32_t len, int32_t maxlen);
+
+#endif /* SPS_H */
@@ -0,0 +1,860 @@
+/* SRTP decryption of the stream h264.bin receives */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "srtp.h"
+#include "stats.h"
+
+#define DBG_PRINT_ENABLED 0
+#include "debug_print.h"
+
+/* AES and SHA-1 run on the instructions for them where the CPU has them:
+ * AES-NI and SHA-NI, checked at run time, or the ARMv8 crypto extensions if
+ * the compiler was told the target has them (-march=armv8-a+crypto).
+ * Anything else uses lookup tables and plain SHA-1. */
+#if defined(__x86_64__) || defined(__i386__)
+#define SRTP_AESNI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#include <x86intrin.h>
+#elif defined(__ARM_FEATURE_CRYPTO)
+#define SRTP_ARMV8 1
+#include <arm_neon.h>
+#endif
+
+#define SRTP_RTP_HEADER 12
+/* Packets of the highest index and below that are told apart from replays */
+#define SRTP_REPLAY_WINDOW 64
+
+/* Key derivation labels of RFC 3711 4.3.1 */
+#define LABEL_CIPHER 0x00u
+#define LABEL_AUTH 0x01u
+#define LABEL_SALT 0x02u
+#define SRTP_AUTH_KEY 20
+
+/* Keystream of the self-test: up to block 0xFF01, the last of RFC 3711 B.2 */
+#define SELFTEST_BLOCKS 0xFF02
+/* "a" hashed by it, one million as in FIPS 180-2 A.3 */
+#define SELFTEST_MILLION 1000000
+
+#define INLINE static inline
+
+typedef void (*ctrfunc) (const aeskey* k, const uint8_t* iv, uint8_t* data, int32_t len);
+typedef void (*sha1func) (uint32_t* h, const uint8_t* p, int32_t blocks);
+
+static uint8_t sbox[256];
+static uint32_t table[256];
+static ctrfunc ctr = NULL;
+static sha1func sha1 = NULL;
+static const char* aesengine = "";
+static const char* shaengine = "";
+
+INLINE uint32_t get32 (const uint8_t* p);
+INLINE uint32_t get32 (const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+INLINE void put32 (uint8_t* p, uint32_t v);
+INLINE void put32 (uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+INLINE uint32_t ror (uint32_t v, uint32_t n);
+INLINE uint32_t ror (uint32_t v, uint32_t n)
+{
+    return (v >> n) | (v << (32u - n));
+}
+
+INLINE uint32_t rol (uint32_t v, uint32_t n);
+INLINE uint32_t rol (uint32_t v, uint32_t n)
+{
+    return (v << n) | (v >> (32u - n));
+}
+
+/* Multiplication by x in GF(2^8) */
+INLINE uint8_t xtime (uint8_t b);
+INLINE uint8_t xtime (uint8_t b)
+{
+    return (uint8_t)((uint32_t)b << 1) ^ (((b & 0x80u) != 0u) ? 0x1Bu : 0x00u);
+}
+
+INLINE int64_t now_ns (void);
+INLINE int64_t now_ns (void)
+{
+    struct timespec ts;
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+INLINE int64_t now_cycles (void);
+INLINE int64_t now_cycles (void)
+{
+#ifdef SRTP_AESNI
+    return (int64_t)__rdtsc();
+#else
+    /* the cycle counter is not readable from user space */
+    return 0;
+#endif
+}
+
+INLINE void xorbytes (uint8_t* data, const uint8_t* stream, int32_t len);
+INLINE void xorbytes (uint8_t* data, const uint8_t* stream, int32_t len)
+{
+    for (int32_t i = 0; i < len; i++) {
+        data[i] ^= stream[i];
+    }
+}
+
+/* The S-box from the inverses in GF(2^8), walked through with the generator
+ * 3, and the first round table of the T-table AES from it */
+static void maketables (void);
+
+static void maketables (void)
+{
+    uint8_t p = 1;
+    uint8_t q = 1;
+    do {
+        p = p ^ xtime (p);
+        q ^= (uint8_t)(q << 1);
+        q ^= (uint8_t)(q << 2);
+        q ^= (uint8_t)(q << 4);
+        if ((q & 0x80u) != 0u) {
+            q ^= 0x09u;
+        }
+        uint32_t r = (uint32_t)q * 0x01010101u;
+        sbox[p] = (uint8_t)(q ^ (uint8_t)rol (r, 1) ^ (uint8_t)rol (r, 2) ^ (uint8_t)rol (r, 3) ^ (uint8_t)rol (r, 4) ^ 0x63u);
+    } while (p != 1u);
+    sbox[0] = 0x63u;
+    for (int32_t i = 0; i < 256; i++) {
+        uint8_t s = sbox[i];
+        table[i] = ((uint32_t)xtime (s) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint32_t)(xtime (s) ^ s);
+    }
+}
+
+static void expandkey (aeskey* k, const uint8_t* key);
+
+static void expandkey (aeskey* k, const uint8_t* key)
+{
+    uint8_t rcon = 1;
+    for (int32_t i = 0; i < 4; i++) {
+        k->words[i] = get32 (key + (4 * i));
+    }
+    for (int32_t i = 4; i < 44; i++) {
+        uint32_t t = k->words[i - 1];
+        if ((i % 4) == 0) {
+            t = ((uint32_t)sbox[(t >> 16) & 0xFFu] << 24) | ((uint32_t)sbox[(t >> 8) & 0xFFu] << 16) |
+                ((uint32_t)sbox[t & 0xFFu] << 8) | (uint32_t)sbox[t >> 24];
+            t ^= (uint32_t)rcon << 24;
+            rcon = xtime (rcon);
+        }
+        k->words[i] = k->words[i - 4] ^ t;
+    }
+    for (int32_t i = 0; i < 44; i++) {
+        put32 (k->bytes + (4 * i), k->words[i]);
+    }
+}
+
+static void encryptblock (const aeskey* k, const uint8_t* in, uint8_t* out);
+
+static void encryptblock (const aeskey* k, const uint8_t* in, uint8_t* out)
+{
+    const uint32_t* w = k->words;
+    uint32_t s0 = get32 (in) ^ w[0];
+    uint32_t s1 = get32 (in + 4) ^ w[1];
+    uint32_t s2 = get32 (in + 8) ^ w[2];
+    uint32_t s3 = get32 (in + 12) ^ w[3];
+    for (int32_t r = 1; r < 10; r++) {
+        w += 4;
+        uint32_t t0 = table[s0 >> 24] ^ ror (table[(s1 >> 16) & 0xFFu], 8) ^ ror (table[(s2 >> 8) & 0xFFu], 16) ^ ror (table[s3 & 0xFFu], 24) ^ w[0];
+        uint32_t t1 = table[s1 >> 24] ^ ror (table[(s2 >> 16) & 0xFFu], 8) ^ ror (table[(s3 >> 8) & 0xFFu], 16) ^ ror (table[s0 & 0xFFu], 24) ^ w[1];
+        uint32_t t2 = table[s2 >> 24] ^ ror (table[(s3 >> 16) & 0xFFu], 8) ^ ror (table[(s0 >> 8) & 0xFFu], 16) ^ ror (table[s1 & 0xFFu], 24) ^ w[2];
+        uint32_t t3 = table[s3 >> 24] ^ ror (table[(s0 >> 16) & 0xFFu], 8) ^ ror (table[(s1 >> 8) & 0xFFu], 16) ^ ror (table[s2 & 0xFFu], 24) ^ w[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+    w += 4;
+    put32 (out, (((uint32_t)sbox[s0 >> 24] << 24) | ((uint32_t)sbox[(s1 >> 16) & 0xFFu] << 16) | ((uint32_t)sbox[(s2 >> 8) & 0xFFu] << 8) | sbox[s3 & 0xFFu]) ^ w[0]);
+    put32 (out + 4, (((uint32_t)sbox[s1 >> 24] << 24) | ((uint32_t)sbox[(s2 >> 16) & 0xFFu] << 16) | ((uint32_t)sbox[(s3 >> 8) & 0xFFu] << 8) | sbox[s0 & 0xFFu]) ^ w[1]);
+    put32 (out + 8, (((uint32_t)sbox[s2 >> 24] << 24) | ((uint32_t)sbox[(s3 >> 16) & 0xFFu] << 16) | ((uint32_t)sbox[(s0 >> 8) & 0xFFu] << 8) | sbox[s1 & 0xFFu]) ^ w[2]);
+    put32 (out + 12, (((uint32_t)sbox[s3 >> 24] << 24) | ((uint32_t)sbox[(s0 >> 16) & 0xFFu] << 16) | ((uint32_t)sbox[(s1 >> 8) & 0xFFu] << 8) | sbox[s2 & 0xFFu]) ^ w[3]);
+}
+
+/* AES counter mode of RFC 3711 4.1.1: the block counter is the last 16 bits
+ * of the IV, which are zero; len is below 2^20 */
+static void ctr_tables (const aeskey* k, const uint8_t* iv, uint8_t* data, int32_t len);
+
+static void ctr_tables (const aeskey* k, const uint8_t* iv, uint8_t* data, int32_t len)
+{
+    uint8_t block[16];
+    uint8_t stream[16];
+    (void)memcpy (block, iv, sizeof (block));
+    for (int32_t off = 0; off < len; off += 16) {
+        uint32_t j = (uint32_t)off / 16u;
+        block[14] = (uint8_t)(j >> 8);
+        block[15] = (uint8_t)j;
+        encryptblock (k, block, stream);
+        xorbytes (data + off, stream, ((len - off) < 16) ? (len - off) : 16);
+    }
+}
+
+#ifdef SRTP_AESNI
+/* Four counter blocks at a time, so that the AES unit has one round of each
+ * in flight while the others finish */
+__attribute__ ((target ("aes,sse2")))
+static void ctr_aesni (const aeskey* k, const uint8_t* iv, uint8_t* data, int32_t len)
+{
+    __m128i rk[11];
+    uint8_t blocks[4][16];
+    for (int32_t r = 0; r < 11; r++) {
+        rk[r] = _mm_load_si128 ((const __m128i*)(const void*)(k->bytes + (16 * r)));
+    }
+    for (int32_t b = 0; b < 4; b++) {
+        (void)memcpy (blocks[b], iv, 16);
+    }
+    int32_t off = 0;
+    for (; (len - off) >= 64; off += 64) {
+        uint32_t j = (uint32_t)off / 16u;
+        __m128i x[4];
+        for (int32_t b = 0; b < 4; b++) {
+            blocks[b][14] = (uint8_t)((j + (uint32_t)b) >> 8);
+            blocks[b][15] = (uint8_t)(j + (uint32_t)b);
+            x[b] = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i*)(const void*)blocks[b]), rk[0]);
+        }
+        for (int32_t r = 1; r < 10; r++) {
+            x[0] = _mm_aesenc_si128 (x[0], rk[r]);
+            x[1] = _mm_aesenc_si128 (x[1], rk[r]);
+            x[2] = _mm_aesenc_si128 (x[2], rk[r]);
+            x[3] = _mm_aesenc_si128 (x[3], rk[r]);
+        }
+        for (int32_t b = 0; b < 4; b++) {
+            __m128i* d = (__m128i*)(void*)(data + off + (16 * b));
+            _mm_storeu_si128 (d, _mm_xor_si128 (_mm_loadu_si128 (d), _mm_aesenclast_si128 (x[b], rk[10])));
+        }
+    }
+    for (; off < len; off += 16) {
+        uint32_t j = (uint32_t)off / 16u;
+        uint8_t stream[16];
+        blocks[0][14] = (uint8_t)(j >> 8);
+        blocks[0][15] = (uint8_t)j;
+        __m128i x = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i*)(const void*)blocks[0]), rk[0]);
+        for (int32_t r = 1; r < 10; r++) {
+            x = _mm_aesenc_si128 (x, rk[r]);
+        }
+        _mm_storeu_si128 ((__m128i*)(void*)stream, _mm_aesenclast_si128 (x, rk[10]));
+        xorbytes (data + off, stream, ((len - off) < 16) ? (len - off) : 16);
+    }
+}
+#endif /* SRTP_AESNI */
+
+#ifdef SRTP_ARMV8
+/* As ctr_aesni; AESE adds the round key before SubBytes, so the rounds are
+ * shifted by one against AES-NI and the last key is added on its own */
+static void ctr_armv8 (const aeskey* k, const uint8_t* iv, uint8_t* data, int32_t len)
+{
+    uint8x16_t rk[11];
+    uint8_t blocks[4][16];
+    for (int32_t r = 0; r < 11; r++) {
+        rk[r] = vld1q_u8 (k->bytes + (16 * r));
+    }
+    for (int32_t b = 0; b < 4; b++) {
+        (void)memcpy (blocks[b], iv, 16);
+    }
+    int32_t off = 0;
+    for (; (len - off) >= 64; off += 64) {
+        uint32_t j = (uint32_t)off / 16u;
+        uint8x16_t x[4];
+        for (int32_t b = 0; b < 4; b++) {
+            blocks[b][14] = (uint8_t)((j + (uint32_t)b) >> 8);
+            blocks[b][15] = (uint8_t)(j + (uint32_t)b);
+            x[b] = vld1q_u8 (blocks[b]);
+        }
+        for (int32_t r = 0; r < 9; r++) {
+            x[0] = vaesmcq_u8 (vaeseq_u8 (x[0], rk[r]));
+            x[1] = vaesmcq_u8 (vaeseq_u8 (x[1], rk[r]));
+            x[2] = vaesmcq_u8 (vaeseq_u8 (x[2], rk[r]));
+            x[3] = vaesmcq_u8 (vaeseq_u8 (x[3], rk[r]));
+        }
+        for (int32_t b = 0; b < 4; b++) {
+            uint8_t* d = data + off + (16 * b);
+            vst1q_u8 (d, veorq_u8 (vld1q_u8 (d), veorq_u8 (vaeseq_u8 (x[b], rk[9]), rk[10])));
+        }
+    }
+    for (; off < len; off += 16) {
+        uint32_t j = (uint32_t)off / 16u;
+        uint8_t stream[16];
+        blocks[0][14] = (uint8_t)(j >> 8);
+        blocks[0][15] = (uint8_t)j;
+        uint8x16_t x = vld1q_u8 (blocks[0]);
+        for (int32_t r = 0; r < 9; r++) {
+            x = vaesmcq_u8 (vaeseq_u8 (x, rk[r]));
+        }
+        vst1q_u8 (stream, veorq_u8 (vaeseq_u8 (x, rk[9]), rk[10]));
+        xorbytes (data + off, stream, ((len - off) < 16) ? (len - off) : 16);
+    }
+}
+#endif /* SRTP_ARMV8 */
+
+static void sha1_scalar (uint32_t* h, const uint8_t* p, int32_t blocks);
+
+static void sha1_scalar (uint32_t* h, const uint8_t* p, int32_t blocks)
+{
+    for (int32_t n = 0; n < blocks; n++) {
+        uint32_t w[80];
+        for (int32_t i = 0; i < 16; i++) {
+            w[i] = get32 (p + (64 * n) + (4 * i));
+        }
+        for (int32_t i = 16; i < 80; i++) {
+            w[i] = rol (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0];
+        uint32_t b = h[1];
+        uint32_t c = h[2];
+        uint32_t d = h[3];
+        uint32_t e = h[4];
+        /* four loops without branches, which the compiler unrolls */
+        for (int32_t i = 0; i < 20; i++) {
+            uint32_t t = rol (a, 5) + (d ^ (b & (c ^ d))) + 0x5A827999u + e + w[i];
+            e = d;
+            d = c;
+            c = rol (b, 30);
+            b = a;
+            a = t;
+        }
+        for (int32_t i = 20; i < 40; i++) {
+            uint32_t t = rol (a, 5) + (b ^ c ^ d) + 0x6ED9EBA1u + e + w[i];
+            e = d;
+            d = c;
+            c = rol (b, 30);
+            b = a;
+            a = t;
+        }
+        for (int32_t i = 40; i < 60; i++) {
+            uint32_t t = rol (a, 5) + ((b & c) | (d & (b | c))) + 0x8F1BBCDCu + e + w[i];
+            e = d;
+            d = c;
+            c = rol (b, 30);
+            b = a;
+            a = t;
+        }
+        for (int32_t i = 60; i < 80; i++) {
+            uint32_t t = rol (a, 5) + (b ^ c ^ d) + 0xCA62C1D6u + e + w[i];
+            e = d;
+            d = c;
+            c = rol (b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+}
+
+#ifdef SRTP_AESNI
+/* Four rounds per instruction; the message schedule of the group four
+ * ahead is worked out while the rounds use the current one */
+__attribute__ ((target ("sha,sse4.1")))
+static void sha1_shani (uint32_t* h, const uint8_t* p, int32_t blocks)
+{
+    const __m128i reverse = _mm_set_epi64x (0x0001020304050607LL, 0x08090A0B0C0D0E0FLL);
+    /* A in the top lane, E in the top lane of its own register */
+    __m128i abcd = _mm_shuffle_epi32 (_mm_loadu_si128 ((const __m128i*)(const void*)h), 0x1B);
+    __m128i e0 = _mm_set_epi32 ((int)h[4], 0, 0, 0);
+    for (int32_t n = 0; n < blocks; n++) {
+        __m128i m[4];
+        __m128i abcdsaved = abcd;
+        __m128i e0saved = e0;
+        for (int32_t i = 0; i < 4; i++) {
+            m[i] = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i*)(const void*)(p + (64 * n) + (16 * i))), reverse);
+        }
+        __m128i e = _mm_add_epi32 (e0, m[0]);
+        for (int32_t k = 0; k < 20; k++) {
+            if (k > 0) {
+                e = _mm_sha1nexte_epu32 (e0, m[k % 4]);
+            }
+            e0 = abcd;
+            switch (k / 5) {
+            case 0:
+                abcd = _mm_sha1rnds4_epu32 (abcd, e, 0);
+                break;
+            case 1:
+                abcd = _mm_sha1rnds4_epu32 (abcd, e, 1);
+                break;
+            case 2:
+                abcd = _mm_sha1rnds4_epu32 (abcd, e, 2);
+                break;
+            default:
+                abcd = _mm_sha1rnds4_epu32 (abcd, e, 3);
+                break;
+            }
+            if (k < 16) {
+                m[k % 4] = _mm_sha1msg2_epu32 (_mm_xor_si128 (_mm_sha1msg1_epu32 (m[k % 4], m[(k + 1) % 4]), m[(k + 2) % 4]), m[(k + 3) % 4]);
+            }
+        }
+        e0 = _mm_sha1nexte_epu32 (e0, e0saved);
+        abcd = _mm_add_epi32 (abcd, abcdsaved);
+    }
+    _mm_storeu_si128 ((__m128i*)(void*)h, _mm_shuffle_epi32 (abcd, 0x1B));
+    h[4] = (uint32_t)_mm_extract_epi32 (e0, 3);
+}
+#endif /* SRTP_AESNI */
+
+#ifdef SRTP_ARMV8
+static void sha1_armv8 (uint32_t* h, const uint8_t* p, int32_t blocks)
+{
+    static const uint32_t k[4] = {0x5A827999u, 0x6ED9EBA1u, 0x8F1BBCDCu, 0xCA62C1D6u};
+    uint32x4_t abcd = vld1q_u32 (h);
+    uint32_t e = h[4];
+    for (int32_t n = 0; n < blocks; n++) {
+        uint32x4_t m[4];
+        uint32x4_t abcdsaved = abcd;
+        uint32_t esaved = e;
+        for (int32_t i = 0; i < 4; i++) {
+            m[i] = vreinterpretq_u32_u8 (vrev32q_u8 (vld1q_u8 (p + (64 * n) + (16 * i))));
+        }
+        for (int32_t g = 0; g < 20; g++) {
+            uint32x4_t wk = vaddq_u32 (m[g % 4], vdupq_n_u32 (k[g / 5]));
+            uint32_t enext = vsha1h_u32 (vgetq_lane_u32 (abcd, 0));
+            if (g < 5) {
+                abcd = vsha1cq_u32 (abcd, e, wk);
+            } else if ((g >= 10) && (g < 15)) {
+                abcd = vsha1mq_u32 (abcd, e, wk);
+            } else {
+                abcd = vsha1pq_u32 (abcd, e, wk);
+            }
+            e = enext;
+            if (g < 16) {
+                m[g % 4] = vsha1su1q_u32 (vsha1su0q_u32 (m[g % 4], m[(g + 1) % 4], m[(g + 2) % 4]), m[(g + 3) % 4]);
+            }
+        }
+        abcd = vaddq_u32 (abcd, abcdsaved);
+        e += esaved;
+    }
+    vst1q_u32 (h, abcd);
+    h[4] = e;
+}
+#endif /* SRTP_ARMV8 */
+
+/* SHA-1 of a 64 byte pad block, which left the state start, followed by
+ * data and extra (at most 20 bytes) */
+static void sha1afterpad (const uint32_t* start, const uint8_t* data, int32_t len, const uint8_t* extra, int32_t extralen, uint8_t* digest);
+
+static void sha1afterpad (const uint32_t* start, const uint8_t* data, int32_t len, const uint8_t* extra, int32_t extralen, uint8_t* digest)
+{
+    uint32_t h[5];
+    uint8_t last[128];
+    int32_t whole = len / 64;
+    int32_t n = len - (whole * 64);
+    uint64_t bits = ((uint64_t)64 + (uint64_t)len + (uint64_t)extralen) * 8u;
+    (void)memcpy (h, start, sizeof (h));
+    sha1 (h, data, whole);
+    (void)memcpy (last, data + (whole * 64), (size_t)n);
+    if (extralen > 0) {
+        (void)memcpy (last + n, extra, (size_t)extralen);
+    }
+    n += extralen;
+    last[n] = 0x80u;
+    n++;
+    while ((n % 64) != 56) {
+        last[n] = 0;
+        n++;
+    }
+    put32 (last + n, (uint32_t)(bits >> 32));
+    put32 (last + n + 4, (uint32_t)bits);
+    sha1 (h, last, (n + 8) / 64);
+    for (int32_t i = 0; i < 5; i++) {
+        put32 (digest + (4 * i), h[i]);
+    }
+}
+
+static void hmacpad (uint32_t* h, const uint8_t* key, uint8_t pad);
+
+static void hmacpad (uint32_t* h, const uint8_t* key, uint8_t pad)
+{
+    uint8_t block[64];
+    (void)memset (block, pad, sizeof (block));
+    for (int32_t i = 0; i < SRTP_AUTH_KEY; i++) {
+        block[i] ^= key[i];
+    }
+    h[0] = 0x67452301u;
+    h[1] = 0xEFCDAB89u;
+    h[2] = 0x98BADCFEu;
+    h[3] = 0x10325476u;
+    h[4] = 0xC3D2E1F0u;
+    sha1 (h, block, 1);
+}
+
+/* The AES-CM PRF of RFC 3711 4.3.3 with a key derivation rate of 0 */
+static void derive (const aeskey* master, const uint8_t* salt, uint8_t label, uint8_t* out, int32_t len);
+
+static void derive (const aeskey* master, const uint8_t* salt, uint8_t label, uint8_t* out, int32_t len)
+{
+    uint8_t iv[16] = {0};
+    (void)memcpy (iv, salt, SRTP_MASTER_SALT);
+    iv[7] ^= label;
+    (void)memset (out, 0, (size_t)len);
+    ctr (master, iv, out, len);
+}
+
+INLINE void report (srtpsession* s, int64_t now);
+INLINE void report (srtpsession* s, int64_t now)
+{
+    if (stats_due (s->lastreport, now)) {
+        if (s->packets > 0) {
+            double n = (double)s->packets;
+#ifdef SRTP_AESNI
+            (void)printf ("%ssrtp %s %s, %d packets, %d rejected, %.0f ns/packet, %.0f cycles/packet\n",
+                          stats_tag(), aesengine, shaengine, s->packets, s->rejected, (double)s->ns / n, (double)s->cycles / n);
+#else
+            (void)printf ("%ssrtp %s %s, %d packets, %d rejected, %.0f ns/packet\n", stats_tag(), aesengine, shaengine, s->packets, s->rejected, (double)s->ns / n);
+#endif
+        }
+        s->packets = 0;
+        s->rejected = 0;
+        s->ns = 0;
+        s->cycles = 0;
+        s->lastreport = now;
+    }
+}
+
+/* Checks and decrypts one packet, false if it is to be dropped */
+static bool unprotect (srtpsession* s, uint8_t* p, int32_t* len);
+
+static bool unprotect (srtpsession* s, uint8_t* p, int32_t* len)
+{
+    int32_t header = SRTP_RTP_HEADER + (4 * (int32_t)(p[0] & 0x0Fu));
+    bool ok = (*len >= (SRTP_RTP_HEADER + SRTP_TAG)) && ((p[0] >> 6) == 2u);
+    if ((ok) && ((p[0] & 0x10u) != 0u) && ((header + 4) <= (*len - SRTP_TAG))) {
+        /* the header extension is authenticated, not encrypted */
+        header += 4 + (4 * (int32_t)(((uint32_t)p[header + 2] << 8) | p[header + 3]));
+    }
+    ok = (ok) && (header <= (*len - SRTP_TAG));
+    uint16_t seq = (uint16_t)(((uint32_t)p[2] << 8) | p[3]);
+    uint32_t ssrc = ok ? get32 (p + 8) : 0u;
+    /* the first packet of a source starts its index, RFC 3711 3.3.1 */
+    bool fresh = (!s->started) || (ssrc != s->ssrc);
+    uint32_t roc = fresh ? 0u : s->roc;
+    if (fresh) {
+        /* empty */
+    } else if (s->highest < 32768u) {
+        if ((int32_t)seq - (int32_t)s->highest > 32768) {
+            /* from before a wrap of the counter */
+            ok = (ok) && (roc > 0u);
+            roc--;
+        }
+    } else if (((int32_t)s->highest - 32768) > (int32_t)seq) {
+        roc++;
+    } else {
+        /* empty */
+    }
+    uint64_t index = ((uint64_t)roc << 16) | seq;
+    uint64_t top = ((uint64_t)s->roc << 16) | s->highest;
+    if ((ok) && (!fresh) && (index <= top)) {
+        uint64_t behind = top - index;
+        ok = (behind < SRTP_REPLAY_WINDOW) && (((s->window >> behind) & 1u) == 0u);
+    }
+    if (ok) {
+        uint8_t roclast[4];
+        uint8_t inner[20];
+        uint8_t tag[20];
+        int32_t authlen = *len - SRTP_TAG;
+        put32 (roclast, roc);
+        sha1afterpad (s->inner, p, authlen, roclast, 4, inner);
+        sha1afterpad (s->outer, inner, 20, NULL, 0, tag);
+        uint8_t diff = 0;
+        for (int32_t i = 0; i < SRTP_TAG; i++) {
+            diff |= (uint8_t)(tag[i] ^ p[authlen + i]);
+        }
+        ok = (diff == 0u);
+    }
+    if (ok) {
+        uint8_t iv[16] = {0};
+        (void)memcpy (iv, s->salt, SRTP_MASTER_SALT);
+        for (int32_t i = 0; i < 4; i++) {
+            iv[4 + i] ^= p[8 + i];
+        }
+        for (int32_t i = 0; i < 6; i++) {
+            iv[8 + i] ^= (uint8_t)(index >> (8 * (5 - i)));
+        }
+        *len -= SRTP_TAG;
+        ctr (&s->cipher, iv, p + header, *len - header);
+        if (fresh) {
+            s->started = true;
+            s->ssrc = ssrc;
+            s->window = 1;
+        } else if (index > top) {
+            uint64_t ahead = index - top;
+            s->window = (ahead < SRTP_REPLAY_WINDOW) ? ((s->window << ahead) | 1u) : 1u;
+        } else {
+            s->window |= (uint64_t)1 << (top - index);
+        }
+        if ((fresh) || (index > top)) {
+            s->roc = roc;
+            s->highest = seq;
+        }
+    }
+    return ok;
+}
+
+#ifdef SRTP_AESNI
+INLINE bool has_shani (void);
+INLINE bool has_shani (void)
+{
+    uint32_t eax;
+    uint32_t ebx;
+    uint32_t ecx;
+    uint32_t edx;
+    return (__get_cpuid_count (7, 0, &eax, &ebx, &ecx, &edx) != 0) && ((ebx & bit_SHA) != 0u) && (__builtin_cpu_supports ("sse4.1"));
+}
+#endif /* SRTP_AESNI */
+
+/* The fastest AES and SHA-1 the CPU has, once */
+static void pick_engines (void);
+
+static void pick_engines (void)
+{
+    if (ctr == NULL) {
+        maketables();
+        ctr = ctr_tables;
+        sha1 = sha1_scalar;
+        aesengine = "aes tables";
+        shaengine = "sha-1";
+#ifdef SRTP_AESNI
+        if (__builtin_cpu_supports ("aes")) {
+            ctr = ctr_aesni;
+            aesengine = "aes-ni";
+        }
+        if (has_shani()) {
+            sha1 = sha1_shani;
+            shaengine = "sha-ni";
+        }
+#endif
+#ifdef SRTP_ARMV8
+        ctr = ctr_armv8;
+        sha1 = sha1_armv8;
+        aesengine = "armv8 aes";
+        shaengine = "armv8 sha-1";
+#endif
+    }
+}
+
+void srtp_init (srtpsession* s, const uint8_t* master, int64_t now)
+{
+    pick_engines();
+    s->keyed = (master != NULL);
+    s->started = false;
+    s->roc = 0;
+    s->highest = 0;
+    s->window = 0;
+    s->packets = 0;
+    s->rejected = 0;
+    s->ns = 0;
+    s->cycles = 0;
+    s->lastreport = now;
+    if (s->keyed) {
+        aeskey masterkey;
+        uint8_t key[SRTP_MASTER_KEY];
+        uint8_t auth[SRTP_AUTH_KEY];
+        expandkey (&masterkey, master);
+        derive (&masterkey, master + SRTP_MASTER_KEY, LABEL_CIPHER, key, SRTP_MASTER_KEY);
+        derive (&masterkey, master + SRTP_MASTER_KEY, LABEL_AUTH, auth, SRTP_AUTH_KEY);
+        derive (&masterkey, master + SRTP_MASTER_KEY, LABEL_SALT, s->salt, SRTP_MASTER_SALT);
+        expandkey (&s->cipher, key);
+        hmacpad (s->inner, auth, 0x36u);
+        hmacpad (s->outer, auth, 0x5Cu);
+        DBG_PRINTF_DEBUG ("SRTP keyed, %s and %s\n", aesengine, shaengine);
+    }
+}
+
+void srtp_unprotect (srtpsession* s, uint8_t* const* packets, int32_t* lens, int32_t n, int64_t now)
+{
+    if (s->keyed) {
+        int64_t ns = now_ns();
+        int64_t cycles = now_cycles();
+        for (int32_t i = 0; i < n; i++) {
+            if ((lens[i] > 0) && (!unprotect (s, packets[i], &lens[i]))) {
+                DBG_PRINTF_WARNING ("SRTP packet %d rejected\n", (int32_t)(((uint32_t)packets[i][2] << 8) | packets[i][3]));
+                lens[i] = 0;
+                s->rejected++;
+            }
+        }
+        s->cycles += now_cycles() - cycles;
+        s->ns += now_ns() - ns;
+        s->packets += n;
+        report (s, now);
+    }
+}
+
+bool srtp_parse_key (const char* hex, uint8_t* master)
+{
+    bool ok = true;
+    for (int32_t i = 0; (ok) && (i < (2 * SRTP_MASTER_SIZE)); i++) {
+        char c = hex[i];
+        uint8_t v = 0;
+        if ((c >= '0') && (c <= '9')) {
+            v = (uint8_t)(c - '0');
+        } else if ((c >= 'a') && (c <= 'f')) {
+            v = (uint8_t)(c - 'a' + 10);
+        } else if ((c >= 'A') && (c <= 'F')) {
+            v = (uint8_t)(c - 'A' + 10);
+        } else {
+            ok = false;
+        }
+        master[i / 2] = ((i % 2) == 0) ? (uint8_t)(v << 4) : (uint8_t)(master[i / 2] | v);
+    }
+    char end = ok ? hex[2 * SRTP_MASTER_SIZE] : '\0';
+    return (ok) && ((end == '\0') || (end == ' ') || (end == '\r') || (end == '\n'));
+}
+
+INLINE bool same (const char* what, const char* engine, const uint8_t* got, const uint8_t* want, int32_t len);
+INLINE bool same (const char* what, const char* engine, const uint8_t* got, const uint8_t* want, int32_t len)
+{
+    bool ok = (memcmp (got, want, (size_t)len) == 0);
+    if (!ok) {
+        (void)fprintf (stderr, "SRTP self-test: %s wrong with %s\n", what, engine);
+    }
+    return ok;
+}
+
+/* RFC 3711 B.2 and B.3 with the AES engine ctr, buf holds the keystream */
+static bool selftest_aes (uint8_t* buf, const char* engine);
+
+static bool selftest_aes (uint8_t* buf, const char* engine)
+{
+    static const uint8_t key[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+    static const uint8_t iv[16] = {0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0x00, 0x00};
+    static const uint8_t first[48] = {
+        0xE0, 0x3E, 0xAD, 0x09, 0x35, 0xC9, 0x5E, 0x80, 0xE1, 0x66, 0xB1, 0x6D, 0xD9, 0x2B, 0x4E, 0xB4,
+        0xD2, 0x35, 0x13, 0x16, 0x2B, 0x02, 0xD0, 0xF7, 0x2A, 0x43, 0xA2, 0xFE, 0x4A, 0x5F, 0x97, 0xAB,
+        0x41, 0xE9, 0x5B, 0x3B, 0xB0, 0xA2, 0xE8, 0xDD, 0x47, 0x79, 0x01, 0xE4, 0xFC, 0xA8, 0x94, 0xC0};
+    static const uint8_t last[48] = {
+        0xEC, 0x8C, 0xDF, 0x73, 0x98, 0x60, 0x7C, 0xB0, 0xF2, 0xD2, 0x16, 0x75, 0xEA, 0x9E, 0xA1, 0xE4,
+        0x36, 0x2B, 0x7C, 0x3C, 0x67, 0x73, 0x51, 0x63, 0x18, 0xA0, 0x77, 0xD7, 0xFC, 0x50, 0x73, 0xAE,
+        0x6A, 0x2C, 0xC3, 0x78, 0x78, 0x89, 0x37, 0x4F, 0xBE, 0xB4, 0xC8, 0x1B, 0x17, 0xBA, 0x6C, 0x44};
+    static const uint8_t master[SRTP_MASTER_SIZE] = {
+        0xE1, 0xF9, 0x7A, 0x0D, 0x3E, 0x01, 0x8B, 0xE0, 0xD6, 0x4F, 0xA3, 0x2C, 0x06, 0xDE, 0x41, 0x39,
+        0x0E, 0xC6, 0x75, 0xAD, 0x49, 0x8A, 0xFE, 0xEB, 0xB6, 0x96, 0x0B, 0x3A, 0xAB, 0xE6};
+    static const uint8_t cipherkey[SRTP_MASTER_KEY] = {
+        0xC6, 0x1E, 0x7A, 0x93, 0x74, 0x4F, 0x39, 0xEE, 0x10, 0x73, 0x4A, 0xFE, 0x3F, 0xF7, 0xA0, 0x87};
+    static const uint8_t ciphersalt[SRTP_MASTER_SALT] = {
+        0x30, 0xCB, 0xBC, 0x08, 0x86, 0x3D, 0x8C, 0x85, 0xD4, 0x9D, 0xB3, 0x4A, 0x9A, 0xE1};
+    static const uint8_t authkey[SRTP_AUTH_KEY] = {
+        0xCE, 0xBE, 0x32, 0x1F, 0x6F, 0xF7, 0x71, 0x6B, 0x6F, 0xD4, 0xAB, 0x49, 0xAF, 0x25, 0x6A, 0x15,
+        0x6D, 0x38, 0xBA, 0xA4};
+    aeskey k;
+    uint8_t out[SRTP_AUTH_KEY];
+    expandkey (&k, key);
+    (void)memset (buf, 0, (size_t)SELFTEST_BLOCKS * 16u);
+    ctr (&k, iv, buf, SELFTEST_BLOCKS * 16);
+    bool ok = same ("keystream", engine, buf, first, 48);
+    ok = same ("keystream", engine, buf + ((SELFTEST_BLOCKS - 3) * 16), last, 48) && (ok);
+    expandkey (&k, master);
+    derive (&k, master + SRTP_MASTER_KEY, LABEL_CIPHER, out, SRTP_MASTER_KEY);
+    ok = same ("cipher key", engine, out, cipherkey, SRTP_MASTER_KEY) && (ok);
+    derive (&k, master + SRTP_MASTER_KEY, LABEL_SALT, out, SRTP_MASTER_SALT);
+    ok = same ("cipher salt", engine, out, ciphersalt, SRTP_MASTER_SALT) && (ok);
+    derive (&k, master + SRTP_MASTER_KEY, LABEL_AUTH, out, SRTP_AUTH_KEY);
+    return same ("auth key", engine, out, authkey, SRTP_AUTH_KEY) && (ok);
+}
+
+/* HMAC-SHA1 of RFC 2202 cases 1 and 3, the keys of which are as long as the
+ * SRTP auth key, and FIPS 180-2 A.3 for many blocks in one go */
+static bool selftest_sha1 (uint8_t* buf, const char* engine);
+
+static bool selftest_sha1 (uint8_t* buf, const char* engine)
+{
+    static const uint8_t tag1[20] = {
+        0xB6, 0x17, 0x31, 0x86, 0x55, 0x05, 0x72, 0x64, 0xE2, 0x8B, 0xC0, 0xB6, 0xFB, 0x37, 0x8C, 0x8E,
+        0xF1, 0x46, 0xBE, 0x00};
+    static const uint8_t tag3[20] = {
+        0x12, 0x5D, 0x73, 0x42, 0xB9, 0xAC, 0x11, 0xCD, 0x91, 0xA3, 0x9A, 0xF4, 0x8A, 0xA1, 0x7B, 0x4F,
+        0x63, 0xF1, 0x75, 0xD3};
+    static const uint8_t million[20] = {
+        0x34, 0xAA, 0x97, 0x3C, 0xD4, 0xC4, 0xDA, 0xA4, 0xF6, 0x1E, 0xEB, 0x2B, 0xDB, 0xAD, 0x27, 0x31,
+        0x65, 0x34, 0x01, 0x6F};
+    uint8_t key[SRTP_AUTH_KEY];
+    uint8_t data[50];
+    uint32_t inner[5];
+    uint32_t outer[5];
+    uint8_t digest[20];
+    uint8_t tag[20];
+    (void)memset (key, 0x0B, sizeof (key));
+    hmacpad (inner, key, 0x36u);
+    hmacpad (outer, key, 0x5Cu);
+    sha1afterpad (inner, (const uint8_t*)"Hi There", 8, NULL, 0, digest);
+    sha1afterpad (outer, digest, 20, NULL, 0, tag);
+    bool ok = same ("HMAC-SHA1", engine, tag, tag1, 20);
+    (void)memset (key, 0xAA, sizeof (key));
+    (void)memset (data, 0xDD, sizeof (data));
+    hmacpad (inner, key, 0x36u);
+    hmacpad (outer, key, 0x5Cu);
+    /* the tag of a packet is over it and its ROC */
+    sha1afterpad (inner, data, 46, data + 46, 4, digest);
+    sha1afterpad (outer, digest, 20, NULL, 0, tag);
+    ok = same ("HMAC-SHA1", engine, tag, tag3, 20) && (ok);
+    /* the first block of "a" stands in for the pad block */
+    (void)memset (buf, 'a', SELFTEST_MILLION);
+    inner[0] = 0x67452301u;
+    inner[1] = 0xEFCDAB89u;
+    inner[2] = 0x98BADCFEu;
+    inner[3] = 0x10325476u;
+    inner[4] = 0xC3D2E1F0u;
+    sha1 (inner, buf, 1);
+    sha1afterpad (inner, buf, SELFTEST_MILLION - 64, NULL, 0, digest);
+    return same ("SHA-1", engine, digest, million, 20) && (ok);
+}
+
+bool srtp_selftest (void)
+{
+    pick_engines();
+    ctrfunc ctrs[2] = {ctr_tables, NULL};
+    const char* ctrnames[2] = {"aes tables", NULL};
+    sha1func sha1s[2] = {sha1_scalar, NULL};
+    const char* sha1names[2] = {"sha-1", NULL};
+#ifdef SRTP_AESNI
+    if (__builtin_cpu_supports ("aes")) {
+        ctrs[1] = ctr_aesni;
+        ctrnames[1] = "aes-ni";
+    }
+    if (has_shani()) {
+        sha1s[1] = sha1_shani;
+        sha1names[1] = "sha-ni";
+    }
+#endif
+#ifdef SRTP_ARMV8
+    ctrs[1] = ctr_armv8;
+    ctrnames[1] = "armv8 aes";
+    sha1s[1] = sha1_armv8;
+    sha1names[1] = "armv8 sha-1";
+#endif
+    ctrfunc usedctr = ctr;
+    sha1func usedsha1 = sha1;
+    uint8_t* buf = (uint8_t*)malloc ((size_t)SELFTEST_BLOCKS * 16u);
+    bool ok = (buf != NULL);
+    for (int32_t i = 0; (buf != NULL) && (i < 2); i++) {
+        if (ctrs[i] != NULL) {
+            ctr = ctrs[i];
+            ok = selftest_aes (buf, ctrnames[i]) && (ok);
+        }
+        if (sha1s[i] != NULL) {
+            sha1 = sha1s[i];
+            ok = selftest_sha1 (buf, sha1names[i]) && (ok);
+        }
+    }
+    ctr = usedctr;
+    sha1 = usedsha1;
+    free (buf);
+    return ok;
+}
@@ -0,0 +1,53 @@
+/* SRTP decryption of the stream h264.bin receives */
+
+#ifndef SRTP_H
+#define SRTP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* AES_CM_128_HMAC_SHA1_80 of RFC 3711, the default and only suite here */
+#define SRTP_MASTER_KEY 16
+#define SRTP_MASTER_SALT 14
+#define SRTP_MASTER_SIZE (SRTP_MASTER_KEY + SRTP_MASTER_SALT)
+#define SRTP_TAG 10
+
+/* Expanded AES-128 key, as words for the table code and as bytes for the
+ * AES instructions */
+typedef struct saeskey {
+    uint32_t words[44];
+    uint8_t bytes[176] __attribute__ ((aligned (16)));
+} aeskey;
+
+typedef struct ssrtpsession {
+    bool keyed;           /* false lets packets through as they are */
+    aeskey cipher;        /* session keys derived from the master key */
+    uint8_t salt[SRTP_MASTER_SALT];
+    uint32_t inner[5];    /* SHA-1 state after the HMAC ipad and opad blocks */
+    uint32_t outer[5];
+    bool started;         /* a packet of ssrc was accepted */
+    uint32_t ssrc;
+    uint32_t roc;         /* rollover counter of the highest sequence number */
+    uint16_t highest;
+    uint64_t window;      /* bit n: highest index - n was accepted */
+    int32_t packets;
+    int32_t rejected;     /* not authentic, replayed or too short */
+    int64_t ns;           /* spent checking and decrypting */
+    int64_t cycles;       /* the same in TSC cycles where there is a TSC */
+    int64_t lastreport;
+} srtpsession;
+
+/* Derives the session keys from master, SRTP_MASTER_KEY bytes of key and
+ * SRTP_MASTER_SALT of salt; NULL master leaves the packets unencrypted. */
+void srtp_init (srtpsession* s, const uint8_t* master, int64_t now);
+/* Checks and decrypts n packets in place in the order they arrived. The tag
+ * is cut off lens; a packet that is rejected gets length 0. */
+void srtp_unprotect (srtpsession* s, uint8_t* const* packets, int32_t* lens, int32_t n, int64_t now);
+/* Reads the master key and salt as 60 hex digits, false if they are not. */
+bool srtp_parse_key (const char* hex, uint8_t* master);
+/* Runs the test vectors of RFC 3711 B.2 and B.3, RFC 2202 and FIPS 180-2
+ * through the tables and plain SHA-1 and through the AES and SHA-1
+ * instructions the CPU has. Says on stderr what was wrong, false if any. */
+bool srtp_selftest (void);
+
+#endif /* SRTP_H */
@@ -0,0 +1,113 @@
+/* Loss statistics of h264.bin */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "stats.h"
+
+/* Of the calling thread, see stats_session */
+static _Thread_local char tag[16] = "";
+static _Thread_local bool receiverknown = false;
+static _Thread_local clockid_t receiverclock;
+/* -1 until stats_interval has looked at the environment */
+static int32_t interval = -1;
+
+int64_t stats_now_us (void)
+{
+    struct timespec ts;
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+int32_t stats_interval (void)
+{
+    if (interval < 0) {
+        const char* env = getenv ("STATS_INTERVAL");
+        interval = ((env != NULL) && (env[0] != '\0')) ? atoi (env) : STATS_INTERVAL;
+        if (interval < 0) {
+            interval = 0;
+        }
+    }
+    return interval;
+}
+
+bool stats_due (int64_t lastreport, int64_t now)
+{
+    int32_t seconds = stats_interval();
+    return (seconds > 0) && ((now - lastreport) >= ((int64_t)seconds * 1000000));
+}
+
+void stats_init (lossstats* ls)
+{
+    for (int32_t i = 0; i < FRAME_KINDS; i++) {
+        ls->frames[i] = 0;
+    }
+    ls->freezeus = 0;
+    ls->artifactus = 0;
+    ls->freezestart = -1;
+    ls->artifactstart = -1;
+    ls->lastreport = stats_now_us();
+    ls->fillerbytes = 0;
+}
+
+void stats_frame (lossstats* ls, int32_t kind)
+{
+    int64_t now = stats_now_us();
+    ls->frames[kind]++;
+    if ((kind == FRAME_DROPPED) || (kind == FRAME_HELD)) {
+        if (ls->freezestart < 0) {
+            ls->freezestart = now;
+        }
+    } else {
+        if (ls->freezestart >= 0) {
+            ls->freezeus += now - ls->freezestart;
+            ls->freezestart = -1;
+        }
+        if (((kind == FRAME_CORRUPT) || (kind == FRAME_CONCEALED)) && (ls->artifactstart < 0)) {
+            ls->artifactstart = now;
+        } else if ((kind == FRAME_REFRESH) && (ls->artifactstart >= 0)) {
+            ls->artifactus += now - ls->artifactstart;
+            ls->artifactstart = -1;
+        } else {
+            /* empty */
+        }
+    }
+    if (stats_due (ls->lastreport, now)) {
+        (void)printf ("%sframes clean %d refresh %d concealed %d corrupt %d held %d dropped %d, freeze %lld ms, artifacts %lld ms, filler %lld kB\n",
+                      stats_tag(), ls->frames[FRAME_CLEAN], ls->frames[FRAME_REFRESH], ls->frames[FRAME_CONCEALED], ls->frames[FRAME_CORRUPT], ls->frames[FRAME_HELD],
+                      ls->frames[FRAME_DROPPED], (long long)(ls->freezeus / 1000), (long long)(ls->artifactus / 1000), (long long)(ls->fillerbytes / 1024));
+        ls->lastreport = now;
+    }
+}
+
+void stats_session (int32_t session, bool tagged)
+{
+    if (tagged) {
+        (void)snprintf (tag, sizeof (tag), "[%d] ", session);
+    } else {
+        tag[0] = '\0';
+    }
+    receiverknown = false;
+}
+
+const char* stats_tag (void)
+{
+    return tag;
+}
+
+void stats_receiver (clockid_t clock)
+{
+    receiverclock = clock;
+    receiverknown = true;
+}
+
+int64_t stats_receiver_cpu_us (void)
+{
+    int64_t us = -1;
+    struct timespec ts;
+    if ((receiverknown) && (clock_gettime (receiverclock, &ts) == 0)) {
+        us = ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    }
+    return us;
+}
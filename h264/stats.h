@@ -0,0 +1,56 @@
+/* Loss statistics of h264.bin */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#ifndef STATS_INTERVAL
+/**
+ * Seconds between two statistics reports on stdout, 0 disables them; the
+ * environment variable STATS_INTERVAL overrides it at run time
+ */
+#define STATS_INTERVAL (0)
+#endif /* STATS_INTERVAL */
+
+#define FRAME_DROPPED 0 /* never reached the decoder */
+#define FRAME_HELD 1    /* decoded but not displayed */
+#define FRAME_CLEAN 2
+#define FRAME_CORRUPT 3 /* displayed with missing data */
+#define FRAME_REFRESH 4 /* IDR or completed recovery point */
+#define FRAME_CONCEALED 5 /* displayed with lost slices replaced by skip slices */
+#define FRAME_KINDS 6
+
+typedef struct slossstats {
+    int32_t frames[FRAME_KINDS];
+    int64_t freezeus;    /* time without a new picture on screen */
+    int64_t artifactus;  /* time showing pictures built on missing data */
+    int64_t freezestart;
+    int64_t artifactstart;
+    int64_t lastreport;
+    int64_t fillerbytes; /* filler data not passed to the decoder */
+} lossstats;
+
+int64_t stats_now_us (void);
+/* Seconds between two reports, from the environment or STATS_INTERVAL. Read
+ * once, so call it before the threads start. */
+int32_t stats_interval (void);
+/* True if a report that was last printed at lastreport is due at now */
+bool stats_due (int64_t lastreport, int64_t now);
+void stats_init (lossstats* ls);
+/* Accounts one access unit of the given FRAME_ kind. */
+void stats_frame (lossstats* ls, int32_t kind);
+/* Tells the reports of the calling thread which session they are about;
+ * tagged starts each of them with "[session] ", for several at a time. */
+void stats_session (int32_t session, bool tagged);
+/* "" or "[session] " for the calling thread, to print before a report */
+const char* stats_tag (void);
+/* The CPU clock of the session's receive thread, for a thread that reports
+ * on the session after stats_session. */
+void stats_receiver (clockid_t clock);
+/* The CPU time of that receive thread, -1 if it was not given. */
+int64_t stats_receiver_cpu_us (void);
+
+#endif /* STATS_H */
@@ -0,0 +1,554 @@
+/* Runs the bitstream rewriters of the demux stage over a corpus of damaged
+ * streams:
+ *
+ *   conceal_test clip.264 clip-lost.264 clip-lost.txt
+ *
+ * clip.264 is a short libx264 stream with four slices per picture, and
+ * clip-lost.264 the same with the byte ranges listed in clip-lost.txt cut
+ * out, as lost TS packets leave a PES. Every access unit conceal_au() takes
+ * has to parse again, keep the intact slices as they were and cover exactly
+ * the macroblocks of the lost slices with P_Skip slices; the others have to
+ * be ones it cannot conceal. The SPS of the clip, with and without VUI, goes
+ * through sps_low_delay() and sps_patch_low_delay(). Exits 1 on a failure. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conceal.h"
+#include "sps.h"
+
+#define INLINE static inline
+
+#define TEST_MAX_AUS 64
+#define TEST_MAX_GAPS 8
+#define TEST_MAX_MBS 8160
+#define TEST_RBSP_SIZE 65536
+#define TEST_OUT_SIZE (1 << 20)
+
+#define MB_UNSET 0
+#define MB_INTACT 1
+#define MB_SKIP 2
+
+typedef struct sslicespan {
+    const uint8_t* data;   /* NAL header byte */
+    int32_t len;
+    int32_t start;         /* offset of the start code in the access unit */
+    int32_t end;           /* offset of the next start code */
+    int32_t first_mb;
+    int32_t end_mb;        /* first_mb of the next slice */
+    bool lost;
+} slicespan;
+
+typedef struct scabacdec {
+    bitreader* br;
+    uint32_t range;
+    uint32_t offset;
+    int32_t state;
+    int32_t mps;
+} cabacdec;
+
+/* Table 9-44 and the LPS column of Table 9-45 */
+static const uint8_t range_lps[64][4] = {
+    {128, 176, 208, 240}, {128, 167, 197, 227}, {128, 158, 187, 216}, {123, 150, 178, 205},
+    {116, 142, 169, 195}, {111, 135, 160, 185}, {105, 128, 152, 175}, {100, 122, 144, 166},
+    {95, 116, 137, 158}, {90, 110, 130, 150}, {85, 104, 123, 142}, {81, 99, 117, 135},
+    {77, 94, 111, 128}, {73, 89, 105, 122}, {69, 85, 100, 116}, {66, 80, 95, 110},
+    {62, 76, 90, 104}, {59, 72, 86, 99}, {56, 69, 81, 94}, {53, 65, 77, 89},
+    {51, 62, 73, 85}, {48, 59, 69, 80}, {46, 56, 66, 76}, {43, 53, 63, 72},
+    {41, 50, 59, 69}, {39, 48, 56, 65}, {37, 45, 54, 62}, {35, 43, 51, 59},
+    {33, 41, 48, 56}, {32, 39, 46, 53}, {30, 37, 43, 50}, {29, 35, 41, 48},
+    {27, 33, 39, 45}, {26, 31, 37, 43}, {24, 30, 35, 41}, {23, 28, 33, 39},
+    {22, 27, 32, 37}, {21, 26, 30, 35}, {20, 24, 29, 33}, {19, 23, 27, 31},
+    {18, 22, 26, 30}, {17, 21, 25, 28}, {16, 20, 23, 27}, {15, 19, 22, 25},
+    {14, 18, 21, 24}, {14, 17, 20, 23}, {13, 16, 19, 22}, {12, 15, 18, 21},
+    {12, 14, 17, 20}, {11, 14, 16, 19}, {11, 13, 15, 18}, {10, 12, 15, 17},
+    {10, 12, 14, 16}, {9, 11, 13, 15}, {9, 11, 12, 14}, {8, 10, 12, 14},
+    {8, 9, 11, 13}, {7, 9, 11, 12}, {7, 9, 10, 12}, {7, 8, 10, 11},
+    {6, 8, 9, 11}, {6, 7, 9, 10}, {6, 7, 8, 9}, {2, 2, 2, 2}
+};
+
+static const uint8_t trans_lps[64] = {
+    0, 0, 1, 2, 2, 4, 4, 5, 6, 7, 8, 9, 9, 11, 11, 12,
+    13, 13, 15, 15, 16, 16, 18, 18, 19, 19, 21, 21, 22, 22, 23, 24,
+    24, 25, 26, 26, 27, 27, 28, 29, 29, 30, 30, 30, 31, 32, 32, 33,
+    33, 33, 34, 34, 35, 35, 35, 36, 36, 36, 37, 37, 37, 38, 38, 63
+};
+
+/* m and n of mb_skip_flag in P slices (ctxIdx 11) per cabac_init_idc */
+static const int8_t skip_mn[3][2] = { {23, 33}, {22, 25}, {29, 16} };
+
+static int32_t failures = 0;
+
+INLINE void fail (int32_t au, const char* what);
+INLINE void fail (int32_t au, const char* what)
+{
+    (void)printf ("FAIL access unit %d: %s\n", au, what);
+    failures++;
+}
+
+static uint8_t* readfile (const char* path, int32_t* len);
+static uint8_t* readfile (const char* path, int32_t* len)
+{
+    uint8_t* data = NULL;
+    FILE* f = fopen (path, "rb");
+    *len = 0;
+    if (f != NULL) {
+        (void)fseek (f, 0, SEEK_END);
+        long size = ftell (f);
+        (void)fseek (f, 0, SEEK_SET);
+        data = (uint8_t*)malloc ((size > 0) ? (size_t)size : 1u);
+        if ((data != NULL) && (size > 0) && (fread (data, 1, (size_t)size, f) == (size_t)size)) {
+            *len = (int32_t)size;
+        }
+        (void)fclose (f);
+    }
+    if (*len == 0) {
+        (void)fprintf (stderr, "cannot read %s\n", path);
+        exit (1);
+    }
+    return data;
+}
+
+/* Offsets of the access units, each starting at its AUD, the last entry is
+ * the end of data. Returns the number of access units. */
+static int32_t split_aus (const uint8_t* data, int32_t len, int32_t* starts);
+static int32_t split_aus (const uint8_t* data, int32_t len, int32_t* starts)
+{
+    int32_t count = 0;
+    nalunit nal;
+    int32_t pos = 0;
+    while (((pos = nal_next (data, len, pos, &nal)) >= 0) && (count < TEST_MAX_AUS)) {
+        if (nal.type == NAL_TYPE_AUD) {
+            int32_t start = (int32_t)(nal.data - data) - 3;
+            starts[count] = ((start > 0) && (data[start - 1] == 0u)) ? (start - 1) : start;
+            count++;
+        }
+    }
+    starts[count] = len;
+    return count;
+}
+
+static int32_t find_slices (const uint8_t* au, int32_t len, int32_t picsize, slicespan* slices, bool* idr);
+static int32_t find_slices (const uint8_t* au, int32_t len, int32_t picsize, slicespan* slices, bool* idr)
+{
+    int32_t count = 0;
+    nalunit nal;
+    int32_t pos = 0;
+    *idr = false;
+    while (((pos = nal_next (au, len, pos, &nal)) >= 0) && (count < CONCEAL_MAX_NALS)) {
+        if ((nal.type == NAL_TYPE_SLICE) || (nal.type == NAL_TYPE_IDR)) {
+            slicespan* s = &slices[count];
+            s->data = nal.data;
+            s->len = nal.len;
+            s->start = (int32_t)(nal.data - au) - 3;
+            s->end = (int32_t)(nal.data - au) + nal.len;
+            s->first_mb = slice_first_mb (nal.data, nal.len);
+            s->lost = false;
+            *idr = (*idr) || (nal.type == NAL_TYPE_IDR);
+            count++;
+        }
+    }
+    for (int32_t i = 0; i < count; i++) {
+        slices[i].end_mb = ((i + 1) < count) ? slices[i + 1].first_mb : picsize;
+    }
+    return count;
+}
+
+static void cabac_init (cabacdec* cd, bitreader* br, int32_t init_idc, int32_t qp);
+static void cabac_init (cabacdec* cd, bitreader* br, int32_t init_idc, int32_t qp)
+{
+    int32_t clipqp = (qp < 0) ? 0 : ((qp > 51) ? 51 : qp);
+    int32_t pre = ((skip_mn[init_idc][0] * clipqp) >> 4) + skip_mn[init_idc][1];
+    pre = (pre < 1) ? 1 : ((pre > 126) ? 126 : pre);
+    cd->state = (pre <= 63) ? (63 - pre) : (pre - 64);
+    cd->mps = (pre <= 63) ? 0 : 1;
+    cd->br = br;
+    cd->range = 510;
+    cd->offset = br_read (br, 9);
+}
+
+static void cabac_renorm (cabacdec* cd);
+static void cabac_renorm (cabacdec* cd)
+{
+    while (cd->range < 256u) {
+        cd->range <<= 1;
+        cd->offset = (cd->offset << 1) | br_read (cd->br, 1);
+    }
+}
+
+static int32_t cabac_decision (cabacdec* cd);
+static int32_t cabac_decision (cabacdec* cd)
+{
+    int32_t bin = cd->mps;
+    uint32_t lps = range_lps[cd->state][(cd->range >> 6) & 3u];
+    cd->range -= lps;
+    if (cd->offset >= cd->range) {
+        bin = 1 - cd->mps;
+        cd->offset -= cd->range;
+        cd->range = lps;
+        if (cd->state == 0) {
+            cd->mps = 1 - cd->mps;
+        }
+        cd->state = trans_lps[cd->state];
+    } else if (cd->state < 62) {
+        cd->state++;
+    } else {
+        /* empty */
+    }
+    cabac_renorm (cd);
+    return bin;
+}
+
+static bool cabac_terminate (cabacdec* cd);
+static bool cabac_terminate (cabacdec* cd)
+{
+    bool end = false;
+    cd->range -= 2u;
+    if (cd->offset >= cd->range) {
+        /* the last bit read is rbsp_stop_one_bit, 9.3.3.2.2.3 */
+        end = true;
+    } else {
+        cabac_renorm (cd);
+    }
+    return end;
+}
+
+/* True if the rest of the RBSP from the reader's position is exactly
+ * rbsp_trailing_bits(), the stop bit already read if stopread. */
+static bool trailing_bits (bitreader* br, bool stopread);
+static bool trailing_bits (bitreader* br, bool stopread)
+{
+    bool ok = (stopread) || (br_read (br, 1) == 1u);
+    while ((ok) && ((br->bitpos & 7) != 0)) {
+        ok = (br_read (br, 1) == 0u);
+    }
+    return (ok) && (!br->overrun) && (br->bitpos == (br->len * 8));
+}
+
+/* Parses a slice that is not one of the clip's as a P_Skip slice of the
+ * picture tpl belongs to. Returns the number of macroblocks it skips, or -1
+ * if it is anything else. */
+static int32_t parse_skip_slice (const uint8_t* nal, int32_t len, const spsinfo* sps, const ppsinfo* pps, const slicehdr* tpl, int32_t* first_mb);
+static int32_t parse_skip_slice (const uint8_t* nal, int32_t len, const spsinfo* sps, const ppsinfo* pps, const slicehdr* tpl, int32_t* first_mb)
+{
+    static uint8_t rbsp[TEST_RBSP_SIZE];
+    int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+    bitreader br;
+    slicehdr sh;
+    br_init (&br, rbsp, rbsplen);
+    int32_t count = -1;
+    if (((nal[0] & 0x1Fu) == NAL_TYPE_SLICE) && slice_parse (&br, (nal[0] >> 5) & 3, false, sps, pps, &sh) &&
+            (sh.slice_type == 0) && (sh.pps_id == pps->pps_id) && (sh.frame_num == tpl->frame_num) &&
+            (sh.poc_lsb == tpl->poc_lsb) && (sh.nal_ref_idc == tpl->nal_ref_idc)) {
+        int32_t init_idc = pps->cabac ? (int32_t)br_read_ue (&br) : 0;
+        int32_t qp = pps->pic_init_qp + br_read_se (&br);
+        if ((pps->deblocking_filter_control) && (br_read_ue (&br) != 1u)) {
+            (void)br_read_se (&br);
+            (void)br_read_se (&br);
+        }
+        *first_mb = sh.first_mb;
+        if (!pps->cabac) {
+            count = (int32_t)br_read_ue (&br);
+            count = trailing_bits (&br, false) ? count : -1;
+        } else if (init_idc <= 2) {
+            bool ok = true;
+            while ((ok) && ((br.bitpos & 7) != 0)) {
+                /* cabac_alignment_one_bit */
+                ok = (br_read (&br, 1) == 1u);
+            }
+            cabacdec cd;
+            cabac_init (&cd, &br, init_idc, qp);
+            bool end = false;
+            int32_t n = 0;
+            while ((ok) && (!end) && (n < TEST_MAX_MBS)) {
+                /* ctxIdxInc of mb_skip_flag is 0 in a run of skipped
+                 * macroblocks at the border of other slices */
+                ok = (cabac_decision (&cd) == 1) && (!br.overrun);
+                end = cabac_terminate (&cd);
+                n++;
+            }
+            count = ((ok) && (end) && trailing_bits (&br, true)) ? n : -1;
+        } else {
+            /* empty */
+        }
+    }
+    return count;
+}
+
+/* The concealed access unit out has to hold the intact slices of the
+ * original as they were, in order, and P_Skip slices over exactly the
+ * macroblocks of the lost ones. */
+static void check_concealed (int32_t au, const uint8_t* out, int32_t outlen, const slicespan* slices, int32_t numslices,
+                             const spsinfo* sps, const ppsinfo* pps);
+static void check_concealed (int32_t au, const uint8_t* out, int32_t outlen, const slicespan* slices, int32_t numslices,
+                             const spsinfo* sps, const ppsinfo* pps)
+{
+    static uint8_t mbs[TEST_MAX_MBS];
+    static uint8_t rbsp[TEST_RBSP_SIZE];
+    int32_t picsize = sps->width_mbs * sps->height_mbs;
+    (void)memset (mbs, MB_UNSET, sizeof (mbs));
+
+    /* the header every slice of the picture has to agree with */
+    slicehdr tpl;
+    bitreader br;
+    int32_t rbsplen = nal_unescape (slices[0].data + 1, slices[0].len - 1, rbsp, (int32_t)sizeof (rbsp));
+    br_init (&br, rbsp, rbsplen);
+    bool ok = slice_parse (&br, (slices[0].data[0] >> 5) & 3, false, sps, pps, &tpl);
+
+    nalunit nal;
+    int32_t pos = 0;
+    int32_t next = 0;
+    int32_t lastfirst = -1;
+    while ((ok) && ((pos = nal_next (out, outlen, pos, &nal)) >= 0)) {
+        if (nal.type == NAL_TYPE_SLICE) {
+            int32_t first = -1;
+            int32_t end = -1;
+            uint8_t mark = MB_INTACT;
+            while ((next < numslices) && (slices[next].lost)) {
+                next++;
+            }
+            if ((next < numslices) && (nal.len == slices[next].len) && (memcmp (nal.data, slices[next].data, (size_t)nal.len) == 0)) {
+                first = slices[next].first_mb;
+                end = slices[next].end_mb;
+                next++;
+            } else {
+                int32_t count = parse_skip_slice (nal.data, nal.len, sps, pps, &tpl, &first);
+                end = (count > 0) ? (first + count) : -1;
+                mark = MB_SKIP;
+            }
+            if ((first <= lastfirst) || (end <= first) || (end > picsize)) {
+                fail (au, "a slice out of order, or neither intact nor a P_Skip slice that parses");
+                ok = false;
+            }
+            for (int32_t mb = first; (ok) && (mb < end); mb++) {
+                if (mbs[mb] != MB_UNSET) {
+                    fail (au, "slices overlap");
+                    ok = false;
+                }
+                mbs[mb] = mark;
+            }
+            lastfirst = first;
+        } else if (!nal.complete) {
+            fail (au, "a NAL unit cut off");
+            ok = false;
+        } else {
+            /* empty */
+        }
+    }
+    while ((ok) && (next < numslices) && (slices[next].lost)) {
+        next++;
+    }
+    if ((ok) && (next < numslices)) {
+        fail (au, "an intact slice went missing");
+        ok = false;
+    }
+    for (int32_t i = 0; (ok) && (i < numslices); i++) {
+        for (int32_t mb = slices[i].first_mb; (ok) && (mb < slices[i].end_mb); mb++) {
+            if (mbs[mb] != (slices[i].lost ? MB_SKIP : MB_INTACT)) {
+                fail (au, "the P_Skip slices do not cover exactly the lost macroblocks");
+                ok = false;
+            }
+        }
+    }
+}
+
+/* Writes the SPS up to bit cut, the position of vui_parameters_present_flag
+ * or bitstream_restriction_flag, with that flag cleared. Returns the length. */
+static int32_t strip_sps (const uint8_t* nal, int32_t len, int32_t cut, uint8_t* out, int32_t maxout);
+static int32_t strip_sps (const uint8_t* nal, int32_t len, int32_t cut, uint8_t* out, int32_t maxout)
+{
+    uint8_t rbsp[PARAMSET_MAX_SIZE];
+    uint8_t stripped[PARAMSET_MAX_SIZE];
+    int32_t rbsplen = nal_unescape (nal + 1, len - 1, rbsp, (int32_t)sizeof (rbsp));
+    bitreader br;
+    bitwriter bw;
+    br_init (&br, rbsp, rbsplen);
+    bw_init (&bw, stripped, (int32_t)sizeof (stripped));
+    bw_copy (&bw, &br, 0, cut);
+    bw_write (&bw, 0, 1);
+    int32_t n = bw_finish (&bw);
+    out[0] = nal[0];
+    n = nal_escape (stripped, n, out + 1, maxout - 1);
+    return (n < 0) ? -1 : (n + 1);
+}
+
+/* The low delay SPS has to parse, signal no reordering and leave everything
+ * else of the original as it was. */
+static void check_low_delay (const char* variant, const uint8_t* nal, int32_t len);
+static void check_low_delay (const char* variant, const uint8_t* nal, int32_t len)
+{
+    spsinfo before;
+    spsinfo after;
+    uint8_t patched[PARAMSET_MAX_SIZE];
+    uint8_t au[PARAMSET_MAX_SIZE + 16];
+    bool ok = sps_parse (nal, len, &before);
+    int32_t n = ok ? sps_low_delay (nal, len, patched, (int32_t)sizeof (patched)) : -1;
+    if (!ok) {
+        (void)printf ("FAIL SPS %s: does not parse\n", variant);
+        failures++;
+    } else if (before.max_num_reorder_frames >= 0) {
+        /* the source's own value stays */
+        if (n >= 0) {
+            (void)printf ("FAIL SPS %s: rewritten although it signals max_num_reorder_frames\n", variant);
+            failures++;
+        }
+    } else if ((n < 0) || (!sps_parse (patched, n, &after)) || (after.max_num_reorder_frames != 0) ||
+               (after.profile_idc != before.profile_idc) || (after.width_mbs != before.width_mbs) ||
+               (after.height_mbs != before.height_mbs) || (after.log2_max_frame_num != before.log2_max_frame_num) ||
+               (after.poc_type != before.poc_type) || (after.log2_max_poc_lsb != before.log2_max_poc_lsb) ||
+               (after.max_num_ref_frames != before.max_num_ref_frames) || (after.vuipos != before.vuipos)) {
+        (void)printf ("FAIL SPS %s: the low delay SPS is wrong\n", variant);
+        failures++;
+    } else {
+        /* in front of a slice, the rest of the access unit stays */
+        const uint8_t slice[8] = { 0x00, 0x00, 0x00, 0x01, 0x65, 0x88, 0x84, 0x00 };
+        au[0] = 0;
+        au[1] = 0;
+        au[2] = 0;
+        au[3] = 1;
+        (void)memcpy (au + 4, nal, (size_t)len);
+        (void)memcpy (au + 4 + len, slice, sizeof (slice));
+        int32_t aulen = sps_patch_low_delay (au, len + 4 + (int32_t)sizeof (slice), (int32_t)sizeof (au));
+        if ((aulen != (n + 4 + (int32_t)sizeof (slice))) || (memcmp (au + 4, patched, (size_t)n) != 0) ||
+                (memcmp (au + 4 + n, slice, sizeof (slice)) != 0)) {
+            (void)printf ("FAIL SPS %s: sps_patch_low_delay differs from sps_low_delay\n", variant);
+            failures++;
+        }
+    }
+}
+
+static void check_sps (const paramsets* ps);
+static void check_sps (const paramsets* ps)
+{
+    spsinfo sps;
+    uint8_t stripped[PARAMSET_MAX_SIZE];
+    if (sps_parse (ps->sps, ps->spslen, &sps)) {
+        check_low_delay ("as sent", ps->sps, ps->spslen);
+        int32_t n = strip_sps (ps->sps, ps->spslen, sps.vuipos, stripped, (int32_t)sizeof (stripped));
+        check_low_delay ("without VUI", stripped, n);
+        if (sps.restrictpos >= 0) {
+            n = strip_sps (ps->sps, ps->spslen, sps.restrictpos, stripped, (int32_t)sizeof (stripped));
+            check_low_delay ("without bitstream restriction", stripped, n);
+        }
+    } else {
+        (void)printf ("FAIL SPS does not parse\n");
+        failures++;
+    }
+}
+
+int main (int argc, char** argv)
+{
+    if (argc != 4) {
+        (void)fprintf (stderr, "usage: %s clip.264 clip-lost.264 clip-lost.txt\n", argv[0]);
+        return 2;
+    }
+    int32_t cliplen = 0;
+    int32_t lostlen = 0;
+    uint8_t* clip = readfile (argv[1], &cliplen);
+    uint8_t* lost = readfile (argv[2], &lostlen);
+    int32_t clipaus[TEST_MAX_AUS + 1];
+    int32_t lostaus[TEST_MAX_AUS + 1];
+    int32_t numaus = split_aus (clip, cliplen, clipaus);
+    if (split_aus (lost, lostlen, lostaus) != numaus) {
+        (void)fprintf (stderr, "%s and %s differ in access units\n", argv[1], argv[2]);
+        return 1;
+    }
+
+    /* the gaps per access unit as offsets into the damaged one */
+    int32_t gaps[TEST_MAX_AUS][TEST_MAX_GAPS];
+    int32_t gaplens[TEST_MAX_AUS][TEST_MAX_GAPS];
+    int32_t numgaps[TEST_MAX_AUS] = { 0 };
+    FILE* f = fopen (argv[3], "r");
+    char line[256];
+    while ((f != NULL) && (fgets (line, (int)sizeof (line), f) != NULL)) {
+        int au = 0;
+        int offset = 0;
+        int bytes = 0;
+        if ((line[0] != '#') && (sscanf (line, "%d %d %d", &au, &offset, &bytes) == 3) &&
+                (au >= 0) && (au < numaus) && (numgaps[au] < TEST_MAX_GAPS)) {
+            gaps[au][numgaps[au]] = offset;
+            gaplens[au][numgaps[au]] = bytes;
+            numgaps[au]++;
+        }
+    }
+    if (f == NULL) {
+        (void)fprintf (stderr, "cannot read %s\n", argv[3]);
+        return 1;
+    }
+    (void)fclose (f);
+
+    static uint8_t out[TEST_OUT_SIZE];
+    static slicespan slices[CONCEAL_MAX_NALS];
+    paramsets ps;
+    (void)memset (&ps, 0, sizeof (ps));
+    int32_t concealed = 0;
+    int32_t refused = 0;
+    for (int32_t i = 0; i < numaus; i++) {
+        const uint8_t* au = clip + clipaus[i];
+        int32_t len = clipaus[i + 1] - clipaus[i];
+        const uint8_t* dmg = lost + lostaus[i];
+        int32_t dmglen = lostaus[i + 1] - lostaus[i];
+        paramsets_update (&ps, au, len);
+        spsinfo sps;
+        ppsinfo pps;
+        if ((!sps_parse (ps.sps, ps.spslen, &sps)) || (!pps_parse (ps.pps, ps.ppslen, &pps)) ||
+                ((sps.width_mbs * sps.height_mbs) > TEST_MAX_MBS)) {
+            fail (i, "no parameter sets to go by");
+            continue;
+        }
+        if (i == 0) {
+            check_sps (&ps);
+        }
+        bool idr = false;
+        int32_t numslices = find_slices (au, len, sps.width_mbs * sps.height_mbs, slices, &idr);
+
+        /* the damaged access unit is the original with the gaps cut out */
+        bool intact = false;
+        int32_t cut = 0;
+        int32_t from = 0;
+        bool same = true;
+        for (int32_t g = 0; g < numgaps[i]; g++) {
+            int32_t start = gaps[i][g] + cut;
+            same = (same) && (memcmp (dmg + from - cut, au + from, (size_t)(start - from)) == 0);
+            for (int32_t s = 0; s < numslices; s++) {
+                if ((slices[s].start < (start + gaplens[i][g])) && (slices[s].end > start)) {
+                    slices[s].lost = true;
+                }
+            }
+            from = start + gaplens[i][g];
+            cut += gaplens[i][g];
+        }
+        same = (same) && ((len - cut) == dmglen) && (memcmp (dmg + from - cut, au + from, (size_t)(len - from)) == 0);
+        if (!same) {
+            fail (i, "the damaged stream is not the clip with the gaps cut out");
+            continue;
+        }
+        for (int32_t s = 0; s < numslices; s++) {
+            intact = (intact) || (!slices[s].lost);
+        }
+
+        int32_t outlen = conceal_au (&ps, dmg, dmglen, gaps[i], numgaps[i], out, (int32_t)sizeof (out));
+        if (numgaps[i] == 0) {
+            /* nothing lost, a P picture comes out as it went in */
+            if ((!idr) && ((outlen != len) || (memcmp (out, au, (size_t)len) != 0))) {
+                fail (i, "an undamaged picture was changed");
+            }
+        } else if ((idr) || (!intact)) {
+            if (outlen >= 0) {
+                fail (i, "concealed although it cannot be");
+            }
+            refused++;
+        } else if (outlen < 0) {
+            fail (i, "not concealed");
+        } else {
+            check_concealed (i, out, outlen, slices, numslices, &sps, &pps);
+            concealed++;
+        }
+    }
+    (void)printf ("%s: %d access units, %d concealed, %d not concealable, %s\n", argv[2], numaus, concealed, refused,
+                  (failures == 0) ? "ok" : "FAILED");
+    free (clip);
+    free (lost);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+/* Runs the OpenMAX IL backend against the fake ilclient of make OMX=stub:
+ *
+ *   omx_test clip.264
+ *
+ * The clip goes in as h264.bin feeds it, parameter sets first. Checks the
+ * buffer flags video_decode gets for the decoder flags, the tunnels set up
+ * when it reports its port settings, that a video_decode which hangs is
+ * taken as stalled after DECODER_STALL_MS, that omx_recover brings back one
+ * that hung or failed, and that omx_close leaves nothing behind, also when
+ * no picture was ever decoded. Exits 1 on a failure. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decoder.h"
+#include "omxstub.h"
+
+#define TEST_MAX_AUS 64
+#define TEST_SETTLE_MS 2000
+
+static int32_t failures = 0;
+static omxstubstats expect;   /* what video_decode should have seen */
+
+static void fail (const char* what);
+static void fail (const char* what)
+{
+    (void)fprintf (stderr, "%s\n", what);
+    failures++;
+}
+
+static void check (bool ok, const char* what);
+static void check (bool ok, const char* what)
+{
+    if (!ok) {
+        fail (what);
+    }
+}
+
+static int64_t now_ms (void);
+static int64_t now_ms (void)
+{
+    struct timespec ts;
+    (void)clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static uint8_t* readfile (const char* path, int32_t* len);
+static uint8_t* readfile (const char* path, int32_t* len)
+{
+    uint8_t* data = NULL;
+    FILE* f = fopen (path, "rb");
+    *len = 0;
+    if ((f != NULL) && (fseek (f, 0, SEEK_END) == 0)) {
+        long size = ftell (f);
+        data = (uint8_t*)malloc ((size_t)size + 1u);
+        rewind (f);
+        if ((data != NULL) && (fread (data, 1, (size_t)size, f) == (size_t)size)) {
+            *len = (int32_t)size;
+        }
+    }
+    if (f != NULL) {
+        (void)fclose (f);
+    }
+    if (*len == 0) {
+        (void)fprintf (stderr, "cannot read %s\n", path);
+        exit (1);
+    }
+    return data;
+}
+
+/* Offset of the start code of the next NAL from pos on, or len. */
+static int32_t nextnal (const uint8_t* data, int32_t len, int32_t pos);
+static int32_t nextnal (const uint8_t* data, int32_t len, int32_t pos)
+{
+    int32_t i = pos;
+    while ((i + 3 < len) && (!((data[i] == 0) && (data[i + 1] == 0) && (data[i + 2] == 0) && (data[i + 3] == 1)))) {
+        i++;
+    }
+    return (i + 3 < len) ? i : len;
+}
+
+/* The access units begin with an access unit delimiter, starts[n] is len. */
+static int32_t split_aus (const uint8_t* data, int32_t len, int32_t* starts);
+static int32_t split_aus (const uint8_t* data, int32_t len, int32_t* starts)
+{
+    int32_t n = 0;
+    for (int32_t pos = nextnal (data, len, 0); (pos < len) && (n < TEST_MAX_AUS); pos = nextnal (data, len, pos + 4)) {
+        if ((data[pos + 4] & 0x1fu) == 9u) {
+            starts[n++] = pos;
+        }
+    }
+    starts[n] = len;
+    return n;
+}
+
+/* Feeds len bytes in as many buffers as it takes, as submitbuffer() in h264.c
+ * does: flags on all of them, DECODER_FLAG_STARTTIME on the first if start is
+ * set and DECODER_FLAG_ENDOFFRAME on the last if end is. Returns the buffers
+ * taken, or -1 if the decoder refused one. */
+static int32_t feed (void* ctx, const uint8_t* data, int32_t len, uint32_t flags, bool start, bool end);
+static int32_t feed (void* ctx, const uint8_t* data, int32_t len, uint32_t flags, bool start, bool end)
+{
+    int32_t count = 0;
+    int32_t pos = 0;
+    do {
+        decoderbuf* buf = omx_decoder.get_buffer (ctx);
+        if (buf == NULL) {
+            count = -1;
+        } else {
+            int32_t n = ((len - pos) < buf->maxlen) ? (len - pos) : buf->maxlen;
+            (void)memcpy (buf->data, data + pos, (size_t)n);
+            buf->len = n;
+            buf->flags = flags;
+            if ((start) && (pos == 0)) {
+                buf->flags |= DECODER_FLAG_STARTTIME;
+            }
+            pos += n;
+            if ((end) && (pos == len)) {
+                buf->flags |= DECODER_FLAG_ENDOFFRAME;
+            }
+            /* the mapping of decoder_omx.c */
+            expect.buffers++;
+            expect.frames += ((buf->flags & DECODER_FLAG_ENDOFFRAME) != 0u) ? 1 : 0;
+            if ((buf->flags & DECODER_FLAG_CODECCONFIG) != 0u) {
+                expect.codecconfig++;
+            } else if ((buf->flags & DECODER_FLAG_STARTTIME) != 0u) {
+                expect.starttime++;
+            } else {
+                expect.timeunknown++;
+            }
+            expect.decodeonly += ((buf->flags & DECODER_FLAG_DECODEONLY) != 0u) ? 1 : 0;
+            expect.corrupt += ((buf->flags & DECODER_FLAG_CORRUPT) != 0u) ? 1 : 0;
+            count = (omx_decoder.submit (ctx, buf) == 0) ? (count + 1) : -1;
+        }
+    } while ((count >= 0) && (pos < len));
+    return count;
+}
+
+/* Waits for video_decode to take all it was given, as the pace of a live
+ * stream leaves it time to. */
+static void settle (void);
+static void settle (void)
+{
+    omxstubstats st;
+    int64_t deadline = now_ms() + TEST_SETTLE_MS;
+    omxstub_stats (&st);
+    while ((st.queued > 0) && (now_ms() < deadline)) {
+        (void)usleep (1000);
+        omxstub_stats (&st);
+    }
+}
+
+/* The parameter sets as one DECODER_FLAG_CODECCONFIG buffer, then the
+ * access units, the one at decodeonly not to be shown and the
+ * one at corrupt with data missing. The last one is ended by a bare marker as
+ * sendtodecoder() does when all its slices went out before. */
+static void feedclip (void* ctx, const uint8_t* clip, const int32_t* aus, int32_t numaus, int32_t decodeonly, int32_t corrupt);
+static void feedclip (void* ctx, const uint8_t* clip, const int32_t* aus, int32_t numaus, int32_t decodeonly, int32_t corrupt)
+{
+    const uint8_t* au = clip + aus[0];
+    int32_t len = aus[1] - aus[0];
+    int32_t sps = nextnal (au, len, 4);
+    int32_t pps = nextnal (au, len, sps + 4);
+    int32_t end = nextnal (au, len, pps + 4);
+    check (((au[sps + 4] & 0x1fu) == 7u) && ((au[pps + 4] & 0x1fu) == 8u), "the clip does not start with SPS and PPS");
+    check (feed (ctx, au + sps, end - sps, DECODER_FLAG_CODECCONFIG, false, true) == 1, "parameter sets refused");
+    settle();
+    for (int32_t i = 0; i < numaus; i++) {
+        uint32_t flags = (i == decodeonly) ? DECODER_FLAG_DECODEONLY : ((i == corrupt) ? DECODER_FLAG_CORRUPT : 0u);
+        bool last = (i + 1) == numaus;
+        check (feed (ctx, clip + aus[i], aus[i + 1] - aus[i], flags, i == 0, !last) > 0, "access unit refused");
+        if (last) {
+            decoderbuf* buf = omx_decoder.get_buffer (ctx);
+            check (buf != NULL, "no buffer for the end of frame marker");
+            if (buf != NULL) {
+                buf->len = 0;
+                buf->flags = DECODER_FLAG_ENDOFFRAME;
+                expect.buffers++;
+                expect.frames++;
+                expect.timeunknown++;
+                check (omx_decoder.submit (ctx, buf) == 0, "end of frame marker refused");
+            }
+        }
+        settle();
+    }
+}
+
+static void check_flags (const omxstubstats* st);
+static void check_flags (const omxstubstats* st)
+{
+    check (st->buffers == expect.buffers, "video_decode did not get every buffer");
+    check (st->frames == expect.frames, "OMX_BUFFERFLAG_ENDOFFRAME does not follow DECODER_FLAG_ENDOFFRAME");
+    check (st->sidedata == expect.frames, "no side data behind the end of a frame");
+    check (st->codecconfig == expect.codecconfig, "OMX_BUFFERFLAG_CODECCONFIG does not follow DECODER_FLAG_CODECCONFIG");
+    check (st->starttime == expect.starttime, "OMX_BUFFERFLAG_STARTTIME does not follow DECODER_FLAG_STARTTIME");
+    check (st->timeunknown == expect.timeunknown, "OMX_BUFFERFLAG_TIME_UNKNOWN not on the other buffers");
+    check (st->decodeonly == expect.decodeonly, "OMX_BUFFERFLAG_DECODEONLY does not follow DECODER_FLAG_DECODEONLY");
+    check (st->corrupt == expect.corrupt, "OMX_BUFFERFLAG_DATACORRUPT does not follow DECODER_FLAG_CORRUPT");
+    check (st->misuse == 0, "a call the firmware would refuse");
+    check (st->forever == 0, "a wait that would never end");
+}
+
+int main (int argc, char** argv)
+{
+    if (argc != 2) {
+        (void)fprintf (stderr, "usage: %s clip.264\n", argv[0]);
+        return 2;
+    }
+    int32_t cliplen = 0;
+    uint8_t* clip = readfile (argv[1], &cliplen);
+    int32_t aus[TEST_MAX_AUS + 1];
+    int32_t numaus = split_aus (clip, cliplen, aus);
+    if (numaus < 5) {
+        (void)fprintf (stderr, "%s has too few access units\n", argv[1]);
+        return 1;
+    }
+
+    omxstubstats st;
+    void* ctx = NULL;
+    check (omx_decoder.open (&ctx) == 0, "open failed");
+    omxstub_stats (&st);
+    check ((st.components == 5) && (st.inits == 1), "not all components created");
+    check (st.avc == 1, "input port not set to AVC");
+    check (st.startvalid == 0, "video_decode waits for a valid frame itself");
+    check ((st.tunnels == 1) && (st.rendering == 0), "only the clock tunnel is set up before the port settings");
+
+    /* port settings change, tunnels and flags */
+    feedclip (ctx, clip, aus, numaus, 2, 3);
+    for (int32_t i = 0; i < 8; i++) {
+        const uint8_t pcm[184] = { 0 };
+        check (omx_decoder.play_audio (ctx, pcm, (int32_t)sizeof (pcm)) == 0, "audio refused");
+    }
+    omxstub_stats (&st);
+    check_flags (&st);
+    check (st.portsettings == 1, "no port settings change");
+    check ((st.tunnels == 3) && (st.rendering == 1), "video_scheduler and video_render not set up on the port settings change");
+    check (st.shown == (numaus - 1), "pictures did not get through to video_render");
+    check (st.audio == 8, "audio did not get through to audio_render");
+    check (!omx_decoder.failed (ctx), "failed without a fault");
+
+    /* a video_decode that hangs */
+    omxstub_fault (OMXSTUB_FAULT_HANG, 0);
+    int32_t taken = 0;
+    int64_t waited = 0;
+    for (int32_t i = 1; (taken >= 0) && (taken < 1000); i = (i % (numaus - 1)) + 1) {
+        int64_t start = now_ms();
+        int32_t n = feed (ctx, clip + aus[i], aus[i + 1] - aus[i], 0, false, true);
+        waited = now_ms() - start;
+        taken = (n < 0) ? -1 : (taken + n);
+    }
+    check (taken < 0, "a hung video_decode still takes input");
+    check ((waited >= (DECODER_STALL_MS - 50)) && (waited < (DECODER_STALL_MS + 500)), "stall not detected after DECODER_STALL_MS");
+    check (omx_decoder.failed (ctx), "stall not reported");
+    check (omx_decoder.get_buffer (ctx) == NULL, "buffer handed out after a stall");
+    check (omx_decoder.recover (ctx) == 0, "recover after a stall failed");
+    check (!omx_decoder.failed (ctx), "still failed after recover");
+    feedclip (ctx, clip, aus, numaus, -1, -1);
+    omxstub_stats (&st);
+    check_flags (&st);
+    check (st.resets == 1, "video_decode not reset");
+    check (st.held == 0, "buffers lost in the reset");
+    check (st.portsettings == 2, "no port settings change after the reset");
+    check ((st.tunnels == 4) && (st.rendering == 1), "only the tunnel from video_decode is set up again");
+
+    /* corrupt input is concealed, an error needs a reset */
+    omxstub_fault (OMXSTUB_FAULT_CORRUPT, 0);
+    check (feed (ctx, clip + aus[1], aus[2] - aus[1], 0, false, true) > 0, "access unit refused");
+    settle();
+    check (!omx_decoder.failed (ctx), "failed on corrupt input");
+    omxstub_fault (OMXSTUB_FAULT_ERROR, 1);
+    for (int32_t i = 0; (i < 1000) && (!omx_decoder.failed (ctx)); i++) {
+        (void)feed (ctx, clip + aus[1], aus[2] - aus[1], 0, false, true);
+        (void)usleep (1000);
+    }
+    check (omx_decoder.failed (ctx), "error not reported");
+    check (omx_decoder.recover (ctx) == 0, "recover after an error failed");
+    check (!omx_decoder.failed (ctx), "still failed after recover");
+    feedclip (ctx, clip, aus, numaus, -1, -1);
+    omxstub_stats (&st);
+    check (st.resets == 2, "video_decode not reset");
+    check ((st.portsettings == 3) && (st.tunnels == 5), "video_decode not tunnelled again after the error");
+    check (!omx_decoder.failed (ctx), "failed after recover");
+
+    omx_decoder.close (ctx);
+    omxstub_stats (&st);
+    check (st.eos == 1, "no EOS sent");
+    check (st.rendereos == 1, "EOS did not get through to video_render");
+    check ((st.components == 0) && (st.inits == 0), "components left behind");
+    check (st.held == 0, "buffers lost in close");
+    check ((st.misuse == 0) && (st.forever == 0), "close does not keep to the firmware");
+    int32_t shown = st.shown;
+    int32_t resets = st.resets;
+
+    /* closed before the first picture */
+    check (omx_decoder.open (&ctx) == 0, "open failed");
+    omx_decoder.close (ctx);
+    omxstub_stats (&st);
+    check (st.components == 0, "components left behind");
+    check (st.eos == 2, "no EOS sent");
+    check ((st.misuse == 0) && (st.forever == 0), "close without a picture does not keep to the firmware");
+
+    if (failures == 0) {
+        (void)printf ("%s: %d buffers, %d pictures shown, %d resets, ok\n", argv[1], st.buffers, shown, resets);
+    }
+    free (clip);
+    return (failures == 0) ? 0 : 1;
+}
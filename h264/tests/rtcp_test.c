@@ -0,0 +1,70 @@
+/* Checks the receiver reports of rtcp.c:
+ *
+ *   rtcp_test
+ *
+ * A report with the CNAME h264.bin sends for the longest dotted quad, and
+ * for the longest CNAME an SDES item takes, has to fit into
+ * RTCP_REPORT_SIZE and come out as an RR and an SDES with the whole name. A
+ * buffer too small for the name gets the report with the name cut short.
+ * Exits 1 on a failure. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rtcp.h"
+
+#define TEST_SSRC 0x4C415A59u
+#define TEST_OWN_SSRC 0x12345678u
+
+static int32_t failures = 0;
+
+static void check (bool ok, const char* what);
+static void check (bool ok, const char* what)
+{
+    if (!ok) {
+        (void)fprintf (stderr, "%s\n", what);
+        failures++;
+    }
+}
+
+/* True if out holds an RR and an SDES with cname cut to namelen, len long */
+static bool parsed (const uint8_t* out, int32_t len, const char* cname, int32_t namelen);
+static bool parsed (const uint8_t* out, int32_t len, const char* cname, int32_t namelen)
+{
+    const uint8_t* sdes = out + 32;
+    int32_t sdeslen = (((int32_t)sdes[2] << 8) | sdes[3]) * 4 + 4;
+    return (len >= 32 + 12) && ((len % 4) == 0) && (out[0] == 0x81u) && (out[1] == RTCP_TYPE_RR) && (out[3] == 7u) &&
+           (sdes[0] == 0x81u) && (sdes[1] == RTCP_TYPE_SDES) && ((32 + sdeslen) == len) && (sdes[8] == 1u) &&
+           (sdes[9] == (uint8_t)namelen) && (memcmp (sdes + 10, cname, (size_t)namelen) == 0) && (sdes[10 + namelen] == 0u) &&
+           (!rtcp_has_bye (out, len));
+}
+
+int main (void)
+{
+    static const char* dotted = "lazycast@255.255.255.255";
+    char longest[256];
+    uint8_t rtp[12] = {0x80, 33, 0x12, 0x34, 0, 0, 0, 0, 0x4C, 0x41, 0x5A, 0x59};
+    uint8_t out[RTCP_REPORT_SIZE];
+    rtcpreceiver r;
+
+    (void)memset (longest, 'x', sizeof (longest) - 1u);
+    longest[sizeof (longest) - 1u] = '\0';
+    rtcp_init (&r, TEST_OWN_SSRC);
+    check (rtcp_write_report (&r, dotted, out, (int32_t)sizeof (out), 0) == 0, "report before the first packet");
+    rtcp_received (&r, rtp, (int32_t)sizeof (rtp), 0);
+    check (r.ssrc == TEST_SSRC, "source not taken");
+
+    int32_t len = rtcp_write_report (&r, dotted, out, (int32_t)sizeof (out), 1000);
+    check (parsed (out, len, dotted, (int32_t)strlen (dotted)), "report with a dotted quad CNAME wrong");
+    check (rtcp_write_report (&r, "lazycast@192.168.173.1", out, (int32_t)sizeof (out), 2000) == 68, "report with the default sink address wrong");
+    len = rtcp_write_report (&r, longest, out, (int32_t)sizeof (out), 3000);
+    check ((len == RTCP_REPORT_SIZE) && (parsed (out, len, longest, 255)), "report with the longest CNAME wrong");
+
+    /* the name is cut short rather than the report left out */
+    len = rtcp_write_report (&r, dotted, out, 64, 4000);
+    check ((len == 64) && (parsed (out, len, dotted, 64 - 32 - 11)), "report not cut to the buffer");
+    check (rtcp_write_report (&r, dotted, out, 40, 5000) == 0, "report written into too small a buffer");
+
+    (void)printf ("rtcp: receiver reports up to %d bytes, %s\n", RTCP_REPORT_SIZE, (failures == 0) ? "ok" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
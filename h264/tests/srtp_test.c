@@ -0,0 +1,92 @@
+/* Checks the SRTP decryption of srtp.c:
+ *
+ *   srtp_test
+ *
+ * srtp_selftest() runs the test vectors of RFC 3711 through the AES tables
+ * and plain SHA-1 as well as through the AES-NI and SHA-NI (or ARMv8) code
+ * the CPU has. Then three packets, protected by OpenSSL with the master key
+ * of RFC 3711 B.3 around a wrap of the sequence number, go through
+ * srtp_unprotect(): in place, with the rollover counter, the one from before
+ * the wrap coming late, and a replay and a changed packet rejected. Exits 1
+ * on a failure. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "srtp.h"
+
+#define TEST_PACKETS 3
+#define TEST_PACKET_SIZE 52
+#define TEST_PAYLOAD 30
+
+static int32_t failures = 0;
+
+static void check (bool ok, const char* what);
+static void check (bool ok, const char* what)
+{
+    if (!ok) {
+        (void)fprintf (stderr, "%s\n", what);
+        failures++;
+    }
+}
+
+/* sequence numbers 0xFFFE, 0xFFFF and 0x0000, the last with ROC 1; SSRC
+ * 0xCAFEBABE, payload "lazycast srtp test packet N..." */
+static const uint8_t protected[TEST_PACKETS][TEST_PACKET_SIZE] = {
+    {0x80, 0x21, 0xFF, 0xFE, 0x00, 0x00, 0x00, 0x00, 0xCA, 0xFE, 0xBA, 0xBE, 0x1D, 0x22, 0x61, 0x0C, 0x4B, 0x02, 0x68, 0x91,
+     0x1D, 0x2A, 0x93, 0xFB, 0xFE, 0x37, 0x37, 0xD0, 0x45, 0x69, 0x7B, 0xD3, 0xC6, 0x2D, 0x48, 0x4B, 0x64, 0xCD, 0x8B, 0x15,
+     0x3C, 0x79, 0x7D, 0xB8, 0x26, 0xD8, 0x89, 0x11, 0xA0, 0x93, 0x24, 0x09},
+    {0x80, 0x21, 0xFF, 0xFF, 0x00, 0x01, 0x5F, 0x90, 0xCA, 0xFE, 0xBA, 0xBE, 0x34, 0xA4, 0x47, 0x2E, 0x4F, 0x66, 0xD9, 0xAA,
+     0x07, 0x32, 0x86, 0x4B, 0x61, 0x9C, 0xC2, 0x76, 0x9B, 0x5B, 0xB8, 0x6D, 0x65, 0x19, 0xE2, 0x1F, 0x83, 0xCA, 0xD2, 0x01,
+     0x25, 0x36, 0x75, 0xFA, 0x24, 0xB4, 0x51, 0xFE, 0xDF, 0xE5, 0x8B, 0xD7},
+    {0x80, 0x21, 0x00, 0x00, 0x00, 0x02, 0xBF, 0x20, 0xCA, 0xFE, 0xBA, 0xBE, 0xE3, 0x26, 0x28, 0xFF, 0x54, 0x5D, 0x67, 0xF5,
+     0x4D, 0xA1, 0x6E, 0x49, 0x26, 0x76, 0xE9, 0x94, 0x52, 0x08, 0x17, 0xD5, 0x34, 0x35, 0x37, 0xFB, 0xAB, 0x55, 0xCD, 0x4B,
+     0xDF, 0xEC, 0x46, 0x62, 0xBF, 0x99, 0xD7, 0xF8, 0x8E, 0xDB, 0x93, 0xBB}
+};
+
+/* Unprotects a copy of packet n, true if it came out as it was sent */
+static bool unprotect (srtpsession* s, int32_t n, int32_t flip);
+static bool unprotect (srtpsession* s, int32_t n, int32_t flip)
+{
+    uint8_t buf[TEST_PACKET_SIZE];
+    uint8_t* packets[1] = {buf};
+    int32_t lens[1] = {TEST_PACKET_SIZE};
+    char plain[TEST_PAYLOAD + 1];
+    (void)memcpy (buf, protected[n], sizeof (buf));
+    if (flip >= 0) {
+        buf[flip] ^= 0x01u;
+    }
+    srtp_unprotect (s, packets, lens, 1, 0);
+    (void)snprintf (plain, sizeof (plain), "lazycast srtp test packet %d...", n);
+    return (lens[0] == (TEST_PACKET_SIZE - SRTP_TAG)) && (memcmp (buf + 12, plain, TEST_PAYLOAD) == 0);
+}
+
+int main (void)
+{
+    check (srtp_selftest(), "test vectors failed");
+
+    uint8_t master[SRTP_MASTER_SIZE];
+    uint8_t scratch[SRTP_MASTER_SIZE];
+    check (!srtp_parse_key ("E1F97A0D3E018BE0D64FA32C06DE41390EC675AD498AFEEBB6960B3AABE", scratch), "short key parsed");
+    check (srtp_parse_key ("E1F97A0D3E018BE0D64FA32C06DE41390EC675AD498AFEEBB6960B3AABE6", master), "key not parsed");
+    srtpsession s;
+    srtp_init (&s, master, 0);
+    check (unprotect (&s, 0, -1), "first packet not decrypted");
+    check (unprotect (&s, 2, -1), "packet after the wrap not decrypted");
+    check (s.roc == 1u, "rollover counter not counted up");
+    check (unprotect (&s, 1, -1), "late packet from before the wrap not decrypted");
+    check (s.roc == 1u, "rollover counter went back for a late packet");
+    check (!unprotect (&s, 1, -1), "replayed packet accepted");
+    check (!unprotect (&s, 2, -1), "replayed packet accepted");
+    check (s.rejected == 2, "rejected packets not counted");
+
+    /* a changed packet is not authentic, wherever the change is */
+    srtp_init (&s, master, 0);
+    check (!unprotect (&s, 0, 3), "changed sequence number accepted");
+    check (!unprotect (&s, 0, 20), "changed payload accepted");
+    check (!unprotect (&s, 0, TEST_PACKET_SIZE - 1), "changed tag accepted");
+    check (unprotect (&s, 0, -1), "packet not decrypted after rejected ones");
+
+    (void)printf ("srtp: test vectors and %d packets, %s\n", TEST_PACKETS, (failures == 0) ? "ok" : "FAILED");
+    return (failures == 0) ? 0 : 1;
+}
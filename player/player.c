@@ -22,9 +22,14 @@ static VCOS_LOG_CAT_T il_ffmpeg_log_category;
 #include "libavcodec/avcodec.h"
 #include <libavformat/avformat.h>
 
+#include "nal.h"
+#include "idr.h"
+#include "stats.h"
+
 //#define insertpacket
 #define stoprendering
 //#define injecterror
+//#define passcorrupt
 
 static AVCodecContext *video_dec_ctx = NULL;
 static AVCodecContext *audio_dec_ctx = NULL;
@@ -159,13 +164,38 @@ static long int startpts;
 
 atomic_int numofnode;
 atomic_int stoprender;
+atomic_int intrarefresh;
+_Atomic int64_t idrat;
+static refreshstate refresh;
 
 OMX_ERRORTYPE copy_into_buffer_and_empty(AVPacket *pkt,COMPONENT_T *component) 
 {
     OMX_ERRORTYPE r;
 
 #ifdef stoprendering
-	if (atomic_load(&numofnode) > 10 && !(pkt->flags & AV_PKT_FLAG_KEY))
+	// after a hole the output is held until the next IDR, or until the
+	// recovery_frame_cnt of the next recovery point has passed
+	if (atomic_load(&stoprender) && !refresh.hold)
+		refresh_hold(&refresh);
+	int held = refresh.hold;
+#endif
+	int autype = refresh_update(&refresh, pkt->data, pkt->size);
+	atomic_store(&intrarefresh, refresh_active(&refresh));
+	if (autype == AU_KEYFRAME)
+		atomic_store(&idrat, stats_now_us());
+#ifdef stoprendering
+	// the intra refresh slices have rebuilt the picture, a keyframe is left to the check below
+	if (held && !refresh.hold && !(pkt->flags & AV_PKT_FLAG_KEY))
+		atomic_store(&stoprender, 0);
+#endif
+
+#ifdef passcorrupt
+	// decode the frame after a hole anyway and let error concealment repair it
+	int corrupt = atomic_exchange(&stoprender, 0);
+#endif
+
+#ifdef stoprendering
+	if (atomic_load(&numofnode) > 10 && !(pkt->flags & AV_PKT_FLAG_KEY) && autype != AU_RECOVERYPOINT)
 		return r;
 	if (atomic_load(&stoprender) && (pkt->flags & AV_PKT_FLAG_KEY))
 	{
@@ -173,6 +203,8 @@ OMX_ERRORTYPE copy_into_buffer_and_empty(AVPacket *pkt,COMPONENT_T *component)
 		atomic_store(&stoprender, 0);
 		return r;
 	}
+	// frames until then are decoded but not shown
+	int decodeonly = refresh.hold;
 
 #endif
 
@@ -232,6 +264,14 @@ OMX_ERRORTYPE copy_into_buffer_and_empty(AVPacket *pkt,COMPONENT_T *component)
 		buff_header->nFlags = 0;
 		if (size <= 0) 
 			buff_header->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+#ifdef passcorrupt
+		if (corrupt)
+			buff_header->nFlags |= OMX_BUFFERFLAG_DATACORRUPT;
+#endif
+#ifdef stoprendering
+		if (decodeonly)
+			buff_header->nFlags |= OMX_BUFFERFLAG_DECODEONLY;
+#endif
 
 	
 		if (pkt->flags & AV_PKT_FLAG_KEY)
@@ -835,6 +875,15 @@ int largers(int a, int b)
 
 int idrsockport = -1;
 char* sourceip;
+int rtpport = 1028;
+
+static void sendidr(int fd, struct sockaddr_in *addr)
+{
+	unsigned char topython[12];
+	if (idrsockport > 0 && sendto(fd, topython, 12, 0, (struct sockaddr *)addr, sizeof(*addr)) < 0)
+		perror("sendto error");
+}
+
 static void* addnullpacket()
 {
 	struct sockaddr_in addr1, addr2, addr3;
@@ -863,7 +912,7 @@ static void* addnullpacket()
 	memset((char *)&addr1, 0, sizeof(addr1));
 	addr1.sin_family = AF_INET;
 	addr1.sin_addr.s_addr = inet_addr(sourceip);
-	addr1.sin_port = htons(1028);
+	addr1.sin_port = htons(rtpport);
 
 	memset((char *)&addr2, 0, sizeof(addr2));
 	addr2.sin_family = AF_INET;
@@ -905,6 +954,9 @@ static void* addnullpacket()
 
 	////
 
+	idrcontrol ic;
+	idr_init(&ic, stats_now_us());
+
 	unsigned char padpacket[2048];
 	padpacket[0] = 0x80;
 	padpacket[1] = 0x21;
@@ -934,6 +986,13 @@ static void* addnullpacket()
 
 		p1->seqnum = (p1->buf[2] << 8) + p1->buf[3];
 		p1->next = NULL;
+
+		int64_t now = stats_now_us();
+		int64_t idrtime = atomic_exchange(&idrat, 0);
+		if (idrtime != 0)
+			idr_received(&ic, idrtime);
+		if (idr_poll(&ic, now))
+			sendidr(fd3, &addr3);
 		
 		if (largers(sentseqnum, p1->seqnum) && sentseqnum > 0)
 		{
@@ -1009,15 +1068,14 @@ static void* addnullpacket()
 #endif
 			sentseqnum = osn;
 			atomic_store(&stoprender, 1);
+			// the hole is given up on, an IDR is not needed while intra refresh heals it
+			if (!atomic_load(&intrarefresh) && idr_loss(&ic, now, false))
+			{
+				sendidr(fd3, &addr3);
+				printf("idr:%d\n", numofpacket);
+			}
 
 		}
-		else if (idrsockport > 0 && (numofpacket == 12 || numofpacket == 14 || numofpacket == 16))
-		{
-			unsigned char topython[12];
-			if (sendto(fd3, topython, 12, 0, (struct sockaddr *)&addr3, addrlen) < 0)
-				perror("sendto error");
-			printf("idr:%d\n", numofpacket);
-		}
 
 		//printf("\n");
 		while (numofpacket > 0 && !hold)
@@ -1033,14 +1091,6 @@ static void* addnullpacket()
 			//printf("%d\n", osn);
 			sentseqnum = osn;
 
-			if (numofpacket == 12 || numofpacket == 14 || numofpacket == 16)
-			{
-				unsigned char topython[12];
-				if (sendto(fd3, topython, 12, 0, (struct sockaddr *)&addr3, addrlen) < 0)
-					perror("sendto error");
-				printf("idr:%d\n", numofpacket);
-			}
-
 
 			osn = 0xFFFF & (osn + 1);
 			rtppacket* nexttemp = head->next;
@@ -1078,6 +1128,8 @@ int main(int argc, char** argv)
     
 
 	avformat_network_init();
+	refresh_init(&refresh);
+	atomic_store(&intrarefresh, 0);
 
 	if (argc > 1)
 	{
@@ -1098,6 +1150,11 @@ int main(int argc, char** argv)
 	}
 	printf("argv3:%s\n", argv[3]);
 	printf("sourceip:%s\n", sourceip);
+	if (argc > 4)
+	{
+		rtpport = atoi(argv[4]);
+		printf("rtpport:%d\n", rtpport);
+	}
 
 	pthread_t npthread;
 	if (pthread_create(&npthread, NULL, addnullpacket, NULL) != 0)
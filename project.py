@@ -20,6 +20,7 @@ import os
 import uuid
 import fcntl, os
 import errno
+import select
 import threading
 from threading import Thread
 import time
@@ -30,6 +31,11 @@ from logging import DEBUG, StreamHandler, getLogger
 import logging
 from contextlib import closing
 
+# sources shown at the same time, each in a session of its own on ports
+# eight apart from 1028 on; more than one is for the null, stub and export
+# outputs of h264.bin, the display and audio are not shared out
+sessions = 1
+
 
 class Res:
     def __init__(self, id, width, height, refresh, progressive=True, h264level='3.1', h265level='3.1'):
@@ -152,6 +158,7 @@ class WfdVideoParameters:
     ]
 
     def get_video_parameter(self):
+        # RTSP_SINK_PARAMS in h264/rtsp.c is the same answer for native_rtsp, keep both in step
         # audio_codec: LPCM:0x01, AAC:0x02, AC3:0x04
         # audio_sampling_frequency: 44.1khz:1, 48khz:2
         # LPCM: 44.1kHz, 16b; 48 kHZ,16b
@@ -173,6 +180,13 @@ class WfdVideoParameters:
         preferred = 0
         profile = 0x02 | 0x01
         level = 0x10
+        # min_slice: smallest slice in macroblocks, 0: no slice encoding
+        # slice_enc: bits 0-9: max number of slices per picture - 1,
+        #   bits 10-12: max slice size as a multiple of min_slice (at most 7),
+        #   bits 13-15: reserved
+        # h264.bin feeds each slice to the decoder as soon as it is received
+        min_slice = 0x0078
+        slice_enc = (7 << 10) | (68 - 1)
 
         res_cea_640_480p60   = 1
         res_cea_720_480p60   = 1
@@ -303,7 +317,7 @@ class WfdVideoParameters:
         vesa = res_vesa
         handheld = res_hh
         msg += 'wfd_video_formats: {0:02X} {1:02X} {2:02X} {3:02X} {4:08X} {5:08X} {6:08X}' \
-               ' 00 0000 0000 00 none none\r\n'.format(native, preferred, profile, level, cea, vesa, handheld)
+               ' 00 {7:04X} {8:04X} 00 none none\r\n'.format(native, preferred, profile, level, cea, vesa, handheld, min_slice, slice_enc)
         msg += 'wfd_3d_video_formats: none\r\n' \
                'wfd_coupled_sink: none\r\n' \
                'wfd_display_edid: none\r\n' \
@@ -314,30 +328,158 @@ class WfdVideoParameters:
         return msg
 
 class Player:
-    def __init__(self,sinkip,idrsockport):
+    # a service player that dies sooner than this after its start is not
+    # started again, until the next SOURCE_READY
+    restart_after = 1.0
+    # times a session is handed to a player started again
+    session_restarts = 3
+    def __init__(self,sinkip,idrsockport,sourceip=None):
         pass
         self.player = None
         self.sinkip = sinkip
         self.idrsockport = idrsockport
-    def start(self):
+        self.sourceip = sourceip
+        self.cond = threading.Condition()
+        self.generation = 0
+        self.exitlock = threading.Lock()
+        self.exitfd = None
+    def arguments(self):
         sound_output_select = 0
         # 0: HDMI sound output
         # 1: 3.5mm audio jack output
         # 2: alsa
-        self.player = subprocess.Popen(["./h264/h264.bin",str(self.idrsockport),str(sound_output_select),self.sinkip])
+        video_decoder = None
+        # None: the default of h264.bin (omx if built with it)
+        # 'omx': hardware decoder of the Pi
+        # 'avcodec': software decoder, audio through alsa
+        args = ["./h264/h264.bin",str(self.idrsockport),str(sound_output_select),self.sinkip]
+        if video_decoder != None:
+            args.append(video_decoder)
+        if self.sourceip != None:
+            # h264.bin negotiates the RTSP session itself
+            if video_decoder == None:
+                args.append('')
+            args.append(self.sourceip)
+        return args
+    def start(self):
+        self.player = subprocess.Popen(self.arguments())
+        waiter = Thread(target=self.wait_exit, args=(self.player,))
+        waiter.daemon = True
+        waiter.start()
+    def wait_exit(self, player):
+        # wakes rtpsrv through exitfd when the player exits; a thread rather
+        # than SIGCHLD, whose handler can only be set in the main thread
+        player.wait()
+        with self.exitlock:
+            if self.exitfd != None:
+                try:
+                    os.write(self.exitfd, '\0')
+                except OSError:
+                    pass
+    def start_service(self, sessions=1):
+        # sourceip '-': h264.bin stays up between sessions, keeping the decoder
+        # set up, and reads the source of each session from stdin; '-N' runs
+        # up to N sessions at the same time, each on its own ports
+        self.sessions = sessions
+        with self.cond:
+            self.launch()
+    def launch(self):
+        # with cond held
+        args = self.arguments()
+        if self.sessions > 1:
+            args[-1] = '-{0:d}'.format(self.sessions)
+        self.player = subprocess.Popen(args, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.started = time.time()
+        # the sessions written to stdin and not started yet, in that order,
+        # and the running ones by the slot h264.bin runs them in
+        self.pending = []
+        self.running = {}
+        self.generation += 1
+        reader = Thread(target=self.read_output, args=(self.player,))
+        reader.daemon = True
+        reader.start()
+    def read_output(self, player):
+        # 'session started SOURCE SLOT' answers the oldest line written to
+        # stdin, and 'session ended RESULT SOURCE SLOT' goes to the
+        # run_session that wrote it, told apart by the slot from other
+        # sessions of the same source; the rest goes to the log. At the end
+        # of the output the player has exited, and unless it was stopped it
+        # is started again right away for the sessions that were running in it
+        logger = getLogger("PiCast.player")
+        for line in iter(player.stdout.readline, ''):
+            fields = line.split()
+            if line.startswith('session started') and len(fields) > 3:
+                with self.cond:
+                    if self.player is player and self.pending:
+                        self.running[fields[3]] = self.pending.pop(0)
+            elif line.startswith('session ended') and len(fields) > 4:
+                with self.cond:
+                    session = self.running.pop(fields[4], None) if self.player is player else None
+                    if session != None:
+                        session['ended'] = fields[2] == '0'
+                        self.cond.notify_all()
+            else:
+                logger.info(line.rstrip())
+        player.wait()
+        with self.cond:
+            if self.player is player and time.time() >= self.started + Player.restart_after:
+                logger.info("player exited ({0:d}), restart player".format(player.returncode))
+                try:
+                    self.launch()
+                except OSError, e:
+                    logger.info("cannot restart player: {0}".format(e))
+            self.cond.notify_all()
+    def run_session(self, sourceip, tcp=False):
+        # returns True if the session ended normally, False if the stream
+        # was lost or h264.bin exited and could not be started again; tcp
+        # offers the source RTP interleaved on the RTSP connection
+        with self.cond:
+            restarts = 0
+            while True:
+                generation = self.generation
+                session = {'ended': None}
+                try:
+                    self.player.stdin.write(sourceip + (' tcp' if tcp else '') + '\n')
+                    self.player.stdin.flush()
+                except (IOError, AttributeError):
+                    return False
+                self.pending.append(session)
+                while session['ended'] == None and self.generation == generation and not self.exited():
+                    self.cond.wait(1.0)
+                if session['ended'] != None or self.generation == generation or restarts == Player.session_restarts:
+                    return session['ended'] == True
+                # the session goes on in the player started in place of the one that exited
+                restarts += 1
     def stop(self):
-        if self.player != None:
-            self.player.kill()
+        with self.cond:
+            player = self.player
             self.player = None
+        if player != None:
+            player.kill()
+            player.wait()
+    def exited(self):
+        return self.player != None and self.player.poll() != None
+
+def wired(localip):
+    # True if localip is on an interface without a wireless directory in
+    # sysfs, so that the session runs over Ethernet
+    for line in os.popen('ip -o -4 addr show').read().splitlines():
+        fields = line.split()
+        if len(fields) > 3 and fields[3].split('/')[0] == localip:
+            return not os.path.exists('/sys/class/net/{}/wireless'.format(fields[1]))
+    return False
 
 class PiCast:
-    def __init__(self, sourceip):
+    service = None
+    servicelock = threading.Lock()
+    def __init__(self, sourceip, tcp=False):
         self.logger = getLogger("PiCast")
-        self.watchdog = 0
         self.csnum = 0
         self.player = None
 
         self.sourceip = sourceip
+        # wired sessions are offered RTP over TCP, they never lose a packet
+        self.tcp = tcp
     def rtsp_response_header(self, cmd=None, url=None, res=None, seq=None, others=None):
         if cmd is not None:
             msg = "{0:s} {1:s} RTSP/1.0".format(cmd, url)
@@ -353,6 +495,16 @@ class PiCast:
         msg += '\r\n'
         return msg
     def run(self):
+        native_rtsp = True
+        # True: a long-running h264.bin runs the RTSP session
+        # False: negotiate here and relay IDR requests from h264.bin
+        if native_rtsp:
+            with PiCast.servicelock:
+                if PiCast.service == None or PiCast.service.player == None or PiCast.service.exited():
+                    PiCast.service = Player('0.0.0.0',0,'-')
+                    PiCast.service.start_service(sessions)
+                self.player = PiCast.service
+            return self.player.run_session(self.sourceip, self.tcp)
         with closing(socket.socket(socket.AF_INET, socket.SOCK_STREAM)) as sock:
             server_address = (self.sourceip, 7236)
             sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
@@ -360,7 +512,7 @@ class PiCast:
             try:
                 sock.connect(server_address)
             except socket.error, e:
-                return
+                return False
             with closing(socket.socket(socket.AF_INET, socket.SOCK_DGRAM)) as idrsock:
                 idrsock_address = ('127.0.0.1', 0)
                 idrsock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
@@ -371,7 +523,7 @@ class PiCast:
                 self.player.start()
                 fcntl.fcntl(sock, fcntl.F_SETFL, os.O_NONBLOCK)
                 fcntl.fcntl(idrsock, fcntl.F_SETFL, os.O_NONBLOCK)
-                self.rtpsrv(sock, idrsock)
+                return self.rtpsrv(sock, idrsock)
 
     def m1(self, sock):
         logger = getLogger("PiCast.m1")
@@ -416,7 +568,7 @@ class PiCast:
         logger.debug("<-{}".format(s_data))
     def m6(self, sock):
         logger = getLogger("PiCast.m6")
-        m6req = self.rtsp_response_header(seq=5, cmd="SETUP", url="rtsp://{0:s}/wfd1.0/streamid=0".format(self.sourceip),others=[("Transport","RTP/AVP/UDP;unicast;client_port={0:d}".format(1028))])
+        m6req = self.rtsp_response_header(seq=5, cmd="SETUP", url="rtsp://{0:s}/wfd1.0/streamid=0".format(self.sourceip),others=[("Transport","RTP/AVP/UDP;unicast;client_port={0:d}-{1:d}".format(1028, 1029))])
         logger.debug("<-{}".format(m6req))
         sock.sendall(m6req)
         
@@ -463,65 +615,106 @@ class PiCast:
         sessionid = self.m6(conn)
         self.m7(conn, sessionid)
         logger.debug("---- Negotiation successful ----")
-    def handle_rcv_err(self, e, csnum, sock, idrsock):
-        logger = getLogger("PiCast.daemon.error")
-        err = e.args[0]
-        if err == errno.EAGAIN or err == errno.EWOULDBLOCK:
-          try:
-            datafromc = idrsock.recv(1000)
-          except socket.error, e:
-            err = e.args[0]
-            if err == errno.EAGAIN or err == errno.EWOULDBLOCK:
-              processrunning = os.popen('ps au').read()
-              if 'h264.bin' not in processrunning:
-                self.player.start()
-                sleep(0.01)
-              else:
-                self.watchdog += 1
-                if self.watchdog == 70/0.01:
-                  self.player.stop()
-                  sleep(1)
-            else:
-              logger.debug("socket error.")
-          else:
-            csnum = csnum + 1
-            msg = 'wfd_idr_request\r\n'
-            idrreq = self.rtsp_response_header(seq=csnum, cmd="SET_PARAMETER", url="rtsp://localhost/wfd1.0", others=[("Content-Length",len(msg)),("Content-Type","text/parameters")])+msg
-            sock.sendall(idrreq)
-            logger.debug("idreq: {}".format(idrreq))
-        else:
-          logger.debug("Exit because of socket error")
-        return csnum
+    def send_idr_request(self, csnum, sock):
+        logger = getLogger("PiCast.daemon.idr")
+        msg = 'wfd_idr_request\r\n'
+        idrreq = self.rtsp_response_header(seq=csnum, cmd="SET_PARAMETER", url="rtsp://localhost/wfd1.0", others=[("Content-Length",len(msg)),("Content-Type","text/parameters")])+msg
+        sock.sendall(idrreq)
+        logger.debug("idreq: {}".format(idrreq))
 
     def rtpsrv(self, sock, idrsock):
+        # Sleeps in epoll until the source sends, h264.bin asks for an IDR
+        # picture or exits (Player.wait_exit through the wakeup pipe), or the
+        # source has been silent for watchdog_timeout seconds.
         logger = getLogger("PiCast.rtpsrv")
+        watchdog_timeout = 70
         csnum = 102
-        self.watchdog = 0
-        while True:
-          try:
-            data = sock.recv(1000)
-          except socket.error, e:
-            csnum = self.handle_rcv_err(e, csnum, sock, idrsock)
-          else:
-            logger.debug("->{}".format(data))
-            self.watchdog = 0
-            if len(data)==0 or 'wfd_trigger_method: TEARDOWN' in data:
+        wakeup_r, wakeup_w = os.pipe()
+        fcntl.fcntl(wakeup_r, fcntl.F_SETFL, os.O_NONBLOCK)
+        fcntl.fcntl(wakeup_w, fcntl.F_SETFL, os.O_NONBLOCK)
+        with self.player.exitlock:
+            self.player.exitfd = wakeup_w
+        ep = select.epoll()
+        ep.register(sock.fileno(), select.EPOLLIN)
+        ep.register(idrsock.fileno(), select.EPOLLIN)
+        ep.register(wakeup_r, select.EPOLLIN)
+        lastheard = time.time()
+        running = True
+        lost = False
+        # the player may have exited before exitfd was set
+        os.write(wakeup_w, '\0')
+        try:
+          while running:
+            try:
+              events = ep.poll(max(lastheard + watchdog_timeout - time.time(), 0))
+            except IOError, e:
+              if e.errno != errno.EINTR:
+                raise
+              events = []
+            if len(events) == 0 and time.time() >= lastheard + watchdog_timeout:
+              logger.info("source silent, restart player")
               self.player.stop()
-              sleep(1)
-              break
-            elif 'wfd_video_formats' in data:
-              logger.info("start player")
               self.player.start()
-            messagelist=data.split('\r\n\r\n')
-            singlemessagelist=[x for x in messagelist if ('GET_PARAMETER' in x or 'SET_PARAMETER' in x )]
-            for singlemessage in singlemessagelist:
-              entrylist=singlemessage.split('\r')
-              for entry in entrylist:
-                if 'CSeq' in entry:
-                  cseq = entry
-                  resp='RTSP/1.0 200 OK\r'+cseq+'\r\n\r\n';#cseq contains \n
-                  sock.sendall(resp)
-                  logger.debug("<-{}".format(resp))
+              lastheard = time.time()
+            for fd, event in events:
+              if fd == wakeup_r:
+                try:
+                  os.read(wakeup_r, 64)
+                except OSError:
+                  pass
+                if self.player.exited():
+                  logger.info("player exited, restart player")
+                  self.player.start()
+              elif fd == idrsock.fileno():
+                try:
+                  datafromc = idrsock.recv(1000)
+                except socket.error, e:
+                  continue
+                if datafromc.startswith('recv timeout'):
+                  # h264.bin has not heard from the source for a fraction of a second
+                  logger.info("stream lost, end session")
+                  self.player.stop()
+                  lost = True
+                  running = False
+                  continue
+                csnum = csnum + 1
+                self.send_idr_request(csnum, sock)
+              elif fd == sock.fileno() and running:
+                try:
+                  data = sock.recv(1000)
+                except socket.error, e:
+                  if e.args[0] == errno.EAGAIN or e.args[0] == errno.EWOULDBLOCK:
+                    continue
+                  logger.debug("Exit because of socket error")
+                  data = ''
+                logger.debug("->{}".format(data))
+                lastheard = time.time()
+                if len(data)==0 or 'wfd_trigger_method: TEARDOWN' in data:
+                  self.player.stop()
+                  sleep(1)
+                  running = False
+                  continue
+                elif 'wfd_video_formats' in data:
+                  logger.info("start player")
+                  self.player.stop()
+                  self.player.start()
+                messagelist=data.split('\r\n\r\n')
+                singlemessagelist=[x for x in messagelist if ('GET_PARAMETER' in x or 'SET_PARAMETER' in x )]
+                for singlemessage in singlemessagelist:
+                  entrylist=singlemessage.split('\r')
+                  for entry in entrylist:
+                    if 'CSeq' in entry:
+                      cseq = entry
+                      resp='RTSP/1.0 200 OK\r'+cseq+'\r\n\r\n';#cseq contains \n
+                      sock.sendall(resp)
+                      logger.debug("<-{}".format(resp))
+          return not lost
+        finally:
+          ep.close()
+          with self.player.exitlock:
+            self.player.exitfd = None
+          os.close(wakeup_r)
+          os.close(wakeup_w)
 
 
 
@@ -570,27 +763,48 @@ sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
 sock.bind(('',7250))
 sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
 sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
-sock.listen(1)
+sock.listen(sessions)
+
+slots = threading.BoundedSemaphore(sessions)
+active = [0]
+activelock = threading.Lock()
+
+def serve(conn, addr):
+    # one MICE connection; kodi stops for the first and starts again after
+    # the last
+    logger.debug("Connected by: {}".format(addr))
+    p = PiCast(addr[0], wired(conn.getsockname()[0]))
+    with activelock:
+        active[0] += 1
+        if active[0] == 1:
+            os.system("sudo service kodi stop")
+    try:
+        while True:
+            data = conn.recv(1024)
+            if data == '':
+                break
+
+            command = data[3].encode('hex')
+            messagetype = commands[command]
+
+            if messagetype == 'SOURCE_READY':
+                if not p.run():
+                    # the source is out of reach, be ready for the next one
+                    break
+    finally:
+        conn.close()
+        with activelock:
+            active[0] -= 1
+            if active[0] == 0:
+                os.system("sudo service kodi start")
+        slots.release()
 
 while True:
+    slots.acquire()
     (conn, addr) = sock.accept()
-    logger.debug("Connected by: {}".format(addr))
-    p = PiCast(addr[0])
-    os.system("sudo service kodi stop")
-    
-    while True:
-        data = conn.recv(1024)
-        if data == '':
-            break
-
-        command = data[3].encode('hex')
-        messagetype = commands[command]
-
-        if messagetype == 'SOURCE_READY':
-            p.run()
-
-    conn.close()
-    os.system("sudo service kodi start")
+    t = Thread(target=serve, args=(conn, addr))
+    t.daemon = True
+    t.start()
 
 sock.close()
 